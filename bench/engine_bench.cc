@@ -0,0 +1,297 @@
+// Times what Ebyroid costs around the engine, with the stand-in engine (src/sim) in place of
+// VOICEROID: the overhead of a job, handling the engine's callbacks at different chunk sizes,
+// shaping the output, reloading an engine, and throughput with 1, 2 and more jobs at once.
+//
+//   $ cmake -S . -B build -DEBYROID_BUILD_BENCHMARKS=ON && cmake --build build
+//   $ build/engine_bench --benchmark_out=engine_bench.json --benchmark_out_format=json
+//
+// The stand-in is loaded from the directory of the executable, which is where the build puts it,
+// or from EBYROID_BENCH_DIR. Its latency and pacing default to 0 here so that the numbers are what
+// Ebyroid and the rendering of tones take rather than sleeps; any EBYROID_SIM_* variable set in the
+// environment is respected, except for EBYROID_SIM_CHUNK_SAMPLES, which BM_Chunks sets itself.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ebyroid.h"
+#include "gain.h"
+#include "pcm_format.h"
+
+using ebyroid::ConvertParams;
+using ebyroid::Ebyroid;
+
+namespace {
+
+// one voice library per two concurrent jobs, which is what the engine takes at once
+const char* const kVoices[] = {"yukari_44", "kiritan_22", "zunko_22", "akane_22"};
+constexpr size_t kNumVoices = sizeof(kVoices) / sizeof(*kVoices);
+
+// about 2.5 seconds of audio at 60 msec a character, with a pause in the middle
+constexpr char kSentence[] = "the quick brown fox, jumps over the lazy dog.";
+constexpr char kShortText[] = "a";
+constexpr uint32_t kDefaultChunkSamples = 8192;
+
+std::string base_dir;
+
+void SetEnv(const char* name, const char* value, bool overwrite) {
+#ifdef _WIN32
+  if (overwrite || std::getenv(name) == nullptr) {
+    _putenv_s(name, value);
+  }
+#else
+  setenv(name, value, overwrite ? 1 : 0);
+#endif
+}
+
+// runs `call` on the engines, skipping the benchmark if it throws
+template <typename Call>
+bool Guard(benchmark::State& state, const Call& call) {
+  try {
+    call();
+    return true;
+  } catch (std::exception& e) {
+    state.SkipWithError(e.what());
+    return false;
+  }
+}
+
+// the pool of the benchmark that runs, with an engine per voice configured alike. only one pool is
+// alive at a time, as pools would otherwise share the instance of the stand-in and its settings
+std::mutex pool_mutex;
+std::unique_ptr<Ebyroid> pool;
+uint32_t pool_chunk_samples = 0;
+
+// null if the engines could not be loaded, in which case the benchmark is skipped
+Ebyroid* PoolFor(benchmark::State& state, uint32_t chunk_samples) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  if (pool && pool_chunk_samples == chunk_samples) {
+    return pool.get();
+  }
+  pool.reset();
+  // read by the stand-in as each engine loads
+  SetEnv("EBYROID_SIM_CHUNK_SAMPLES", std::to_string(chunk_samples).c_str(), true);
+  pool.reset(Ebyroid::Create());
+  bool loaded = Guard(state, [] {
+    for (const char* voice : kVoices) {
+      pool->Preload(base_dir, voice, nullptr);
+    }
+  });
+  if (!loaded) {
+    pool.reset();
+    return nullptr;
+  }
+  pool_chunk_samples = chunk_samples;
+  return pool.get();
+}
+
+// what a job for the voice takes, with the voice's own prosody and no deadline
+struct Params {
+  explicit Params(const char* voice_name) : dir(base_dir), voice(voice_name) {
+    params.needs_reload = false;
+    params.base_dir = dir.data();
+    params.voice = voice.data();
+    params.sample_rate = 0;
+    params.prosody = nullptr;
+    params.cancel = nullptr;
+    params.deadline = std::chrono::steady_clock::time_point::max();
+  }
+
+  std::string dir;
+  std::string voice;
+  ConvertParams params;
+};
+
+// converts the text once, returning the bytes of PCM
+size_t ConvertOnce(benchmark::State& state,
+                   Ebyroid* ebyroid,
+                   const ConvertParams& params,
+                   const char* text,
+                   const ebyroid::PcmSink& sink = nullptr) {
+  int16_t* pcm = nullptr;
+  size_t size = 0;
+  Guard(state, [&] { ebyroid->Convert(params, (const unsigned char*) text, &pcm, &size, sink); });
+  std::free(pcm);
+  return size;
+}
+
+// converts the text to AI Kana once
+std::string KanaOnce(benchmark::State& state,
+                     Ebyroid* ebyroid,
+                     const ConvertParams& params,
+                     const char* text) {
+  unsigned char* kana = nullptr;
+  size_t size = 0;
+  Guard(state, [&] { ebyroid->Hiragana(params, (const unsigned char*) text, &kana, &size); });
+  std::string aikana((const char*) kana, size);
+  std::free(kana);
+  return aikana;
+}
+
+// the overhead of a job that is next to nothing for the engine to render
+void BM_JobOverhead(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, kDefaultChunkSamples);
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[0]);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ConvertOnce(state, ebyroid, p.params, kShortText));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JobOverhead)->UseRealTime();
+
+// language analysis alone, text to AI Kana
+void BM_Hiragana(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, kDefaultChunkSamples);
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[0]);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(KanaOnce(state, ebyroid, p.params, kSentence));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Hiragana)->UseRealTime();
+
+// synthesis alone, AI Kana to wave
+void BM_Speech(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, kDefaultChunkSamples);
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[0]);
+  const std::string aikana = KanaOnce(state, ebyroid, p.params, kSentence);
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    int16_t* pcm = nullptr;
+    size_t size = 0;
+    Guard(state, [&] {
+      ebyroid->Speech(p.params, (const unsigned char*) aikana.c_str(), &pcm, &size);
+    });
+    std::free(pcm);
+    bytes += size;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_Speech)->UseRealTime();
+
+// a sentence handed over in chunks of range(0) samples, buffered (range(1) == 0) or streamed
+// through a sink (range(1) == 1)
+void BM_Chunks(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, (uint32_t) state.range(0));
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[0]);
+  const bool streamed = state.range(1) != 0;
+  ebyroid::PcmSink sink = [](const int16_t* shorts, size_t size) {
+    benchmark::DoNotOptimize(shorts[size - 1]);
+  };
+  ebyroid::Histogram::Snapshot before = ebyroid->metrics().chunks_per_job.snapshot();
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    bytes += ConvertOnce(state, ebyroid, p.params, kSentence, streamed ? sink : nullptr);
+  }
+  ebyroid::Histogram::Snapshot after = ebyroid->metrics().chunks_per_job.snapshot();
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+  state.counters["chunks_per_job"] =
+      (double) (after.sum - before.sum) / std::max<uint64_t>(after.count - before.count, 1);
+}
+BENCHMARK(BM_Chunks)
+    ->ArgsProduct({{256, 1024, 4096, 16384}, {0, 1}})
+    ->ArgNames({"chunk_samples", "streamed"})
+    ->UseRealTime();
+
+// shaping a sentence worth of engine PCM into what the caller asked for: gain alone for s16 mono
+// (range(0) == 0), or a sample format (range(0)) on range(1) channels
+void BM_OutputCopy(benchmark::State& state) {
+  const ebyroid::SampleFormat format = (ebyroid::SampleFormat) state.range(0);
+  const uint32_t channels = (uint32_t) state.range(1);
+  std::vector<int16_t> pcm(44100 * 3);
+  for (size_t i = 0; i < pcm.size(); i++) {
+    pcm[i] = (int16_t) ((i * 2654435761u) >> 16);
+  }
+  std::vector<unsigned char> out(pcm.size() * channels * ebyroid::BytesPerSample(format));
+  for (auto _ : state) {
+    if (format == ebyroid::kS16 && channels == 1) {
+      ebyroid::ApplyGain(pcm.data(), pcm.size(), 0.5f, (int16_t*) out.data());
+    } else {
+      ebyroid::ConvertPcm(pcm.data(), pcm.size(), format, channels, out.data());
+    }
+    benchmark::DoNotOptimize(out.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * out.size());
+}
+BENCHMARK(BM_OutputCopy)
+    ->ArgsProduct({{ebyroid::kS16, ebyroid::kF32, ebyroid::kS24, ebyroid::kS32}, {1, 2}})
+    ->ArgNames({"format", "channels"});
+
+// throwing away an engine and loading it afresh, as a needs_reload job does, along with the job
+void BM_Reload(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, kDefaultChunkSamples);
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[0]);
+  p.params.needs_reload = true;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ConvertOnce(state, ebyroid, p.params, kShortText));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reload)->UseRealTime();
+
+// sentences converted by as many threads at once, every two of them on a voice of their own
+void BM_Throughput(benchmark::State& state) {
+  Ebyroid* ebyroid = PoolFor(state, kDefaultChunkSamples);
+  if (ebyroid == nullptr) {
+    return;
+  }
+  Params p(kVoices[(state.thread_index() / 2) % kNumVoices]);
+  size_t bytes = 0;
+  for (auto _ : state) {
+    bytes += ConvertOnce(state, ebyroid, p.params, kSentence);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_Throughput)->ThreadRange(1, 2 * kNumVoices)->UseRealTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 2;
+  }
+  if (const char* dir = std::getenv("EBYROID_BENCH_DIR"); dir != nullptr) {
+    base_dir = dir;
+  } else {
+    base_dir = std::filesystem::absolute(argv[0]).parent_path().string();
+  }
+  const char* const defaults[] = {"EBYROID_SIM_LATENCY_MSEC", "EBYROID_SIM_INTERVAL_MSEC"};
+  for (const char* name : defaults) {
+    SetEnv(name, "0", false);
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  pool.reset();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Times the resampler kernels against the scalar one on 10 seconds of synthetic audio for every
+// pair of rates that Voiceroid offers, and checks that they all agree to the bit.
+//
+//   $ cmake -S . -B build -DEBYROID_BUILD_BENCHMARKS=ON && cmake --build build
+//   $ build/resampler_bench [iterations]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "output_buffer.h"
+#include "resampler.h"
+
+using ebyroid::OutputBuffer;
+using ebyroid::Resampler;
+
+namespace {
+
+constexpr uint32_t kSeconds = 10;
+// how the engine hands PCM over when streaming
+constexpr size_t kChunkSamples = 8192;
+
+const char* const kKernelNames[] = {"scalar", "sse2", "avx2"};
+
+// a few harmonics with some vibrato and noise, loud enough to exercise saturation now and then
+std::vector<int16_t> MakeInput(uint32_t rate) {
+  std::vector<int16_t> input((size_t) rate * kSeconds);
+  const double pi = std::acos(-1.0);
+  uint32_t noise = 12345;
+  for (size_t i = 0; i < input.size(); i++) {
+    double t = (double) i / rate;
+    double f0 = 180.0 + 40.0 * std::sin(2 * pi * 3.0 * t);
+    double v = 0.0;
+    for (int h = 1; h <= 12; h++) {
+      v += std::sin(2 * pi * f0 * h * t) / h;
+    }
+    noise = noise * 1664525 + 1013904223;
+    v = v * 14000.0 + (double) (noise >> 20) - 2048.0;
+    input[i] = (int16_t) std::fmax(-32768.0, std::fmin(32767.0, v));
+  }
+  return input;
+}
+
+// resamples the whole input in engine-sized chunks, returning the output of the last iteration
+std::vector<int16_t> Run(Resampler* resampler,
+                         const std::vector<int16_t>& input,
+                         int iterations,
+                         double* msec) {
+  OutputBuffer<int16_t> output;
+  auto started = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    output.Clear();
+    for (size_t pos = 0; pos < input.size(); pos += kChunkSamples) {
+      size_t n = std::min(kChunkSamples, input.size() - pos);
+      resampler->Process(input.data() + pos, n, &output);
+    }
+    resampler->Flush(&output);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - started;
+  *msec = std::chrono::duration<double, std::milli>(elapsed).count() / iterations;
+  return std::vector<int16_t>(output.data(), output.data() + output.size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 20;
+  if (iterations <= 0) {
+    std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 2;
+  }
+
+  const uint32_t froms[] = {22050, 44100};
+  const uint32_t tos[] = {16000, 24000, 48000};
+  const int best = Resampler::BestKernel();
+  std::printf("best kernel: %s, %d iterations of %u s of audio\n\n",
+              kKernelNames[best],
+              iterations,
+              kSeconds);
+  std::printf("%-16s %-8s %10s %12s %8s\n", "rates", "kernel", "msec", "x realtime", "speedup");
+
+  bool agreed = true;
+  for (uint32_t from : froms) {
+    std::vector<int16_t> input = MakeInput(from);
+    for (uint32_t to : tos) {
+      double scalar_msec = 0.0;
+      std::vector<int16_t> expected;
+      for (int kernel = Resampler::kScalar; kernel <= best; kernel++) {
+        Resampler resampler(from, to, (Resampler::Kernel) kernel);
+        double msec;
+        std::vector<int16_t> output = Run(&resampler, input, iterations, &msec);
+        if (kernel == Resampler::kScalar) {
+          scalar_msec = msec;
+          expected = output;
+        } else if (output != expected) {
+          std::fprintf(
+              stderr, "%u -> %u: %s disagrees with scalar\n", from, to, kKernelNames[kernel]);
+          agreed = false;
+        }
+        char rates[32];
+        std::snprintf(rates, sizeof(rates), "%u->%u", from, to);
+        std::printf("%-16s %-8s %10.2f %12.0f %7.2fx\n",
+                    rates,
+                    kKernelNames[kernel],
+                    msec,
+                    kSeconds * 1000.0 / msec,
+                    scalar_msec / msec);
+      }
+    }
+  }
+  return agreed ? 0 : 1;
+}
@@ -1,11 +1,15 @@
+const CancelHandle = require('./lib/cancel_handle');
 const Ebyroid = require('./lib/ebyroid');
 const Voiceroid = require('./lib/voiceroid');
 const MiniServer = require('./lib/mini_server');
+const OpusObject = require('./lib/opus_object');
 const WaveObject = require('./lib/wave_object');
 
 module.exports = {
+  CancelHandle,
   Ebyroid,
   Voiceroid,
   MiniServer,
+  OpusObject,
   WaveObject,
 };
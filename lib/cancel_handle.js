@@ -0,0 +1,91 @@
+/**
+ * Error code of a request given up on through its {@link CancelHandle}.
+ */
+const CANCELLED = 'EBYROID_CANCELLED';
+
+/**
+ * Error code of a request given up on because its `timeout` ran out.
+ */
+const DEADLINE_EXCEEDED = 'EBYROID_DEADLINE_EXCEEDED';
+
+/**
+ * @param {string} code
+ * @param {string} message
+ * @returns {Error}
+ */
+function errorOf(code, message) {
+  const err = new Error(message);
+  err.code = code;
+  return err;
+}
+
+/**
+ * Lets the caller give up on a request that is no longer wanted, e.g. because the client has gone away.
+ * A request still waiting for its turn never runs, and one running on VOICEROID is aborted there, freeing the engine for others.
+ * Either way its promise is rejected with an error whose `code` is `EBYROID_CANCELLED`.
+ *
+ * @example
+ * const handle = new CancelHandle();
+ * ebyroid.convert(text, { cancel: handle }).catch(err => { ... });
+ * handle.cancel();
+ */
+class CancelHandle {
+  constructor() {
+    /**
+     * whether cancel() has been called.
+     *
+     * @type {boolean}
+     */
+    this.cancelled = false;
+
+    /** @type {Set<function():void>} */
+    this.listeners = new Set();
+  }
+
+  /**
+   * Give up on the requests this handle was passed to. Calling it more than once does nothing.
+   */
+  cancel() {
+    if (this.cancelled) {
+      return;
+    }
+    this.cancelled = true;
+    const listeners = Array.from(this.listeners);
+    this.listeners.clear();
+    listeners.forEach(listener => listener());
+  }
+
+  /**
+   * Run `listener` on cancel(), right away if already cancelled.
+   *
+   * @package
+   * @param {function():void} listener
+   * @returns {function():void} a function that stops listening
+   */
+  onCancel(listener) {
+    if (this.cancelled) {
+      listener();
+      return () => {};
+    }
+    this.listeners.add(listener);
+    return () => this.listeners.delete(listener);
+  }
+
+  /**
+   * @package
+   * @returns {Error}
+   */
+  static cancelledError() {
+    return errorOf(CANCELLED, 'The job has been cancelled');
+  }
+
+  /**
+   * @package
+   * @returns {Error}
+   */
+  static deadlineExceededError() {
+    return errorOf(DEADLINE_EXCEEDED, 'The job has exceeded its deadline');
+  }
+}
+
+module.exports = CancelHandle;
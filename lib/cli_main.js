@@ -1,11 +1,13 @@
 /* eslint-disable no-console */
 const fs = require('fs');
+const os = require('os');
 const path = require('path');
 const inquirer = require('inquirer');
 const root = require('yargs');
 const Ebyroid = require('./ebyroid');
 const Voiceroid = require('./voiceroid');
 const MiniServer = require('./mini_server');
+const { runLoad, summaryOf, formatReport } = require('./load_generator');
 
 /** @typedef {root.Argv<{}>} Yargs */
 /** @typedef {{ [key in keyof root.Arguments<{}>]: Arguments<{}>[key] }} Argv */
@@ -196,7 +198,7 @@ function toVR(o) {
 }
 
 /** @param {Argv} argv */
-function start(argv) {
+async function start(argv) {
   console.log('Loading config from JSON file...');
   const json = fs.readFileSync(argv.config, 'utf8');
   const objects = JSON.parse(json);
@@ -208,16 +210,85 @@ function start(argv) {
     vrs.map(v => v.name).join(', ')
   );
   const ebyroid = new Ebyroid(...vrs);
+  if (argv.trace) {
+    Ebyroid.startTracing(argv.trace);
+    const how =
+      Ebyroid.traceSignal === 'SIGBREAK'
+        ? 'press Ctrl+Break'
+        : `send ${Ebyroid.traceSignal}`;
+    console.log(`Tracing, ${how} or stop to write "${argv.trace}"...`);
+    // exit rather than be killed by them, so that the trace gets written
+    for (const signal of ['SIGINT', 'SIGTERM']) {
+      process.once(signal, () =>
+        process.exit(128 + os.constants.signals[signal])
+      );
+    }
+  }
+  console.log('Loading voice libraries...');
+  let report;
+  try {
+    report = await ebyroid.init();
+  } catch (e) {
+    console.error('\nSorry, a voice library could not be loaded!', e.message);
+    process.exitCode = 1;
+    return 1;
+  }
+  const msec = x => `${x.toFixed(0)}ms`;
+  Object.entries(report.voices).forEach(([name, t]) =>
+    console.log(
+      `  ${name}: ${msec(t.totalMsec)}`,
+      `(Init ${msec(t.initMsec)}, LangLoad ${msec(t.langLoadMsec)},`,
+      `VoiceLoad ${msec(t.voiceLoadMsec)})`
+    )
+  );
+  console.log(`Loaded in ${report.totalMsec}ms`);
   const defname = objects.find(o => o.default).name;
   ebyroid.use(defname);
   console.log(`Use "${defname}" as default...`);
-  const mini = new MiniServer(ebyroid);
+  const mini = new MiniServer(ebyroid, undefined, argv.stream);
   console.log(`Starting up the server, with port ${argv.port}...`);
   mini.start(argv.port);
   console.log(`Server started! - http://localhost:${argv.port}/`);
   return 0;
 }
 
+/** @param {Argv} argv */
+async function bench(argv) {
+  const options = {
+    url: argv.url,
+    endpoint: argv.endpoint,
+    stream: typeof argv.stream === 'boolean' ? argv.stream : null,
+    mode: argv.mode,
+    rate: argv.rate,
+    concurrency: argv.concurrency,
+    duration: argv.duration,
+    textLength: argv.textLength,
+    voices: argv.voices || null,
+    timeout: argv.timeout,
+    seed: argv.seed,
+  };
+  const onProgress = (sent, done) => {
+    if (!argv.json) {
+      process.stderr.write(`\r${done}/${sent} requests done...`);
+    }
+  };
+  let report;
+  try {
+    report = await runLoad(options, onProgress);
+  } catch (e) {
+    console.error('\nSorry, the benchmark could not be run!', e.message);
+    process.exitCode = 1;
+    return 1;
+  }
+  if (argv.json) {
+    console.log(JSON.stringify(summaryOf(report), null, 2));
+  } else {
+    process.stderr.write('\n');
+    console.log(formatReport(report));
+  }
+  return 0;
+}
+
 const c = {
   command: 'configure',
   desc: 'create a configuration file',
@@ -254,19 +325,113 @@ const s = {
         describe: 'specify a port to listen',
         default: 4090,
       })
+      .option('stream', {
+        describe: 'stream audio while it is rendered (chunked transfer)',
+        default: false,
+      })
+      .option('trace', {
+        describe:
+          'record trace events, written to the given file on SIGUSR2 (Ctrl+Break on Windows) and on exit',
+      })
       .normalize('config')
+      .normalize('trace')
       .number('port')
+      .boolean('stream')
       .demandOption('config');
   },
 
   handler: start,
 };
 
+const b = {
+  command: 'bench',
+  desc: 'put load on a running server and measure latency',
+
+  /** @param {Yargs} yargs */
+  builder(yargs) {
+    return yargs
+      .option('url', {
+        alias: 'u',
+        describe: 'where the API of the server is',
+        default: 'http://localhost:4090/api/v1',
+      })
+      .option('endpoint', {
+        alias: 'e',
+        describe: 'which endpoint to request',
+        choices: ['audiostream', 'audiofile'],
+        default: 'audiostream',
+      })
+      .option('stream', {
+        describe: 'ask for streamed audio, or not with --no-stream',
+        default: null,
+        defaultDescription: 'up to the server',
+      })
+      .option('mode', {
+        alias: 'm',
+        describe: 'open: send at a fixed rate, closed: keep requests in flight',
+        choices: ['open', 'closed'],
+        default: 'closed',
+      })
+      .option('rate', {
+        alias: 'r',
+        describe: 'requests per second in the open mode',
+        default: 10,
+      })
+      .option('concurrency', {
+        alias: 'n',
+        describe: 'requests in flight in the closed mode',
+        default: 2,
+      })
+      .option('duration', {
+        alias: 'd',
+        describe: 'seconds to send requests for',
+        default: 30,
+      })
+      .option('text-length', {
+        alias: 'l',
+        describe: 'characters per text, e.g. 40, 10-80 or 10-30:0.8,200:0.2',
+        default: '20-80',
+      })
+      .option('voices', {
+        alias: 'v',
+        describe: 'voiceroids to mix by weight, e.g. akari:3,kiritan:1',
+      })
+      .option('timeout', {
+        describe: 'msec after which a request counts as failed',
+        default: 60000,
+      })
+      .option('seed', {
+        describe: 'seed of the random texts and voices',
+        default: 1,
+      })
+      .option('json', {
+        describe: 'print the results as JSON',
+        default: false,
+      })
+      .string('text-length')
+      .string('voices')
+      .boolean('json')
+      .number('rate')
+      .number('concurrency')
+      .number('duration')
+      .number('timeout')
+      .number('seed')
+      .check(argv => {
+        const positive = ['rate', 'concurrency', 'duration', 'timeout'];
+        const bad = positive.find(key => !(argv[key] > 0));
+        return bad ? `--${bad} should be a positive number` : true;
+      });
+  },
+
+  handler: bench,
+};
+
 function main() {
   const m = [
     'For more specific details:',
     '  ebyroid configure --help',
     '  ebyroid start --help',
+    '  ebyroid bench --help',
     '',
     'Or just try:',
     '  ebyroid configure && ebyroid start',
@@ -275,6 +440,7 @@ function main() {
     .scriptName('ebyroid')
     .command(c.command, c.desc, c.builder, c.handler)
     .command(s.command, s.desc, s.builder, s.handler)
+    .command(b.command, b.desc, b.builder, b.handler)
     .demandCommand(1, m.join('\n'))
     .help().argv;
 }
@@ -1,37 +1,94 @@
 const assert = require('assert').strict;
+const path = require('path');
 const iconv = require('iconv-lite');
 const debug = require('debug')('ebyroid');
 /** @type {import("./module_def")} */
 const native = require('../dll/ebyroid.node'); // eslint-disable-line node/no-unpublished-require
-const Semaphore = require('./semaphore');
+const { prosodyError, nativeProsodyOf } = require('./prosody');
+const Scheduler = require('./scheduler');
+const OpusObject = require('./opus_object');
+const Voiceroid = require('./voiceroid');
 const WaveObject = require('./wave_object');
 
 /** @typedef {import("./module_def").NativeOptions} NativeOptions */
 
-/** @typedef {import("./voiceroid")} Voiceroid */
+/** @typedef {import("./module_def").NativeInitOptions} NativeInitOptions */
 
-// shift-jis
-const SHIFT_JIS = 'shiftjis';
+/** @typedef {import("./module_def").PcmArray} PcmArray */
+
+/** @typedef {import("./wave_object").SampleFormat} SampleFormat */
+
+/** @typedef {import("./cancel_handle")} CancelHandle */
+
+/** @typedef {import("./scheduler").SchedulerStats} SchedulerStats */
+
+/** @typedef {import("./module_def").CacheStats} CacheStats */
+
+/** @typedef {import("./module_def").StageStats} StageStats */
+
+/** @typedef {import("./module_def").NativeStats} NativeStats */
+
+/** @typedef {import("./prosody").Prosody} Prosody */
+
+/** @typedef {import("./opus_object").Codec} Codec */
+
+/** @typedef {import("./module_def").LoadTimings} LoadTimings */
 
 /**
- * Class-wise global semaphore object.
+ * What {@link Ebyroid#init} did.
  *
- * @type {Semaphore}
+ * @typedef InitReport
+ * @type {object}
+ * @property {number} totalMsec how long it took as a whole, which is about as long as the slowest voice library took.
+ * @property {Object<string, LoadTimings>} voices how long each stage of loading took, by the name of the voiceroid. voiceroids of one voice library share theirs, and the ones that did not get loaded to respect `maxResidentEngines` are left out.
  */
-const semaphore = new Semaphore(2);
 
 /**
- * @type {Voiceroid[]}
+ * Per-request options.
+ *
+ * @typedef ConvertOptions
+ * @type {object}
+ * @property {("high"|"normal"|"low")} [priority="normal"] requests of a higher priority go ahead of the others waiting in the native job queue.
+ * @property {CancelHandle} [cancel] lets you give up on the request, which then fails with an error whose `code` is `EBYROID_CANCELLED`.
+ * @property {number} [timeout] msec within which the request has to be done, waiting time included. beyond that it is given up on and fails with an error whose `code` is `EBYROID_DEADLINE_EXCEEDED`.
+ * @property {SampleFormat} [format="s16"] the sample format of the resulting PCM, which Ebyroid converts to natively off the event loop. `data` of the WaveObject is an Int16Array for s16, a Float32Array for f32, a Uint8Array (three bytes a sample) for s24 and an Int32Array for s32.
+ * @property {(1|2)} [channels] the number of channels of the resulting PCM, which defaults to the `channels` option of the Voiceroid. with 2, the Mono voice is interleaved into Stereo natively.
+ * @property {("peak"|"rms")} [normalize] scales the resulting PCM so that its peak or RMS level meets `targetLevel`, in place of the `volume` of the Voiceroid. not for streams, as it takes the whole of the PCM.
+ * @property {number} [targetLevel] the level in dBFS (0 or below) that `normalize` aims for. defaults to -1 for peak and -20 for rms.
+ * @property {Prosody} [prosody] speed, pitch, intonation and pauses of the voice for this request alone. the voice library stays loaded, and only what differs from the request before is handed to VOICEROID.
+ * @property {Codec} [codec] encodes the result into Opus natively off the event loop, which then comes as an {@link OpusObject} instead of a WaveObject. the PCM is resampled to 48000Hz for it whatever the `sampleRate` of the Voiceroid. needs a build with libopus (see {@link Ebyroid.opusSupported}), and is not for streams nor other formats than s16.
+ * @property {number} [bitrate=64000] bits per second of the Opus encoder, from 6000 to 510000.
  */
-const fifo = [];
+
+// shift-jis
+const SHIFT_JIS = 'shiftjis';
 
 /**
- * The voiceroid that is currently used **in the native library**.
+ * Decides when requests run on the native library, which is set up along with it.
+ *
+ * @type {Scheduler?}
+ */
+let scheduler = null;
+
+/**
+ * The voiceroid that is used last **in the native library**.
  *
  * @type {Voiceroid?}
  */
 let current = null;
 
+/**
+ * Where the trace goes, and what flushes it on a signal and on exit, while tracing.
+ *
+ * @type {{path: string, signal: string?, listener: ?function(): void}?}
+ */
+let tracing = null;
+
+/**
+ * What writes the trace by default: there is no SIGUSR2 on Windows, where Ctrl+Break raises SIGBREAK.
+ */
+const TRACE_SIGNAL = process.platform === 'win32' ? 'SIGBREAK' : 'SIGUSR2';
+
 /**
  * @type {Ebyroid?}
  */
@@ -45,85 +102,357 @@ function validateOpCall(self) {
   assert(current !== null, 'ebyroid native module must have been initialized');
 }
 
+/**
+ * @type {Object<string, number>}
+ */
+const PRIORITIES = { high: 0, normal: 1, low: 2 };
+
+/**
+ * Sample formats in the order of their native numbers.
+ *
+ * @type {SampleFormat[]}
+ */
+const SAMPLE_FORMATS = ['s16', 'f32', 's24', 's32'];
+
+/**
+ * Normalization modes by their native numbers, along with the default target level of each.
+ *
+ * @type {Object<string, {mode: number, targetLevel: number}>}
+ */
+const NORMALIZATIONS = {
+  peak: { mode: 1, targetLevel: -1 },
+  rms: { mode: 2, targetLevel: -20 },
+};
+
+/**
+ * Codecs by their native numbers.
+ *
+ * @type {Object<string, number>}
+ */
+const CODECS = { opus: 1, ogg: 2 };
+
+/**
+ * The rate that Opus plays at.
+ *
+ * @type {number}
+ */
+const OPUS_SAMPLE_RATE = 48000;
+
+/**
+ * @param {Ebyroid} self
+ * @returns {NativeInitOptions}
+ */
+function nativeInitOptionsOf(self) {
+  return {
+    maxEngines: self.maxResidentEngines,
+    ...self.queueOptions,
+    cacheBytes: self.cacheBytes,
+    kanaCacheSize: self.kanaCacheSize,
+    maxSegmentBytes: self.maxSegmentBytes,
+    engineHosts: self.engineHosts,
+    hostPath: path.join(
+      __dirname,
+      '..',
+      'dll',
+      process.platform === 'win32' ? 'ebyroid_host.exe' : 'ebyroid_host'
+    ),
+  };
+}
+
 /**
  * @param {Voiceroid} vr
- * @param {Error} err
- * @returns {Voiceroid}
+ * @param {ConvertOptions} [options={}]
+ * @returns {NativeOptions}
  */
-function errorroid(vr, err) {
-  // FIXME more graceful way to handle errors?
-  return Object.assign(Object.create(Object.getPrototypeOf(vr)), vr, {
-    baseDirPath: 'error',
-    voiceDirName: err.message,
-  });
+function nativeOptionsOf(vr, options = {}) {
+  const priority = PRIORITIES[options.priority || 'normal'];
+  assert(priority !== undefined, 'priority must be "high", "normal" or "low"');
+  assert(
+    options.timeout === undefined ||
+      (Number.isInteger(options.timeout) && options.timeout >= 0),
+    'timeout must be a non-negative integer'
+  );
+  const format = SAMPLE_FORMATS.indexOf(options.format || 's16');
+  assert(format >= 0, 'format must be "s16", "f32", "s24" or "s32"');
+  const channels =
+    options.channels === undefined ? vr.outputChannels : options.channels;
+  assert(channels === 1 || channels === 2, 'channels must be 1 or 2');
+  const nativeOptions = {
+    needs_reload: false,
+    base_dir: vr.baseDirPath,
+    voice: vr.voiceDirName,
+    volume: vr.outputVolume,
+    sample_rate: vr.outputSampleRate,
+    format,
+    channels,
+    priority,
+  };
+  if (options.normalize !== undefined) {
+    const normalization = NORMALIZATIONS[options.normalize];
+    assert(normalization !== undefined, 'normalize must be "peak" or "rms"');
+    const targetLevel =
+      options.targetLevel === undefined
+        ? normalization.targetLevel
+        : options.targetLevel;
+    assert(
+      Number.isFinite(targetLevel) && targetLevel <= 0,
+      'targetLevel must be a number of dBFS, 0 or below'
+    );
+    nativeOptions.normalize = normalization.mode;
+    nativeOptions.target_level = targetLevel;
+  }
+  if (options.prosody !== undefined) {
+    const error = prosodyError(options.prosody);
+    assert(error === null, error);
+    Object.assign(nativeOptions, nativeProsodyOf(options.prosody));
+  }
+  if (options.codec !== undefined) {
+    const codec = CODECS[options.codec];
+    assert(codec !== undefined, 'codec must be "opus" or "ogg"');
+    assert(
+      native.opus,
+      'this build has no Opus encoder (libopus was not found)'
+    );
+    assert(format === 0, 'Opus can only be encoded from s16');
+    const bitrate = options.bitrate === undefined ? 64000 : options.bitrate;
+    assert(
+      Number.isInteger(bitrate) && bitrate >= 6000 && bitrate <= 510000,
+      'bitrate must be an integer from 6000 to 510000'
+    );
+    nativeOptions.sample_rate = OPUS_SAMPLE_RATE;
+    nativeOptions.codec = codec;
+    nativeOptions.bitrate = bitrate;
+  }
+  return nativeOptions;
 }
 
 /**
- * @returns {Voiceroid?}
+ * @param {PcmArray} data PCM that the native module made with the options
+ * @param {number} sampleRate
+ * @param {NativeOptions} options
+ * @returns {WaveObject}
  */
-function lastRegistered() {
-  const vr = fifo[fifo.length - 1];
-  return vr || null;
+function waveObjectOf(data, sampleRate, options) {
+  const format = SAMPLE_FORMATS[options.format];
+  return new WaveObject(data, sampleRate, options.channels, format);
 }
 
 /**
- * @param {Voiceroid} vr
+ * @param {Buffer} data what the native module encoded with the options
+ * @param {Uint32Array} [packetEnds] where each packet ends, for raw Opus
+ * @param {NativeOptions} options
+ * @returns {OpusObject}
  */
-function register(vr) {
-  fifo.push(vr);
-  debug('(registered) fifo = %d', fifo.length);
+function opusObjectOf(data, packetEnds, options) {
+  const codec = Object.keys(CODECS).find(key => CODECS[key] === options.codec);
+  return new OpusObject(data, packetEnds || null, options.channels, codec);
 }
 
 /**
+ * @param {Buffer} buffer
+ * @param {NativeOptions} options
  * @param {Voiceroid} vr
+ * @param {?function(WaveObject):(void|Promise)} onChunk streams PCM out chunk by chunk if given
+ * @param {function(Error,(PcmArray|Buffer|number),Uint32Array=):void} callback
+ * @returns {number} the job id
  */
-function unregister(vr) {
-  assert(vr === fifo[0], 'unregisteration is equivalent to fifo.shift()');
-  fifo.shift();
-  debug('(unregistered) fifo = %d', fifo.length);
+function nativeConvert(buffer, options, vr, onChunk, callback) {
+  if (onChunk) {
+    // the job is held up while any promise that onChunk has handed back is pending
+    let jobId;
+    let holds = 0;
+    const release = () => {
+      if (--holds === 0) {
+        native.pause(jobId, false);
+      }
+    };
+    const emit = pcm => {
+      const held = onChunk(waveObjectOf(pcm, vr.outputSampleRate, options));
+      if (held && typeof held.then === 'function') {
+        if (holds++ === 0) {
+          native.pause(jobId, true);
+        }
+        held.then(release, release);
+      }
+    };
+    jobId = native.convertStream(buffer, options, emit, callback);
+    return jobId;
+  }
+  return native.convert(buffer, options, callback);
 }
 
 /**
+ * Runs a native job once it is the turn of the voiceroid, giving up on it as `options` say.
+ *
  * @param {Voiceroid} vr
- * @returns {boolean}
+ * @param {ConvertOptions} options
+ * @param {NativeOptions} nativeOptions
+ * @param {function(function(Error,*,Uint32Array=):void):number} start starts the job with its callback, and returns the job id
+ * @returns {Promise<Array>} what the job called back with, but for the error
  */
-function needsLibraryReload(vr) {
-  const lastreg = lastRegistered();
-  const comparison = lastreg || current;
-  return !vr.usesSameLibrary(comparison);
+async function runNativeJob(vr, options, nativeOptions, start) {
+  const cancel = options.cancel || null;
+  const deadline =
+    options.timeout === undefined ? Infinity : Date.now() + options.timeout;
+  await scheduler.acquire(vr, cancel, deadline);
+
+  if (deadline < Infinity) {
+    // what is left of it after waiting for a turn
+    nativeOptions.timeout = Math.max(deadline - Date.now(), 0);
+  }
+  return new Promise((resolve, reject) => {
+    let stopListening = () => {};
+    let jobId;
+    try {
+      jobId = start((err, output, ends) => {
+        stopListening();
+        scheduler.release(vr);
+        if (err) {
+          reject(err);
+          return;
+        }
+        current = vr;
+        resolve([output, ends]);
+      });
+    } catch (e) {
+      // the native side has turned the job down, and never calls back
+      scheduler.release(vr);
+      throw e;
+    }
+    if (cancel) {
+      stopListening = cancel.onCancel(() => native.cancel(jobId));
+    }
+  });
 }
 
 /**
  * @this Ebyroid
  * @param {string} text
  * @param {Voiceroid} vr
- * @returns {Promise<WaveObject>}
+ * @param {?function(WaveObject):(void|Promise)} onChunk
+ * @param {ConvertOptions} [options={}]
+ * @returns {Promise<WaveObject|OpusObject|number>} the number of samples when streamed
  */
-async function internalConvertF(text, vr) {
+async function internalConvertF(text, vr, onChunk = null, options = {}) {
+  assert(
+    !onChunk || options.normalize === undefined,
+    'streams cannot be normalized'
+  );
+  assert(!onChunk || options.codec === undefined, 'streams cannot be encoded');
   const buffer = iconv.encode(text, SHIFT_JIS);
-  await semaphore.acquire();
-
-  assert(vr.usesSameLibrary(current), 'it must not need to reload');
+  const nativeOptions = nativeOptionsOf(vr, options);
+
+  // repeated text is served from the cache, without waiting for a turn on the engines.
+  // PCM to encode is looked up by the native module, which still has to encode it
+  const cached = nativeOptions.codec
+    ? null
+    : native.lookupCache(buffer, nativeOptions);
+  if (cached) {
+    const pcm = waveObjectOf(cached, vr.outputSampleRate, nativeOptions);
+    if (!onChunk) {
+      return pcm;
+    }
+    if (cached.length > 0) {
+      onChunk(pcm);
+    }
+    return cached.byteLength / ((pcm.bitDepth / 8) * pcm.numChannels);
+  }
 
-  // TODO setup full options here
-  const options = {
-    needs_reload: false,
-    volume: vr.outputVolume,
-  };
+  const [pcmOut, packetEnds] = await runNativeJob(
+    vr,
+    options,
+    nativeOptions,
+    callback => nativeConvert(buffer, nativeOptions, vr, onChunk, callback)
+  );
+  if (onChunk) {
+    return pcmOut;
+  }
+  if (nativeOptions.codec) {
+    return opusObjectOf(pcmOut, packetEnds, nativeOptions);
+  }
+  return waveObjectOf(pcmOut, vr.outputSampleRate, nativeOptions);
+}
 
-  return new Promise((resolve, reject) =>
-    native.convert(buffer, options, (err, pcmOut) => {
-      current = vr;
-      semaphore.release();
-      if (err) {
-        reject(err);
-      } else {
-        resolve(new WaveObject(pcmOut, vr.outputSampleRate));
-      }
-    })
+/**
+ * @this Ebyroid
+ * @param {string[]} texts
+ * @param {Voiceroid} vr
+ * @param {ConvertOptions} [options={}]
+ * @returns {Promise<WaveObject[]>} in the order of `texts`, sharing one array
+ */
+async function internalConvertBatchF(texts, vr, options = {}) {
+  assert(
+    Array.isArray(texts) &&
+      texts.length > 0 &&
+      texts.every(text => typeof text === 'string' && !text.includes('\0')),
+    'texts must be a non-empty array of strings without NUL'
+  );
+  assert(options.codec === undefined, 'batches cannot be encoded');
+  const buffers = texts.map(text => iconv.encode(text, SHIFT_JIS));
+  const nativeOptions = nativeOptionsOf(vr, options);
+
+  const [pcmOut, ends] = await runNativeJob(
+    vr,
+    options,
+    nativeOptions,
+    callback => native.convertBatch(buffers, nativeOptions, callback)
+  );
+  return Array.from(ends, (end, i) =>
+    waveObjectOf(
+      pcmOut.subarray(i > 0 ? ends[i - 1] : 0, end),
+      vr.outputSampleRate,
+      nativeOptions
+    )
   );
 }
 
+/**
+ * @this Ebyroid
+ * @param {string} voiceroidName
+ * @returns {Voiceroid}
+ */
+function voiceroidByNameF(voiceroidName) {
+  if (this.using === null) {
+    // only when a user called this method without calling .use() once
+    this.use(voiceroidName);
+  }
+  validateOpCall(this);
+
+  const vr = this.voiceroids.get(voiceroidName);
+  if (!vr) {
+    throw new Error(`Could not find a voiceroid by name "${voiceroidName}".`);
+  }
+  return vr;
+}
+
+/**
+ * @this Ebyroid
+ * @param {string} text
+ * @param {string} voiceroidName
+ * @param {?function(WaveObject):(void|Promise)} onChunk
+ * @param {ConvertOptions} [options={}]
+ * @returns {Promise<WaveObject|OpusObject|number>} the number of samples when streamed
+ */
+async function internalConvertExF(text, voiceroidName, onChunk, options) {
+  const vr = voiceroidByNameF.call(this, voiceroidName);
+  return internalConvertF.call(this, text, vr, onChunk, options);
+}
+
+/**
+ * Optional settings for an Ebyroid.
+ *
+ * @typedef EbyroidOptions
+ * @type {object}
+ * @property {number} [maxResidentEngines=0] how many voice libraries may stay loaded at once. the least recently used one is unloaded to make room for another. `0` keeps all of them.
+ * @property {number} [maxBatchWait=500] when voice libraries have to be swapped, requests are batched by library to save loads. this is how long in msec a request may wait for its library to come.
+ * @property {number} [workers=4] how many native threads run requests. every voice library runs two requests at most at once, as VOICEROID does not take more.
+ * @property {number} [queueCapacity=64] how many requests of each priority may wait per voice library in the native job queue. requests beyond that are rejected with an error whose `code` is `EBYROID_QUEUE_FULL`.
+ * @property {number} [cacheBytes=0] how many bytes of PCM may be kept to serve repeated text without VOICEROID. the least recently used PCM is dropped to make room. `0` disables the cache.
+ * @property {number} [maxSegmentBytes=0] text longer than this many bytes of Shift-JIS (a Japanese character takes two) is split at sentence boundaries into segments, which VOICEROID renders side by side and which are joined back seamlessly. streamed audio then starts after the first segment rather than the whole text, and other requests get to go in between segments. `0` never splits.
+ * @property {number} [kanaCacheSize=0] with a positive number, text is converted in two stages, language analysis into AI Kana and then synthesis, and that many analysis results are kept. text seen before then skips analysis, even for another voice. `0` converts in one go.
+ * @property {number} [engineHosts=0] with a positive number, VOICEROID runs in processes of its own rather than in this one, that many for every voice library, each taking two requests at once. a crash of VOICEROID then fails the requests of its process, which is started afresh for the next ones, rather than taking this process down. `0` runs VOICEROID in this process. not with `maxResidentEngines`.
+ */
+
 /**
  * Ebyroid class provides an access to the native VOICEROID+/VOICEROID2 libraries.
  */
@@ -131,9 +460,16 @@ class Ebyroid {
   /**
    * Construct an Ebyroid instance.
    *
-   * @param  {...Voiceroid} voiceroids voiceroids to use.
+   * @param  {...(Voiceroid|EbyroidOptions)} voiceroids voiceroids to use, optionally followed by {@link EbyroidOptions}.
+   * @example
+   * const ebyroid = new Ebyroid(yukari, kiritan, { maxResidentEngines: 1 });
    */
   constructor(...voiceroids) {
+    /** @type {EbyroidOptions} */
+    const options =
+      voiceroids[voiceroids.length - 1] instanceof Voiceroid
+        ? {}
+        : voiceroids.pop();
     assert(voiceroids.length > 0, 'at least one voiceroid must be given');
     debug('voiceroids = %O', voiceroids);
 
@@ -151,11 +487,157 @@ class Ebyroid {
      * @type {Voiceroid?}
      */
     this.using = null;
+
+    /**
+     * how many voice libraries may stay loaded at once (0 for all of them).
+     *
+     * @type {number}
+     */
+    this.maxResidentEngines = options.maxResidentEngines || 0;
+    assert(
+      Number.isInteger(this.maxResidentEngines) && this.maxResidentEngines >= 0,
+      'maxResidentEngines must be a non-negative integer'
+    );
+
+    /**
+     * how long in msec a request may wait for its voice library to be swapped in.
+     *
+     * @type {number}
+     */
+    this.maxBatchWait =
+      typeof options.maxBatchWait === 'number' ? options.maxBatchWait : 500;
+
+    /**
+     * settings of the native job queue.
+     *
+     * @type {{ workers?: number, queueCapacity?: number }}
+     */
+    this.queueOptions = {
+      workers: options.workers,
+      queueCapacity: options.queueCapacity,
+    };
+
+    /**
+     * how many bytes of PCM may be cached (0 for no cache).
+     *
+     * @type {number}
+     */
+    this.cacheBytes = options.cacheBytes || 0;
+    assert(
+      Number.isInteger(this.cacheBytes) &&
+        this.cacheBytes >= 0 &&
+        this.cacheBytes < 2 ** 32,
+      'cacheBytes must be a non-negative integer below 4GiB'
+    );
+
+    /**
+     * how long text may be before it gets split (0 to never split).
+     *
+     * @type {number}
+     */
+    this.maxSegmentBytes = options.maxSegmentBytes || 0;
+    assert(
+      Number.isInteger(this.maxSegmentBytes) && this.maxSegmentBytes >= 0,
+      'maxSegmentBytes must be a non-negative integer'
+    );
+
+    /**
+     * how many AI Kana results may be cached (0 to convert in one go).
+     *
+     * @type {number}
+     */
+    this.kanaCacheSize = options.kanaCacheSize || 0;
+    assert(
+      Number.isInteger(this.kanaCacheSize) && this.kanaCacheSize >= 0,
+      'kanaCacheSize must be a non-negative integer'
+    );
+
+    /**
+     * how many engine hosts to run per voice library (0 to run the engines in this process).
+     *
+     * @type {number}
+     */
+    this.engineHosts = options.engineHosts || 0;
+    assert(
+      Number.isInteger(this.engineHosts) && this.engineHosts >= 0,
+      'engineHosts must be a non-negative integer'
+    );
+    assert(
+      this.engineHosts === 0 || this.maxResidentEngines === 0,
+      'engineHosts does not go with maxResidentEngines'
+    );
+  }
+
+  /**
+   * Load voice libraries ahead of the first requests, off the event loop.
+   * Libraries are loaded side by side as far as VOICEROID allows, so this takes about as long as the slowest of them rather than all of them in turn.
+   * No more of them are loaded than `maxResidentEngines` lets stay resident. Requests may be made meanwhile, which wait for their library.
+   * Once this is done, {@link Ebyroid#use} no longer blocks.
+   *
+   * @param {...string} voiceroidNames name identifiers of the voiceroids to load, all of them if none is given
+   * @returns {Promise<InitReport>} how long loading took, stage by stage. rejected with an error whose `code` is `EBYROID_INIT_FAILED` if any library fails to load, in which case the others stay loaded
+   * @example
+   * const ebyroid = new Ebyroid(akari, kiritan);
+   * const report = await ebyroid.init();
+   * console.log(`took ${report.totalMsec} msec`, report.voices);
+   * ebyroid.use('akari-chan');
+   */
+  async init(...voiceroidNames) {
+    const names =
+      voiceroidNames.length > 0 ? voiceroidNames : [...this.voiceroids.keys()];
+    /** @type {Map<string, Voiceroid[]>} voiceroids by their library */
+    const libraries = new Map();
+    names.forEach(name => {
+      const vr = this.voiceroids.get(name);
+      if (!vr) {
+        throw new Error(`Could not find a voiceroid by name "${name}".`);
+      }
+      const key = `${vr.baseDirPath}\n${vr.voiceDirName}`;
+      libraries.set(key, [...(libraries.get(key) || []), vr]);
+    });
+
+    if (scheduler === null) {
+      scheduler = new Scheduler(this.maxResidentEngines, this.maxBatchWait);
+    }
+    let room = scheduler.room();
+    const groups = [...libraries.values()].filter(([vr]) => {
+      if (scheduler.isResident(vr)) {
+        return true;
+      }
+      room -= 1;
+      return room >= 0;
+    });
+
+    debug('call initAsync. libraries = %O', [...libraries.keys()]);
+    const started = Date.now();
+    const voices = groups.map(([vr]) => ({
+      baseDir: vr.baseDirPath,
+      voice: vr.voiceDirName,
+    }));
+    /** @type {LoadTimings[]} */
+    const timings = await new Promise((resolve, reject) => {
+      native.initAsync(voices, nativeInitOptionsOf(this), (err, result) =>
+        err ? reject(err) : resolve(result)
+      );
+    });
+
+    /** @type {InitReport} */
+    const report = { totalMsec: Date.now() - started, voices: {} };
+    groups.forEach((group, i) => {
+      scheduler.preload(group[0]);
+      group.forEach(vr => {
+        report.voices[vr.name] = timings[i];
+      });
+    });
+    if (current === null && groups.length > 0) {
+      current = groups[0][0];
+    }
+    return report;
   }
 
   /**
    * Let ebyroid use a specific voiceroid library.
-   * Distinctively, this operation may take a few seconds to complete when called first time.
+   * Distinctively, this operation may take a few seconds to complete when called first time, unless {@link Ebyroid#init} has been awaited.
    *
    * @param {string} voiceroidName a name identifier of the voiceroid to use
    * @example
@@ -173,13 +655,17 @@ class Ebyroid {
     if (current === null) {
       debug('call init. voiceroid = %O', vr);
       try {
-        native.init(vr.baseDirPath, vr.voiceDirName, vr.outputVolume);
+        native.init(vr.baseDirPath, vr.voiceDirName, nativeInitOptionsOf(this));
       } catch (err) {
         // eslint-disable-next-line no-console
         console.error('Failed to initialize ebyroid native module', err);
         throw err;
       }
       current = vr;
+      if (scheduler === null) {
+        scheduler = new Scheduler(this.maxResidentEngines, this.maxBatchWait);
+      }
+      scheduler.preload(vr);
     }
     debug('use %s', vr.name);
     this.using = vr;
@@ -187,83 +673,86 @@ class Ebyroid {
 
   /**
    * Convert text to a PCM buffer.
-   * When a voiceroid corresponding to the given voiceroidName uses a different voice library than
-   * the one currently used in the native library, it will acquire a mutex lock and reload native library.
-   * In which case it may block all of other requests for fair amount of time like a two or three seconds.
+   * Every voice library gets an engine of its own that stays loaded, so switching voices does not block other requests.
+   * Only the first request for a voice library (or the first one after it got unloaded to respect `maxResidentEngines`) waits for it to load, which may take a few seconds.
    * See {@link Voiceroid} for further details.
    *
    * @param {string} text Raw utf-8 text to convert
    * @param {string} voiceroidName a name identifier of the voiceroid to use
-   * @returns {Promise<WaveObject>} object that consists of a raw PCM buffer and format information
+   * @param {ConvertOptions} [options={}] per-request options
+   * @returns {Promise<WaveObject|OpusObject>} object that consists of a raw PCM buffer and format information, or Opus with a `codec`
    */
-  async convertEx(text, voiceroidName) {
-    if (this.using === null) {
-      // only when a user called this method without calling .use() once
-      this.use(voiceroidName);
-    }
-    validateOpCall(this);
-
-    const vr = this.voiceroids.get(voiceroidName);
-    if (!vr) {
-      throw new Error(`Could not find a voiceroid by name "${voiceroidName}".`);
-    }
-
-    if (!needsLibraryReload(vr)) {
-      debug('convertEx() delegates to internalConvertF %s', vr.name);
-      return internalConvertF.call(this, text, vr);
-    }
-
-    const buffer = iconv.encode(text, SHIFT_JIS);
-
-    debug('register %s', vr.name);
-    register(vr);
+  async convertEx(text, voiceroidName, options = {}) {
+    return internalConvertExF.call(this, text, voiceroidName, null, options);
+  }
 
-    debug('waiting for a lock');
-    await semaphore.lock();
-    debug('got a lock');
+  /**
+   * Convert text to a PCM buffer. Prefer using this method whenever you can.
+   *
+   * @param {string} text Raw utf-8 text to convert
+   * @param {ConvertOptions} [options={}] per-request options
+   * @returns {Promise<WaveObject|OpusObject>} object that consists of a raw PCM buffer and format information, or Opus with a `codec`
+   */
+  convert(text, options = {}) {
+    validateOpCall(this);
+    return internalConvertF.call(this, text, this.using, null, options);
+  }
 
-    assert(!vr.usesSameLibrary(current), 'it must need to reload');
+  /**
+   * Same as {@link Ebyroid.convertEx} except that PCM is handed to `onChunk` piece by piece as soon as VOICEROID produces it,
+   * instead of all at once after the whole text has been rendered.
+   *
+   * @param {string} text Raw utf-8 text to convert
+   * @param {string} voiceroidName a name identifier of the voiceroid to use
+   * @param {function(WaveObject):(void|Promise)} onChunk called with each piece of PCM in order. rendering is held up while a promise that it returns is pending, for a consumer that cannot keep up
+   * @param {ConvertOptions} [options={}] per-request options
+   * @returns {Promise<number>} the total number of samples streamed
+   */
+  async convertExStream(text, voiceroidName, onChunk, options = {}) {
+    assert(typeof onChunk === 'function', 'onChunk must be a function');
+    return internalConvertExF.call(this, text, voiceroidName, onChunk, options);
+  }
 
-    /** @type {NativeOptions} */
-    const options = {
-      needs_reload: true,
-      base_dir: vr.baseDirPath,
-      voice: vr.voiceDirName,
-      volume: vr.outputVolume,
-    };
+  /**
+   * Same as {@link Ebyroid.convert} except that PCM is handed to `onChunk` piece by piece as soon as VOICEROID produces it,
+   * instead of all at once after the whole text has been rendered.
+   *
+   * @param {string} text Raw utf-8 text to convert
+   * @param {function(WaveObject):(void|Promise)} onChunk called with each piece of PCM in order. rendering is held up while a promise that it returns is pending, for a consumer that cannot keep up
+   * @param {ConvertOptions} [options={}] per-request options
+   * @returns {Promise<number>} the total number of samples streamed
+   */
+  convertStream(text, onChunk, options = {}) {
+    validateOpCall(this);
+    assert(typeof onChunk === 'function', 'onChunk must be a function');
+    return internalConvertF.call(this, text, this.using, onChunk, options);
+  }
 
-    return new Promise((resolve, reject) =>
-      native.convert(buffer, options, (err, pcmOut) => {
-        debug('unregister %s', vr.name);
-        unregister(vr);
-        if (err) {
-          current = errorroid(vr, err);
-          reject(err);
-          debug('unlock with error %O', err);
-          setImmediate(() => semaphore.unlock());
-        } else {
-          current = vr;
-          debug('unlock');
-          semaphore.unlock();
-          resolve(new WaveObject(pcmOut, vr.outputSampleRate));
-        }
-      })
-    );
+  /**
+   * Convert many texts with the voiceroid as one request, which keeps the engine of its voice library busy from the first text to the last.
+   * Bulk rendering this way spares each text the round trip through the scheduler and the event loop that a request of its own takes.
+   * The texts are not cached, and the batch fails as a whole if any of them does.
+   *
+   * @param {string[]} texts Raw utf-8 texts to convert
+   * @param {string} voiceroidName a name identifier of the voiceroid to use
+   * @param {ConvertOptions} [options={}] per-request options, which apply to every text. a `timeout` is for the whole batch, and each text is normalized on its own.
+   * @returns {Promise<WaveObject[]>} one for each text in order, whose `data` are views into one array
+   */
+  async convertBatchEx(texts, voiceroidName, options = {}) {
+    const vr = voiceroidByNameF.call(this, voiceroidName);
+    return internalConvertBatchF.call(this, texts, vr, options);
   }
 
   /**
-   * Convert text to a PCM buffer. Prefer using this method whenever you can.
+   * Same as {@link Ebyroid.convertBatchEx} with the voiceroid in use.
    *
-   * @param {string} text Raw utf-8 text to convert
-   * @returns {Promise<WaveObject>} object that consists of a raw PCM buffer and format information
+   * @param {string[]} texts Raw utf-8 texts to convert
+   * @param {ConvertOptions} [options={}] per-request options, which apply to every text
+   * @returns {Promise<WaveObject[]>} one for each text in order, whose `data` are views into one array
    */
-  convert(text) {
+  convertBatch(texts, options = {}) {
     validateOpCall(this);
-    if (needsLibraryReload(this.using)) {
-      debug('convert() escalates to convertEx()');
-      return this.convertEx(text, this.using.name);
-    }
-    return internalConvertF.call(this, text, this.using);
+    return internalConvertBatchF.call(this, texts, this.using, options);
   }
 
   /**
@@ -276,11 +765,12 @@ class Ebyroid {
   async rawApiCallTextToKana(rawText) {
     validateOpCall(this);
     const buffer = iconv.encode(rawText, SHIFT_JIS);
-    await semaphore.acquire();
+    const vr = current;
+    await scheduler.acquire(vr);
 
     return new Promise((resolve, reject) => {
-      native.reinterpret(buffer, {}, (err, output) => {
-        semaphore.release();
+      native.reinterpret(buffer, nativeOptionsOf(vr), (err, output) => {
+        scheduler.release(vr);
         if (err) {
           reject(err);
         } else {
@@ -301,20 +791,148 @@ class Ebyroid {
   async rawApiCallAiKanaToSpeech(aiKana) {
     validateOpCall(this);
     const buffer = iconv.encode(aiKana, SHIFT_JIS);
-    await semaphore.acquire();
+    const vr = current;
+    await scheduler.acquire(vr);
 
+    const nativeOptions = nativeOptionsOf(vr);
     return new Promise((resolve, reject) => {
-      native.speech(buffer, {}, (err, pcmOut) => {
-        semaphore.release();
+      native.speech(buffer, nativeOptions, (err, pcmOut) => {
+        scheduler.release(vr);
         if (err) {
           reject(err);
         } else {
-          resolve(new WaveObject(pcmOut, current.baseSampleRate));
+          resolve(waveObjectOf(pcmOut, vr.baseSampleRate, nativeOptions));
         }
       });
     });
   }
 
+  /**
+   * Counts of voice library loads, along with how many reloads serving requests in arrival order would have taken.
+   * The difference is what batching requests by voice library saves.
+   *
+   * @returns {SchedulerStats?} null before the native library is initialized
+   */
+  reloadStats() {
+    return scheduler ? scheduler.stats() : null;
+  }
+
+  /**
+   * Hit and miss counts of the PCM cache, along with how much it holds.
+   *
+   * @returns {CacheStats?} null before the native library is initialized
+   */
+  cacheStats() {
+    return scheduler ? native.cacheStats() : null;
+  }
+
+  /**
+   * How much VOICEROID time language analysis and synthesis have taken, along with hits of the AI Kana cache.
+   *
+   * @returns {StageStats?} null before the native library is initialized
+   */
+  stageStats() {
+    return scheduler ? native.stageStats() : null;
+  }
+
+  /**
+   * Runtime metrics of the native library: job outcomes and engine errors, along with histograms of queue wait,
+   * engine time, PCM chunks, copying and loading. Cheap enough to poll, see also the `/api/v1/metrics` route of MiniServer.
+   *
+   * @returns {NativeStats?} null before the native library is initialized
+   */
+  stats() {
+    return scheduler ? native.stats() : null;
+  }
+
+  /**
+   * Whether the native module was built with libopus, without which the `codec` option is not available.
+   *
+   * @type {boolean}
+   */
+  static get opusSupported() {
+    return native.opus;
+  }
+
+  /**
+   * Starts recording what every request goes through natively (waiting for a worker, VOICEROID calls, each chunk of
+   * PCM it hands over, copying and completion) as Chrome trace events, which you can open in chrome://tracing or
+   * https://ui.perfetto.dev. Events are kept per native thread, the oldest falling out once `eventsPerThread` is reached.
+   * While tracing, the process writes the trace to `path` on `signal`, e.g. `kill -USR2 <pid>` (Ctrl+Break on Windows),
+   * and once more when it exits.
+   *
+   * @param {string} path the file to write the trace to
+   * @param {object} [options]
+   * @param {number} [options.eventsPerThread=65536] how many events to keep per native thread. only the first start sets it
+   * @param {string?} [options.signal] the signal to write the trace on, or null for none. defaults to SIGUSR2, and to SIGBREAK on Windows
+   */
+  static startTracing(path, options = {}) {
+    const { eventsPerThread, signal = TRACE_SIGNAL } = options;
+    assert(
+      typeof path === 'string' && path.length > 0,
+      'path must be a string'
+    );
+    if (eventsPerThread !== undefined) {
+      assert(
+        Number.isInteger(eventsPerThread) && eventsPerThread > 0,
+        'eventsPerThread must be a positive integer'
+      );
+    }
+    Ebyroid.stopTracing();
+    if (eventsPerThread === undefined) {
+      native.traceStart();
+    } else {
+      native.traceStart(eventsPerThread);
+    }
+    const listener = () => {
+      try {
+        const count = Ebyroid.flushTrace();
+        debug('wrote %d trace events to %s', count, path);
+      } catch (err) {
+        debug('could not write the trace: %s', err.message);
+      }
+    };
+    if (signal) {
+      process.on(signal, listener);
+    }
+    process.on('exit', listener);
+    tracing = { path, signal, listener };
+  }
+
+  /**
+   * Writes what has been recorded since tracing started. Recording goes on.
+   *
+   * @param {string} [path] the file to write the trace to, defaulting to the one tracing started with
+   * @returns {number} how many events went in
+   */
+  static flushTrace(path = tracing && tracing.path) {
+    assert(typeof path === 'string', 'tracing has not started');
+    return native.traceFlush(path);
+  }
+
+  /**
+   * Stops recording. What has been recorded can still be written with {@link Ebyroid.flushTrace}.
+   */
+  static stopTracing() {
+    native.traceStop();
+    if (tracing && tracing.listener) {
+      process.removeListener('exit', tracing.listener);
+      if (tracing.signal) {
+        process.removeListener(tracing.signal, tracing.listener);
+      }
+      tracing = { ...tracing, signal: null, listener: null };
+    }
+  }
+
+  /**
+   * The signal that writes the trace while tracing, if any.
+   *
+   * @type {string?}
+   */
+  static get traceSignal() {
+    return tracing && tracing.signal;
+  }
+
   /**
    * Supportive static method for the case in which you like to use it as singleton.
    *
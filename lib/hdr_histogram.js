@@ -0,0 +1,112 @@
+/**
+ * How many distinct values there are below the first doubling, which keeps every value to 3
+ * significant digits (an error of 1/1024 at worst).
+ */
+const SUB_BUCKETS = 2048;
+const HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+
+/**
+ * @param {number} value a non-negative integer
+ * @returns {number} how many times the value is halved to go below SUB_BUCKETS
+ */
+function shiftOf(value) {
+  let shift = Math.max(0, Math.floor(Math.log2(value + 1)) - 10);
+  // log2 of large values may be off by one either way
+  while (shift > 0 && Math.floor(value / 2 ** (shift - 1)) < SUB_BUCKETS) {
+    shift -= 1;
+  }
+  while (Math.floor(value / 2 ** shift) >= SUB_BUCKETS) {
+    shift += 1;
+  }
+  return shift;
+}
+
+/**
+ * Counts integer values (e.g. usec) the way HdrHistogram does: exactly below 2048, and from there
+ * in buckets that double in width every doubling of the value, so that every value is kept to
+ * 3 significant digits however large it gets. Recording is O(1) and takes no allocation once the
+ * largest value has been seen, and percentiles come out without keeping the values themselves.
+ */
+class HdrHistogram {
+  constructor() {
+    /** @type {number[]} counts by bucket index, see indexOf */
+    this.counts = [];
+    this.count = 0;
+    this.sum = 0;
+    this.min = Infinity;
+    this.max = 0;
+  }
+
+  /**
+   * @param {number} value
+   * @returns {number} where the value is counted
+   */
+  static indexOf(value) {
+    const shift = shiftOf(value);
+    if (shift === 0) {
+      return value;
+    }
+    const sub = Math.floor(value / 2 ** shift);
+    return (
+      SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (sub - HALF_SUB_BUCKETS)
+    );
+  }
+
+  /**
+   * @param {number} index
+   * @returns {number} the largest value that is counted at the index
+   */
+  static highestValueAt(index) {
+    if (index < SUB_BUCKETS) {
+      return index;
+    }
+    const shift = Math.floor((index - SUB_BUCKETS) / HALF_SUB_BUCKETS) + 1;
+    const sub = ((index - SUB_BUCKETS) % HALF_SUB_BUCKETS) + HALF_SUB_BUCKETS;
+    return (sub + 1) * 2 ** shift - 1;
+  }
+
+  /**
+   * @param {number} value non-negative, rounded to an integer
+   */
+  record(value) {
+    const v = Math.max(0, Math.round(value));
+    const index = HdrHistogram.indexOf(v);
+    while (this.counts.length <= index) {
+      this.counts.push(0);
+    }
+    this.counts[index] += 1;
+    this.count += 1;
+    this.sum += v;
+    this.min = Math.min(this.min, v);
+    this.max = Math.max(this.max, v);
+  }
+
+  /**
+   * @param {number} percentile from 0 to 100
+   * @returns {number} the value that so many percent of the values are at or below, to 3
+   * significant digits, or 0 if nothing has been recorded
+   */
+  valueAtPercentile(percentile) {
+    if (this.count === 0) {
+      return 0;
+    }
+    const rank = Math.max(1, Math.ceil((percentile / 100) * this.count));
+    let seen = 0;
+    for (let i = 0; i < this.counts.length; i++) {
+      seen += this.counts[i];
+      if (seen >= rank) {
+        return Math.min(HdrHistogram.highestValueAt(i), this.max);
+      }
+    }
+    return this.max;
+  }
+
+  /**
+   * @returns {number} the mean of the values, or 0 if nothing has been recorded
+   */
+  mean() {
+    return this.count > 0 ? this.sum / this.count : 0;
+  }
+}
+
+module.exports = HdrHistogram;
@@ -0,0 +1,400 @@
+const http = require('http');
+const HdrHistogram = require('./hdr_histogram');
+
+/**
+ * What to put on the server, and how.
+ *
+ * @typedef LoadOptions
+ * @type {object}
+ * @property {string} url where the API of the server is, e.g. `http://localhost:4090/api/v1`
+ * @property {('audiostream'|'audiofile')} endpoint
+ * @property {boolean?} stream whether to ask for streamed audio (`?stream=`), or null to leave it to the server
+ * @property {('open'|'closed')} mode open-loop sends `rate` requests per second whatever the responses do, closed-loop keeps `concurrency` requests in flight
+ * @property {number} rate requests per second, for the open-loop
+ * @property {number} concurrency requests in flight, for the closed-loop
+ * @property {number} duration seconds to send requests for
+ * @property {string} textLength how long each text is in characters, see {@link parseLengths}
+ * @property {string?} voices which voiceroid each request goes to, see {@link parseVoices}, or null for the default one
+ * @property {number} timeout msec after which a request is given up on
+ * @property {number} seed of the random texts and voices, the same seed giving the same requests
+ */
+
+/**
+ * What came out of a run. Times are in usec.
+ *
+ * @typedef LoadReport
+ * @type {object}
+ * @property {LoadOptions} options
+ * @property {number} elapsedMsec from the first request until the last response
+ * @property {number} requests
+ * @property {number} succeeded
+ * @property {Object<string, number>} errors counts by `HTTP <status>` or the code of the error
+ * @property {number} bytes body bytes of successful responses
+ * @property {HdrHistogram} latency until the whole response is in, from when the request was due
+ * @property {HdrHistogram} ttfb until the first byte of the body, from when the request was due
+ */
+
+/**
+ * @typedef WeightedRange
+ * @type {object}
+ * @property {number} min
+ * @property {number} max
+ * @property {number} weight
+ */
+
+/**
+ * The fraction of the requests that each of the entries gets.
+ *
+ * @typedef WeightedName
+ * @type {object}
+ * @property {string} name
+ * @property {number} weight
+ */
+
+// what random texts are made of, and what ends their sentences
+const SYLLABLES = [
+  ...'あいうえおかきくけこさしすせそたちつてとなにぬねのはひふへほまみむめもやゆよらりるれろわん',
+];
+const SENTENCE_END = '。';
+
+/**
+ * A small seedable PRNG (mulberry32), so that a run can be repeated request for request.
+ *
+ * @param {number} seed
+ * @returns {function(): number} from 0 (inclusive) to 1 (exclusive), like Math.random
+ */
+function randomOf(seed) {
+  let state = seed >>> 0;
+  return () => {
+    state = (state + 0x6d2b79f5) >>> 0;
+    let t = state;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+/**
+ * @template T
+ * @param {(T & { weight: number })[]} entries
+ * @param {function(): number} random
+ * @returns {T}
+ */
+function pick(entries, random) {
+  const total = entries.reduce((sum, e) => sum + e.weight, 0);
+  let r = random() * total;
+  for (const entry of entries) {
+    r -= entry.weight;
+    if (r < 0) {
+      return entry;
+    }
+  }
+  return entries[entries.length - 1];
+}
+
+/**
+ * @param {string} weight
+ * @param {string} spec
+ * @returns {number}
+ */
+function weightOf(weight, spec) {
+  if (weight === undefined) {
+    return 1;
+  }
+  const w = Number(weight);
+  if (!(w > 0)) {
+    throw new RangeError(`bad weight in "${spec}"`);
+  }
+  return w;
+}
+
+/**
+ * Parses a distribution of text lengths: comma-separated lengths (`40`) or ranges (`10-80`), each
+ * picked uniformly from, with an optional weight after a colon.
+ *
+ * @example
+ * parseLengths('20-80'); // 20 to 80 characters
+ * parseLengths('10-30:0.8,200-400:0.2'); // mostly short, sometimes long
+ * @param {string} spec
+ * @returns {WeightedRange[]}
+ */
+function parseLengths(spec) {
+  return String(spec)
+    .split(',')
+    .map(entry => {
+      const [range, weight] = entry.trim().split(':');
+      const [min, max = min] = range.split('-').map(Number);
+      if (!Number.isInteger(min) || !Number.isInteger(max) || min < 1) {
+        throw new RangeError(`bad text length "${entry}"`);
+      }
+      if (max < min) {
+        throw new RangeError(`bad text length "${entry}"`);
+      }
+      return { min, max, weight: weightOf(weight, entry) };
+    });
+}
+
+/**
+ * Parses a mix of voiceroids: comma-separated names as in the config, each with an optional weight
+ * after a colon. Requests for any other than the default voiceroid go through `convertEx`.
+ *
+ * @example
+ * parseVoices('akari:3,kiritan:1'); // three in four requests for akari
+ * @param {string} spec
+ * @returns {WeightedName[]}
+ */
+function parseVoices(spec) {
+  return String(spec)
+    .split(',')
+    .map(entry => {
+      const [name, weight] = entry.trim().split(':');
+      if (!name) {
+        throw new RangeError(`bad voice "${entry}"`);
+      }
+      return { name, weight: weightOf(weight, entry) };
+    });
+}
+
+/**
+ * @param {number} length in characters
+ * @param {function(): number} random
+ * @returns {string} kana in sentences of 10 to 30 characters
+ */
+function textOf(length, random) {
+  let text = '';
+  let sentence = 10 + Math.floor(random() * 21);
+  while (text.length < length) {
+    if (sentence === 0 || text.length === length - 1) {
+      text += SENTENCE_END;
+      sentence = 10 + Math.floor(random() * 21);
+    } else {
+      text += SYLLABLES[Math.floor(random() * SYLLABLES.length)];
+      sentence -= 1;
+    }
+  }
+  return text;
+}
+
+/**
+ * @returns {number} usec on a monotonic clock
+ */
+function nowUsec() {
+  return Number(process.hrtime.bigint() / 1000n);
+}
+
+/**
+ * Sends a request and reads the whole response, never rejecting.
+ *
+ * @param {string} url
+ * @param {http.Agent} agent
+ * @param {number} timeout msec
+ * @returns {Promise<{ error: string?, ttfbAt: number, endAt: number, bytes: number }>}
+ */
+function send(url, agent, timeout) {
+  return new Promise(resolve => {
+    let ttfbAt = 0;
+    let bytes = 0;
+    let done = false;
+    const finish = error => {
+      if (!done) {
+        done = true;
+        resolve({ error, ttfbAt, endAt: nowUsec(), bytes });
+      }
+    };
+    const req = http.get(url, { agent }, res => {
+      res.on('data', chunk => {
+        if (ttfbAt === 0) {
+          ttfbAt = nowUsec();
+        }
+        bytes += chunk.length;
+      });
+      res.on('aborted', () => finish('ABORTED'));
+      res.on('error', err => finish(err.code || 'ABORTED'));
+      res.on('end', () =>
+        finish(res.statusCode >= 400 ? `HTTP ${res.statusCode}` : null)
+      );
+    });
+    req.setTimeout(timeout, () => {
+      finish('TIMEOUT');
+      req.destroy();
+    });
+    req.on('error', err => finish(err.code || err.message));
+  });
+}
+
+/**
+ * Puts load on a running Ebyroid server and measures how it copes.
+ *
+ * In the open-loop, latency counts from when a request was due rather than from when it went out,
+ * so that a server falling behind shows in the percentiles instead of slowing the load down
+ * (coordinated omission). In the closed-loop, either is the same.
+ *
+ * @param {LoadOptions} options
+ * @param {function(number, number):void} [onProgress] called every second with the requests sent and done so far
+ * @returns {Promise<LoadReport>}
+ */
+async function runLoad(options, onProgress = () => {}) {
+  const random = randomOf(options.seed);
+  const lengths = parseLengths(options.textLength);
+  const voices = options.voices ? parseVoices(options.voices) : null;
+  const base = options.url.replace(/\/+$/, '');
+  const agent = new http.Agent({ keepAlive: true, maxSockets: Infinity });
+
+  /** @type {LoadReport} */
+  const report = {
+    options,
+    elapsedMsec: 0,
+    requests: 0,
+    succeeded: 0,
+    errors: {},
+    bytes: 0,
+    latency: new HdrHistogram(),
+    ttfb: new HdrHistogram(),
+  };
+
+  const nextUrl = () => {
+    const range = pick(lengths, random);
+    const length =
+      range.min + Math.floor(random() * (range.max - range.min + 1));
+    const params = new URLSearchParams({ text: textOf(length, random) });
+    if (voices) {
+      params.set('name', pick(voices, random).name);
+    }
+    if (options.stream !== null && options.stream !== undefined) {
+      params.set('stream', options.stream ? 'true' : 'false');
+    }
+    return `${base}/${options.endpoint}?${params}`;
+  };
+
+  let done = 0;
+  const fire = async dueAt => {
+    report.requests += 1;
+    const result = await send(nextUrl(), agent, options.timeout);
+    done += 1;
+    if (result.error) {
+      report.errors[result.error] = (report.errors[result.error] || 0) + 1;
+      return;
+    }
+    report.succeeded += 1;
+    report.bytes += result.bytes;
+    report.latency.record(result.endAt - dueAt);
+    report.ttfb.record((result.ttfbAt || result.endAt) - dueAt);
+  };
+
+  const startedAt = nowUsec();
+  const durationUsec = options.duration * 1e6;
+  const progress = setInterval(() => onProgress(report.requests, done), 1000);
+  try {
+    if (options.mode === 'open') {
+      const interval = 1e6 / options.rate;
+      const inFlight = [];
+      let sent = 0;
+      await new Promise(resolve => {
+        const tick = () => {
+          const now = nowUsec() - startedAt;
+          while (sent * interval <= now && sent * interval < durationUsec) {
+            inFlight.push(fire(startedAt + sent * interval));
+            sent += 1;
+          }
+          if (sent * interval >= durationUsec) {
+            resolve();
+            return;
+          }
+          setTimeout(tick, Math.max(0, (sent * interval - now) / 1000));
+        };
+        tick();
+      });
+      await Promise.all(inFlight);
+    } else {
+      const worker = async () => {
+        while (nowUsec() - startedAt < durationUsec) {
+          await fire(nowUsec());
+        }
+      };
+      await Promise.all(Array.from({ length: options.concurrency }, worker));
+    }
+  } finally {
+    clearInterval(progress);
+    agent.destroy();
+  }
+  report.elapsedMsec = (nowUsec() - startedAt) / 1000;
+  return report;
+}
+
+/**
+ * @param {HdrHistogram} histogram of usec
+ * @returns {{ p50: number, p90: number, p99: number, p999: number, max: number, mean: number }} in msec
+ */
+function percentilesOf(histogram) {
+  const msec = usec => Math.round(usec) / 1000;
+  return {
+    p50: msec(histogram.valueAtPercentile(50)),
+    p90: msec(histogram.valueAtPercentile(90)),
+    p99: msec(histogram.valueAtPercentile(99)),
+    p999: msec(histogram.valueAtPercentile(99.9)),
+    max: msec(histogram.max),
+    mean: msec(histogram.mean()),
+  };
+}
+
+/**
+ * The numbers of a report, as they go out as JSON.
+ *
+ * @param {LoadReport} report
+ * @returns {object}
+ */
+function summaryOf(report) {
+  const seconds = report.elapsedMsec / 1000;
+  const failed = report.requests - report.succeeded;
+  return {
+    options: report.options,
+    elapsedMsec: Math.round(report.elapsedMsec),
+    requests: report.requests,
+    succeeded: report.succeeded,
+    failed,
+    errorRate: report.requests > 0 ? failed / report.requests : 0,
+    errors: report.errors,
+    requestsPerSecond: seconds > 0 ? report.succeeded / seconds : 0,
+    bytesPerSecond: seconds > 0 ? report.bytes / seconds : 0,
+    latencyMsec: percentilesOf(report.latency),
+    ttfbMsec: percentilesOf(report.ttfb),
+  };
+}
+
+/**
+ * @param {LoadReport} report
+ * @returns {string} the report as a human reads it
+ */
+function formatReport(report) {
+  const s = summaryOf(report);
+  const o = report.options;
+  const load =
+    o.mode === 'open'
+      ? `open-loop at ${o.rate} req/s`
+      : `closed-loop with ${o.concurrency} in flight`;
+  const row = (label, p) =>
+    `${label.padEnd(9)}` +
+    ['p50', 'p90', 'p99', 'p999', 'max', 'mean']
+      .map(k => `${k} ${p[k].toFixed(1).padStart(8)}`)
+      .join('  ');
+  const lines = [
+    `${o.endpoint}, ${load} for ${o.duration}s, ${s.elapsedMsec}ms in all`,
+    `requests ${s.requests}, succeeded ${s.succeeded}, failed ${s.failed} ` +
+      `(${(s.errorRate * 100).toFixed(2)}%)`,
+    ...Object.keys(s.errors).map(e => `  ${e}: ${s.errors[e]}`),
+    `throughput ${s.requestsPerSecond.toFixed(2)} req/s, ` +
+      `${(s.bytesPerSecond / 1048576).toFixed(2)} MiB/s`,
+    'msec',
+    row('latency', s.latencyMsec),
+    row('ttfb', s.ttfbMsec),
+  ];
+  return lines.join('\n');
+}
+
+module.exports = {
+  runLoad,
+  summaryOf,
+  formatReport,
+  parseLengths,
+  parseVoices,
+};
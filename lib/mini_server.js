@@ -1,13 +1,22 @@
 const http = require('http');
 const semver = require('semver');
+const CancelHandle = require('./cancel_handle');
+const Ebyroid = require('./ebyroid');
+const { PROSODY_RANGES, prosodyError } = require('./prosody');
+const { prometheusText } = require('./prometheus');
+const WaveObject = require('./wave_object');
 
-/** @typedef {import('./wave_object')} WaveObject */
-/** @typedef {import('./ebyroid')} Ebyroid */
+/** @typedef {import('./prosody').Prosody} Prosody */
+
+/** @typedef {import('./opus_object')} OpusObject */
 
 function unused(...x) {
   return x;
 }
 
+// the largest body of POST /batch
+const MAX_BATCH_BYTES = 1 << 20;
+
 /**
  * @param {http.ServerResponse} res
  * @param {number} code
@@ -86,6 +95,165 @@ function ok(res) {
   res.end();
 }
 
+/**
+ * @param {WaveObject} pcm
+ * @returns {Buffer} a view of the PCM bytes (no copy)
+ */
+function bytesOf(pcm) {
+  return Buffer.from(pcm.data.buffer, pcm.data.byteOffset, pcm.data.byteLength);
+}
+
+/**
+ * @param {WaveObject} pcm
+ * @returns {object} the extra headers of /audiostream
+ */
+function pcmHeaders(pcm) {
+  return {
+    'Ebyroid-PCM-Sample-Rate': pcm.sampleRate,
+    'Ebyroid-PCM-Bit-Depth': pcm.bitDepth,
+    'Ebyroid-PCM-Number-Of-Channels': pcm.numChannels,
+  };
+}
+
+/**
+ * @param {http.ServerResponse} res
+ * @returns {CancelHandle} a handle that gets cancelled when the client goes away before the response is done
+ */
+function cancelOnClose(res) {
+  const handle = new CancelHandle();
+  res.on('close', () => {
+    if (!res.writableFinished) {
+      handle.cancel();
+    }
+  });
+  return handle;
+}
+
+/**
+ * @this MiniServer
+ * @param {URLSearchParams} params
+ * @returns {boolean} true if the response should be streamed as it is rendered
+ */
+function wantsStream(params) {
+  const stream = params.get('stream');
+  if (stream === null) {
+    return this.streaming;
+  }
+  return stream === '1' || stream === 'true';
+}
+
+/**
+ * @param {URLSearchParams} params
+ * @returns {Prosody} what of the prosody is given in the query, e.g. `?speed=1.2&pitch=0.9`
+ */
+function prosodyOf(params) {
+  const prosody = {};
+  for (const key of Object.keys(PROSODY_RANGES)) {
+    const value = params.get(key);
+    if (value !== null) {
+      prosody[key] = value === '' ? NaN : Number(value);
+    }
+  }
+  return prosody;
+}
+
+/**
+ * Settles once `res` has flushed what it has buffered, or is closed.
+ *
+ * @param {http.ServerResponse} res
+ * @returns {Promise<void>}
+ */
+function drained(res) {
+  return new Promise(resolve => {
+    const done = () => {
+      res.off('drain', done);
+      res.off('close', done);
+      resolve();
+    };
+    res.on('drain', done);
+    res.on('close', done);
+  });
+}
+
+/**
+ * Send PCM with chunked transfer encoding while it is still being rendered.
+ * The status line goes out with the first chunk, so a failure before that is still a proper 500.
+ *
+ * @this MiniServer
+ * @param {http.ServerResponse} res
+ * @param {string} text
+ * @param {string?} name
+ * @param {Prosody} prosody
+ * @param {function(WaveObject):object} headersFor builds the response headers from the first chunk
+ * @param {function(WaveObject):Buffer} [preambleFor] builds the bytes to send ahead of PCM
+ */
+async function streamAudioF(
+  res,
+  text,
+  name,
+  prosody,
+  headersFor,
+  preambleFor = null
+) {
+  let started = false;
+  const start = pcm => {
+    started = true;
+    const headers = headersFor(pcm);
+    headers['Transfer-Encoding'] = 'chunked';
+    res.writeHead(200, headers);
+    if (preambleFor) {
+      res.write(preambleFor(pcm));
+    }
+  };
+
+  /** @param {WaveObject} pcm */
+  const onChunk = pcm => {
+    if (!res.socket || res.socket.destroyed) {
+      // the client has gone away, there is no one to send the rest to
+      return;
+    }
+    if (!started) {
+      start(pcm);
+    }
+    if (!res.write(bytesOf(pcm))) {
+      // the client is behind, no more is rendered until the socket has caught up
+      return drained(res);
+    }
+  };
+
+  const cancel = cancelOnClose(res);
+  try {
+    if (name && name !== this.defaultName) {
+      await this.ebyroid.convertExStream(text, name, onChunk, {
+        cancel,
+        prosody,
+      });
+    } else {
+      await this.ebyroid.convertStream(text, onChunk, { cancel, prosody });
+    }
+  } catch (e) {
+    if (cancel.cancelled) {
+      // nobody to tell
+      return Promise.resolve();
+    }
+    if (!started) {
+      return error500(res, e.code, e.message);
+    }
+    // too late to change the status, cut the body short so that the client notices
+    res.destroy(e);
+    return Promise.resolve();
+  }
+
+  if (!started) {
+    const vr = name ? this.ebyroid.voiceroids.get(name) : this.ebyroid.using;
+    start(
+      new WaveObject(new Int16Array(0), vr.outputSampleRate, vr.outputChannels)
+    );
+  }
+  res.end();
+  return Promise.resolve();
+}
+
 /**
  * @this MiniServer
  * @param {http.IncomingMessage} req
@@ -98,27 +266,83 @@ async function onGetAudioStreamF(req, res, params) {
   if (!text) {
     return error4x(res, 400, 'text was not given');
   }
+  const prosody = prosodyOf(params);
+  const prosodyErrorMessage = prosodyError(prosody);
+  if (prosodyErrorMessage) {
+    return error4x(res, 400, prosodyErrorMessage);
+  }
+  if (wantsStream.call(this, params)) {
+    const headersFor = pcm => ({
+      'Content-Type': 'application/octet-stream',
+      ...pcmHeaders(pcm),
+    });
+    return streamAudioF.call(
+      this,
+      res,
+      text,
+      params.get('name'),
+      prosody,
+      headersFor
+    );
+  }
+  const cancel = cancelOnClose(res);
   try {
     /** @type {WaveObject} */ let pcm;
     const name = params.get('name');
     if (name && name !== this.defaultName) {
-      pcm = await this.ebyroid.convertEx(text, name);
+      pcm = await this.ebyroid.convertEx(text, name, { cancel, prosody });
     } else {
-      pcm = await this.ebyroid.convert(text);
+      pcm = await this.ebyroid.convert(text, { cancel, prosody });
     }
-    const buffer = Buffer.from(pcm.data.buffer);
+    const buffer = bytesOf(pcm);
     const headers = {
       'Content-Type': 'application/octet-stream',
       'Content-Length': buffer.byteLength,
-      'Ebyroid-PCM-Sample-Rate': pcm.sampleRate,
-      'Ebyroid-PCM-Bit-Depth': pcm.bitDepth,
-      'Ebyroid-PCM-Number-Of-Channels': pcm.numChannels,
+      ...pcmHeaders(pcm),
     };
     res.writeHead(200, headers);
     res.write(buffer);
     res.end();
     return Promise.resolve();
   } catch (e) {
+    if (cancel.cancelled) {
+      return Promise.resolve();
+    }
+    return error500(res, e.code, e.message);
+  }
+}
+
+/**
+ * Send the audio as an Ogg/Opus file, which is encoded natively once it is rendered in whole.
+ *
+ * @this MiniServer
+ * @param {http.ServerResponse} res
+ * @param {string} text
+ * @param {string?} name
+ * @param {Prosody} prosody
+ */
+async function sendOggF(res, text, name, prosody) {
+  const cancel = cancelOnClose(res);
+  const options = { cancel, prosody, codec: 'ogg' };
+  try {
+    /** @type {OpusObject} */ let opus;
+    if (name && name !== this.defaultName) {
+      opus = await this.ebyroid.convertEx(text, name, options);
+    } else {
+      opus = await this.ebyroid.convert(text, options);
+    }
+    const headers = {
+      'Content-Type': opus.mimeType(),
+      'Content-Length': opus.data.byteLength,
+    };
+    res.writeHead(200, headers);
+    res.write(opus.data);
+    res.end();
+    return Promise.resolve();
+  } catch (e) {
+    if (cancel.cancelled) {
+      return Promise.resolve();
+    }
     return error500(res, e.code, e.message);
   }
 }
@@ -129,7 +353,8 @@ async function onGetAudioStreamF(req, res, params) {
  * @param {URLSearchParams} params
  */
 async function onGetAudioFileF(req, res, params) {
-  if (killWrongSFD(req, res, 'audio/wav')) {
+  const codec = params.get('codec');
+  if (killWrongSFD(req, res, codec === 'opus' ? 'audio/ogg' : 'audio/wav')) {
     return Promise.resolve();
   }
 
@@ -137,28 +362,215 @@ async function onGetAudioFileF(req, res, params) {
   if (!text) {
     return error4x(res, 400, 'text was not given');
   }
+  const prosody = prosodyOf(params);
+  const prosodyErrorMessage = prosodyError(prosody);
+  if (prosodyErrorMessage) {
+    return error4x(res, 400, prosodyErrorMessage);
+  }
+  if (codec !== null) {
+    if (codec !== 'opus') {
+      return error4x(res, 400, 'codec must be opus');
+    }
+    if (!Ebyroid.opusSupported) {
+      return error4x(res, 400, 'this server has no Opus encoder');
+    }
+    // Opus takes the whole of the audio, so it is never streamed
+    return sendOggF.call(this, res, text, params.get('name'), prosody);
+  }
+  if (wantsStream.call(this, params)) {
+    const headersFor = () => ({ 'Content-Type': 'audio/wav' });
+    const preambleFor = pcm =>
+      WaveObject.streamingWaveFileHeader(
+        pcm.sampleRate,
+        pcm.numChannels,
+        pcm.sampleFormat
+      );
+    return streamAudioF.call(
+      this,
+      res,
+      text,
+      params.get('name'),
+      prosody,
+      headersFor,
+      preambleFor
+    );
+  }
+  const cancel = cancelOnClose(res);
   try {
     /** @type {WaveObject} */ let pcm;
     const name = params.get('name');
     if (name && name !== this.defaultName) {
-      pcm = await this.ebyroid.convertEx(text, name);
+      pcm = await this.ebyroid.convertEx(text, name, { cancel, prosody });
     } else {
-      pcm = await this.ebyroid.convert(text);
+      pcm = await this.ebyroid.convert(text, { cancel, prosody });
     }
-    const dataBuffer = Buffer.from(pcm.data.buffer);
+    const dataBuffer = bytesOf(pcm);
     const headerBuffer = pcm.waveFileHeader();
-    const waveBuffer = Buffer.concat([headerBuffer, dataBuffer]);
     const headers = {
       'Content-Type': 'audio/wav',
-      'Content-Length': waveBuffer.byteLength,
+      'Content-Length': headerBuffer.byteLength + dataBuffer.byteLength,
     };
     res.writeHead(200, headers);
-    res.write(waveBuffer);
+    res.write(headerBuffer);
+    res.write(dataBuffer);
     res.end();
     return Promise.resolve();
   } catch (e) {
+    if (cancel.cancelled) {
+      return Promise.resolve();
+    }
+    return error500(res, e.code, e.message);
+  }
+}
+
+/**
+ * @param {http.IncomingMessage} req
+ * @param {number} limit
+ * @returns {Promise<string|null|undefined>} the body in utf-8, null if it is larger than `limit` bytes, or undefined if the client broke the request off
+ */
+function readBody(req, limit) {
+  return new Promise(resolve => {
+    const chunks = [];
+    let size = 0;
+    req.on('data', chunk => {
+      size += chunk.length;
+      if (size <= limit) {
+        chunks.push(chunk);
+      }
+    });
+    req.on('end', () =>
+      resolve(size > limit ? null : Buffer.concat(chunks).toString('utf8'))
+    );
+    req.on('aborted', () => resolve(undefined));
+    req.on('error', () => resolve(undefined));
+  });
+}
+
+/**
+ * @param {string} body NDJSON, a `{"text": string, "name"?: string}` on each line
+ * @returns {({text: string, name: string?}[]|string)} the items in order, or what is wrong with them
+ */
+function batchItemsOf(body) {
+  const items = [];
+  const lines = body.split('\n');
+  for (let i = 0; i < lines.length; i++) {
+    if (lines[i].trim() === '') {
+      continue;
+    }
+    let item;
+    try {
+      item = JSON.parse(lines[i]);
+    } catch (e) {
+      return `line ${i + 1} is not JSON`;
+    }
+    if (
+      item === null ||
+      typeof item.text !== 'string' ||
+      item.text === '' ||
+      item.text.includes('\0') ||
+      (item.name !== undefined && typeof item.name !== 'string')
+    ) {
+      return `line ${i + 1} must have a text, and may have a name`;
+    }
+    items.push({ text: item.text, name: item.name || null });
+  }
+  if (items.length === 0) {
+    return 'no texts were given';
+  }
+  return items;
+}
+
+/**
+ * Render every line of the body, grouped into one batch for each voiceroid, and answer with a line for each in order.
+ *
+ * @this MiniServer
+ * @param {http.IncomingMessage} req
+ * @param {http.ServerResponse} res
+ * @param {URLSearchParams} params
+ */
+async function onPostBatchF(req, res, params) {
+  const body = await readBody(req, MAX_BATCH_BYTES);
+  if (body === undefined) {
+    // there is no one to answer
+    res.destroy();
+    return Promise.resolve();
+  }
+  if (body === null) {
+    return error4x(res, 413, 'the batch is too large');
+  }
+  const items = batchItemsOf(body);
+  if (typeof items === 'string') {
+    return error4x(res, 400, items);
+  }
+  const prosody = prosodyOf(params);
+  const prosodyErrorMessage = prosodyError(prosody);
+  if (prosodyErrorMessage) {
+    return error4x(res, 400, prosodyErrorMessage);
+  }
+
+  // indices of the items by the voiceroid to use
+  const groups = new Map();
+  const fallbackName = params.get('name') || this.defaultName;
+  items.forEach((item, index) => {
+    const name = item.name || fallbackName;
+    if (!groups.has(name)) {
+      groups.set(name, []);
+    }
+    groups.get(name).push(index);
+  });
+  for (const name of groups.keys()) {
+    if (!this.ebyroid.voiceroids.has(name)) {
+      return error4x(res, 400, `no voiceroid is named ${name}`);
+    }
+  }
+
+  const cancel = cancelOnClose(res);
+  const options = { cancel, prosody };
+  /** @type {WaveObject[]} */ const pcms = new Array(items.length);
+  try {
+    // the batches of different voiceroids run side by side
+    await Promise.all(
+      Array.from(groups, async ([name, indices]) => {
+        const texts = indices.map(index => items[index].text);
+        const results =
+          name === this.defaultName
+            ? await this.ebyroid.convertBatch(texts, options)
+            : await this.ebyroid.convertBatchEx(texts, name, options);
+        results.forEach((pcm, i) => {
+          pcms[indices[i]] = pcm;
+        });
+      })
+    );
+  } catch (e) {
+    if (cancel.cancelled) {
+      return Promise.resolve();
+    }
+    // nothing is to come of the other batches
+    cancel.cancel();
     return error500(res, e.code, e.message);
   }
+
+  res.writeHead(200, { 'Content-Type': 'application/x-ndjson' });
+  for (const pcm of pcms) {
+    const wav = Buffer.concat([pcm.waveFileHeader(), bytesOf(pcm)]);
+    res.write(`${JSON.stringify({ wav: wav.toString('base64') })}\n`);
+  }
+  res.end();
+  return Promise.resolve();
+}
+
+/**
+ * @this MiniServer
+ * @param {http.ServerResponse} res
+ */
+function onGetMetricsF(res) {
+  const text = prometheusText(this.ebyroid);
+  const headers = {
+    'Content-Type': 'text/plain; version=0.0.4; charset=utf-8',
+    'Content-Length': Buffer.byteLength(text),
+  };
+  res.writeHead(200, headers);
+  res.end(text);
 }
 
 /**
@@ -167,7 +579,7 @@ async function onGetAudioFileF(req, res, params) {
  * @param {http.ServerResponse} res
  */
 async function onRequestF(req, res) {
-  if (req.method !== 'GET') {
+  if (req.method !== 'GET' && req.method !== 'POST') {
     return error4x(res, 400, 'bad request');
   }
 
@@ -177,6 +589,13 @@ async function onRequestF(req, res) {
   }
 
   const pathname = url.pathname.slice(this.basePath.length);
+  if (req.method === 'POST') {
+    // the only route that takes a body
+    if (pathname !== '/batch') {
+      return error4x(res, 404, 'not found');
+    }
+    return onPostBatchF.call(this, req, res, url.searchParams);
+  }
   switch (pathname) {
     case '':
     case '/':
@@ -185,6 +604,8 @@ async function onRequestF(req, res) {
       return onGetAudioStreamF.call(this, req, res, url.searchParams);
     case '/audiofile':
       return onGetAudioFileF.call(this, req, res, url.searchParams);
+    case '/metrics':
+      return onGetMetricsF.call(this, res);
     default:
       return error4x(res, 404, 'not found');
   }
@@ -197,10 +618,12 @@ class MiniServer {
   /**
    * @param {Ebyroid} ebyroid
    * @param {number} maxHeaderSize requires Node v13.3.0 or higher
+   * @param {boolean} streaming whether audio is streamed by default while it is rendered (overridden by `?stream=`)
    */
-  constructor(ebyroid, maxHeaderSize = 65536) {
+  constructor(ebyroid, maxHeaderSize = 65536, streaming = false) {
     this.ebyroid = ebyroid;
     this.basePath = '/api/v1';
+    this.streaming = streaming;
 
     let options = {};
     if (semver.gte(process.version, '13.3.0')) {
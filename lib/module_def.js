@@ -8,37 +8,221 @@
 /**
  * @typedef NativeOptions
  * @type {object}
- * @property {boolean} needs_reload determines if native addon needs to reload the VOICEROID library
+ * @property {boolean} needs_reload makes native addon throw away the resident engine of the voice and load it afresh
  * @property {string?} base_dir a path in which VOICEROID is installed
- * @property {string?} voice a directory name where the voice library files are at
- * @property {number?} volume desired output volume ranged from 0.0 to 5.0
+ * @property {string?} voice a directory name where the voice library files are at. the engine of this voice does the job, which gets loaded if not resident yet. without it the job goes to the engine used last
+ * @property {number?} volume gain from 0.0 to 5.0 applied to the PCM, which engines render at unity gain. defaults to 1.0
+ * @property {(0|1|2)?} normalize 1 or 2 to work out the gain from the peak or RMS level of the PCM instead, so that it meets `target_level`. 0 (default) does not. not for streams
+ * @property {number?} target_level the level in dBFS, 0 or below, that `normalize` aims for
+ * @property {number?} speed how fast the voice speaks in the job (0.5 to 4.0) in place of its own setting, as do the following
+ * @property {number?} pitch how high the voice is (0.5 to 2.0)
+ * @property {number?} range how much the pitch moves (0.0 to 2.0)
+ * @property {number?} pause_middle msec of the short pause (0 to 10000)
+ * @property {number?} pause_long msec of the long pause (0 to 10000)
+ * @property {number?} pause_sentence msec of the pause at the end of a sentence (0 to 10000)
+ * @property {number?} sample_rate the rate (Hz) that convert jobs resample their output to, unless it is 0 (default) or the engine's own
+ * @property {(0|1|2|3)?} format the sample format that PCM is handed over in: 0 for s16 (default), 1 for f32, 2 for s24 (packed into 3 bytes) and 3 for s32. converted on the worker thread
+ * @property {(1|2)?} channels 2 for interleaved stereo, the mono output of the engine on both channels. defaults to 1
+ * @property {(0|1|2)?} codec what convert encodes its whole output into on the worker thread: 0 for none (default), 1 for Opus packets and 2 for Ogg/Opus. needs `opus` of the module, s16 at a `sample_rate` of 48000, and no stream
+ * @property {number?} bitrate bits per second of the Opus encoder. defaults to 64000
+ * @property {(0|1|2)?} priority 0 for high, 1 for normal (default) and 2 for low. a job waiting in the queue goes ahead of the ones of lower priority
+ * @property {number?} timeout msec from now within which the job has to be done, or else it fails with an error of code `EBYROID_DEADLINE_EXCEEDED`
+ */
+
+/**
+ * PCM in the `format` of the NativeOptions: Int16Array for s16, Float32Array for f32, Uint8Array for s24 and Int32Array for s32.
+ *
+ * @typedef {(Int16Array|Float32Array|Uint8Array|Int32Array)} PcmArray
+ */
+
+/**
+ * @typedef NativeInitOptions
+ * @type {object}
+ * @property {number} [maxEngines=0] how many engines may be resident at once, 0 for no limit
+ * @property {number} [workers=4] how many threads run jobs
+ * @property {number} [queueCapacity=64] how many jobs of each priority may wait per engine. beyond that jobs fail with an error of code `EBYROID_QUEUE_FULL`
+ * @property {number} [cacheBytes=0] how many bytes the cache of convert results may hold, 0 for no cache
+ * @property {number} [maxSegmentBytes=0] input of convert longer than this is split at sentence boundaries into segments that run as jobs of their own and get joined back. 0 never splits
+ * @property {number} [kanaCacheSize=0] with a positive number, convert runs in two stages (text to AI Kana, then to wave) and caches that many results of the first. 0 converts in one go
+ * @property {number} [engineHosts=0] with a positive number, engines run in processes of their own (`hostPath`), that many for every voice, rather than in this one. 0 runs them in this one
+ * @property {string} [hostPath] the ebyroid_host executable, which `engineHosts` needs
+ */
+
+/**
+ * How long each stage of loading a voice library took, in msec. Libraries load side by side except for the library file and the language, which wait for each other,
+ * and `totalMsec` includes that waiting while the stages do not.
+ *
+ * @typedef LoadTimings
+ * @type {object}
+ * @property {boolean} loaded false if the library was loaded already, in which case the rest is all 0
+ * @property {number} libraryMsec copying the library file if need be, and loading it
+ * @property {number} initMsec _AITalkAPI_Init
+ * @property {number} langLoadMsec _AITalkAPI_LangLoad
+ * @property {number} voiceLoadMsec _AITalkAPI_VoiceLoad
+ * @property {number} paramMsec _AITalkAPI_GetParam and SetParam
+ * @property {number} totalMsec all of it
+ */
+
+/**
+ * @typedef CacheStats
+ * @type {object}
+ * @property {number} hits lookups that found PCM
+ * @property {number} misses lookups that did not
+ * @property {number} entries how many results are cached
+ * @property {number} bytes how many bytes they take, keys included
+ * @property {number} budget how many bytes they may take
+ */
+
+/**
+ * @typedef StageStats
+ * @type {object}
+ * @property {number} kanaJobs how many text to AI Kana jobs (language analysis) have been done
+ * @property {number} kanaMsec how long in total they took on the engines
+ * @property {number} waveJobs how many AI Kana to wave jobs (synthesis) have been done
+ * @property {number} waveMsec how long in total they took on the engines
+ * @property {number} plainJobs how many text to wave jobs (both in one go) have been done
+ * @property {number} plainMsec how long in total they took on the engines
+ * @property {number} kanaHits two-stage conversions that found their AI Kana in the cache
+ * @property {number} kanaMisses two-stage conversions that had to analyze the text
+ */
+
+/**
+ * Counts of observations in fixed buckets.
+ *
+ * @typedef Histogram
+ * @type {object}
+ * @property {number[]} bounds the inclusive upper bound of each bucket, ascending
+ * @property {number[]} counts observations per bucket (not cumulative), with one more at the end for those above all bounds
+ * @property {number} sum of all observations
+ * @property {number} count of all observations
+ */
+
+/**
+ * @typedef JobStats
+ * @type {object}
+ * @property {number} inFlight jobs not finished yet
+ * @property {number} queued jobs waiting for a worker
+ * @property {number} succeeded
+ * @property {number} failed
+ * @property {number} cancelled
+ * @property {number} deadlineExceeded
+ * @property {number} rejected jobs turned away as the queue was full
+ */
+
+/**
+ * @typedef VoiceLoadStats
+ * @type {object}
+ * @property {string} baseDir
+ * @property {string} voice
+ * @property {number} loads how many times the voice library has been loaded
+ * @property {number} reloads how many of them loaded it again, after an eviction or `needs_reload`
+ * @property {number} msec how long they took in total
+ */
+
+/**
+ * @typedef NativeStats
+ * @type {object}
+ * @property {JobStats} jobs
+ * @property {Object<string, number>} errors failures by the name of the result code the engine returned, e.g. `ERR_TOO_MANY_JOBS`
+ * @property {Histogram} queueWaitMsec how long jobs waited in the queue for a worker
+ * @property {{ kana: Histogram, wave: Histogram, plain: Histogram }} engineMsec engine time of jobs by stage, see StageStats
+ * @property {Histogram} chunksPerJob how many times the engine handed over PCM per job
+ * @property {Histogram} chunkBytes how many bytes of PCM the engine handed over each time
+ * @property {number} outputBytes bytes of audio handed over to JS
+ * @property {Histogram} copyMsec time spent turning engine PCM into the output asked for
+ * @property {Histogram} loadMsec how long loading a voice library took
+ * @property {number} hostRestarts how many engine hosts have been started in place of one that exited, see `engineHosts`
+ * @property {VoiceLoadStats[]} loads
  */
 
 /**
  * Native ebyroid module's type interface.
  */
 class NativeModule {
+  /**
+   * whether the module was built with libopus, which the `codec` option needs
+   *
+   * @type {boolean}
+   */
+  get opus() {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * call init, loading the first engine on the main thread. throws an error of code `EBYROID_INIT_FAILED` if it cannot be loaded.
+   * may be called again to load another engine, but only the first call takes the options
+   *
+   * @param {string} baseDir a path in which VOICEROID is installed
+   * @param {string} voice a directory name where the voice library files are at
+   * @param {NativeInitOptions} [options={}] settings of the engine pool and the job queue
+   * @abstract
+   */
+  init(baseDir, voice, options) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * call init, loading the engines off the main thread and side by side
+   *
+   * @param {{ baseDir: string, voice: string }[]} voices engines to load
+   * @param {NativeInitOptions} options settings of the engine pool and the job queue, which only the first call takes
+   * @param {function(Error,LoadTimings[]):void} callback result is how long loading each engine took, in the order of `voices`. if any of them fails to load, the error has the code `EBYROID_INIT_FAILED`, and the rest stay loaded
+   * @abstract
+   */
+  initAsync(voices, options, callback) {
+    throw new Error('not implemented');
+  }
+
   /**
    * call convert
    *
    * @param {Buffer} input ShiftJIS bytecodes
-   * @param {NativeOptions} options options to determine whether to reload or not
-   * @param {function(Error,Int16Array):void} callback result is an array of 16bit PCM data
+   * @param {NativeOptions} options options to determine which engine to use
+   * @param {function(Error,(PcmArray|Buffer),Uint32Array=):void} callback result is an array of PCM data, or a buffer of the encoded bytes with a `codec`. for Opus packets, the third argument tells where each of them ends in the buffer
+   * @returns {number} the job id
    * @abstract
    */
   convert(input, options, callback) {
     throw new Error('not implemented');
   }
 
+  /**
+   * call convert, streaming PCM out as the engine produces it
+   *
+   * @param {Buffer} input ShiftJIS bytecodes
+   * @param {NativeOptions} options options to determine which engine to use
+   * @param {function(PcmArray):void} onChunk called with each chunk of PCM data in order. see {@link pause} for consumers that fall behind
+   * @param {function(Error,number):void} callback result is the total number of samples streamed
+   * @returns {number} the job id
+   * @abstract
+   */
+  convertStream(input, options, onChunk, callback) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * call convert for each of the inputs as one job, which runs them on the engine one after another
+   *
+   * @param {Buffer[]} inputs ShiftJIS bytecodes, none of which may have a NUL
+   * @param {NativeOptions} options options to determine which engine to use, but for `codec`
+   * @param {function(Error,PcmArray,Uint32Array):void} callback result is an array of the PCM data of all the inputs in order, and where each of them ends in it
+   * @returns {number} the job id
+   * @abstract
+   */
+  convertBatch(inputs, options, callback) {
+    throw new Error('not implemented');
+  }
+
   /**
    * call reinterpret
    *
    * @param {Buffer} input ShiftJIS bytecodes
-   * @param {object} dummy the passing value should always be `{}`
+   * @param {NativeOptions} options options to determine which engine to use, which may be `{}`
    * @param {function(Error,Buffer)} callback result is a buffer of ShiftJIS bytecodes of AI Kana
+   * @returns {number} the job id
    * @abstract
    */
-  reinterpret(input, dummy, callback) {
+  reinterpret(input, options, callback) {
     throw new Error('not implemented');
   }
 
@@ -46,11 +230,126 @@ class NativeModule {
    * call speech
    *
    * @param {Buffer} input ShiftJIS bytecodes of AI Kana
-   * @param {object} dummy the passing value should always be `{}`
-   * @param {function(Error,Int16Array)} callback result is an array of 16bit PCM data
+   * @param {NativeOptions} options options to determine which engine to use, which may be `{}`
+   * @param {function(Error,PcmArray)} callback result is an array of PCM data
+   * @returns {number} the job id
+   * @abstract
+   */
+  speech(input, options, callback) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * call speech, streaming PCM out as the engine produces it
+   *
+   * @param {Buffer} input ShiftJIS bytecodes of AI Kana
+   * @param {NativeOptions} options options to determine which engine to use, which may be `{}`
+   * @param {function(PcmArray):void} onChunk called with each chunk of PCM data in order. see {@link pause} for consumers that fall behind
+   * @param {function(Error,number):void} callback result is the total number of samples streamed
+   * @returns {number} the job id
+   * @abstract
+   */
+  speechStream(input, options, onChunk, callback) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * look up the PCM that convert would produce. only results of convert with a voice
+   * (and not streamed) get cached
+   *
+   * @param {Buffer} input ShiftJIS bytecodes
+   * @param {NativeOptions} options options to determine which engine to use
+   * @returns {PcmArray?} the cached PCM. in s16 mono at unity gain it is shared with the cache and thus not to be modified
+   * @abstract
+   */
+  lookupCache(input, options) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * get statistics of the cache
+   *
+   * @returns {CacheStats}
+   * @abstract
+   */
+  cacheStats() {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * get how much engine time each kind of job has taken
+   *
+   * @returns {StageStats}
+   * @abstract
+   */
+  stageStats() {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * get runtime metrics of jobs, engines and loads. null before init
+   *
+   * @returns {NativeStats?}
+   * @abstract
+   */
+  stats() {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * start recording trace events of every job, keeping up to `eventsPerThread` of the latest events
+   * per native thread. only the first start sets that
+   *
+   * @param {number} [eventsPerThread=65536]
+   * @abstract
+   */
+  traceStart(eventsPerThread) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * stop recording trace events, keeping what has been recorded
+   *
+   * @abstract
+   */
+  traceStop() {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * write what has been recorded since the last traceStart to a file, as Chrome trace-event JSON.
+   * throws an error of code `EBYROID_TRACE_FAILED` if it cannot
+   *
+   * @param {string} path
+   * @returns {number} how many events went in
+   * @abstract
+   */
+  traceFlush(path) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * give up on a job. one still waiting never runs, and one running is aborted.
+   * either way its callback gets an error of code `EBYROID_CANCELLED`
+   *
+   * @param {number} jobId what the call that started the job returned
+   * @returns {boolean} false if the job is not in flight any more
+   * @abstract
+   */
+  cancel(jobId) {
+    throw new Error('not implemented');
+  }
+
+  /**
+   * hold a streaming job up before its next chunk, for a consumer that cannot keep up, or let it
+   * go on. a paused job keeps its engine busy, and is still given up on at its timeout or when cancelled
+   *
+   * @param {number} jobId what the call that started the job returned
+   * @param {boolean} paused whether to hold the job up
+   * @returns {boolean} false if the job is not in flight any more
    * @abstract
    */
-  speech(input, dummy, callback) {
+  pause(jobId, paused) {
     throw new Error('not implemented');
   }
 }
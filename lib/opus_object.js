@@ -0,0 +1,77 @@
+/**
+ * What Opus comes in: `opus` for raw packets one after another, such as Discord voice takes, or `ogg` for an Ogg/Opus file.
+ *
+ * @typedef {("opus"|"ogg")} Codec
+ */
+
+/**
+ * Conversion result object that contains Opus encoded audio instead of PCM.
+ * Opus always plays at 48000Hz, in packets of 20 msec.
+ */
+class OpusObject {
+  /**
+   * @param {Buffer} data the encoded bytes
+   * @param {?Uint32Array} packetEnds where each packet ends in the data, for `opus`
+   * @param {(1|2)} numChannels the number of channels
+   * @param {Codec} codec what the data is in
+   */
+  constructor(data, packetEnds, numChannels, codec) {
+    /**
+     * the encoded bytes. an Ogg/Opus file as is for `ogg`, or the packets back to back for `opus`.
+     * @type {Buffer}
+     */
+    this.data = data;
+    /**
+     * for `opus`, the offset in `data` at which each packet ends (and the next one begins). null for `ogg`.
+     * @type {Uint32Array?}
+     */
+    this.packetEnds = packetEnds;
+    /**
+     * what the data is in.
+     * @type {Codec}
+     */
+    this.codec = codec;
+    /**
+     * the sample-rate that the data decodes to.
+     * @type {48000}
+     */
+    this.sampleRate = 48000;
+    /**
+     * msec of audio in a packet.
+     * @type {20}
+     */
+    this.frameDuration = 20;
+    /**
+     * the number of channels in the data. 1 for Mono, 2 for Stereo.
+     * @type {1|2}
+     */
+    this.numChannels = numChannels;
+  }
+
+  /**
+   * @returns {Buffer[]} each Opus packet in order, which shares memory with `data`. empty for `ogg`
+   * @example
+   * const opus = await ebyroid.convert('こんにちは', { codec: 'opus' });
+   * opus.packets().forEach(packet => voiceConnection.sendPacket(packet));
+   */
+  packets() {
+    if (!this.packetEnds) {
+      return [];
+    }
+    let begin = 0;
+    return Array.from(this.packetEnds, end => {
+      const packet = this.data.subarray(begin, end);
+      begin = end;
+      return packet;
+    });
+  }
+
+  /**
+   * @returns {string} the MIME type of the data
+   */
+  mimeType() {
+    return this.codec === 'ogg' ? 'audio/ogg' : 'audio/opus';
+  }
+}
+
+module.exports = OpusObject;
@@ -0,0 +1,227 @@
+/** @typedef {import("./ebyroid")} Ebyroid */
+/** @typedef {import("./module_def").Histogram} Histogram */
+
+/**
+ * @param {string} value
+ * @returns {string} the value as it goes between the quotes of a label
+ */
+function escapeLabel(value) {
+  return value
+    .replace(/\\/g, '\\\\')
+    .replace(/"/g, '\\"')
+    .replace(/\n/g, '\\n');
+}
+
+/**
+ * @param {object} labels
+ * @returns {string} e.g. `{stage="kana"}`, or an empty string for no labels
+ */
+function labelsOf(labels) {
+  const pairs = Object.keys(labels).map(
+    name => `${name}="${escapeLabel(String(labels[name]))}"`
+  );
+  return pairs.length > 0 ? `{${pairs.join(',')}}` : '';
+}
+
+/**
+ * Builds a page of the Prometheus text exposition format, a family of samples at a time.
+ */
+class Exposition {
+  constructor() {
+    /** @type {string[]} */
+    this.lines = [];
+  }
+
+  /**
+   * @param {string} name
+   * @param {('counter'|'gauge'|'histogram')} type
+   * @param {string} help
+   */
+  family(name, type, help) {
+    this.lines.push(`# HELP ${name} ${help}`, `# TYPE ${name} ${type}`);
+  }
+
+  /**
+   * @param {string} name
+   * @param {number} value
+   * @param {object} [labels={}]
+   */
+  sample(name, value, labels = {}) {
+    this.lines.push(`${name}${labelsOf(labels)} ${value}`);
+  }
+
+  /**
+   * The samples of a histogram, whose family has to be declared beforehand.
+   *
+   * @param {string} name
+   * @param {Histogram} histogram
+   * @param {number} [divisor=1] what the bounds and the sum are divided by, e.g. 1000 for msec to sec
+   * @param {object} [labels={}]
+   */
+  histogram(name, histogram, divisor = 1, labels = {}) {
+    let cumulative = 0;
+    histogram.counts.forEach((count, i) => {
+      cumulative += count;
+      const le =
+        i < histogram.bounds.length ? histogram.bounds[i] / divisor : '+Inf';
+      this.sample(`${name}_bucket`, cumulative, { ...labels, le });
+    });
+    this.sample(`${name}_sum`, histogram.sum / divisor, labels);
+    this.sample(`${name}_count`, cumulative, labels);
+  }
+
+  /**
+   * @returns {string}
+   */
+  toString() {
+    return this.lines.join('\n') + '\n';
+  }
+}
+
+/**
+ * Renders the runtime metrics of the native library, the PCM cache and the scheduler
+ * in the Prometheus text exposition format (version 0.0.4).
+ * Before the native library is initialized there is nothing to render but an empty page.
+ *
+ * @param {Ebyroid} ebyroid
+ * @returns {string}
+ */
+function prometheusText(ebyroid) {
+  const page = new Exposition();
+  const stats = ebyroid.stats();
+  if (!stats) {
+    return page.toString();
+  }
+
+  page.family('ebyroid_jobs_in_flight', 'gauge', 'Jobs not finished yet.');
+  page.sample('ebyroid_jobs_in_flight', stats.jobs.inFlight);
+  page.family('ebyroid_jobs_queued', 'gauge', 'Jobs waiting for a worker.');
+  page.sample('ebyroid_jobs_queued', stats.jobs.queued);
+  page.family(
+    'ebyroid_jobs_total',
+    'counter',
+    'Finished jobs by how they ended.'
+  );
+  page.sample('ebyroid_jobs_total', stats.jobs.succeeded, {
+    outcome: 'succeeded',
+  });
+  page.sample('ebyroid_jobs_total', stats.jobs.failed, { outcome: 'failed' });
+  page.sample('ebyroid_jobs_total', stats.jobs.cancelled, {
+    outcome: 'cancelled',
+  });
+  page.sample('ebyroid_jobs_total', stats.jobs.deadlineExceeded, {
+    outcome: 'deadline_exceeded',
+  });
+  page.sample('ebyroid_jobs_total', stats.jobs.rejected, {
+    outcome: 'rejected',
+  });
+
+  page.family(
+    'ebyroid_engine_errors_total',
+    'counter',
+    'Failures by the result code the engine returned.'
+  );
+  Object.keys(stats.errors).forEach(result => {
+    page.sample('ebyroid_engine_errors_total', stats.errors[result], {
+      result,
+    });
+  });
+
+  page.family(
+    'ebyroid_queue_wait_seconds',
+    'histogram',
+    'Time jobs waited in the queue for a worker.'
+  );
+  page.histogram('ebyroid_queue_wait_seconds', stats.queueWaitMsec, 1000);
+  page.family('ebyroid_engine_seconds', 'histogram', 'Engine time by stage.');
+  Object.keys(stats.engineMsec).forEach(stage => {
+    page.histogram('ebyroid_engine_seconds', stats.engineMsec[stage], 1000, {
+      stage,
+    });
+  });
+  page.family(
+    'ebyroid_chunks_per_job',
+    'histogram',
+    'Chunks of PCM the engine handed over per job.'
+  );
+  page.histogram('ebyroid_chunks_per_job', stats.chunksPerJob);
+  page.family(
+    'ebyroid_chunk_bytes',
+    'histogram',
+    'Bytes of PCM the engine handed over at a time.'
+  );
+  page.histogram('ebyroid_chunk_bytes', stats.chunkBytes);
+  page.family(
+    'ebyroid_output_bytes_total',
+    'counter',
+    'Bytes of audio handed over to JavaScript.'
+  );
+  page.sample('ebyroid_output_bytes_total', stats.outputBytes);
+  page.family(
+    'ebyroid_copy_seconds',
+    'histogram',
+    'Time spent turning engine PCM into the output asked for.'
+  );
+  page.histogram('ebyroid_copy_seconds', stats.copyMsec, 1000);
+
+  page.family(
+    'ebyroid_load_seconds',
+    'histogram',
+    'Time it took to load a voice library.'
+  );
+  page.histogram('ebyroid_load_seconds', stats.loadMsec, 1000);
+  page.family(
+    'ebyroid_host_restarts_total',
+    'counter',
+    'Engine hosts started in place of one that exited.'
+  );
+  page.sample('ebyroid_host_restarts_total', stats.hostRestarts);
+  const voiceFamilies = [
+    ['ebyroid_voice_loads_total', 'Loads of a voice library.', 'loads'],
+    [
+      'ebyroid_voice_reloads_total',
+      'Loads of a voice library that had been loaded before.',
+      'reloads',
+    ],
+  ];
+  voiceFamilies.forEach(([name, help, property]) => {
+    page.family(name, 'counter', help);
+    stats.loads.forEach(load => {
+      page.sample(name, load[property], {
+        base_dir: load.baseDir,
+        voice: load.voice,
+      });
+    });
+  });
+  page.family(
+    'ebyroid_voice_load_seconds_total',
+    'counter',
+    'Time spent loading a voice library.'
+  );
+  stats.loads.forEach(load => {
+    page.sample('ebyroid_voice_load_seconds_total', load.msec / 1000, {
+      base_dir: load.baseDir,
+      voice: load.voice,
+    });
+  });
+
+  const cache = ebyroid.cacheStats();
+  page.family('ebyroid_cache_hits_total', 'counter', 'PCM cache hits.');
+  page.sample('ebyroid_cache_hits_total', cache.hits);
+  page.family('ebyroid_cache_misses_total', 'counter', 'PCM cache misses.');
+  page.sample('ebyroid_cache_misses_total', cache.misses);
+  page.family('ebyroid_cache_bytes', 'gauge', 'Bytes the PCM cache holds.');
+  page.sample('ebyroid_cache_bytes', cache.bytes);
+
+  const reloads = ebyroid.reloadStats();
+  page.family(
+    'ebyroid_scheduler_queued',
+    'gauge',
+    'Requests waiting for their voice library to be swapped in.'
+  );
+  page.sample('ebyroid_scheduler_queued', reloads.queued);
+
+  return page.toString();
+}
+
+module.exports = { prometheusText };
@@ -0,0 +1,66 @@
+/**
+ * How the voice speaks in a request, in place of its own settings in VOICEROID. Anything left out stays as the voice has it.
+ * Changing these costs no reload of the voice library, so every request may have its own.
+ *
+ * @typedef Prosody
+ * @type {object}
+ * @property {number} [speed] how fast the voice speaks, from 0.5 to 4.0.
+ * @property {number} [pitch] how high the voice is, from 0.5 to 2.0.
+ * @property {number} [range] how much the pitch moves (intonation), from 0.0 to 2.0.
+ * @property {number} [pauseMiddle] msec of the short pause at `、` and the like, from 0 to 10000.
+ * @property {number} [pauseLong] msec of the long pause, from 0 to 10000.
+ * @property {number} [pauseSentence] msec of the pause at the end of a sentence, from 0 to 10000.
+ */
+
+/**
+ * What VOICEROID2 takes for each property, along with its name in the native options.
+ *
+ * @type {Object<string, {min: number, max: number, native: string}>}
+ */
+const PROSODY_RANGES = {
+  speed: { min: 0.5, max: 4.0, native: 'speed' },
+  pitch: { min: 0.5, max: 2.0, native: 'pitch' },
+  range: { min: 0.0, max: 2.0, native: 'range' },
+  pauseMiddle: { min: 0, max: 10000, native: 'pause_middle' },
+  pauseLong: { min: 0, max: 10000, native: 'pause_long' },
+  pauseSentence: { min: 0, max: 10000, native: 'pause_sentence' },
+};
+
+/**
+ * @param {Prosody} prosody
+ * @returns {string?} what is wrong with the prosody, or null if nothing
+ */
+function prosodyError(prosody) {
+  if (typeof prosody !== 'object' || prosody === null) {
+    return 'prosody must be an object';
+  }
+  for (const [key, value] of Object.entries(prosody)) {
+    const range = PROSODY_RANGES[key];
+    if (!range) {
+      return `prosody has no such property as "${key}"`;
+    }
+    if (
+      value !== undefined &&
+      !(typeof value === 'number' && value >= range.min && value <= range.max)
+    ) {
+      return `prosody.${key} must range from ${range.min} to ${range.max}`;
+    }
+  }
+  return null;
+}
+
+/**
+ * @param {Prosody} prosody a valid one
+ * @returns {object} the prosody as the native module takes it
+ */
+function nativeProsodyOf(prosody) {
+  const nativeProsody = {};
+  for (const [key, value] of Object.entries(prosody)) {
+    if (value !== undefined) {
+      nativeProsody[PROSODY_RANGES[key].native] = value;
+    }
+  }
+  return nativeProsody;
+}
+
+module.exports = { PROSODY_RANGES, prosodyError, nativeProsodyOf };
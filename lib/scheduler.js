@@ -0,0 +1,342 @@
+const debug = require('debug')('ebyroid');
+const CancelHandle = require('./cancel_handle');
+
+/** @typedef {import("./voiceroid")} Voiceroid */
+
+/**
+ * @typedef Library
+ * @type {object}
+ * @property {string} key
+ * @property {{ resolve: function():void, since: number }[]} queue requests waiting for a turn
+ * @property {number} running jobs handed over to the native library and not finished yet
+ * @property {boolean} resident whether the library is (about to be) loaded in the native library
+ * @property {number} since when the library got resident
+ */
+
+/**
+ * @typedef SchedulerStats
+ * @type {object}
+ * @property {number} loads how many times a voice library has been loaded
+ * @property {number} reloads how many of them loaded a library that had been unloaded before
+ * @property {number} fifoReloads how many reloads serving requests in arrival order would have taken
+ * @property {number} queued requests waiting for a turn right now
+ */
+
+/**
+ * @param {Voiceroid} vr
+ * @returns {string}
+ */
+function libraryKey(vr) {
+  return `${vr.baseDirPath}\n${vr.voiceDirName}`;
+}
+
+/**
+ * Hands out turns to run on the native engines, batching requests by voice library.
+ * A request whose library is resident goes on to the native job queue right away.
+ * Any other request waits until the least recently used library runs dry, or until it has waited for `maxWait` msec
+ * (and that library has been resident for as long), at which point the library stops taking new requests
+ * and gets swapped out as soon as its running ones finish.
+ * That way A, B, A, B traffic takes a load per batch rather than per request, while a minority voice never starves.
+ * The least recently used library is exactly what the native library unloads, so both sides agree on what is resident.
+ */
+class Scheduler {
+  /**
+   * @param {number} maxResident how many libraries may be resident at once, 0 for no limit
+   * @param {number} maxWait msec a request may wait for its library to be swapped in
+   */
+  constructor(maxResident, maxWait) {
+    this.maxResident = maxResident > 0 ? maxResident : Infinity;
+    this.maxWait = maxWait;
+
+    /** @type {Map<string, Library>} */
+    this.libraries = new Map();
+
+    /**
+     * resident libraries, the least recently used first.
+     *
+     * @type {Library[]}
+     */
+    this.resident = [];
+
+    /**
+     * the library being emptied to make room for an overdue one.
+     *
+     * @type {Library?}
+     */
+    this.draining = null;
+
+    /** @type {NodeJS.Timeout?} */
+    this.timer = null;
+
+    /** @type {SchedulerStats} */
+    this.counts = { loads: 0, reloads: 0, fifoReloads: 0 };
+
+    /** @type {Set<string>} libraries loaded at least once */
+    this.everLoaded = new Set();
+
+    /** @type {string[]} what would be resident if requests ran in arrival order */
+    this.fifoResident = [];
+
+    /** @type {Set<string>} libraries loaded at least once if requests ran in arrival order */
+    this.fifoEverLoaded = new Set();
+  }
+
+  /**
+   * Tell that the library is already loaded, as done by the native init.
+   *
+   * @param {Voiceroid} vr
+   */
+  preload(vr) {
+    const lib = this.libraryOf(vr);
+    if (!lib.resident) {
+      this.admit(lib);
+      this.modelFifo(lib.key);
+    }
+  }
+
+  /**
+   * @param {Voiceroid} vr
+   * @returns {boolean} whether the library of the voiceroid is (about to be) loaded
+   */
+  isResident(vr) {
+    return this.libraryOf(vr).resident;
+  }
+
+  /**
+   * @returns {number} how many more libraries may be loaded without unloading any
+   */
+  room() {
+    return this.maxResident - this.resident.length;
+  }
+
+  /**
+   * Wait for a turn to run on the voice library of the given voiceroid.
+   * Every resolved acquire() must be paired with a release().
+   * The wait ends in a rejection if `cancel` is cancelled or `deadline` passes first.
+   *
+   * @param {Voiceroid} vr
+   * @param {CancelHandle?} [cancel=null]
+   * @param {number} [deadline=Infinity] time in msec since the epoch
+   * @returns {Promise<void>}
+   */
+  acquire(vr, cancel = null, deadline = Infinity) {
+    const lib = this.libraryOf(vr);
+    this.modelFifo(lib.key);
+    return new Promise((resolve, reject) => {
+      let timer = null;
+      let stopListening = () => {};
+      const request = {
+        resolve: () => {
+          clearTimeout(timer);
+          stopListening();
+          resolve();
+        },
+        since: Date.now(),
+      };
+      const withdraw = err => {
+        const at = lib.queue.indexOf(request);
+        if (at < 0) {
+          return;
+        }
+        clearTimeout(timer);
+        stopListening();
+        lib.queue.splice(at, 1);
+        reject(err);
+        // whoever was waiting behind may be able to go now
+        this.dispatch();
+      };
+
+      lib.queue.push(request);
+      if (deadline < Infinity) {
+        timer = setTimeout(
+          () => withdraw(CancelHandle.deadlineExceededError()),
+          Math.max(deadline - Date.now(), 0)
+        );
+      }
+      if (cancel) {
+        stopListening = cancel.onCancel(() =>
+          withdraw(CancelHandle.cancelledError())
+        );
+      }
+      this.dispatch();
+    });
+  }
+
+  /**
+   * @param {Voiceroid} vr
+   */
+  release(vr) {
+    const lib = this.libraryOf(vr);
+    lib.running -= 1;
+    this.dispatch();
+  }
+
+  /**
+   * @returns {SchedulerStats}
+   */
+  stats() {
+    let queued = 0;
+    this.libraries.forEach(lib => {
+      queued += lib.queue.length;
+    });
+    return { ...this.counts, queued };
+  }
+
+  /**
+   * @private
+   * @param {Voiceroid} vr
+   * @returns {Library}
+   */
+  libraryOf(vr) {
+    const key = libraryKey(vr);
+    let lib = this.libraries.get(key);
+    if (!lib) {
+      lib = { key, queue: [], running: 0, resident: false, since: 0 };
+      this.libraries.set(key, lib);
+    }
+    return lib;
+  }
+
+  /**
+   * @private
+   */
+  dispatch() {
+    this.swap();
+
+    this.resident.slice().forEach(lib => {
+      while (lib !== this.draining && lib.queue.length > 0) {
+        this.start(lib);
+      }
+    });
+  }
+
+  /**
+   * Swap in waiting libraries for as long as there is room, or room can be made.
+   *
+   * @private
+   */
+  swap() {
+    for (;;) {
+      const waiting = this.oldestWaiting();
+      if (!waiting) {
+        this.draining = null;
+        return;
+      }
+      if (this.resident.length < this.maxResident) {
+        this.admit(waiting);
+        continue;
+      }
+
+      // every library gets to serve a batch of at least `maxWait` msec once swapped in
+      const victim = this.resident[0];
+      const due = Math.max(waiting.queue[0].since, victim.since) + this.maxWait;
+      const overdue = Date.now() >= due;
+      if (victim.running === 0 && (victim.queue.length === 0 || overdue)) {
+        debug('scheduler swaps %s for %s', victim.key, waiting.key);
+        this.draining = null;
+        this.evict(victim);
+        this.admit(waiting);
+        continue;
+      }
+
+      if (overdue) {
+        // stop feeding the victim so that it runs dry
+        this.draining = victim;
+      } else {
+        this.wakeUpAt(due);
+      }
+      return;
+    }
+  }
+
+  /**
+   * @private
+   * @returns {Library?} the non-resident library with the longest waiting request
+   */
+  oldestWaiting() {
+    let oldest = null;
+    this.libraries.forEach(lib => {
+      if (
+        !lib.resident &&
+        lib.queue.length > 0 &&
+        (oldest === null || lib.queue[0].since < oldest.queue[0].since)
+      ) {
+        oldest = lib;
+      }
+    });
+    return oldest;
+  }
+
+  /**
+   * @private
+   * @param {Library} lib
+   */
+  start(lib) {
+    const { resolve } = lib.queue.shift();
+    lib.running += 1;
+    // mirror the native library, which marks an engine as used when a job starts on it
+    this.resident.splice(this.resident.indexOf(lib), 1);
+    this.resident.push(lib);
+    resolve();
+  }
+
+  /**
+   * @private
+   * @param {Library} lib
+   */
+  admit(lib) {
+    lib.resident = true;
+    lib.since = Date.now();
+    this.resident.push(lib);
+    this.counts.loads += 1;
+    if (this.everLoaded.has(lib.key)) {
+      this.counts.reloads += 1;
+    }
+    this.everLoaded.add(lib.key);
+  }
+
+  /**
+   * @private
+   * @param {Library} lib
+   */
+  evict(lib) {
+    lib.resident = false;
+    this.resident.splice(this.resident.indexOf(lib), 1);
+  }
+
+  /**
+   * Count the reloads that serving requests in arrival order would take, for comparison.
+   *
+   * @private
+   * @param {string} key
+   */
+  modelFifo(key) {
+    const at = this.fifoResident.indexOf(key);
+    if (at >= 0) {
+      this.fifoResident.splice(at, 1);
+    } else if (this.fifoEverLoaded.has(key)) {
+      this.counts.fifoReloads += 1;
+    }
+    this.fifoEverLoaded.add(key);
+    this.fifoResident.push(key);
+    if (this.fifoResident.length > this.maxResident) {
+      this.fifoResident.shift();
+    }
+  }
+
+  /**
+   * @private
+   * @param {number} time
+   */
+  wakeUpAt(time) {
+    if (this.timer !== null) {
+      return;
+    }
+    this.timer = setTimeout(() => {
+      this.timer = null;
+      this.dispatch();
+    }, Math.max(time - Date.now(), 0));
+  }
+}
+
+module.exports = Scheduler;
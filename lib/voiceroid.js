@@ -60,12 +60,12 @@ function sanitizeSampleRate(sampleRate, version) {
   }
   if (
     typeof sampleRate === 'number' &&
-    [22050, 44100, 48000].includes(sampleRate)
+    [16000, 22050, 24000, 44100, 48000].includes(sampleRate)
   ) {
     return sampleRate;
   }
   throw new TypeError(
-    'options.sampleRate should be one of 22050, 44100 or 48000'
+    'options.sampleRate should be one of 16000, 22050, 24000, 44100 or 48000'
   );
 }
 
@@ -73,7 +73,7 @@ function sanitizeChannels(channels) {
   if (typeof channels === 'undefined') {
     return 1;
   }
-  if (typeof channels === 'number' && channels === 1 && channels === 2) {
+  if (typeof channels === 'number' && (channels === 1 || channels === 2)) {
     return channels;
   }
   throw new TypeError('options.channels should be 1 or 2');
@@ -81,18 +81,19 @@ function sanitizeChannels(channels) {
 
 /**
  * Configurative options for a Voiceroid.
- * Note that variety of these values never affects Ebyroid on decision of exclusive reloading of voice libraries.
+ * Note that variety of these values never affects Ebyroid on decision of which engine (voice library) to use.
  *
  * @typedef VoiceroidOptions
  * @type {object}
- * @property {number} [volume=2.2] desired output volume (from 0.0 to 5.0) with 2.2 recommended.
- * @property {(22050|44100|48000)} [sampleRate=(22050|44100)] desired sample-rate of output PCM. VOICEROID+ defaults to 22050, and VOICEROID2 does to 44100. if a higher rate than default is given, Ebyroid will resample (upconvert) it to the rate.
- * @property {(1|2)} [channels=1] desired number of channels of output PCM. 1 stands for Mono, and 2 does for Stereo. since VOICEROID's output is always Mono, Ebyroid will manually interleave it when you set channels to 2.
+ * @property {number} [volume=2.2] desired output volume (from 0.0 to 5.0) with 2.2 recommended. it is applied natively to the PCM, saturating rather than wrapping around where it gets too loud.
+ * @property {(16000|22050|24000|44100|48000)} [sampleRate=(22050|44100)] desired sample-rate of output PCM. VOICEROID+ defaults to 22050, and VOICEROID2 does to 44100. if any other rate is given, Ebyroid will resample (upconvert or downconvert) it to the rate natively, on the worker thread that runs the conversion.
+ * @property {(1|2)} [channels=1] desired number of channels of output PCM. 1 stands for Mono, and 2 does for Stereo. since VOICEROID's output is always Mono, Ebyroid will interleave it natively when you set channels to 2.
  */
 
 /**
  * Voiceroid data class contains necessary information to load the native library.
- * Note that the name identitier and optional settings never affect Ebyroid on its determination of whether to reload native libraries or not whereas the other params do.
+ * Note that the name identitier and optional settings never affect Ebyroid on its determination of which native engine to use whereas the other params do.
+ * Voiceroids that share a voice library share its engine, which renders at unity gain for all of them whatever their volumes are.
  */
 class Voiceroid {
   /**
@@ -13,73 +13,145 @@ function toSampleRateLE(sampleRateUint32, weight) {
   return b32;
 }
 
+// RIFF size for streams of unknown length
+const UNKNOWN_SIZE = 0xffffffff;
+
+/**
+ * Bits per sample of each sample format.
+ *
+ * @type {Object<string, number>}
+ */
+const BIT_DEPTHS = { s16: 16, f32: 32, s24: 24, s32: 32 };
+
+/**
+ * @param {number} dataSize
+ * @param {number} sampleRate
+ * @param {number} numChannels
+ * @param {SampleFormat} sampleFormat
+ * @returns {Buffer}
+ */
+function waveFileHeader(dataSize, sampleRate, numChannels, sampleFormat) {
+  const bytesPerSample = BIT_DEPTHS[sampleFormat] / 8;
+  const theRIFF = new Uint8Array([0x52, 0x49, 0x46, 0x46]);
+  // 36 = headers(44) - RIFF(4) - this(4)
+  const fileSize = toUint32LE(
+    dataSize === UNKNOWN_SIZE ? UNKNOWN_SIZE : dataSize + 36
+  );
+  const theWAVE = new Uint8Array([0x57, 0x41, 0x56, 0x45]);
+  const theFmt = new Uint8Array([0x66, 0x6d, 0x74, 0x20]);
+  const fmtSizeLE = new Uint8Array([0x10, 0x00, 0x00, 0x00]);
+  // 1 for integer PCM, 3 for IEEE float
+  const fmtCodeLE = new Uint8Array([
+    sampleFormat === 'f32' ? 0x03 : 0x01,
+    0x00,
+  ]);
+  const numChannelsLE = new Uint8Array([numChannels, 0x00]);
+  const sampleRateLE = toSampleRateLE(sampleRate, 1);
+  const bytesPerSecLE = toSampleRateLE(
+    sampleRate,
+    numChannels * bytesPerSample
+  );
+  const byteAlignmentLE = new Uint8Array([numChannels * bytesPerSample, 0x00]);
+  const bitsPerSampleLE = new Uint8Array([bytesPerSample * 8, 0x00]);
+  const theData = new Uint8Array([0x64, 0x61, 0x74, 0x61]);
+  const dataSizeLE = toUint32LE(dataSize);
+  const header = Buffer.concat([
+    theRIFF,
+    fileSize,
+    theWAVE,
+    theFmt,
+    fmtSizeLE,
+    fmtCodeLE,
+    numChannelsLE,
+    sampleRateLE,
+    bytesPerSecLE,
+    byteAlignmentLE,
+    bitsPerSampleLE,
+    theData,
+    dataSizeLE,
+  ]);
+  assert(header.byteLength === 44, `wave header must have just 44 bytes`);
+  return header;
+}
+
+/**
+ * How samples are laid out: signed 16bit integers, 32bit floats from -1.0 to 1.0, signed 24bit integers packed into three bytes, or signed 32bit integers. All little endian.
+ *
+ * @typedef {("s16"|"f32"|"s24"|"s32")} SampleFormat
+ */
+
 /**
  * Conversion result object that contains a PCM data and format information.
  */
 class WaveObject {
   /**
-   * @param {Int16Array} data 16bit PCM data
+   * @param {(Int16Array|Float32Array|Uint8Array|Int32Array)} data PCM data
    * @param {number} sampleRate sample-rate of the data (Hz)
+   * @param {(1|2)} [numChannels=1] the number of interleaved channels in the data
+   * @param {SampleFormat} [sampleFormat="s16"] the sample format of the data
    */
-  constructor(data, sampleRate) {
+  constructor(data, sampleRate, numChannels = 1, sampleFormat = 's16') {
     /**
-     * an array of signed 16bit integer values which represents 16bit Linear PCM data
-     * @type {Int16Array}
+     * PCM data, whose array type goes with the sample format: Int16Array for s16, Float32Array for f32, Uint8Array (three bytes a sample) for s24 and Int32Array for s32.
+     * VOICEROID renders 16bit, which Ebyroid converts to the other formats natively.
+     * @type {(Int16Array|Float32Array|Uint8Array|Int32Array)}
      */
     this.data = data;
     /**
-     * the bit depth of PCM data. this value is fixed to 16 unless any VOICEROID comes to support 24bit depth someday.
-     * @type {16}
+     * the sample format of PCM data, which is `s16` unless another one is asked for.
+     * @type {SampleFormat}
      */
-    this.bitDepth = 16;
+    this.sampleFormat = sampleFormat;
     /**
-     * the sample-rate (samples per second) of PCM data. 22050Hz for VOICEROID+ and 44100Hz for VOICEROID2.
-     * That's for now. Ebyroid's resampling feature will come soon.
-     * @type {22050|44100}
+     * the bit depth of PCM data, which follows from the sample format.
+     * @type {16|24|32}
+     */
+    this.bitDepth = BIT_DEPTHS[sampleFormat];
+    /**
+     * the sample-rate (samples per second) of PCM data, which is the `sampleRate` option of the Voiceroid.
+     * that defaults to 22050Hz for VOICEROID+ and 44100Hz for VOICEROID2, and anything else is resampled from it.
+     * @type {16000|22050|24000|44100|48000}
      */
     this.sampleRate = sampleRate;
     /**
-     * the number of channels in PCM data. 1 for Mono, 2 for Stereo. It's fixed to 1 due to VOICEROID's nature.
-     * That's for now. Ebyroid soon will provide an option to interleave data into Stereo.
+     * the number of channels in PCM data. 1 for Mono, 2 for Stereo. VOICEROID's output is always Mono, which Ebyroid interleaves natively into Stereo when asked to.
      * @type {1|2}
      */
-    this.numChannels = 1;
+    this.numChannels = numChannels;
   }
 
   /**
    * @returns {Buffer} the wave file header bytes corresponding to this object
    */
   waveFileHeader() {
-    const theRIFF = new Uint8Array([0x52, 0x49, 0x46, 0x46]);
-    const fileSize = toUint32LE(this.data.byteLength + 36); // 36 = headers(44) - RIFF(4) - this(4)
-    const theWAVE = new Uint8Array([0x57, 0x41, 0x56, 0x45]);
-    const theFmt = new Uint8Array([0x66, 0x6d, 0x74, 0x20]);
-    const fmtSizeLE = new Uint8Array([0x10, 0x00, 0x00, 0x00]);
-    const fmtCodeLE = new Uint8Array([0x01, 0x00]);
-    const numChannelsLE = new Uint8Array([this.numChannels, 0x00]);
-    const sampleRateLE = toSampleRateLE(this.sampleRate, 1);
-    const bytesPerSecLE = toSampleRateLE(this.sampleRate, this.numChannels);
-    const byteAlignmentLE = new Uint8Array([this.numChannels * 2, 0x00]);
-    const bitsPerSampleLE = new Uint8Array([0x10, 0x00]);
-    const theData = new Uint8Array([0x64, 0x61, 0x74, 0x61]);
-    const dataSize = toUint32LE(this.data.byteLength);
-    const header = Buffer.concat([
-      theRIFF,
-      fileSize,
-      theWAVE,
-      theFmt,
-      fmtSizeLE,
-      fmtCodeLE,
-      numChannelsLE,
-      sampleRateLE,
-      bytesPerSecLE,
-      byteAlignmentLE,
-      bitsPerSampleLE,
-      theData,
-      dataSize,
-    ]);
-    assert(header.byteLength === 44, `wave header must have just 44 bytes`);
-    return header;
+    return waveFileHeader(
+      this.data.byteLength,
+      this.sampleRate,
+      this.numChannels,
+      this.sampleFormat
+    );
+  }
+
+  /**
+   * Wave file header for data whose length is not known yet, e.g. when sending PCM as it is being rendered.
+   * Both RIFF and data chunk sizes are set to `0xFFFFFFFF`, which players take as "read until the end of stream".
+   *
+   * @param {number} sampleRate sample-rate of the data (Hz)
+   * @param {number} [numChannels=1] the number of channels
+   * @param {SampleFormat} [sampleFormat="s16"] the sample format
+   * @returns {Buffer} the wave file header bytes
+   */
+  static streamingWaveFileHeader(
+    sampleRate,
+    numChannels = 1,
+    sampleFormat = 's16'
+  ) {
+    return waveFileHeader(
+      UNKNOWN_SIZE,
+      sampleRate,
+      numChannels,
+      sampleFormat
+    );
   }
 }
 
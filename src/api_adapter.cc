@@ -1,20 +1,20 @@
 #include "api_adapter.h"
 
+#include <cstdio>
 #include <stdexcept>
 
-#include <Windows.h>
-
 #include "ebyutil.h"
+#include "platform.h"
 
 namespace ebyroid {
 
 namespace {
 
 template <class T>
-inline T LoadProc(const HINSTANCE& handle, const char* proc_name) {
-  FARPROC proc = GetProcAddress(handle, proc_name);
+inline T LoadProc(platform::LibraryHandle handle, const char* proc_name) {
+  void* proc = platform::FindSymbol(handle, proc_name);
   if (proc == nullptr) {
-    FreeLibrary(handle);
+    platform::CloseLibrary(handle);
     char m[64];
     std::snprintf(m, 64, "Could not find '%s' in the library.", proc_name);
     throw std::runtime_error(m);
@@ -25,29 +25,14 @@ inline T LoadProc(const HINSTANCE& handle, const char* proc_name) {
 }  // namespace
 
 ApiAdapter* ApiAdapter::Create(const char* base_dir, const char* dll_path) {
-  if (BOOL ok = SetDllDirectoryA(base_dir); !ok) {
-    char m[128];
-    std::snprintf(m,
-                  128,
-                  "SetDllDirectory failed with code %d (Check out the voiceroid path setting)",
-                  GetLastError());
-    throw new std::runtime_error(m);
-  }
-
-  HINSTANCE handle = LoadLibraryA(dll_path);
+  platform::LibraryHandle handle = platform::OpenLibrary(base_dir, dll_path);
   if (handle == nullptr) {
-    char m[128];
+    char m[512];
     std::snprintf(m,
-                  128,
-                  "LoadLibrary failed with code %d (Check out the voiceroid path setting)",
-                  GetLastError());
-    throw new std::runtime_error(m);
-  }
-
-  if (BOOL ok = SetDllDirectoryA(nullptr); !ok) {
-    // this should not be so critical
-    Eprintf("SetDllDirectoryA(NULL) failed with code %d", GetLastError());
-    Eprintf("albeit the program will go on ignoring this error.");
+                  512,
+                  "LoadLibrary failed with %s (Check out the voiceroid path setting)",
+                  platform::DescribeLastError().c_str());
+    throw std::runtime_error(m);
   }
 
   ApiAdapter* adapter = new ApiAdapter(handle);
@@ -69,7 +54,7 @@ ApiAdapter* ApiAdapter::Create(const char* base_dir, const char* dll_path) {
 }
 
 ApiAdapter::~ApiAdapter() {
-  if (BOOL result = FreeLibrary(dll_instance_); !result) {
+  if (bool ok = platform::CloseLibrary(dll_instance_); !ok) {
     Eprintf("FreeLibrary(HMODULE) failed. Though the program will go on, may lead to fatal error.");
   }
 }
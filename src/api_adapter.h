@@ -3,11 +3,7 @@
 
 #include <cstdint>
 
-// forward-declaration to avoid including Windows.h in header
-#ifndef _WINDEF_
-struct HINSTANCE__;
-typedef HINSTANCE__* HINSTANCE;
-#endif
+#include "platform.h"
 
 namespace ebyroid {
 
@@ -19,6 +15,9 @@ static constexpr int32_t kConfigRawbufSize = 0x158880;
 
 static constexpr int32_t kLenSeedValue = 0;
 
+// how many jobs an engine takes at once, the next one fails with ERR_TOO_MANY_JOBS
+static constexpr uint32_t kMaxConcurrentJobs = 2;
+
 enum EventReasonCode : uint32_t {
   TEXTBUF_FULL = 0x00000065,
   TEXTBUF_FLUSH = 0x00000066,
@@ -177,7 +176,7 @@ class ApiAdapter {
   ResultCode GetData(int32_t job_id, int16_t* raw_buf, uint32_t len_buf, uint32_t* size);
 
  private:
-  ApiAdapter(HINSTANCE dll_instance) : dll_instance_(dll_instance) {}
+  ApiAdapter(platform::LibraryHandle dll_instance) : dll_instance_(dll_instance) {}
 
   typedef ResultCode(__stdcall* ApiInit)(TConfig*);
   typedef ResultCode(__stdcall* ApiEnd)(void);
@@ -193,7 +192,7 @@ class ApiAdapter {
   typedef ResultCode(__stdcall* ApiCloseSpeech)(int32_t, int32_t);
   typedef ResultCode(__stdcall* ApiGetData)(int32_t, int16_t*, uint32_t, uint32_t*);
 
-  HINSTANCE dll_instance_ = nullptr;
+  platform::LibraryHandle dll_instance_ = nullptr;
 
   ApiInit init_;
   ApiEnd end_;
@@ -1,5 +1,7 @@
 #include "api_settings.h"
 
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 
 #include "ebyutil.h"
@@ -10,8 +12,8 @@ using std::string;
 
 Settings SettingsBuilder::Build() {
   Settings settings;
-  string dll_path = base_dir_ + kWinDelimit + kDllFilename;
-  string license_path = base_dir_ + kWinDelimit + kLicFilename;
+  string dll_path = base_dir_ + kDelimit + kDllFilename;
+  string license_path = base_dir_ + kDelimit + kLicFilename;
   std::strcpy(settings.base_dir, base_dir_.c_str());
   std::strcpy(settings.voice_name, voice_name_.c_str());
   std::strcpy(settings.dll_path, dll_path.c_str());
@@ -27,8 +29,8 @@ Settings SettingsBuilder::Build() {
     // this means the given library is VOICEROID+
     settings.frequency = kFrequency22;
 
-    string voice_dir = base_dir_ + kWinDelimit + "voice";
-    string language_dir = base_dir_ + kWinDelimit + "lang";
+    string voice_dir = base_dir_ + kDelimit + "voice";
+    string language_dir = base_dir_ + kDelimit + "lang";
     std::strcpy(settings.voice_dir, voice_dir.c_str());
     std::strcpy(settings.language_dir, language_dir.c_str());
     if (voice_name_ == "kiritan_22") {
@@ -42,15 +44,15 @@ Settings SettingsBuilder::Build() {
     } else {
       char m[64];
       std::snprintf(m, 64, "Unsupported VOICEROID+ library '%s' was given.", settings.voice_name);
-      throw new std::runtime_error(m);
+      throw std::runtime_error(m);
     }
   } else {
     // this means it is either VOICEROID2 or an unexpected library
     // try to setup as VOICEROID2 anyways
     settings.frequency = kFrequency44;
 
-    string voice_dir = base_dir_ + kWinDelimit + "Voice";
-    string language_dir = base_dir_ + kWinDelimit + "Lang" + kWinDelimit + "standard";
+    string voice_dir = base_dir_ + kDelimit + "Voice";
+    string language_dir = base_dir_ + kDelimit + "Lang" + kDelimit + "standard";
     std::strcpy(settings.voice_dir, voice_dir.c_str());
     std::strcpy(settings.language_dir, language_dir.c_str());
     settings.seed = EBY_SEED_A;
@@ -5,14 +5,21 @@
 
 #include <cstdint>
 
+#include "platform.h"
+
 namespace ebyroid {
 
 static constexpr size_t kMaxPathSize = 0xFF;
 static constexpr int32_t kFrequency44 = 0xAC44;
 static constexpr int32_t kFrequency22 = 0x5622;
-static constexpr char* kDllFilename = "aitalked.dll";
-static constexpr char* kLicFilename = "aitalk.lic";
-static constexpr char* kWinDelimit = "\\";
+#ifdef _WIN32
+static constexpr const char* kDllFilename = "aitalked.dll";
+#else
+// the stand-in engine, see src/sim
+static constexpr const char* kDllFilename = "aitalked.so";
+#endif
+static constexpr const char* kLicFilename = "aitalk.lic";
+static constexpr const char* kDelimit = platform::kPathDelimiter;
 
 struct Settings {
   char base_dir[kMaxPathSize];
@@ -0,0 +1,44 @@
+#include "completion.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace ebyroid {
+
+void Completion::Signal() {
+  // notify while holding the lock: the waiter may destroy this object as soon as it wakes up
+  std::lock_guard<std::mutex> lock(mutex_);
+  signaled_ = true;
+  cv_.notify_all();
+}
+
+bool Completion::WaitUntil(std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return cv_.wait_until(lock, deadline, [this] { return signaled_; });
+}
+
+void CancelToken::Cancel() {
+  // signal under the lock, so that no waiter can detach and destroy its completion meanwhile
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_.store(true, std::memory_order_release);
+  for (Completion* completion : completions_) {
+    completion->Signal();
+  }
+}
+
+bool CancelToken::Attach(Completion* completion) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cancelled()) {
+    return false;
+  }
+  completions_.push_back(completion);
+  return true;
+}
+
+void CancelToken::Detach(Completion* completion) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  completions_.erase(std::remove(completions_.begin(), completions_.end(), completion),
+                     completions_.end());
+}
+
+}  // namespace ebyroid
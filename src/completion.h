@@ -0,0 +1,67 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace ebyroid {
+
+/**
+ * One-shot latch that an engine callback trips to wake up the thread waiting on the job.
+ */
+class Completion {
+ public:
+  Completion() = default;
+  Completion(const Completion&) = delete;
+  Completion(Completion&&) = delete;
+
+  void Signal();
+
+  /**
+   * Blocks until Signal() is called or `deadline` passes. Returns false on timeout.
+   */
+  bool WaitUntil(std::chrono::steady_clock::time_point deadline);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool signaled_ = false;
+};
+
+/**
+ * Lets another thread give up on a job. Cancel() also trips the Completions that the job is
+ * waiting on, if any, so the waiters notice at once rather than when the engine is done. A job
+ * split into segments, or a batch, waits on several at once.
+ */
+class CancelToken {
+ public:
+  CancelToken() = default;
+  CancelToken(const CancelToken&) = delete;
+  CancelToken(CancelToken&&) = delete;
+
+  void Cancel();
+  bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+  // makes the token usable for another job
+  void Reset() { cancelled_.store(false, std::memory_order_release); }
+
+  /**
+   * Has Cancel() signal `completion` until it is detached. Returns false if already cancelled.
+   */
+  bool Attach(Completion* completion);
+  void Detach(Completion* completion);
+
+ private:
+  std::mutex mutex_;
+  // kept across Reset(), so that reused tokens do not allocate
+  std::vector<Completion*> completions_;
+  std::atomic<bool> cancelled_{false};
+};
+
+}  // namespace ebyroid
+
+#endif  // COMPLETION_H
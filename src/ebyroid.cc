@@ -1,168 +1,740 @@
 #include "ebyroid.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <string>
 
-#include <Windows.h>
-
 #include "api_adapter.h"
 #include "api_settings.h"
 #include "ebyutil.h"
+#include "platform.h"
+#include "resampler.h"
+#include "tracer.h"
 
 namespace ebyroid {
 
-using std::string, std::vector, std::function, std::pair;
+using std::string, std::function, std::pair;
+using Clock = std::chrono::steady_clock;
 
 namespace {
 
-ApiAdapter* NewAdapter(const string&, const string&, float);
+// the DLL search path and the working directory belong to the whole process, so loading libraries
+// and languages, which depend on them, takes turns across engines
+std::mutex process_mutex;
+
+// silence the engine puts around the output of every job, in samples
+struct Padding {
+  uint32_t begin;
+  uint32_t term;
+};
+
+ApiAdapter* NewAdapter(const Settings&,
+                       const string&,
+                       Padding*,
+                       std::unique_ptr<char[]>*,
+                       LoadTimings*);
+uint64_t UsecSince(Clock::time_point since);
+string CopyLibrary(const string& path);
 int __stdcall HiraganaCallback(EventReasonCode, int32_t, IntPtr);
 int __stdcall SpeechCallback(EventReasonCode, int32_t, uint64_t, IntPtr);
+int16_t* WorkerScratch();
+void ThrowIfAborted(const ConvertParams& params);
+enum class WaitResult { kDone, kTimedOut, kCancelled, kDeadlineExceeded };
+WaitResult WaitForJob(Completion& completion, const ConvertParams& params);
 inline pair<bool, string> WithDirecory(const char* dir, function<pair<bool, string>(void)> yield);
 
 }  // namespace
 
-Ebyroid::~Ebyroid() {
-  delete api_adapter_;
+struct Ebyroid::Engine {
+  Engine(const string& key,
+         const string& library,
+         const string& library_copy,
+         ApiAdapter* adapter,
+         uint32_t sample_rate,
+         Padding padding,
+         std::unique_ptr<char[]> param_buffer)
+      : key(key),
+        library(library),
+        library_copy(library_copy),
+        api_adapter(adapter),
+        sample_rate(sample_rate),
+        padding(padding),
+        param_buffer(std::move(param_buffer)),
+        own_speaker(((TTtsParam*) this->param_buffer.get())->speaker[0]) {}
+  ~Engine();
+  void LearnOutputRate(size_t inbytes, size_t samples);
+  // hands the parameters for `prosody` to the engine, if they are not what it has already.
+  // to be called with param_mutex held, up to starting the job that is to use them
+  void ApplyProsody(const Prosody* prosody);
+
+  // base_dir and voice, which identify the engine
+  const string key;
+  // the library the engine was loaded from, and its private copy if it had to be copied
+  const string library;
+  const string library_copy;
+  ApiAdapter* const api_adapter;
+  const uint32_t sample_rate;
+  const Padding padding;
+  // running estimate of how many samples one byte of input turns into, for preallocation
+  std::atomic<uint32_t> samples_per_byte{0};
+  // the engine takes its parameters as they are when a job starts, so setting them and starting
+  // a job go together under this lock
+  std::mutex param_mutex;
+  // TTtsParam as last handed to the engine, guarded by param_mutex
+  const std::unique_ptr<char[]> param_buffer;
+  // what the voice speaks with by itself
+  const TTtsParam::TSpeakerParam own_speaker;
+};
+
+Ebyroid::Engine::~Engine() {
+  delete api_adapter;
+  if (!library_copy.empty()) {
+    std::error_code error;
+    if (bool ok = std::filesystem::remove(library_copy, error); !ok) {
+      Eprintf("Could not remove %s (%s)", library_copy.c_str(), error.message().c_str());
+    }
+  }
+}
+
+void Ebyroid::Engine::LearnOutputRate(size_t inbytes, size_t samples) {
+  if (inbytes == 0) {
+    return;
+  }
+  uint32_t observed = (uint32_t)(samples / inbytes);
+  uint32_t last = samples_per_byte.load(std::memory_order_relaxed);
+  uint32_t next = last == 0 ? observed : (last * 7 + observed) / 8;
+  samples_per_byte.store(next, std::memory_order_relaxed);
+}
+
+void Ebyroid::Engine::ApplyProsody(const Prosody* prosody) {
+  static const Prosody kOwn;
+  if (prosody == nullptr) {
+    prosody = &kOwn;
+  }
+  auto either = [](auto wanted, auto own) { return wanted < 0 ? own : wanted; };
+  TTtsParam::TSpeakerParam& speaker = ((TTtsParam*) param_buffer.get())->speaker[0];
+  TTtsParam::TSpeakerParam wanted = speaker;
+  wanted.speed = either(prosody->speed, own_speaker.speed);
+  wanted.pitch = either(prosody->pitch, own_speaker.pitch);
+  wanted.range = either(prosody->range, own_speaker.range);
+  wanted.pause_middle = either(prosody->pause_middle, own_speaker.pause_middle);
+  wanted.pause_long = either(prosody->pause_long, own_speaker.pause_long);
+  wanted.pause_sentence = either(prosody->pause_sentence, own_speaker.pause_sentence);
+  if (std::memcmp(&wanted, &speaker, sizeof(speaker)) == 0) {
+    return;
+  }
+
+  const TTtsParam::TSpeakerParam applied = speaker;
+  speaker = wanted;
+  if (ResultCode result = api_adapter->SetParam(param_buffer.get()); result != ERR_SUCCESS) {
+    speaker = applied;
+    char m[64];
+    std::snprintf(m, 64, "API Set Param failed with code %d", result);
+    throw ApiError(m, result);
+  }
 }
 
-Ebyroid* Ebyroid::Create(const string& base_dir, const string& voice, float volume) {
-  ApiAdapter* adapter = NewAdapter(base_dir, voice, volume);
-  Ebyroid* ebyroid = new Ebyroid(adapter);
+Ebyroid::Ebyroid(size_t max_engines, size_t kana_cache_size)
+    : max_engines_(max_engines),
+      kana_cache_(kana_cache_size > 0 ? new KanaCache(kana_cache_size) : nullptr) {}
+
+Ebyroid::~Ebyroid() = default;
+
+Ebyroid* Ebyroid::Create(const string& base_dir,
+                         const string& voice,
+                         size_t max_engines,
+                         size_t kana_cache_size) {
+  Ebyroid* ebyroid = new Ebyroid(max_engines, kana_cache_size);
+  try {
+    ebyroid->Preload(base_dir, voice, nullptr);
+  } catch (...) {
+    delete ebyroid;
+    throw;
+  }
   return ebyroid;
 }
 
-int Ebyroid::Hiragana(const unsigned char* inbytes, unsigned char** outbytes, size_t* outsize) {
-  Response* const response = new Response(api_adapter_);
+Ebyroid* Ebyroid::Create(size_t max_engines, size_t kana_cache_size) {
+  return new Ebyroid(max_engines, kana_cache_size);
+}
 
-  TJobParam param;
-  param.mode_in_out = IOMODE_PLAIN_TO_AIKANA;
-  param.user_data = response;
+void Ebyroid::Preload(const string& base_dir, const string& voice, LoadTimings* timings) {
+  if (timings != nullptr) {
+    *timings = LoadTimings{};
+  }
+  Acquire(base_dir, voice, false, timings);
+}
+
+int Ebyroid::Hiragana(const ConvertParams& params,
+                      const unsigned char* inbytes,
+                      unsigned char** outbytes,
+                      size_t* outsize) {
+  ThrowIfAborted(params);
+  std::shared_ptr<Engine> engine = Acquire(params);
+  return Hiragana(*engine, params, inbytes, outbytes, outsize);
+}
+
+int Ebyroid::Speech(const ConvertParams& params,
+                    const unsigned char* inbytes,
+                    int16_t** outbytes,
+                    size_t* outsize,
+                    uint32_t mode,
+                    const PcmSink& sink) {
+  ThrowIfAborted(params);
+  std::shared_ptr<Engine> engine = Acquire(params);
+  return Speech(*engine, params, inbytes, outbytes, outsize, mode, sink);
+}
+
+int Ebyroid::Convert(const ConvertParams& params,
+                     const unsigned char* inbytes,
+                     int16_t** outbytes,
+                     size_t* outsize,
+                     const PcmSink& sink,
+                     uint32_t trim) {
+  // no point loading an engine for a job that has been given up on
+  ThrowIfAborted(params);
+  // holding the engine keeps it alive even if it gets evicted in the meantime
+  std::shared_ptr<Engine> engine = Acquire(params);
+  if (params.sample_rate == 0 || params.sample_rate == engine->sample_rate) {
+    Synthesize(*engine, params, inbytes, outbytes, outsize, sink);
+    TrimPadding(*engine, trim, *outbytes, outsize);
+    return 0;
+  }
+
+  Resampler resampler(engine->sample_rate, params.sample_rate);
+  OutputBuffer<int16_t> resampled;
+  if (sink) {
+    // streamed output goes through the resampler chunk by chunk
+    size_t streamed = 0;
+    auto pass = [&sink, &resampled, &streamed]() {
+      if (resampled.size() > 0) {
+        sink(resampled.data(), resampled.size());
+        streamed += resampled.size();
+        resampled.Clear();
+      }
+    };
+    PcmSink resampling = [&resampler, &resampled, &pass](const int16_t* shorts, size_t size) {
+      resampler.Process(shorts, size, &resampled);
+      pass();
+    };
+    Synthesize(*engine, params, inbytes, outbytes, outsize, resampling);
+    resampler.Flush(&resampled);
+    pass();
+    *outsize = streamed * 2;  // sizeof(int16_t) == 2
+    return 0;
+  }
+
+  Synthesize(*engine, params, inbytes, outbytes, outsize, nullptr);
+  TrimPadding(*engine, trim, *outbytes, outsize);
+  std::unique_ptr<int16_t, decltype(&std::free)> original(*outbytes, &std::free);
+  size_t samples = *outsize / 2;
+  resampled.Reserve((size_t)((uint64_t) samples * params.sample_rate / engine->sample_rate) + 1);
+  resampler.Process(original.get(), samples, &resampled);
+  resampler.Flush(&resampled);
+  *outbytes = resampled.Release(&samples);
+  *outsize = samples * 2;
+  return 0;
+}
+
+void Ebyroid::Synthesize(Engine& engine,
+                         const ConvertParams& params,
+                         const unsigned char* inbytes,
+                         int16_t** outbytes,
+                         size_t* outsize,
+                         const PcmSink& sink) {
+  if (!kana_cache_) {
+    Speech(engine, params, inbytes, outbytes, outsize, IOMODE_PLAIN_TO_WAVE, sink);
+    return;
+  }
+
+  // analysis depends on the language database of the install directory, not on the voice
+  thread_local string key;
+  key.assign(engine.key, 0, engine.key.find('\n')).append(1, '\n').append((const char*) inbytes);
+  KanaCache::KanaRef kana = kana_cache_->Find(key);
+  if (!kana) {
+    unsigned char* kana_bytes;
+    size_t kana_size;
+    Hiragana(engine, params, inbytes, &kana_bytes, &kana_size);
+    string analyzed((const char*) kana_bytes, kana_size);
+    std::free(kana_bytes);
+    kana = kana_cache_->Insert(key, std::move(analyzed));
+  }
+  Speech(engine,
+         params,
+         (const unsigned char*) kana->c_str(),
+         outbytes,
+         outsize,
+         IOMODE_AIKANA_TO_WAVE,
+         sink);
+}
+
+uint32_t Ebyroid::SampleRate(const ConvertParams& params) {
+  return Acquire(params)->sample_rate;
+}
+
+void Ebyroid::TrimPadding(const Engine& engine, uint32_t trim, int16_t* pcm, size_t* size) {
+  if (pcm == nullptr || trim == kTrimNone) {
+    return;
+  }
+
+  // take off no more than the padding, and only silence, lest any voice gets cut
+  size_t samples = *size / 2;  // sizeof(int16_t) == 2
+  size_t begin = 0;
+  if (trim & kTrimBegin) {
+    while (begin < engine.padding.begin && begin < samples && pcm[begin] == 0) {
+      begin++;
+    }
+  }
+  size_t end = samples;
+  if (trim & kTrimTerm) {
+    while (samples - end < engine.padding.term && end > begin && pcm[end - 1] == 0) {
+      end--;
+    }
+  }
+  if (begin > 0) {
+    std::memmove(pcm, pcm + begin, (end - begin) * 2);
+  }
+  *size = (end - begin) * 2;
+}
+
+StageStats Ebyroid::stage_stats() const {
+  StageStats stats = {};
+  Histogram::Snapshot kana = metrics_.engine_usec[kKanaStage].snapshot();
+  Histogram::Snapshot wave = metrics_.engine_usec[kWaveStage].snapshot();
+  Histogram::Snapshot plain = metrics_.engine_usec[kPlainStage].snapshot();
+  stats.kana_jobs = kana.count;
+  stats.kana_usec = kana.sum;
+  stats.wave_jobs = wave.count;
+  stats.wave_usec = wave.sum;
+  stats.plain_jobs = plain.count;
+  stats.plain_usec = plain.sum;
+  if (kana_cache_) {
+    stats.kana_hits = kana_cache_->hits();
+    stats.kana_misses = kana_cache_->misses();
+  }
+  stats.kana_hits += metrics_.host_kana_hits.value();
+  stats.kana_misses += metrics_.host_kana_misses.value();
+  return stats;
+}
+
+std::shared_ptr<Ebyroid::Engine> Ebyroid::Recent() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (engines_.empty()) {
+    throw std::runtime_error("No engine is loaded (the last load must have failed)");
+  }
+  return engines_.front();
+}
+
+std::shared_ptr<Ebyroid::Engine> Ebyroid::Acquire(const ConvertParams& params) {
+  if (params.base_dir == nullptr || params.voice == nullptr) {
+    return Recent();
+  }
+  return Acquire(params.base_dir, params.voice, params.needs_reload, nullptr);
+}
+
+std::shared_ptr<Ebyroid::Engine> Ebyroid::Acquire(const string& base_dir,
+                                                  const string& voice,
+                                                  bool reload,
+                                                  LoadTimings* timings) {
+  string key = base_dir + '\n' + voice;
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // the usual case: the engine is resident, so just mark it as the most recently used
+  if (!reload) {
+    for (auto it = engines_.begin(); it != engines_.end(); ++it) {
+      if ((*it)->key == key) {
+        engines_.splice(engines_.begin(), engines_, it);
+        return engines_.front();
+      }
+    }
+  }
+
+  // someone else is loading it already, whose engine is as fresh as a reload would get
+  if (auto it = loading_.find(key); it != loading_.end()) {
+    std::shared_future<std::shared_ptr<Engine>> loading = it->second;
+    lock.unlock();
+    return loading.get();  // throws whatever the load failed with
+  }
 
-  char eventname[32];
-  std::sprintf(eventname, "TTKLOCK:%p", response);
+  // make room first, as every engine holds on to a whole voice database
+  auto evict = [this](std::list<std::shared_ptr<Engine>>::iterator it) {
+    Dprintf("evict engine %s", (*it)->key.c_str());
+    evicted_.push_back(*it);
+    engines_.erase(it);
+  };
+  if (reload) {
+    auto it = std::find_if(
+        engines_.begin(), engines_.end(), [&key](auto& engine) { return engine->key == key; });
+    if (it != engines_.end()) {
+      evict(it);
+    }
+  }
+  while (max_engines_ > 0 && !engines_.empty() &&
+         engines_.size() + loading_.size() >= max_engines_) {
+    evict(std::prev(engines_.end()));
+  }
+
+  // other voices get loaded side by side meanwhile
+  std::promise<std::shared_ptr<Engine>> loaded;
+  loading_.emplace(key, loaded.get_future().share());
+  lock.unlock();
+  std::shared_ptr<Engine> engine;
+  try {
+    TraceSpan span("load", Tracer::job());
+    span.Detail(voice.c_str());
+    engine = Load(base_dir, voice, timings);
+  } catch (...) {
+    loaded.set_exception(std::current_exception());
+    lock.lock();
+    loading_.erase(key);
+    throw;
+  }
+  lock.lock();
+  engines_.push_front(engine);
+  loading_.erase(key);
+  lock.unlock();
+  loaded.set_value(engine);
+  if (engine->library_copy.empty()) {
+    // which the engine now tells as resident
+    ReleaseLibrary(engine->library);
+  }
+  return engine;
+}
+
+std::shared_ptr<Ebyroid::Engine> Ebyroid::Load(const string& base_dir,
+                                               const string& voice,
+                                               LoadTimings* timings) {
+  const Clock::time_point started = Clock::now();
+  LoadTimings local = {};
+  local.loaded = true;
+
+  SettingsBuilder builder(base_dir, voice);
+  Settings settings = builder.Build();
+
+  // the same file loaded twice is the same instance of the library, hence a private copy
+  string library(settings.dll_path);
+  string library_copy;
+  if (!ClaimLibrary(library)) {
+    library_copy = CopyLibrary(library);
+  }
+  local.library_usec = UsecSince(started);
+
+  const string& path = library_copy.empty() ? library : library_copy;
+  ApiAdapter* adapter;
+  Padding padding;
+  std::unique_ptr<char[]> param_buffer;
+  try {
+    adapter = NewAdapter(settings, path, &padding, &param_buffer, &local);
+  } catch (...) {
+    if (library_copy.empty()) {
+      ReleaseLibrary(library);
+    } else {
+      std::error_code error;
+      std::filesystem::remove(library_copy, error);
+    }
+    throw;
+  }
+  engine_loads_++;
+  local.total_usec = UsecSince(started);
+  metrics_.CountLoad(base_dir, voice, local.total_usec);
+  if (timings != nullptr) {
+    *timings = local;
+  }
+  Dprintf("loaded engine %s from %s in %llu usec",
+          voice.c_str(),
+          path.c_str(),
+          (unsigned long long) local.total_usec);
+
+  return std::make_shared<Engine>(base_dir + '\n' + voice,
+                                  library,
+                                  library_copy,
+                                  adapter,
+                                  settings.frequency,
+                                  padding,
+                                  std::move(param_buffer));
+}
 
-  HANDLE event = CreateEventA(NULL, TRUE, FALSE, eventname);
+void Ebyroid::CountStage(Stage stage, std::chrono::steady_clock::time_point started) {
+  metrics_.engine_usec[stage].Observe(UsecSince(started));
+}
+
+bool Ebyroid::ClaimLibrary(const string& library) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  evicted_.erase(std::remove_if(evicted_.begin(),
+                                evicted_.end(),
+                                [](auto& engine) { return engine.expired(); }),
+                 evicted_.end());
+  auto uses = [&library](const Engine& engine) {
+    return engine.library_copy.empty() && engine.library == library;
+  };
+  for (auto& engine : engines_) {
+    if (uses(*engine)) {
+      return false;
+    }
+  }
+  for (auto& weak : evicted_) {
+    if (std::shared_ptr<Engine> engine = weak.lock(); engine && uses(*engine)) {
+      return false;
+    }
+  }
+  if (std::find(claimed_libraries_.begin(), claimed_libraries_.end(), library) !=
+      claimed_libraries_.end()) {
+    return false;
+  }
+  claimed_libraries_.push_back(library);
+  return true;
+}
+
+void Ebyroid::ReleaseLibrary(const string& library) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find(claimed_libraries_.begin(), claimed_libraries_.end(), library);
+  if (it != claimed_libraries_.end()) {
+    claimed_libraries_.erase(it);
+  }
+}
+
+int Ebyroid::Hiragana(Engine& engine,
+                      const ConvertParams& params,
+                      const unsigned char* inbytes,
+                      unsigned char** outbytes,
+                      size_t* outsize) {
+  // the job may have waited in a queue, or for the engine to load, long enough to be given up on
+  ThrowIfAborted(params);
+
+  Response response(engine.api_adapter);
+  // AI Kana tends to be a few times longer than its source text
+  response.Reserve(std::strlen((const char*) inbytes) * 4);
+
+  TJobParam param;
+  param.mode_in_out = IOMODE_PLAIN_TO_AIKANA;
+  param.user_data = &response;
 
   int32_t job_id;
-  if (ResultCode result = api_adapter_->TextToKana(&job_id, &param, (const char*) inbytes);
-      result != ERR_SUCCESS) {
-    delete response;
-    ResetEvent(event);
-    CloseHandle(event);
-    static constexpr char* format = "TextToKana failed with the result code %d\n"
-                                    "Given inbytes: %s";
+  const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  ResultCode result;
+  {
+    TraceSpan span("TextToKana", response.trace_job());
+    result = engine.api_adapter->TextToKana(&job_id, &param, (const char*) inbytes);
+  }
+  if (result != ERR_SUCCESS) {
+    static constexpr const char* format = "TextToKana failed with the result code %d\n"
+                                          "Given inbytes: %s";
     char m[0xFFFF];
     std::snprintf(m, 0xFFFF, format, result, inbytes);
+    throw ApiError(m, result);
+  }
+
+  if (WaitResult result = WaitForJob(response.completion(), params); result != WaitResult::kDone) {
+    // closing a running job aborts it, after which no more callbacks refer to the response
+    engine.api_adapter->CloseKana(job_id);
+    if (result == WaitResult::kCancelled) {
+      throw JobAborted(JobAborted::kCancelled);
+    }
+    if (result == WaitResult::kDeadlineExceeded) {
+      throw JobAborted(JobAborted::kDeadlineExceeded);
+    }
+    char m[64];
+    std::snprintf(m, 64, "TextToKana timed out after %u msec", kJobTimeoutMsec);
     throw std::runtime_error(m);
   }
 
-  WaitForSingleObject(event, INFINITE);
-  ResetEvent(event);
-  CloseHandle(event);
+  CountStage(kKanaStage, started);
 
   // finalize
-  if (ResultCode result = api_adapter_->CloseKana(job_id); result != ERR_SUCCESS) {
-    delete response;
-    throw std::runtime_error("wtf");
+  {
+    TraceSpan span("CloseKana", response.trace_job());
+    result = engine.api_adapter->CloseKana(job_id);
+  }
+  if (result != ERR_SUCCESS) {
+    throw ApiError("wtf", result);
   }
 
-  // write to output memory
-  vector<unsigned char> buffer = response->End();
-  *outsize = buffer.size();
-  *outbytes = (unsigned char*) malloc(buffer.size() + 1);
-  std::copy(buffer.begin(), buffer.end(), *outbytes);
-  *(*outbytes + buffer.size()) = '\0';
-
-  delete response;
+  // hand over the output memory (NUL-terminated)
+  *outbytes = response.End(outsize);
   return 0;
 }
 
-int Ebyroid::Speech(const unsigned char* inbytes,
+int Ebyroid::Speech(Engine& engine,
+                    const ConvertParams& params,
+                    const unsigned char* inbytes,
                     int16_t** outbytes,
                     size_t* outsize,
-                    uint32_t mode) {
-  Response* const response = new Response(api_adapter_);
+                    uint32_t mode,
+                    const PcmSink& sink) {
+  ThrowIfAborted(params);
+
+  const size_t inlen = std::strlen((const char*) inbytes);
+  Response response(
+      engine.api_adapter, sink, sink ? WorkerScratch() : nullptr, &metrics_.chunk_bytes);
+  if (!sink) {
+    // make room for what this much input usually turns into, plus a margin
+    response.Reserve16(inlen * engine.samples_per_byte.load(std::memory_order_relaxed) * 5 / 4);
+  }
 
   TJobParam param;
   param.mode_in_out = mode == 0u ? IOMODE_AIKANA_TO_WAVE : (JobInOut) mode;
-  param.user_data = response;
-
-  char eventname[32];
-  sprintf(eventname, "TTSLOCK:%p", response);
-  HANDLE event = CreateEventA(NULL, TRUE, FALSE, eventname);
+  param.user_data = &response;
 
   int32_t job_id;
-  if (ResultCode result = api_adapter_->TextToSpeech(&job_id, &param, (const char*) inbytes);
-      result != ERR_SUCCESS) {
-    delete response;
-    ResetEvent(event);
-    CloseHandle(event);
-    static constexpr char* format = "TextToSpeech failed with the result code %d\n"
-                                    "Given inbytes: %s";
+  const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  ResultCode result;
+  {
+    std::lock_guard<std::mutex> lock(engine.param_mutex);
+    engine.ApplyProsody(params.prosody);
+    TraceSpan span("TextToSpeech", response.trace_job());
+    result = engine.api_adapter->TextToSpeech(&job_id, &param, (const char*) inbytes);
+  }
+  if (result != ERR_SUCCESS) {
+    static constexpr const char* format = "TextToSpeech failed with the result code %d\n"
+                                          "Given inbytes: %s";
     char m[0xFFFF];
     std::snprintf(m, 0xFFFF, format, result, inbytes);
+    throw ApiError(m, result);
+  }
+
+  if (WaitResult result = WaitForJob(response.completion(), params); result != WaitResult::kDone) {
+    // closing a running job aborts it, after which no more callbacks refer to the response
+    engine.api_adapter->CloseSpeech(job_id);
+    if (result == WaitResult::kCancelled) {
+      throw JobAborted(JobAborted::kCancelled);
+    }
+    if (result == WaitResult::kDeadlineExceeded) {
+      throw JobAborted(JobAborted::kDeadlineExceeded);
+    }
+    char m[64];
+    std::snprintf(m, 64, "TextToSpeech timed out after %u msec", kJobTimeoutMsec);
     throw std::runtime_error(m);
   }
 
-  WaitForSingleObject(event, INFINITE);
-  ResetEvent(event);
-  CloseHandle(event);
+  CountStage(param.mode_in_out == IOMODE_PLAIN_TO_WAVE ? kPlainStage : kWaveStage, started);
+  metrics_.chunks_per_job.Observe(response.chunks16());
 
   // finalize
-  if (ResultCode result = api_adapter_->CloseSpeech(job_id); result != ERR_SUCCESS) {
-    delete response;
-    throw std::runtime_error("wtf");
+  {
+    TraceSpan span("CloseSpeech", response.trace_job());
+    result = engine.api_adapter->CloseSpeech(job_id);
+  }
+  if (result != ERR_SUCCESS) {
+    throw ApiError("wtf", result);
   }
 
-  // write to output memory
-  vector<int16_t> buffer = response->End16();
-  *outsize = buffer.size() * 2;  // sizeof(int16_t) == 2
-  *outbytes = (int16_t*) malloc(buffer.size() * 2 + 1);
-  std::copy(buffer.begin(), buffer.end(), *outbytes);
-  *((char*) *outbytes + (buffer.size() * 2)) = '\0';
+  if (sink) {
+    *outbytes = nullptr;
+    *outsize = response.streamed16() * 2;  // sizeof(int16_t) == 2
+    engine.LearnOutputRate(inlen, response.streamed16());
+    return 0;
+  }
 
-  delete response;
+  // hand over the output memory
+  size_t samples;
+  *outbytes = response.End16(&samples);
+  *outsize = samples * 2;  // sizeof(int16_t) == 2
+  engine.LearnOutputRate(inlen, samples);
   return 0;
 }
 
-int Ebyroid::Convert(const ConvertParams& params,
-                     const unsigned char* inbytes,
-                     int16_t** outbytes,
-                     size_t* outsize) {
-  if (params.needs_reload) {
-    delete api_adapter_;
-    api_adapter_ = NewAdapter(params.base_dir, params.voice, params.volume);
+void Response::Write(char* bytes, uint32_t size) {
+  buffer_.Append((unsigned char*) bytes, size);
+}
+
+void Response::Write16(int16_t* shorts, uint32_t size) {
+  CountChunk(size);
+  if (sink_) {
+    if (size == 0) {
+      return;
+    }
+    sink_(shorts, size);
+    streamed16_ += size;
+    return;
   }
+  buffer_16_.Append(shorts, size);
+}
 
-  return Speech(inbytes, outbytes, outsize, IOMODE_PLAIN_TO_WAVE);
-};
+char* Response::Tail(uint32_t* room) noexcept {
+  try {
+    size_t spare;
+    char* tail = (char*) buffer_.Tail(kMinReadRoom, &spare);
+    *room = (uint32_t) std::min<size_t>(spare, UINT32_MAX);
+    return tail;
+  } catch (std::bad_alloc&) {
+    return nullptr;
+  }
+}
 
-void Response::Write(char* bytes, uint32_t size) {
-  buffer_.insert(std::end(buffer_), bytes, bytes + size);
+int16_t* Response::Tail16(uint32_t* room) noexcept {
+  if (sink_) {
+    *room = kScratchSamples;
+    return scratch_;
+  }
+  try {
+    size_t spare;
+    int16_t* tail = buffer_16_.Tail(kMinReadRoom, &spare);
+    *room = (uint32_t) std::min<size_t>(spare, UINT32_MAX);
+    return tail;
+  } catch (std::bad_alloc&) {
+    return nullptr;
+  }
 }
 
-void Response::Write16(int16_t* shorts, uint32_t size) {
-  buffer_16_.insert(std::end(buffer_16_), shorts, shorts + size);
+void Response::Commit(uint32_t size) {
+  buffer_.Commit(size);
 }
 
-vector<unsigned char> Response::End() {
-  return std::move(buffer_);
+void Response::Commit16(uint32_t size) {
+  CountChunk(size);
+  if (sink_) {
+    if (size > 0) {
+      sink_(scratch_, size);
+      streamed16_ += size;
+    }
+    return;
+  }
+  buffer_16_.Commit(size);
 }
 
-vector<int16_t> Response::End16() {
-  return std::move(buffer_16_);
+void Response::CountChunk(uint32_t size) {
+  if (size == 0) {
+    return;
+  }
+  chunks16_++;
+  if (chunk_bytes_ != nullptr) {
+    chunk_bytes_->Observe(size * 2);  // sizeof(int16_t) == 2
+  }
 }
 
-namespace {
+unsigned char* Response::End(size_t* size) {
+  return buffer_.Release(size);
+}
 
-ApiAdapter* NewAdapter(const string& base_dir, const string& voice, float volume) {
-  SettingsBuilder builder(base_dir, voice);
-  Settings settings = builder.Build();
+int16_t* Response::End16(size_t* size) {
+  return buffer_16_.Release(size);
+}
+
+namespace {
 
-  ApiAdapter* adapter = ApiAdapter::Create(settings.base_dir, settings.dll_path);
+ApiAdapter* NewAdapter(const Settings& settings,
+                       const string& dll_path,
+                       Padding* padding,
+                       std::unique_ptr<char[]>* param_buffer,
+                       LoadTimings* timings) {
+  ApiAdapter* adapter;
+  Clock::time_point started;
+  {
+    std::lock_guard<std::mutex> lock(process_mutex);
+    started = Clock::now();
+    adapter = ApiAdapter::Create(settings.base_dir, dll_path.c_str());
+    timings->library_usec += UsecSince(started);
+  }
 
   TConfig config;
   config.hz_voice_db = settings.frequency;
@@ -172,32 +744,47 @@ ApiAdapter* NewAdapter(const string& base_dir, const string& voice, float volume
   config.code_auth_seed = settings.seed;
   config.len_auth_seed = kLenSeedValue;
 
+  started = Clock::now();
   if (ResultCode result = adapter->Init(&config); result != ERR_SUCCESS) {
     delete adapter;
     string message = "API initialization failed with code ";
     message += std::to_string(result);
-    throw std::runtime_error(message);
+    throw ApiError(message, result);
   }
+  timings->init_usec = UsecSince(started);
 
-  auto [is_error, what] = WithDirecory(settings.base_dir, [adapter, settings]() {
+  std::unique_lock<std::mutex> lock(process_mutex);
+  started = Clock::now();
+  ResultCode lang_result = ERR_SUCCESS;
+  auto [is_error, what] = WithDirecory(settings.base_dir, [adapter, settings, &lang_result]() {
     if (ResultCode result = adapter->LangLoad(settings.language_dir); result != ERR_SUCCESS) {
+      lang_result = result;
       char m[64];
       std::snprintf(m, 64, "API LangLoad failed (could not load language) with code %d", result);
       return pair(true, string(m));
     }
     return pair(false, string());
   });
+  timings->lang_load_usec = UsecSince(started);
+  lock.unlock();
   if (is_error) {
     delete adapter;
+    if (lang_result != ERR_SUCCESS) {
+      throw ApiError(what, lang_result);
+    }
     throw std::runtime_error(what);
   }
 
+  started = Clock::now();
   if (ResultCode result = adapter->VoiceLoad(settings.voice_name); result != ERR_SUCCESS) {
     delete adapter;
     string message = "API Load Voice failed (Could not load voice data) with code ";
     message += std::to_string(result);
-    throw std::runtime_error(message);
+    throw ApiError(message, result);
   }
+  timings->voice_load_usec = UsecSince(started);
+
+  started = Clock::now();
 
   uint32_t param_size = 0;
   if (ResultCode result = adapter->GetParam((void*) 0, &param_size);
@@ -205,36 +792,42 @@ ApiAdapter* NewAdapter(const string& base_dir, const string& voice, float volume
     delete adapter;
     string message = "API Get Param failed (Could not acquire the size) with code ";
     message += std::to_string(result);
-    throw std::runtime_error(message);
+    throw ApiError(message, result);
   }
 
-  char* param_buffer = new char[param_size];
-  TTtsParam* param = (TTtsParam*) param_buffer;
+  param_buffer->reset(new char[param_size]);
+  TTtsParam* param = (TTtsParam*) param_buffer->get();
   param->size = param_size;
   if (ResultCode result = adapter->GetParam(param, &param_size); result != ERR_SUCCESS) {
-    delete[] param_buffer;
     delete adapter;
     string message = "API Get Param failed with code ";
     message += std::to_string(result);
-    throw std::runtime_error(message);
+    throw ApiError(message, result);
   }
   param->extend_format = BOTH;
   param->proc_text_buf = HiraganaCallback;
   param->proc_raw_buf = SpeechCallback;
   param->proc_event_tts = nullptr;
   param->len_raw_buf_bytes = kConfigRawbufSize;
-  param->volume = volume;
+  // engines render at unity gain so that every volume can share them, the volume of a job is
+  // applied to its PCM afterwards
+  param->volume = 1.0;
   param->speaker[0].volume = 1.0;
 
   if (ResultCode result = adapter->SetParam(param); result != ERR_SUCCESS) {
-    delete[] param_buffer;
     delete adapter;
     string message = "API Set Param failed with code ";
     message += std::to_string(result);
-    throw std::runtime_error(message);
+    throw ApiError(message, result);
   }
 
-  delete[] param_buffer;
+  timings->param_usec = UsecSince(started);
+
+  auto samples_of = [&settings](int32_t msec) {
+    return (uint32_t)((uint64_t) settings.frequency * std::max(msec, 0) / 1000);
+  };
+  padding->begin = samples_of(param->pause_begin);
+  padding->term = samples_of(param->pause_term);
 
   return adapter;
 }
@@ -248,26 +841,25 @@ int __stdcall HiraganaCallback(EventReasonCode reason_code, int32_t job_id, IntP
     return 0;
   }
 
-  static constexpr int kBufferSize = 0x1000;
-  char* buffer = new char[kBufferSize];
+  // let the engine write straight into the output
   while (true) {
-    uint32_t size, pos;
-    if (ResultCode result = api_adapter->GetKana(job_id, buffer, kBufferSize, &size, &pos);
+    uint32_t room, size, pos;
+    char* tail = response->Tail(&room);
+    if (tail == nullptr) {
+      break;
+    }
+    if (ResultCode result = api_adapter->GetKana(job_id, tail, room, &size, &pos);
         result != ERR_SUCCESS) {
       break;
     }
-    response->Write(buffer, size);
-    if (kBufferSize > size) {
+    response->Commit(size);
+    if (room > size) {
       break;
     }
   }
-  delete[] buffer;
 
   if (reason_code == TEXTBUF_CLOSE) {
-    char eventname[32];
-    sprintf(eventname, "TTKLOCK:%p", response);
-    HANDLE event = OpenEventA(EVENT_ALL_ACCESS, FALSE, eventname);
-    SetEvent(event);
+    response->completion().Signal();
   }
   return 0;
 }
@@ -283,55 +875,130 @@ int __stdcall SpeechCallback(EventReasonCode reason_code,
     // unexpected: may possibly lead to memory leak
     return 0;
   }
+  const uint64_t trace_begin = Tracer::enabled() ? Tracer::Now() : 0;
+  uint32_t samples = 0;
 
-  static constexpr int kBufferSize = 0xFFFF;
-  int16_t* buffer = new int16_t[kBufferSize];
+  // let the engine write straight into the output (or the scratch area when streaming)
   while (true) {
-    uint32_t size, pos;
-    if (ResultCode result = api_adapter->GetData(job_id, buffer, kBufferSize, &size);
+    uint32_t room, size;
+    int16_t* tail = response->Tail16(&room);
+    if (tail == nullptr) {
+      break;
+    }
+    if (ResultCode result = api_adapter->GetData(job_id, tail, room, &size);
         result != ERR_SUCCESS) {
       break;
     }
-    response->Write16(buffer, size);
-    if (kBufferSize > size) {
+    response->Commit16(size);
+    samples += size;
+    if (room > size) {
       break;
     }
   }
-  delete[] buffer;
 
+  // (before signaling, after which the response may be gone)
+  if (trace_begin != 0) {
+    Tracer::Complete("SpeechCallback",
+                     trace_begin,
+                     response->trace_job(),
+                     "reason",
+                     reason_code,
+                     "bytes",
+                     samples * 2);
+  }
   if (reason_code == RAWBUF_CLOSE) {
-    char eventname[32];
-    sprintf(eventname, "TTSLOCK:%p", response);
-    HANDLE event = OpenEventA(EVENT_ALL_ACCESS, FALSE, eventname);
-    SetEvent(event);
+    response->completion().Signal();
   }
   return 0;
 }
 
+uint64_t UsecSince(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count();
+}
+
+string CopyLibrary(const string& path) {
+  namespace fs = std::filesystem;
+  static std::atomic<uint32_t> sequence{0};
+
+  // unique per process and per copy, e.g. /tmp/ebyroid-1234-1-aitalked.so
+  char prefix[64];
+  std::snprintf(prefix, 64, "ebyroid-%lu-%u-", platform::CurrentProcessId(), ++sequence);
+  fs::path copy = fs::temp_directory_path() / (prefix + fs::path(path).filename().string());
+
+  std::error_code error;
+  if (bool ok = fs::copy_file(path, copy, fs::copy_options::overwrite_existing, error); !ok) {
+    string message = "Could not copy " + path + " to " + copy.string() + " (" + error.message();
+    message += ")";
+    throw std::runtime_error(message);
+  }
+  return copy.string();
+}
+
+int16_t* WorkerScratch() {
+  // the thread that waits on a job lends its scratch to the job's callbacks
+  thread_local std::unique_ptr<int16_t[]> scratch(new int16_t[kScratchSamples]);
+  return scratch.get();
+}
+
+void ThrowIfAborted(const ConvertParams& params) {
+  if (params.cancel != nullptr && params.cancel->cancelled()) {
+    throw JobAborted(JobAborted::kCancelled);
+  }
+  if (std::chrono::steady_clock::now() >= params.deadline) {
+    throw JobAborted(JobAborted::kDeadlineExceeded);
+  }
+}
+
+WaitResult WaitForJob(Completion& completion, const ConvertParams& params) {
+  using std::chrono::steady_clock;
+  steady_clock::time_point timeout =
+      steady_clock::now() + std::chrono::milliseconds(kJobTimeoutMsec);
+  steady_clock::time_point until = std::min(timeout, params.deadline);
+
+  if (params.cancel != nullptr && !params.cancel->Attach(&completion)) {
+    return WaitResult::kCancelled;
+  }
+  bool signaled = completion.WaitUntil(until);
+  if (params.cancel != nullptr) {
+    params.cancel->Detach(&completion);
+    if (params.cancel->cancelled()) {
+      return WaitResult::kCancelled;
+    }
+  }
+
+  if (signaled) {
+    return WaitResult::kDone;
+  }
+  return until < timeout ? WaitResult::kDeadlineExceeded : WaitResult::kTimedOut;
+}
+
 inline pair<bool, string> WithDirecory(const char* dir, function<pair<bool, string>(void)> yield) {
-  static constexpr size_t kErrMax = 64 + MAX_PATH;
-  char org[MAX_PATH];
-  if (DWORD result = GetCurrentDirectoryA(MAX_PATH, org); result == 0) {
-    char m[64];
-    std::snprintf(m, 64, "Could not get the current directory.\n\tErrorNo = %d", GetLastError());
+  static constexpr size_t kErrMax = 64 + platform::kMaxPath;
+  char org[platform::kMaxPath];
+  if (bool ok = platform::GetWorkingDirectory(org, platform::kMaxPath); !ok) {
+    char m[kErrMax];
+    std::snprintf(m,
+                  kErrMax,
+                  "Could not get the current directory.\n\tError: %s",
+                  platform::DescribeLastError().c_str());
     return pair(true, string(m));
   }
-  if (BOOL result = SetCurrentDirectoryA(dir); !result) {
+  if (bool ok = platform::SetWorkingDirectory(dir); !ok) {
     char m[kErrMax];
     std::snprintf(m,
                   kErrMax,
-                  "Could not change directory.\n\tErrorNo = %d\n\tTarget path: %s",
-                  GetLastError(),
+                  "Could not change directory.\n\tError: %s\n\tTarget path: %s",
+                  platform::DescribeLastError().c_str(),
                   dir);
     return pair(true, string(m));
   }
   auto [is_error, what] = yield();
-  if (BOOL result = SetCurrentDirectoryA(org); !result && !is_error) {
+  if (bool ok = platform::SetWorkingDirectory(org); !ok && !is_error) {
     char m[kErrMax];
     std::snprintf(m,
                   kErrMax,
-                  "Could not change directory.\n\tErrorNo = %d\n\tTarget path: %s",
-                  GetLastError(),
+                  "Could not change directory.\n\tError: %s\n\tTarget path: %s",
+                  platform::DescribeLastError().c_str(),
                   org);
     return pair(true, string(m));
   }
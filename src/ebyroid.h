@@ -1,54 +1,299 @@
 #ifndef EBYROID_H
 #define EBYROID_H
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "completion.h"
+#include "kana_cache.h"
+#include "metrics.h"
+#include "output_buffer.h"
+#include "tracer.h"
+
 namespace ebyroid {
 
+// how long a single engine job may take before it is given up on
+static constexpr uint32_t kJobTimeoutMsec = 60000;
+
+// the least room offered to the engine per GetData/GetKana call
+static constexpr uint32_t kMinReadRoom = 0x2000;
+
+// size of the per-worker landing area for streamed PCM
+static constexpr uint32_t kScratchSamples = 0xFFFF;
+
 // forward-declaration to avoid including api_adapter.h
 class ApiAdapter;
 
+/**
+ * Receives PCM as soon as the engine hands it over. Called on the engine's callback thread.
+ */
+typedef std::function<void(const int16_t* shorts, size_t size)> PcmSink;
+
+/**
+ * How the voice speaks in a job, overriding the voice's own settings. Any field that is negative
+ * keeps the voice's own setting. Pauses are in msec.
+ */
+struct Prosody {
+  float speed = -1.0f;
+  float pitch = -1.0f;
+  float range = -1.0f;
+  int32_t pause_middle = -1;
+  int32_t pause_long = -1;
+  int32_t pause_sentence = -1;
+};
+
+/**
+ * Which engine a job goes to. Without `voice` (and `base_dir`) it goes to the most recently used.
+ * `needs_reload` throws away the resident engine of the voice and loads it afresh.
+ * Convert() resamples its output to `sample_rate`, unless it is 0 or the engine's own rate.
+ * Synthesis follows `prosody`, unless it is null and the voice speaks as it would by itself.
+ * The job is given up on with JobAborted once `cancel` (if any) is cancelled or `deadline` passes.
+ */
 struct ConvertParams {
   bool needs_reload;
   char* base_dir;
   char* voice;
-  float volume;
+  uint32_t sample_rate;
+  const Prosody* prosody;
+  CancelToken* cancel;
+  std::chrono::steady_clock::time_point deadline;
 };
 
+/**
+ * Thrown when a job is given up on at the caller's request, as opposed to failing.
+ */
+class JobAborted : public std::runtime_error {
+ public:
+  enum Reason { kCancelled, kDeadlineExceeded };
+
+  explicit JobAborted(Reason reason)
+      : std::runtime_error(reason == kCancelled ? "The job has been cancelled"
+                                                : "The job has exceeded its deadline"),
+        reason_(reason) {}
+  Reason reason() const { return reason_; }
+
+ private:
+  Reason reason_;
+};
+
+/**
+ * Thrown when the engine fails a call, with the ResultCode it failed with.
+ */
+class ApiError : public std::runtime_error {
+ public:
+  ApiError(const std::string& what, int32_t result) : std::runtime_error(what), result_(result) {}
+  int32_t result() const { return result_; }
+
+ private:
+  int32_t result_;
+};
+
+/**
+ * What Convert() takes off its output, so that consecutive pieces of a text join up just like the
+ * whole text would come out: the silence the engine puts before and after the output of each job.
+ */
+enum TrimFlags : uint32_t { kTrimNone = 0, kTrimBegin = 1, kTrimTerm = 2 };
+
+/**
+ * How much engine time each kind of job has taken, from starting the job to its completion.
+ */
+struct StageStats {
+  // text to AI Kana (language analysis)
+  uint64_t kana_jobs;
+  uint64_t kana_usec;
+  // AI Kana to wave (synthesis)
+  uint64_t wave_jobs;
+  uint64_t wave_usec;
+  // text to wave in one go
+  uint64_t plain_jobs;
+  uint64_t plain_usec;
+  // lookups of the kana cache by two-stage conversions
+  uint64_t kana_hits;
+  uint64_t kana_misses;
+};
+
+/**
+ * How long each stage of loading an engine took. Loads of different voices run side by side, except
+ * for loading the library and the language, which change state of the whole process and thus wait
+ * for each other. `total_usec` includes that waiting, while the stages do not.
+ */
+struct LoadTimings {
+  // false if the engine was resident already, in which case the rest is all 0
+  bool loaded;
+  // copying the library if need be, and loading it
+  uint64_t library_usec;
+  // _AITalkAPI_Init, LangLoad and VoiceLoad
+  uint64_t init_usec;
+  uint64_t lang_load_usec;
+  uint64_t voice_load_usec;
+  // GetParam and SetParam
+  uint64_t param_usec;
+  uint64_t total_usec;
+};
+
+/**
+ * A pool of resident engines, one per voice library, each on a private instance of the engine
+ * library so that they never share its global state. Jobs for different voices run side by side
+ * and switching voices costs nothing once both are resident.
+ */
 class Ebyroid {
  public:
   Ebyroid(const Ebyroid&) = delete;
   Ebyroid(Ebyroid&&) = delete;
   ~Ebyroid();
 
-  static Ebyroid* Create(const std::string& base_dir, const std::string& voice, float volume);
-  int Hiragana(const unsigned char* inbytes, unsigned char** outbytes, size_t* outsize);
-  int Speech(const unsigned char* inbytes, int16_t** outbytes, size_t* outsize, uint32_t mode = 0u);
+  // `max_engines` caps how many engines are resident at once (0 for no cap), the least recently
+  // used one is evicted to make room for another.
+  // with `kana_cache_size` > 0, Convert() runs in two stages, text to AI Kana and AI Kana to wave,
+  // and caches up to that many results of the first per install directory, which holds the
+  // language database. Text seen before then skips language analysis, whatever the voice.
+  static Ebyroid* Create(const std::string& base_dir,
+                         const std::string& voice,
+                         size_t max_engines = 0,
+                         size_t kana_cache_size = 0);
+  // the same, with no engine loaded yet. Jobs fail until one is, see Preload()
+  static Ebyroid* Create(size_t max_engines = 0, size_t kana_cache_size = 0);
+  // loads the engine of the voice unless it is resident, which may take seconds. safe to call from
+  // several threads at once, which load different voices side by side. `timings` may be null
+  void Preload(const std::string& base_dir, const std::string& voice, LoadTimings* timings);
+  int Hiragana(const ConvertParams& params,
+               const unsigned char* inbytes,
+               unsigned char** outbytes,
+               size_t* outsize);
+  // with a sink, PCM is not buffered: *outbytes gets nullptr and *outsize the total bytes streamed
+  int Speech(const ConvertParams& params,
+             const unsigned char* inbytes,
+             int16_t** outbytes,
+             size_t* outsize,
+             uint32_t mode = 0u,
+             const PcmSink& sink = nullptr);
+  // `trim` is a combination of TrimFlags, which only applies to output that is not streamed
   int Convert(const ConvertParams& params,
               const unsigned char* inbytes,
               int16_t** outbytes,
-              size_t* outsize);
+              size_t* outsize,
+              const PcmSink& sink = nullptr,
+              uint32_t trim = kTrimNone);
+
+  // the rate of what the engine for the params puts out, loading it if need be
+  uint32_t SampleRate(const ConvertParams& params);
+
+  // how many times an engine has been loaded, including the first one
+  uint64_t engine_loads() const { return engine_loads_; };
+  StageStats stage_stats() const;
+  // everything that goes on in the pool, and whatever else its user wants to count along with it
+  Metrics& metrics() { return metrics_; }
 
  private:
-  Ebyroid(ApiAdapter* api_adapter) : api_adapter_(api_adapter) {}
-  ApiAdapter* api_adapter_;
+  struct Engine;
+
+  Ebyroid(size_t max_engines, size_t kana_cache_size);
+  std::shared_ptr<Engine> Recent();
+  std::shared_ptr<Engine> Acquire(const ConvertParams& params);
+  std::shared_ptr<Engine> Acquire(const std::string& base_dir,
+                                  const std::string& voice,
+                                  bool reload,
+                                  LoadTimings* timings);
+  std::shared_ptr<Engine> Load(const std::string& base_dir,
+                               const std::string& voice,
+                               LoadTimings* timings);
+  // true if the library may be loaded as it is, which it then is until ReleaseLibrary()
+  bool ClaimLibrary(const std::string& library_path);
+  void ReleaseLibrary(const std::string& library_path);
+  void CountStage(Stage stage, std::chrono::steady_clock::time_point started);
+  static void TrimPadding(const Engine& engine, uint32_t trim, int16_t* pcm, size_t* size);
+  void Synthesize(Engine& engine,
+                  const ConvertParams& params,
+                  const unsigned char* inbytes,
+                  int16_t** outbytes,
+                  size_t* outsize,
+                  const PcmSink& sink);
+  int Hiragana(Engine& engine,
+               const ConvertParams& params,
+               const unsigned char* inbytes,
+               unsigned char** outbytes,
+               size_t* outsize);
+  int Speech(Engine& engine,
+             const ConvertParams& params,
+             const unsigned char* inbytes,
+             int16_t** outbytes,
+             size_t* outsize,
+             uint32_t mode,
+             const PcmSink& sink);
+
+  const size_t max_engines_;
+  // guards engines_, evicted_, loading_ and claimed_libraries_
+  std::mutex mutex_;
+  // resident engines, the most recently used first
+  std::list<std::shared_ptr<Engine>> engines_;
+  // evicted engines that may still be finishing their last jobs
+  std::vector<std::weak_ptr<Engine>> evicted_;
+  // engines being loaded by their keys, which whoever else wants them waits for
+  std::map<std::string, std::shared_future<std::shared_ptr<Engine>>> loading_;
+  // libraries being loaded as they are (not copied)
+  std::vector<std::string> claimed_libraries_;
+  std::atomic<uint64_t> engine_loads_{0};
+  // null unless Convert() runs in two stages
+  const std::unique_ptr<KanaCache> kana_cache_;
+  Metrics metrics_;
 };
 
 class Response {
  public:
-  Response(ApiAdapter* adapter) : api_adapter_(adapter) {}
+  // every chunk of PCM that the engine hands over is observed into `chunk_bytes`, unless null
+  Response(ApiAdapter* adapter,
+           const PcmSink& sink = nullptr,
+           int16_t* scratch = nullptr,
+           Histogram* chunk_bytes = nullptr)
+      : api_adapter_(adapter),
+        sink_(sink),
+        scratch_(scratch),
+        chunk_bytes_(chunk_bytes),
+        trace_job_(Tracer::job()) {}
   void Write(char* bytes, uint32_t size);
   void Write16(int16_t* shorts, uint32_t size);
-  std::vector<unsigned char> End();
-  std::vector<int16_t> End16();
+  // room for the engine to write into directly, whatever it wrote is to be Commit()ed.
+  // returns nullptr if no room could be made.
+  char* Tail(uint32_t* room) noexcept;
+  int16_t* Tail16(uint32_t* room) noexcept;
+  void Commit(uint32_t size);
+  void Commit16(uint32_t size);
+  void Reserve(size_t size) { buffer_.Reserve(size); };
+  void Reserve16(size_t size) { buffer_16_.Reserve(size); };
+  // the returned memory belongs to the caller, who frees it with free()
+  unsigned char* End(size_t* size);
+  int16_t* End16(size_t* size);
+  size_t streamed16() { return streamed16_; };
+  // how many chunks of PCM the engine has handed over
+  size_t chunks16() { return chunks16_; };
+  // the job that the response is for, to trace callbacks on the engine's threads by
+  uint32_t trace_job() { return trace_job_; };
   ApiAdapter* api_adapter() { return api_adapter_; };
+  Completion& completion() { return completion_; };
 
  private:
+  void CountChunk(uint32_t size);
+
   ApiAdapter* api_adapter_;
-  std::vector<unsigned char> buffer_;
-  std::vector<int16_t> buffer_16_;
+  Completion completion_;
+  OutputBuffer<unsigned char> buffer_;
+  OutputBuffer<int16_t> buffer_16_;
+  PcmSink sink_;
+  int16_t* scratch_;
+  Histogram* chunk_bytes_;
+  const uint32_t trace_job_;
+  size_t streamed16_ = 0;
+  size_t chunks16_ = 0;
 };
 
 }  // namespace ebyroid
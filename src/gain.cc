@@ -0,0 +1,164 @@
+#include "gain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "simd.h"
+
+namespace ebyroid {
+
+namespace {
+
+constexpr int kGainShift = 12;
+
+typedef void (*GainProc)(const int16_t* in, size_t n, int16_t gain, int16_t* out);
+
+struct Levels {
+  // the largest magnitude, up to 32768
+  uint32_t peak;
+  uint64_t sum_of_squares;
+};
+
+typedef void (*MeasureProc)(const int16_t* pcm, size_t n, Levels* levels);
+
+void GainScalar(const int16_t* in, size_t n, int16_t gain, int16_t* out) {
+  for (size_t i = 0; i < n; i++) {
+    int32_t sample = ((int32_t) in[i] * gain + (1 << (kGainShift - 1))) >> kGainShift;
+    out[i] = (int16_t) std::min(std::max(sample, (int32_t) INT16_MIN), (int32_t) INT16_MAX);
+  }
+}
+
+void MeasureScalar(const int16_t* pcm, size_t n, Levels* levels) {
+  for (size_t i = 0; i < n; i++) {
+    int32_t sample = pcm[i];
+    levels->peak = std::max(levels->peak, (uint32_t) std::abs(sample));
+    levels->sum_of_squares += (uint64_t) (sample * sample);
+  }
+}
+
+#ifdef EBYROID_X86
+
+EBYROID_TARGET("sse2") void GainSse2(const int16_t* in, size_t n, int16_t gain, int16_t* out) {
+  const __m128i gains = _mm_set1_epi16(gain);
+  const __m128i round = _mm_set1_epi32(1 << (kGainShift - 1));
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    // 32bit products, rounded back to Q0 and packed with saturation
+    __m128i lo = _mm_mullo_epi16(x, gains);
+    __m128i hi = _mm_mulhi_epi16(x, gains);
+    __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), kGainShift);
+    __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), kGainShift);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(p0, p1));
+  }
+  GainScalar(in + i, n - i, gain, out + i);
+}
+
+EBYROID_TARGET("avx2") void GainAvx2(const int16_t* in, size_t n, int16_t gain, int16_t* out) {
+  const __m256i gains = _mm256_set1_epi16(gain);
+  const __m256i round = _mm256_set1_epi32(1 << (kGainShift - 1));
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i lo = _mm256_mullo_epi16(x, gains);
+    __m256i hi = _mm256_mulhi_epi16(x, gains);
+    // unpacking and packing both work within 128bit lanes, which keeps the samples in order
+    __m256i p0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), round);
+    __m256i p1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), round);
+    p0 = _mm256_srai_epi32(p0, kGainShift);
+    p1 = _mm256_srai_epi32(p1, kGainShift);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_packs_epi32(p0, p1));
+  }
+  GainScalar(in + i, n - i, gain, out + i);
+}
+
+EBYROID_TARGET("sse2") void MeasureSse2(const int16_t* pcm, size_t n, Levels* levels) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i high = _mm_set1_epi16(INT16_MIN);
+  __m128i low = _mm_set1_epi16(INT16_MAX);
+  __m128i squares = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pcm + i));
+    high = _mm_max_epi16(high, x);
+    low = _mm_min_epi16(low, x);
+    // a pair of squares takes up to 2^31, which fits the 32bit lanes if read as unsigned
+    __m128i pairs = _mm_madd_epi16(x, x);
+    squares = _mm_add_epi64(squares, _mm_unpacklo_epi32(pairs, zero));
+    squares = _mm_add_epi64(squares, _mm_unpackhi_epi32(pairs, zero));
+  }
+  if (i > 0) {
+    int16_t highs[8], lows[8];
+    uint64_t sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(highs), high);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lows), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), squares);
+    for (int k = 0; k < 8; k++) {
+      levels->peak = std::max(levels->peak, (uint32_t) std::abs((int32_t) highs[k]));
+      levels->peak = std::max(levels->peak, (uint32_t) std::abs((int32_t) lows[k]));
+    }
+    levels->sum_of_squares += sums[0] + sums[1];
+  }
+  MeasureScalar(pcm + i, n - i, levels);
+}
+
+#endif  // EBYROID_X86
+
+GainProc GainOfCpu() {
+#ifdef EBYROID_X86
+  switch (CpuSimdLevel()) {
+    case kSimdAvx2:
+      return GainAvx2;
+    case kSimdSse2:
+      return GainSse2;
+    default:
+      break;
+  }
+#endif
+  return GainScalar;
+}
+
+MeasureProc MeasureOfCpu() {
+#ifdef EBYROID_X86
+  // AVX2 would not be much faster, as the loop is bound by horizontal bookkeeping anyway
+  if (CpuSimdLevel() >= kSimdSse2) {
+    return MeasureSse2;
+  }
+#endif
+  return MeasureScalar;
+}
+
+}  // namespace
+
+void ApplyGain(const int16_t* in, size_t n, float gain, int16_t* out) {
+  if (gain == 1.0f) {
+    if (in != out) {
+      std::memmove(out, in, n * sizeof(int16_t));
+    }
+    return;
+  }
+  static const GainProc proc = GainOfCpu();
+  gain = std::min(std::max(gain, 0.0f), kMaxGain);
+  proc(in, n, (int16_t) std::lround(gain * (1 << kGainShift)), out);
+}
+
+float NormalizingGain(const int16_t* pcm, size_t n, Normalization mode, float target_dbfs) {
+  if (mode == kNormalizeNone || n == 0) {
+    return 1.0f;
+  }
+  static const MeasureProc measure = MeasureOfCpu();
+  Levels levels = {};
+  measure(pcm, n, &levels);
+
+  double level = mode == kNormalizePeak ? (double) levels.peak
+                                        : std::sqrt((double) levels.sum_of_squares / n);
+  if (level < 1.0) {
+    return 1.0f;
+  }
+  double target = std::pow(10.0, target_dbfs / 20.0) * 32768.0;
+  return (float) std::min(target / level, (double) kMaxGain);
+}
+
+}  // namespace ebyroid
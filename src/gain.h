@@ -0,0 +1,28 @@
+#ifndef GAIN_H
+#define GAIN_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ebyroid {
+
+// ApplyGain() works in Q12 fixed point, which takes gains below 8
+static constexpr float kMaxGain = 32767.0f / 4096.0f;
+
+enum Normalization : uint32_t { kNormalizeNone = 0, kNormalizePeak = 1, kNormalizeRms = 2 };
+
+/**
+ * Multiplies `n` samples by `gain` (0 to kMaxGain) into `out`, saturating rather than wrapping
+ * around. `out` may be `in`.
+ */
+void ApplyGain(const int16_t* in, size_t n, float gain, int16_t* out);
+
+/**
+ * The gain that brings the peak or the RMS of the samples to `target_dbfs`, with 0 dBFS being a
+ * full-scale square wave. Capped at kMaxGain, and 1.0 for silence.
+ */
+float NormalizingGain(const int16_t* pcm, size_t n, Normalization mode, float target_dbfs);
+
+}  // namespace ebyroid
+
+#endif  // GAIN_H
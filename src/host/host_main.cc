@@ -0,0 +1,372 @@
+// An engine host: a process of its own that runs the jobs of one voice for the native module, so
+// that the engine gets the whole process to itself and a crash takes down nothing but the host.
+// The module spawns it (see src/host_pool.h) as
+//
+//   ebyroid_host <ring name> <ring bytes> <kana cache size> <pipe in> <pipe out>
+//
+// and sends jobs down the first pipe, see src/host_protocol.h. PCM goes back through the shared
+// ring, and everything else through the second pipe. The host exits once the first pipe closes.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../api_adapter.h"
+#include "../ebyroid.h"
+#include "../ebyutil.h"
+#include "../host_protocol.h"
+#include "../metrics.h"
+#include "../platform.h"
+#include "../shared_ring.h"
+
+using namespace ebyroid;
+
+namespace {
+
+// what `histogram` has counted since `last`, which it is then brought up to
+void Advance(const Histogram& histogram, HostHistogram* last, HostHistogram* delta) {
+  Histogram::Snapshot now = histogram.snapshot();
+  for (size_t i = 0; i < now.counts.size(); i++) {
+    delta->counts[i] = now.counts[i] - last->counts[i];
+    last->counts[i] = now.counts[i];
+  }
+  delta->sum = now.sum - last->sum;
+  last->sum = now.sum;
+}
+
+void Advance(uint64_t now, uint64_t* last, uint64_t* delta) {
+  *delta = now - *last;
+  *last = now;
+}
+
+struct Job {
+  uint32_t id;
+  HostJob job;
+  std::string base_dir;
+  std::string voice;
+  std::string input;
+  std::chrono::steady_clock::time_point deadline;
+  CancelToken cancel;
+};
+
+class Host {
+ public:
+  Host(SharedRing* ring, size_t kana_cache_size, platform::PipeHandle in, platform::PipeHandle out)
+      : ring_(ring), pool_(Ebyroid::Create(0, kana_cache_size)), in_(in), out_(out) {}
+
+  // reads jobs until the pipe closes, then gives up on what is left and waits for it
+  void Run();
+
+ private:
+  // sends a message of `head` and `tail` as its payload. the caller holds `write_mutex_`
+  bool Send(uint32_t type,
+            uint32_t id,
+            const void* head,
+            size_t head_size,
+            const void* tail,
+            size_t tail_size);
+  // sends a message of `head`, which starts with the HostBlock that `data` goes into
+  bool SendBlock(uint32_t type,
+                 uint32_t id,
+                 void* head,
+                 size_t head_size,
+                 const void* data,
+                 size_t size);
+  void Work();
+  void RunJob(Job& job);
+  void Execute(Job& job, HostResult* result, std::string* output);
+  // what the metrics of the pool have counted since the last report
+  void Report(HostMetrics* report);
+
+  const std::unique_ptr<SharedRing> ring_;
+  const std::unique_ptr<Ebyroid> pool_;
+  const platform::PipeHandle in_;
+  const platform::PipeHandle out_;
+  // set once the front has gone away, so that nothing waits for it any more
+  std::atomic<bool> abandoned_{false};
+  // guards writes to `out_` and the ring
+  std::mutex write_mutex_;
+  // guards the rest
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Job*> pending_;
+  std::map<uint32_t, std::unique_ptr<Job>> jobs_;
+  bool stopping_ = false;
+  // guards what has been reported so far
+  std::mutex report_mutex_;
+  HostMetrics reported_ = {};
+};
+
+bool Host::Send(uint32_t type,
+                uint32_t id,
+                const void* head,
+                size_t head_size,
+                const void* tail,
+                size_t tail_size) {
+  HostMessage message = {type, id, (uint32_t)(head_size + tail_size)};
+  // what went into the ring is there before the front hears of it
+  std::atomic_thread_fence(std::memory_order_release);
+  bool sent = platform::WritePipe(out_, &message, sizeof(message)) &&
+              platform::WritePipe(out_, head, head_size) &&
+              (tail_size == 0 || platform::WritePipe(out_, tail, tail_size));
+  if (!sent) {
+    abandoned_ = true;
+  }
+  return sent;
+}
+
+bool Host::SendBlock(uint32_t type,
+                     uint32_t id,
+                     void* head,
+                     size_t head_size,
+                     const void* data,
+                     size_t size) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  HostBlock* block = (HostBlock*) head;
+  block->size = (uint32_t) size;
+  block->inlined = 0;
+  if (size > 0 && ring_->Reserve((uint32_t) size, &block->position, abandoned_)) {
+    std::memcpy(ring_->At(block->position), data, size);
+    return Send(type, id, head, head_size, nullptr, 0);
+  }
+  if (abandoned_) {
+    return false;
+  }
+  // larger than the ring, which is rare enough to go through the pipe
+  block->position = 0;
+  block->inlined = 1;
+  return Send(type, id, head, head_size, data, size);
+}
+
+void Host::Run() {
+  std::vector<std::thread> workers;
+  for (uint32_t i = 0; i < kMaxConcurrentJobs; i++) {
+    workers.emplace_back(&Host::Work, this);
+  }
+
+  std::string payload;
+  for (;;) {
+    HostMessage message;
+    if (!platform::ReadPipe(in_, &message, sizeof(message))) {
+      break;
+    }
+    payload.resize(message.size);
+    if (message.size > 0 && !platform::ReadPipe(in_, &payload[0], message.size)) {
+      break;
+    }
+
+    if (message.type == kHostCancel) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (auto found = jobs_.find(message.id); found != jobs_.end()) {
+        found->second->cancel.Cancel();
+      }
+      continue;
+    }
+    if (message.type != kHostJob || payload.size() < sizeof(HostJob)) {
+      Eprintf("Unexpected message of type %u from the front", message.type);
+      break;
+    }
+
+    auto job = std::make_unique<Job>();
+    job->id = message.id;
+    std::memcpy(&job->job, payload.data(), sizeof(HostJob));
+    const char* p = payload.data() + sizeof(HostJob);
+    const char* end = payload.data() + payload.size();
+    std::string* strings[] = {&job->base_dir, &job->voice, &job->input};
+    for (std::string* s : strings) {
+      const char* nul = (const char*) std::memchr(p, '\0', end - p);
+      if (nul == nullptr) {
+        nul = end;
+      }
+      s->assign(p, nul - p);
+      p = nul < end ? nul + 1 : end;
+    }
+    job->deadline = job->job.timeout_msec == 0
+                        ? std::chrono::steady_clock::time_point::max()
+                        : std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(job->job.timeout_msec);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(job.get());
+    jobs_[message.id] = std::move(job);
+    cv_.notify_one();
+  }
+
+  // the front is gone, or going: nobody is to get the results of what is left
+  abandoned_ = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    for (auto& entry : jobs_) {
+      entry.second->cancel.Cancel();
+    }
+    cv_.notify_all();
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void Host::Work() {
+  for (;;) {
+    Job* job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      job = pending_.front();
+      pending_.pop_front();
+    }
+    RunJob(*job);
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.erase(job->id);
+  }
+}
+
+void Host::RunJob(Job& job) {
+  HostResult result = {};
+  std::string output;
+  std::string error;
+  try {
+    Execute(job, &result, &output);
+    result.status = kHostOk;
+  } catch (JobAborted& e) {
+    result.status =
+        e.reason() == JobAborted::kCancelled ? kHostCancelled : kHostDeadlineExceeded;
+    error = e.what();
+  } catch (ApiError& e) {
+    result.status = kHostApiError;
+    result.result = e.result();
+    error = e.what();
+  } catch (std::exception& e) {
+    result.status = kHostFailed;
+    error = e.what();
+  }
+  Report(&result.metrics);
+
+  if (result.status != kHostOk) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    Send(kHostDone, job.id, &result, sizeof(result), error.c_str(), error.size());
+    return;
+  }
+  SendBlock(kHostDone, job.id, &result, sizeof(result), output.data(), output.size());
+}
+
+void Host::Execute(Job& job, HostResult* result, std::string* output) {
+  ConvertParams params;
+  params.needs_reload = (job.job.flags & kHostReload) != 0;
+  params.base_dir = &job.base_dir[0];
+  params.voice = &job.voice[0];
+  params.sample_rate = job.job.sample_rate;
+  params.prosody = (job.job.flags & kHostProsody) != 0 ? &job.job.prosody : nullptr;
+  params.cancel = &job.cancel;
+  params.deadline = job.deadline;
+  const unsigned char* input = (const unsigned char*) job.input.c_str();
+
+  PcmSink sink = nullptr;
+  if ((job.job.flags & kHostStream) != 0) {
+    sink = [this, &job, result](const int16_t* shorts, size_t size) {
+      HostBlock block;
+      if (!SendBlock(kHostChunk, job.id, &block, sizeof(block), shorts, size * 2)) {
+        job.cancel.Cancel();
+      }
+      result->streamed += size * 2;
+    };
+  }
+
+  switch (job.job.type) {
+    case kHostLoad: {
+      pool_->Preload(job.base_dir, job.voice, &result->timings);
+      result->value = pool_->SampleRate(params);
+      break;
+    }
+    case kHostHiragana: {
+      unsigned char* out = nullptr;
+      size_t size = 0;
+      result->value = pool_->Hiragana(params, input, &out, &size);
+      output->assign((const char*) out, size);
+      std::free(out);
+      break;
+    }
+    case kHostSpeech:
+    case kHostConvert: {
+      int16_t* out = nullptr;
+      size_t size = 0;
+      if (job.job.type == kHostSpeech) {
+        result->value = pool_->Speech(params, input, &out, &size, job.job.mode, sink);
+      } else {
+        result->value = pool_->Convert(params, input, &out, &size, sink, job.job.trim);
+      }
+      if (out != nullptr) {
+        output->assign((const char*) out, size);
+        std::free(out);
+      }
+      break;
+    }
+    default:
+      throw std::runtime_error("Unknown type of job " + std::to_string(job.job.type));
+  }
+}
+
+void Host::Report(HostMetrics* report) {
+  Metrics& metrics = pool_->metrics();
+  std::lock_guard<std::mutex> lock(report_mutex_);
+  for (int stage = 0; stage < kNumStages; stage++) {
+    Advance(metrics.engine_usec[stage], &reported_.engine_usec[stage], &report->engine_usec[stage]);
+  }
+  Advance(metrics.chunks_per_job, &reported_.chunks_per_job, &report->chunks_per_job);
+  Advance(metrics.chunk_bytes, &reported_.chunk_bytes, &report->chunk_bytes);
+  Advance(metrics.load_usec, &reported_.load_usec, &report->load_usec);
+  uint64_t loads = 0, reloads = 0;
+  for (const Metrics::VoiceLoads& voice : metrics.voice_loads()) {
+    loads += voice.loads;
+    reloads += voice.reloads;
+  }
+  Advance(loads, &reported_.loads, &report->loads);
+  Advance(reloads, &reported_.reloads, &report->reloads);
+  StageStats stats = pool_->stage_stats();
+  Advance(stats.kana_hits, &reported_.kana_hits, &report->kana_hits);
+  Advance(stats.kana_misses, &reported_.kana_misses, &report->kana_misses);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc != 6) {
+    Eprintf("usage: %s <ring name> <ring bytes> <kana cache size> <pipe in> <pipe out>", argv[0]);
+    return 2;
+  }
+  const platform::PipeHandle in = platform::PipeOf(argv[4]);
+  const platform::PipeHandle out = platform::PipeOf(argv[5]);
+  SharedRing* ring;
+  try {
+    ring = SharedRing::Open(argv[1], (uint32_t) std::strtoul(argv[2], nullptr, 10));
+  } catch (std::exception& e) {
+    Eprintf("%s", e.what());
+    return 1;
+  }
+
+  Host host(ring, std::strtoul(argv[3], nullptr, 10), in, out);
+  HostMessage ready = {kHostReady, 0, 0};
+  if (!platform::WritePipe(out, &ready, sizeof(ready))) {
+    return 1;
+  }
+  host.Run();
+  platform::ClosePipe(in);
+  platform::ClosePipe(out);
+  return 0;
+}
@@ -0,0 +1,561 @@
+#include "host_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "completion.h"
+#include "ebyutil.h"
+#include "host_protocol.h"
+#include "platform.h"
+#include "shared_ring.h"
+#include "tracer.h"
+
+namespace ebyroid {
+
+using std::string;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// how long a host gets to end a job that it has been told to give up on, before it is killed
+constexpr uint32_t kCancelGraceMsec = 5000;
+
+// how long a host gets to exit once its pipe has been closed
+constexpr uint32_t kExitGraceMsec = 5000;
+
+}  // namespace
+
+struct HostPool::Call {
+  // filled in by the caller, apart from what comes from the params
+  HostJob job = {};
+  const PcmSink* sink = nullptr;
+  // what the host knows the job by
+  uint32_t id = 0;
+  // tripped by the reader once the job has ended or the host has gone, and by the job's
+  // CancelToken
+  Completion wake;
+  // tripped by the reader alone, after `wake`, and the last the reader does with the call
+  Completion done;
+  // set by the reader before `done`
+  HostResult result = {};
+  void* output = nullptr;
+  string error;
+  bool lost = false;
+  // why the caller gave up on the job, if it did
+  bool gave_up = false;
+  JobAborted::Reason reason = JobAborted::kCancelled;
+};
+
+struct HostPool::Host {
+  ~Host();
+
+  string base_dir;
+  string voice;
+  platform::ProcessHandle process = nullptr;
+  platform::PipeHandle to = platform::kInvalidPipe;
+  platform::PipeHandle from = platform::kInvalidPipe;
+  std::unique_ptr<SharedRing> ring;
+  std::thread reader;
+  // guards writes to `to`, and what follows
+  std::mutex mutex;
+  std::map<uint32_t, Call*> calls;
+  uint32_t last_id = 0;
+  bool alive = true;
+  bool closing = false;
+  // jobs routed to the host and not over yet
+  std::atomic<uint32_t> busy{0};
+  // ready once the process has started, or failed to. see Route()
+  std::shared_future<void> started;
+  // guards sample_rate, which is set once the voice has loaded
+  std::mutex load_mutex;
+  uint32_t sample_rate = 0;
+};
+
+HostPool::Host::~Host() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  // the host exits once it sees the pipe closed, and the reader once the host has exited
+  if (to != platform::kInvalidPipe) {
+    platform::ClosePipe(to);
+  }
+  if (process != nullptr) {
+    platform::ReapProcess(process, kExitGraceMsec);
+  }
+  if (reader.joinable()) {
+    reader.join();
+  }
+  if (from != platform::kInvalidPipe) {
+    platform::ClosePipe(from);
+  }
+}
+
+HostPool::HostPool(const string& host_path,
+                   uint32_t hosts_per_voice,
+                   uint32_t ring_bytes,
+                   size_t kana_cache_size,
+                   Metrics* metrics)
+    : host_path_(host_path),
+      hosts_per_voice_(std::max<uint32_t>(hosts_per_voice, 1)),
+      ring_bytes_(ring_bytes),
+      kana_cache_size_(kana_cache_size),
+      metrics_(metrics) {}
+
+HostPool::~HostPool() = default;
+
+void HostPool::Spawn(Host* host, const string& base_dir) {
+  static std::atomic<uint32_t> last_ring{0};
+  const string name = "ebyroid-" + std::to_string(platform::CurrentProcessId()) + "-" +
+                      std::to_string(++last_ring);
+
+  host->ring.reset(SharedRing::Create(name, ring_bytes_));
+  // the name goes as soon as the host has mapped the ring, or failed to, so that nothing is left
+  // behind whichever process crashes
+  struct Unlink {
+    const string& name;
+    ~Unlink() { platform::UnlinkSharedMemory(name); }
+  } unlink{name};
+
+  const string& voice = host->voice;
+  const std::vector<string> args = {
+      name, std::to_string(ring_bytes_), std::to_string(kana_cache_size_)};
+  if (!platform::SpawnProcess(host_path_, args, &host->process, &host->to, &host->from)) {
+    throw std::runtime_error("Could not start the engine host " + host_path_ + " for " + voice +
+                             " in " + base_dir + " (" + platform::DescribeLastError() + ")");
+  }
+  HostMessage ready;
+  if (!platform::ReadPipe(host->from, &ready, sizeof(ready)) || ready.type != kHostReady) {
+    throw std::runtime_error("The engine host of " + voice + " in " + base_dir +
+                             " exited as it started");
+  }
+  host->reader = std::thread(&HostPool::Read, this, host);
+  Dprintf("Started an engine host of %s in %s", voice.c_str(), base_dir.c_str());
+}
+
+std::shared_ptr<HostPool::Host> HostPool::Route(const string& base_dir, const string& voice) {
+  const string key = base_dir + "\n" + voice;
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<std::shared_ptr<Host>>& group = hosts_[key];
+  group.resize(hosts_per_voice_);
+
+  // the least busy one, starting after the last one picked so that ties take turns
+  const size_t start = last_host_++;
+  size_t best = 0;
+  uint32_t best_busy = UINT32_MAX;
+  for (size_t i = 0; i < group.size(); i++) {
+    const size_t k = (start + i) % group.size();
+    const uint32_t busy = group[k] ? group[k]->busy.load() : 0;
+    if (busy < best_busy) {
+      best = k;
+      best_busy = busy;
+    }
+  }
+
+  // one that is still starting counts as alive, and is waited for
+  std::shared_ptr<Host> host = group[best];
+  bool alive = false;
+  if (host) {
+    std::lock_guard<std::mutex> host_lock(host->mutex);
+    alive = host->alive;
+  }
+  if (alive) {
+    host->busy++;
+    lock.unlock();
+    try {
+      host->started.get();  // throws whatever the start failed with
+    } catch (...) {
+      host->busy--;
+      throw;
+    }
+    return host;
+  }
+
+  if (host) {
+    metrics_->host_restarts.Add();
+  }
+  // the slot is taken right away, and the host started outside the lock, so that neither jobs of
+  // other voices nor the other hosts of this one wait for it. whoever still holds on to the old
+  // host lets it go once their job has failed
+  std::promise<void> started;
+  host = std::make_shared<Host>();
+  host->base_dir = base_dir;
+  host->voice = voice;
+  host->started = started.get_future().share();
+  host->busy++;
+  group[best] = host;
+  lock.unlock();
+  try {
+    Spawn(host.get(), base_dir);
+  } catch (...) {
+    started.set_exception(std::current_exception());
+    host->busy--;
+    {
+      std::lock_guard<std::mutex> host_lock(host->mutex);
+      host->alive = false;
+    }
+    // the next job tries again, which is no restart
+    lock.lock();
+    if (hosts_[key][best] == host) {
+      hosts_[key][best].reset();
+    }
+    throw;
+  }
+  started.set_value();
+  return host;
+}
+
+void HostPool::Read(Host* host) {
+  string payload;
+  for (;;) {
+    HostMessage message;
+    if (!platform::ReadPipe(host->from, &message, sizeof(message))) {
+      break;
+    }
+    payload.resize(message.size);
+    if (message.size > 0 && !platform::ReadPipe(host->from, &payload[0], message.size)) {
+      break;
+    }
+    // whatever the host put into the ring before sending the message is there to read
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (message.type == kHostChunk && payload.size() >= sizeof(HostBlock)) {
+      HostBlock block;
+      std::memcpy(&block, payload.data(), sizeof(block));
+      const void* data =
+          block.inlined ? payload.data() + sizeof(block) : host->ring->At(block.position);
+      Call* call = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(host->mutex);
+        if (auto found = host->calls.find(message.id); found != host->calls.end()) {
+          call = found->second;
+        }
+      }
+      // the call is there until its kHostDone, which only this thread hands over
+      if (call != nullptr && call->sink != nullptr && *call->sink) {
+        (*call->sink)((const int16_t*) data, block.size / 2);
+      }
+      if (!block.inlined) {
+        host->ring->Release(block.position + block.size);
+      }
+    } else if (message.type == kHostDone && payload.size() >= sizeof(HostResult)) {
+      HostResult result;
+      std::memcpy(&result, payload.data(), sizeof(result));
+      Count(*host, result.metrics);
+      const char* rest = payload.data() + sizeof(result);
+      const size_t rest_size = payload.size() - sizeof(result);
+      const HostBlock& block = result.output;
+      Call* call = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(host->mutex);
+        if (auto found = host->calls.find(message.id); found != host->calls.end()) {
+          call = found->second;
+          host->calls.erase(found);
+        }
+      }
+      if (call != nullptr) {
+        call->result = result;
+        if (result.status != kHostOk) {
+          call->error.assign(rest, rest_size);
+        } else {
+          // with a NUL past the end, as Ebyroid hands output over, which kana relies on
+          call->output = std::malloc(block.size + 1);
+          if (call->output != nullptr) {
+            if (block.size > 0) {
+              std::memcpy(
+                  call->output, block.inlined ? rest : host->ring->At(block.position), block.size);
+            }
+            ((char*) call->output)[block.size] = '\0';
+          } else {
+            call->result.status = kHostFailed;
+            call->error = "Could not allocate memory for the output";
+          }
+        }
+      }
+      if (block.size > 0 && !block.inlined) {
+        host->ring->Release(block.position + block.size);
+      }
+      if (call != nullptr) {
+        call->wake.Signal();
+        call->done.Signal();
+      }
+    } else {
+      Eprintf("Unexpected message of type %u from the engine host of %s",
+              message.type,
+              host->voice.c_str());
+      platform::KillProcess(host->process);
+      break;
+    }
+  }
+
+  // the host has exited: what it was running is lost
+  std::map<uint32_t, Call*> calls;
+  {
+    std::lock_guard<std::mutex> lock(host->mutex);
+    host->alive = false;
+    calls.swap(host->calls);
+    if (!host->closing) {
+      Eprintf("The engine host of %s has exited, with %zu jobs running",
+              host->voice.c_str(),
+              calls.size());
+    }
+  }
+  for (auto& entry : calls) {
+    entry.second->lost = true;
+    entry.second->wake.Signal();
+    entry.second->done.Signal();
+  }
+}
+
+void HostPool::Send(Host& host,
+                    Call* call,
+                    uint32_t type,
+                    const ConvertParams& params,
+                    const char* input) {
+  HostJob& job = call->job;
+  job.type = type;
+  job.sample_rate = params.sample_rate;
+  job.flags = 0;
+  if (params.needs_reload) {
+    job.flags |= kHostReload;
+  }
+  if (call->sink != nullptr && *call->sink) {
+    job.flags |= kHostStream;
+  }
+  if (params.prosody != nullptr) {
+    job.flags |= kHostProsody;
+    job.prosody = *params.prosody;
+  }
+  job.timeout_msec = 0;
+  if (params.deadline != Clock::time_point::max()) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(params.deadline -
+                                                                      Clock::now());
+    job.timeout_msec = (uint32_t) std::clamp<int64_t>(left.count(), 1, UINT32_MAX);
+  }
+
+  thread_local string payload;
+  payload.assign((const char*) &job, sizeof(job));
+  payload.append(params.base_dir).append(1, '\0');
+  payload.append(params.voice).append(1, '\0');
+  payload.append(input).append(1, '\0');
+
+  std::lock_guard<std::mutex> lock(host.mutex);
+  if (!host.alive) {
+    throw std::runtime_error("The engine host of " + host.voice + " has exited");
+  }
+  call->id = ++host.last_id;
+  HostMessage message = {kHostJob, call->id, (uint32_t) payload.size()};
+  host.calls[call->id] = call;
+  if (!platform::WritePipe(host.to, &message, sizeof(message)) ||
+      !platform::WritePipe(host.to, payload.data(), payload.size())) {
+    host.calls.erase(call->id);
+    throw std::runtime_error("Could not send the job to the engine host of " + host.voice + " (" +
+                             platform::DescribeLastError() + ")");
+  }
+}
+
+void HostPool::Wait(Host& host, Call* call, const ConvertParams& params) {
+  bool attached = params.cancel == nullptr || params.cancel->Attach(&call->wake);
+  if (attached) {
+    call->wake.WaitUntil(params.deadline);
+  }
+  if (params.cancel != nullptr) {
+    params.cancel->Detach(&call->wake);
+  }
+  if (call->done.WaitUntil(Clock::now())) {
+    return;
+  }
+
+  // give up on the job, which the host still has to end before the call may go away
+  call->gave_up = true;
+  call->reason = params.cancel != nullptr && params.cancel->cancelled()
+                     ? JobAborted::kCancelled
+                     : JobAborted::kDeadlineExceeded;
+  {
+    std::lock_guard<std::mutex> lock(host.mutex);
+    if (host.alive) {
+      HostMessage message = {kHostCancel, call->id, 0};
+      platform::WritePipe(host.to, &message, sizeof(message));
+    }
+  }
+  if (!call->done.WaitUntil(Clock::now() + std::chrono::milliseconds(kCancelGraceMsec))) {
+    Eprintf("The engine host of %s does not give up on a job, killing it", host.voice.c_str());
+    platform::KillProcess(host.process);
+    call->done.WaitUntil(Clock::time_point::max());
+  }
+}
+
+void HostPool::Run(Call* call, uint32_t type, const ConvertParams& params, const char* input) {
+  if (params.voice == nullptr) {
+    throw std::runtime_error("Engine hosts only take jobs for a given voice");
+  }
+  std::shared_ptr<Host> host = Route(params.base_dir, params.voice);
+  struct Busy {
+    Host& host;
+    ~Busy() { host.busy--; }
+  } busy{*host};
+
+  // a host loads its voice before its first job, so that the load is counted like any other
+  {
+    std::lock_guard<std::mutex> lock(host->load_mutex);
+    if (host->sample_rate == 0) {
+      Call load;
+      ConvertParams load_params = params;
+      load_params.needs_reload = false;
+      load_params.prosody = nullptr;
+      Send(*host, &load, kHostLoad, load_params, "");
+      Wait(*host, &load, load_params);
+      Check(*host, load);
+      host->sample_rate = load.result.value;
+      call->result.timings = load.result.timings;
+    }
+  }
+  if (type == kHostLoad) {
+    call->result.value = host->sample_rate;
+    return;
+  }
+
+  TraceSpan span("host", Tracer::job());
+  span.Detail(params.voice);
+  Send(*host, call, type, params, input);
+  Wait(*host, call, params);
+  Check(*host, *call);
+}
+
+void HostPool::Count(const Host& host, const HostMetrics& report) {
+  for (int stage = 0; stage < kNumStages; stage++) {
+    const HostHistogram& engine_usec = report.engine_usec[stage];
+    metrics_->engine_usec[stage].Add(engine_usec.counts, engine_usec.sum);
+  }
+  metrics_->chunks_per_job.Add(report.chunks_per_job.counts, report.chunks_per_job.sum);
+  metrics_->chunk_bytes.Add(report.chunk_bytes.counts, report.chunk_bytes.sum);
+  metrics_->load_usec.Add(report.load_usec.counts, report.load_usec.sum);
+  metrics_->AddLoads(host.base_dir, host.voice, report.loads, report.reloads, report.load_usec.sum);
+  metrics_->host_kana_hits.Add(report.kana_hits);
+  metrics_->host_kana_misses.Add(report.kana_misses);
+}
+
+void HostPool::Check(const Host& host, const Call& call) {
+  if (call.lost && call.gave_up) {
+    throw JobAborted(call.reason);
+  }
+  if (call.lost) {
+    throw std::runtime_error("The engine host of " + host.voice + " exited during the job");
+  }
+  switch (call.result.status) {
+    case kHostOk:
+      return;
+    case kHostCancelled:
+      // which is what the host says to the front giving up on the job, whatever the reason
+      throw JobAborted(call.gave_up ? call.reason : JobAborted::kCancelled);
+    case kHostDeadlineExceeded:
+      throw JobAborted(JobAborted::kDeadlineExceeded);
+    case kHostApiError:
+      throw ApiError(call.error, call.result.result);
+    default:
+      throw std::runtime_error(call.error);
+  }
+}
+
+void HostPool::Preload(const string& base_dir, const string& voice, LoadTimings* timings) {
+  ConvertParams params;
+  params.needs_reload = false;
+  params.base_dir = const_cast<char*>(base_dir.c_str());
+  params.voice = const_cast<char*>(voice.c_str());
+  params.sample_rate = 0;
+  params.prosody = nullptr;
+  params.cancel = nullptr;
+  params.deadline = Clock::time_point::max();
+
+  // every host of the voice at once, which Route() hands out in turn while none is busy
+  std::vector<std::thread> threads;
+  std::vector<LoadTimings> loads(hosts_per_voice_);
+  std::vector<string> errors(hosts_per_voice_);
+  for (uint32_t i = 0; i < hosts_per_voice_; i++) {
+    threads.emplace_back([this, &params, &loads, &errors, i] {
+      try {
+        Call call;
+        Run(&call, kHostLoad, params, "");
+        loads[i] = call.result.timings;
+      } catch (std::exception& e) {
+        errors[i] = e.what();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (const string& error : errors) {
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+  }
+  if (timings != nullptr) {
+    *timings = *std::max_element(
+        loads.begin(), loads.end(), [](const LoadTimings& a, const LoadTimings& b) {
+          return a.total_usec < b.total_usec;
+        });
+  }
+}
+
+int HostPool::Hiragana(const ConvertParams& params,
+                       const unsigned char* inbytes,
+                       unsigned char** outbytes,
+                       size_t* outsize) {
+  Call call;
+  Run(&call, kHostHiragana, params, (const char*) inbytes);
+  *outbytes = (unsigned char*) call.output;
+  *outsize = call.result.output.size;
+  return (int) call.result.value;
+}
+
+int HostPool::Speech(const ConvertParams& params,
+                     const unsigned char* inbytes,
+                     int16_t** outbytes,
+                     size_t* outsize,
+                     uint32_t mode,
+                     const PcmSink& sink) {
+  Call call;
+  call.job.mode = mode;
+  call.sink = &sink;
+  Run(&call, kHostSpeech, params, (const char*) inbytes);
+  *outbytes = (int16_t*) call.output;
+  *outsize = sink ? call.result.streamed : call.result.output.size;
+  return (int) call.result.value;
+}
+
+int HostPool::Convert(const ConvertParams& params,
+                      const unsigned char* inbytes,
+                      int16_t** outbytes,
+                      size_t* outsize,
+                      const PcmSink& sink,
+                      uint32_t trim) {
+  Call call;
+  call.job.trim = trim;
+  call.sink = &sink;
+  Run(&call, kHostConvert, params, (const char*) inbytes);
+  *outbytes = (int16_t*) call.output;
+  *outsize = sink ? call.result.streamed : call.result.output.size;
+  return (int) call.result.value;
+}
+
+uint32_t HostPool::SampleRate(const ConvertParams& params) {
+  Call call;
+  Run(&call, kHostLoad, params, "");
+  return call.result.value;
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,100 @@
+#ifndef HOST_POOL_H
+#define HOST_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ebyroid.h"
+#include "metrics.h"
+
+namespace ebyroid {
+
+struct HostMetrics;
+
+/**
+ * Runs engines in host processes of their own (src/host) rather than in this one: `hosts_per_voice`
+ * of them for every voice, each with its own engine and thus its own jobs at once. A job goes to
+ * the host of its voice that has the fewest jobs running. PCM comes back through a ring in shared
+ * memory. A host that crashes fails the jobs it was running, and the next job of its voice starts
+ * another one in its place, which loads the voice again.
+ *
+ * Takes the same calls as Ebyroid, and throws the same errors.
+ */
+class HostPool {
+ public:
+  // `host_path` is the ebyroid_host executable. every host has a ring of `ring_bytes` (a power of
+  // 2) and a kana cache of `kana_cache_size` entries, see Ebyroid::Create(). restarts of hosts are
+  // counted into `metrics`, along with what the hosts count into their own
+  HostPool(const std::string& host_path,
+           uint32_t hosts_per_voice,
+           uint32_t ring_bytes,
+           size_t kana_cache_size,
+           Metrics* metrics);
+  HostPool(const HostPool&) = delete;
+  HostPool(HostPool&&) = delete;
+  // closes the pipes to the hosts, which then exit once their jobs have
+  ~HostPool();
+
+  // loads the voice in every host of it, starting the hosts if need be. `timings` (if any) gets
+  // those of the slowest host
+  void Preload(const std::string& base_dir, const std::string& voice, LoadTimings* timings);
+  int Hiragana(const ConvertParams& params,
+               const unsigned char* inbytes,
+               unsigned char** outbytes,
+               size_t* outsize);
+  int Speech(const ConvertParams& params,
+             const unsigned char* inbytes,
+             int16_t** outbytes,
+             size_t* outsize,
+             uint32_t mode = 0u,
+             const PcmSink& sink = nullptr);
+  int Convert(const ConvertParams& params,
+              const unsigned char* inbytes,
+              int16_t** outbytes,
+              size_t* outsize,
+              const PcmSink& sink = nullptr,
+              uint32_t trim = kTrimNone);
+  uint32_t SampleRate(const ConvertParams& params);
+
+  uint32_t hosts_per_voice() const { return hosts_per_voice_; }
+
+ private:
+  struct Host;
+  struct Call;
+
+  // the host for a job of the voice, counted busy with it. starts the host if need be, or waits
+  // for it to have started
+  std::shared_ptr<Host> Route(const std::string& base_dir, const std::string& voice);
+  // starts the process of a host of `host->voice`, and its reader
+  void Spawn(Host* host, const std::string& base_dir);
+  // sends a job to the host without waiting for it
+  void Send(Host& host, Call* call, uint32_t type, const ConvertParams& params, const char* input);
+  // waits for the job to end, giving up on it as `params` says
+  void Wait(Host& host, Call* call, const ConvertParams& params);
+  // runs a job on a host of the voice of `params`, and throws if it did not succeed
+  void Run(Call* call, uint32_t type, const ConvertParams& params, const char* input);
+  static void Check(const Host& host, const Call& call);
+  // adds what a host has reported of its metrics to ours
+  void Count(const Host& host, const HostMetrics& report);
+  void Read(Host* host);
+
+  const std::string host_path_;
+  const uint32_t hosts_per_voice_;
+  const uint32_t ring_bytes_;
+  const size_t kana_cache_size_;
+  Metrics* const metrics_;
+  // guards hosts_, and is never held while a host starts
+  std::mutex mutex_;
+  // by base_dir and voice
+  std::map<std::string, std::vector<std::shared_ptr<Host>>> hosts_;
+  std::atomic<uint32_t> last_host_{0};
+};
+
+}  // namespace ebyroid
+
+#endif  // HOST_POOL_H
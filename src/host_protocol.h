@@ -0,0 +1,116 @@
+#ifndef HOST_PROTOCOL_H
+#define HOST_PROTOCOL_H
+
+#include <cstdint>
+
+#include "ebyroid.h"
+#include "metrics.h"
+
+namespace ebyroid {
+
+// What the process that runs jobs (the front) and an engine host (src/host) say to each other over
+// the pipes between them. Every message is a HostMessage followed by `size` bytes of payload, which
+// starts with the struct that goes with its type. Both ends are the same build, so structs go as
+// they are laid out in memory.
+
+enum HostMessageType : uint32_t {
+  // host to front, once the host has mapped the ring
+  kHostReady = 1,
+  // front to host: a HostJob, or nothing but the id of the job to give up on
+  kHostJob,
+  kHostCancel,
+  // host to front: a HostBlock of streamed PCM, or the HostResult of a job
+  kHostChunk,
+  kHostDone,
+};
+
+struct HostMessage {
+  uint32_t type;
+  // of the job that the message is about
+  uint32_t id;
+  uint32_t size;
+};
+
+enum HostJobType : uint32_t {
+  kHostLoad,
+  kHostHiragana,
+  kHostSpeech,
+  kHostConvert,
+};
+
+enum HostJobFlags : uint32_t {
+  kHostReload = 1,
+  // PCM goes to the front in kHostChunk messages as it comes
+  kHostStream = 2,
+  kHostProsody = 4,
+};
+
+// followed by base_dir, voice and the input, each NUL-terminated
+struct HostJob {
+  uint32_t type;
+  // of Speech()
+  uint32_t mode;
+  // TrimFlags of Convert()
+  uint32_t trim;
+  uint32_t sample_rate;
+  uint32_t flags;
+  // from when the host gets the job, 0 for no deadline
+  uint32_t timeout_msec;
+  Prosody prosody;
+};
+
+// where the host has put bytes for the front: in the ring, or following the message if they do
+// not fit in it
+struct HostBlock {
+  uint32_t position;
+  uint32_t size;
+  uint32_t inlined;
+};
+
+enum HostStatus : uint32_t {
+  kHostOk,
+  kHostFailed,
+  // failed with the ResultCode in `result`
+  kHostApiError,
+  kHostCancelled,
+  kHostDeadlineExceeded,
+};
+
+// what a Histogram has counted over some time
+struct HostHistogram {
+  uint64_t counts[Histogram::kMaxBounds + 1];
+  uint64_t sum;
+};
+
+// what the Metrics of a host have counted since it last reported, for the front to add to its own.
+// the host runs the engine of one voice, which the loads are of
+struct HostMetrics {
+  HostHistogram engine_usec[kNumStages];
+  HostHistogram chunks_per_job;
+  HostHistogram chunk_bytes;
+  HostHistogram load_usec;
+  uint64_t loads;
+  uint64_t reloads;
+  uint64_t kana_hits;
+  uint64_t kana_misses;
+};
+
+// followed by the inlined output, if any, or the error message unless kHostOk
+struct HostResult {
+  // first, as for kHostChunk
+  HostBlock output;
+  uint32_t status;
+  int32_t result;
+  // the sample rate of the voice for kHostLoad, what the job returned otherwise
+  uint32_t value;
+  // how many bytes went out in kHostChunk messages
+  uint64_t streamed;
+  // of kHostLoad
+  LoadTimings timings;
+  // with every result, whether the job succeeded or not
+  HostMetrics metrics;
+};
+
+}  // namespace ebyroid
+
+#endif  // HOST_PROTOCOL_H
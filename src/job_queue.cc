@@ -0,0 +1,155 @@
+#include "job_queue.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ebyroid {
+
+JobQueue::JobQueue(uint32_t workers, uint32_t capacity, uint32_t lane_limit)
+    : capacity_(capacity), lane_limit_(lane_limit) {
+  for (uint32_t i = 0; i < workers; i++) {
+    workers_.emplace_back(&JobQueue::Work, this);
+  }
+}
+
+JobQueue::~JobQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+JobQueue::PushResult JobQueue::Push(const std::string& lane_name,
+                                    Priority priority,
+                                    JobProc proc,
+                                    void* job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Lane* lane = LaneOf(lane_name);
+    Ring& ring = lane->rings[priority];
+    if (ring.size == capacity_) {
+      return kFull;
+    }
+    ring.entries[(ring.head + ring.size) % capacity_] = Entry{proc, job};
+    ring.size++;
+    pending_++;
+  }
+  cv_.notify_one();
+  return kQueued;
+}
+
+bool JobQueue::Remove(void* job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& lane : lanes_) {
+    for (Ring& ring : lane->rings) {
+      for (uint32_t i = 0; i < ring.size; i++) {
+        if (ring.entries[(ring.head + i) % capacity_].job != job) {
+          continue;
+        }
+        // close the gap, keeping the order of the jobs behind
+        for (uint32_t j = i + 1; j < ring.size; j++) {
+          ring.entries[(ring.head + j - 1) % capacity_] = ring.entries[(ring.head + j) % capacity_];
+        }
+        ring.size--;
+        pending_--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+size_t JobQueue::RemoveIf(const std::function<bool(JobProc proc, void* job)>& match) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t removed = 0;
+  for (auto& lane : lanes_) {
+    for (Ring& ring : lane->rings) {
+      // moves the jobs that stay up over the gaps, in their order
+      uint32_t kept = 0;
+      for (uint32_t i = 0; i < ring.size; i++) {
+        Entry entry = ring.entries[(ring.head + i) % capacity_];
+        if (match(entry.proc, entry.job)) {
+          continue;
+        }
+        ring.entries[(ring.head + kept) % capacity_] = entry;
+        kept++;
+      }
+      removed += ring.size - kept;
+      ring.size = kept;
+    }
+  }
+  pending_ -= removed;
+  return removed;
+}
+
+size_t JobQueue::pending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_;
+}
+
+JobQueue::Lane* JobQueue::LaneOf(const std::string& name) {
+  for (auto& lane : lanes_) {
+    if (lane->name == name) {
+      return lane.get();
+    }
+  }
+
+  // a lane is allocated once per engine and kept, so pushing never allocates afterwards
+  auto lane = std::make_unique<Lane>();
+  lane->name = name;
+  for (Ring& ring : lane->rings) {
+    ring.entries = std::make_unique<Entry[]>(capacity_);
+  }
+  lanes_.push_back(std::move(lane));
+  return lanes_.back().get();
+}
+
+bool JobQueue::Take(Entry* entry, Lane** taken_from) {
+  const size_t num_lanes = lanes_.size();
+  for (uint32_t priority = 0; priority < kNumPriorities; priority++) {
+    for (size_t i = 0; i < num_lanes; i++) {
+      Lane* lane = lanes_[(next_lane_ + i) % num_lanes].get();
+      Ring& ring = lane->rings[priority];
+      if (ring.size == 0 || lane->running >= lane_limit_) {
+        continue;
+      }
+      *entry = ring.entries[ring.head];
+      ring.head = (ring.head + 1) % capacity_;
+      ring.size--;
+      pending_--;
+      lane->running++;
+      next_lane_ = (next_lane_ + i + 1) % num_lanes;
+      *taken_from = lane;
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobQueue::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    Entry entry;
+    Lane* lane;
+    cv_.wait(lock, [&] { return stopping_ || Take(&entry, &lane); });
+    if (stopping_) {
+      return;
+    }
+
+    lock.unlock();
+    entry.proc(entry.job);
+    lock.lock();
+
+    // the lane has a free slot again, which another worker may be waiting for
+    lane->running--;
+    cv_.notify_one();
+  }
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,102 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ebyroid {
+
+/**
+ * Bounded queue of jobs with its own worker threads, which takes over concurrency control of the
+ * engines from callers.
+ *
+ * Jobs are queued in lanes, one per engine, each holding a fixed-capacity ring buffer per priority
+ * class. A worker takes the oldest job of the highest priority among the lanes that have a free
+ * slot on their engine, so neither Push nor taking a job costs more as the backlog grows.
+ * A full ring rejects the job. Thread-safe: any thread may push.
+ */
+class JobQueue {
+ public:
+  enum Priority : uint32_t { kHigh = 0, kNormal = 1, kLow = 2 };
+  static constexpr uint32_t kNumPriorities = 3;
+
+  enum PushResult { kQueued, kFull };
+
+  typedef void (*JobProc)(void* job);
+
+  /**
+   * `capacity` is the size of every ring, i.e. how many jobs of a priority class a lane can hold.
+   * `lane_limit` is how many jobs of a lane may run at once.
+   */
+  JobQueue(uint32_t workers, uint32_t capacity, uint32_t lane_limit);
+  JobQueue(const JobQueue&) = delete;
+  JobQueue(JobQueue&&) = delete;
+
+  /**
+   * Lets the running jobs finish and stops the workers. Jobs still waiting are never run.
+   */
+  ~JobQueue();
+
+  /**
+   * Queues `proc(job)` to run on a worker. `lane` names the engine the job is going to use.
+   */
+  PushResult Push(const std::string& lane, Priority priority, JobProc proc, void* job);
+
+  /**
+   * Takes a job that is still waiting out of the queue, so that it never runs.
+   * Returns false if it is not waiting (any more), i.e. it is running or done.
+   */
+  bool Remove(void* job);
+
+  /**
+   * Takes every waiting job that `match(proc, job)` picks out of the queue, e.g. all the parts of
+   * something that went in pieces. Returns how many it took.
+   */
+  size_t RemoveIf(const std::function<bool(JobProc proc, void* job)>& match);
+
+  // jobs waiting for a worker
+  size_t pending();
+
+ private:
+  struct Entry {
+    JobProc proc;
+    void* job;
+  };
+
+  struct Ring {
+    std::unique_ptr<Entry[]> entries;
+    uint32_t head = 0;
+    uint32_t size = 0;
+  };
+
+  struct Lane {
+    std::string name;
+    Ring rings[kNumPriorities];
+    uint32_t running = 0;
+  };
+
+  Lane* LaneOf(const std::string& name);
+  bool Take(Entry* entry, Lane** lane);
+  void Work();
+
+  const uint32_t capacity_;
+  const uint32_t lane_limit_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::unique_ptr<Lane>> lanes_;
+  // where the next search for a job starts, so that no lane gets ahead of the others for long
+  size_t next_lane_ = 0;
+  size_t pending_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace ebyroid
+
+#endif  // JOB_QUEUE_H
@@ -0,0 +1,40 @@
+#include "kana_cache.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace ebyroid {
+
+KanaCache::KanaRef KanaCache::Find(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  lru_.splice(lru_.begin(), lru_, found->second);
+  return found->second->kana;
+}
+
+KanaCache::KanaRef KanaCache::Insert(const std::string& key, std::string&& kana) {
+  KanaRef ref = std::make_shared<const std::string>(std::move(kana));
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto found = index_.find(key); found != index_.end()) {
+    found->second->kana = ref;
+    lru_.splice(lru_.begin(), lru_, found->second);
+    return ref;
+  }
+
+  if (lru_.size() >= capacity_) {
+    index_.erase(lru_.back().key);
+    lru_.pop_back();
+  }
+  lru_.push_front(Entry{key, ref});
+  index_.emplace(key, lru_.begin());
+  return ref;
+}
+
+}  // namespace ebyroid
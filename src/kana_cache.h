@@ -0,0 +1,52 @@
+#ifndef KANA_CACHE_H
+#define KANA_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ebyroid {
+
+/**
+ * Small LRU cache of AI Kana, i.e. of what language analysis makes of a text, so that text seen
+ * before goes straight to synthesis. Holds up to a fixed number of entries. Thread-safe.
+ */
+class KanaCache {
+ public:
+  typedef std::shared_ptr<const std::string> KanaRef;
+
+  explicit KanaCache(size_t capacity) : capacity_(capacity) {}
+  KanaCache(const KanaCache&) = delete;
+  KanaCache(KanaCache&&) = delete;
+
+  // the cached kana of the key, or nullptr
+  KanaRef Find(const std::string& key);
+
+  // caches `kana` for the key, replacing the least recently used entry if full
+  KanaRef Insert(const std::string& key, std::string&& kana);
+
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+ private:
+  struct Entry {
+    std::string key;
+    KanaRef kana;
+  };
+
+  const size_t capacity_;
+  std::mutex mutex_;
+  // the most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+}  // namespace ebyroid
+
+#endif  // KANA_CACHE_H
@@ -0,0 +1,155 @@
+#include "metrics.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "api_adapter.h"
+
+namespace ebyroid {
+
+namespace {
+
+// 100 usec to 10 sec
+constexpr uint64_t kUsecBounds[] = {100,     250,     500,     1000,    2500,   5000,
+                                    10000,   25000,   50000,   100000,  250000, 500000,
+                                    1000000, 2500000, 5000000, 10000000};
+// 1KiB to 4MiB
+constexpr uint64_t kByteBounds[] = {1024, 4096, 16384, 65536, 262144, 1048576, 4194304};
+constexpr uint64_t kCountBounds[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512};
+
+// what the engine may fail a call with, see api_adapter.h
+constexpr std::pair<ResultCode, const char*> kResultCodes[] = {
+    {ERR_USERDIC_NOENTRY, "ERR_USERDIC_NOENTRY"},
+    {ERR_USERDIC_LOCKED, "ERR_USERDIC_LOCKED"},
+    {ERR_COUNT_LIMIT, "ERR_COUNT_LIMIT"},
+    {ERR_READ_FAULT, "ERR_READ_FAULT"},
+    {ERR_PATH_NOT_FOUND, "ERR_PATH_NOT_FOUND"},
+    {ERR_FILE_NOT_FOUND, "ERR_FILE_NOT_FOUND"},
+    {ERR_OUT_OF_MEMORY, "ERR_OUT_OF_MEMORY"},
+    {ERR_JOB_BUSY, "ERR_JOB_BUSY"},
+    {ERR_INVALID_JOBID, "ERR_INVALID_JOBID"},
+    {ERR_TOO_MANY_JOBS, "ERR_TOO_MANY_JOBS"},
+    {ERR_LICENSE_REJECTED, "ERR_LICENSE_REJECTED"},
+    {ERR_LICENSE_EXPIRED, "ERR_LICENSE_EXPIRED"},
+    {ERR_LICENSE_ABSENT, "ERR_LICENSE_ABSENT"},
+    {ERR_INSUFFICIENT, "ERR_INSUFFICIENT"},
+    {ERR_NOT_LOADED, "ERR_NOT_LOADED"},
+    {ERR_NOT_INITIALIZED, "ERR_NOT_INITIALIZED"},
+    {ERR_WAIT_TIMEOUT, "ERR_WAIT_TIMEOUT"},
+    {ERR_INVALID_ARGUMENT, "ERR_INVALID_ARGUMENT"},
+    {ERR_UNSUPPORTED, "ERR_UNSUPPORTED"},
+    {ERR_INTERNAL_ERROR, "ERR_INTERNAL_ERROR"},
+    {ERR_ALREADY_INITIALIZED, "ERR_ALREADY_INITIALIZED"},
+    {ERR_ALREADY_LOADED, "ERR_ALREADY_LOADED"},
+    {ERR_PARTIALLY_REGISTERED, "ERR_PARTIALLY_REGISTERED"},
+    {ERR_NOMORE_DATA, "ERR_NOMORE_DATA"},
+};
+constexpr size_t kNumResultCodes = sizeof(kResultCodes) / sizeof(*kResultCodes);
+
+}  // namespace
+
+void Histogram::Observe(uint64_t value) {
+  size_t bucket = 0;
+  while (bucket < num_bounds_ && value > bounds_[bucket]) {
+    bucket++;
+  }
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::Add(const uint64_t* counts, uint64_t sum) {
+  for (size_t i = 0; i <= num_bounds_; i++) {
+    if (counts[i] > 0) {
+      counts_[i].fetch_add(counts[i], std::memory_order_relaxed);
+    }
+  }
+  sum_.fetch_add(sum, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot snapshot;
+  snapshot.bounds.assign(bounds_, bounds_ + num_bounds_);
+  snapshot.counts.resize(num_bounds_ + 1);
+  snapshot.count = 0;
+  for (size_t i = 0; i <= num_bounds_; i++) {
+    snapshot.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    snapshot.count += snapshot.counts[i];
+  }
+  snapshot.sum = sum_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+Metrics::Metrics()
+    : queue_wait_usec(kUsecBounds),
+      engine_usec{Histogram(kUsecBounds), Histogram(kUsecBounds), Histogram(kUsecBounds)},
+      chunks_per_job(kCountBounds),
+      chunk_bytes(kByteBounds),
+      copy_usec(kUsecBounds),
+      load_usec(kUsecBounds) {
+  static_assert(kNumStages == 3, "engine_usec takes a histogram per stage");
+  static_assert(kNumResultCodes < sizeof(errors_) / sizeof(*errors_), "errors_ is too small");
+}
+
+void Metrics::CountError(int32_t result) {
+  size_t index = 0;
+  while (index < kNumResultCodes && kResultCodes[index].first != result) {
+    index++;
+  }
+  errors_[index].Add();
+}
+
+void Metrics::CountLoad(const std::string& base_dir, const std::string& voice, uint64_t usec) {
+  load_usec.Observe(usec);
+  std::lock_guard<std::mutex> lock(loads_mutex_);
+  VoiceLoads& loads = loads_[std::make_pair(base_dir, voice)];
+  if (loads.loads == 0) {
+    loads.base_dir = base_dir;
+    loads.voice = voice;
+  } else {
+    loads.reloads++;
+  }
+  loads.loads++;
+  loads.usec += usec;
+}
+
+void Metrics::AddLoads(const std::string& base_dir,
+                       const std::string& voice,
+                       uint64_t loads,
+                       uint64_t reloads,
+                       uint64_t usec) {
+  if (loads == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(loads_mutex_);
+  VoiceLoads& voice_loads = loads_[std::make_pair(base_dir, voice)];
+  voice_loads.base_dir = base_dir;
+  voice_loads.voice = voice;
+  voice_loads.loads += loads;
+  voice_loads.reloads += reloads;
+  voice_loads.usec += usec;
+}
+
+std::vector<std::pair<const char*, uint64_t>> Metrics::errors() const {
+  std::vector<std::pair<const char*, uint64_t>> errors;
+  for (size_t i = 0; i <= kNumResultCodes; i++) {
+    if (uint64_t count = errors_[i].value(); count > 0) {
+      errors.emplace_back(i < kNumResultCodes ? kResultCodes[i].second : "UNKNOWN", count);
+    }
+  }
+  return errors;
+}
+
+std::vector<Metrics::VoiceLoads> Metrics::voice_loads() {
+  std::lock_guard<std::mutex> lock(loads_mutex_);
+  std::vector<VoiceLoads> loads;
+  loads.reserve(loads_.size());
+  for (auto& [key, voice] : loads_) {
+    loads.push_back(voice);
+  }
+  return loads;
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,143 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ebyroid {
+
+/**
+ * A monotonic count. Relaxed, as nothing is ordered by it.
+ */
+class Counter {
+ public:
+  void Add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+/**
+ * Counts observations into buckets fixed at construction. Observe() takes a few compares and two
+ * relaxed atomic adds, and no lock, so that it can go on the path of every job.
+ */
+class Histogram {
+ public:
+  static constexpr size_t kMaxBounds = 20;
+
+  struct Snapshot {
+    // the inclusive upper bound of each bucket, ascending
+    std::vector<uint64_t> bounds;
+    // per bucket (not cumulative), with one more at the end for what is above the last bound
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+    uint64_t count;
+  };
+
+  // the bounds of the buckets, ascending
+  template <size_t N>
+  explicit Histogram(const uint64_t (&bounds)[N]) : num_bounds_(N) {
+    static_assert(N <= kMaxBounds, "too many buckets");
+    for (size_t i = 0; i < N; i++) {
+      bounds_[i] = bounds[i];
+    }
+  }
+  Histogram(const Histogram&) = delete;
+  Histogram(Histogram&&) = delete;
+
+  void Observe(uint64_t value);
+  // adds what was counted elsewhere into buckets of the same bounds, one count per bucket
+  void Add(const uint64_t* counts, uint64_t sum);
+  // not atomic as a whole: an observation racing with it may show in the counts but not the sum
+  Snapshot snapshot() const;
+
+ private:
+  uint64_t bounds_[kMaxBounds];
+  size_t num_bounds_;
+  std::atomic<uint64_t> counts_[kMaxBounds + 1] = {};
+  std::atomic<uint64_t> sum_{0};
+};
+
+/**
+ * The stages of engine work that Ebyroid times, see StageStats.
+ */
+enum Stage { kKanaStage, kWaveStage, kPlainStage, kNumStages };
+
+/**
+ * What the native side has been up to, cheap enough to keep on in production. Everything on the
+ * path of a job is a Counter or a Histogram. Only loading an engine, which takes seconds anyway,
+ * takes a lock. Times are in usec.
+ */
+class Metrics {
+ public:
+  // how a job ended
+  enum Outcome { kSucceeded, kFailed, kCancelled, kDeadlineExceeded, kRejected, kNumOutcomes };
+
+  // loads of one voice
+  struct VoiceLoads {
+    std::string base_dir;
+    std::string voice;
+    uint64_t loads = 0;
+    // loads of an engine that had been loaded before, i.e. after an eviction or a needs_reload
+    uint64_t reloads = 0;
+    uint64_t usec = 0;
+  };
+
+  Metrics();
+  Metrics(const Metrics&) = delete;
+  Metrics(Metrics&&) = delete;
+
+  void CountOutcome(Outcome outcome) { outcomes_[outcome].Add(); }
+  // a ResultCode that the engine failed a call with
+  void CountError(int32_t result);
+  void CountLoad(const std::string& base_dir, const std::string& voice, uint64_t usec);
+  // loads counted elsewhere, e.g. by an engine host, whose times go into load_usec on their own
+  void AddLoads(const std::string& base_dir,
+                const std::string& voice,
+                uint64_t loads,
+                uint64_t reloads,
+                uint64_t usec);
+
+  uint64_t outcomes(Outcome outcome) const { return outcomes_[outcome].value(); }
+  // the name of each ResultCode seen so far, and how many times
+  std::vector<std::pair<const char*, uint64_t>> errors() const;
+  std::vector<VoiceLoads> voice_loads();
+
+  // from queueing a job (or a segment of one) until a worker takes it
+  Histogram queue_wait_usec;
+  // from starting an engine job to its completion, per Stage
+  Histogram engine_usec[kNumStages];
+  // how many times the engine hands over PCM per job, and how much each time
+  Histogram chunks_per_job;
+  Histogram chunk_bytes;
+  // bytes of PCM (or Opus) handed over to JS
+  Counter output_bytes;
+  // turning engine PCM into what the caller gets: joining segments, gain and sample formats
+  Histogram copy_usec;
+  // loading an engine, whatever the voice
+  Histogram load_usec;
+  // engine hosts started in place of one that exited, see HostPool
+  Counter host_restarts;
+  // lookups of the kana caches of engine hosts, which StageStats adds to Ebyroid's own
+  Counter host_kana_hits;
+  Counter host_kana_misses;
+
+ private:
+  Counter outcomes_[kNumOutcomes];
+  // by the index of the code in the table of metrics.cc, with one more for unknown codes
+  Counter errors_[32];
+  std::mutex loads_mutex_;
+  // by base_dir and voice
+  std::map<std::pair<std::string, std::string>, VoiceLoads> loads_;
+};
+
+}  // namespace ebyroid
+
+#endif  // METRICS_H
@@ -1,405 +1,2602 @@
 #include <node_api.h>
 
 #include <stdint.h>
-
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "api_adapter.h"
 #include "ebyroid.h"
 #include "ebyutil.h"
+#include "gain.h"
+#include "host_pool.h"
+#include "job_queue.h"
+#include "metrics.h"
+#include "opus_writer.h"
+#include "pcm_cache.h"
+#include "pcm_format.h"
+#include "resampler.h"
+#include "segmenter.h"
+#include "tracer.h"
+
+using ebyroid::Ebyroid, ebyroid::ConvertParams, ebyroid::PcmSink, ebyroid::JobQueue;
+using ebyroid::CancelToken, ebyroid::JobAborted, ebyroid::PcmCache, ebyroid::SampleFormat;
+using ebyroid::Normalization, ebyroid::Metrics, ebyroid::Histogram, ebyroid::Tracer;
+using ebyroid::TraceSpan, ebyroid::HostPool;
+using Clock = std::chrono::steady_clock;
+
+typedef enum { WORK_HIRAGANA, WORK_SPEECH, WORK_CONVERT } work_type;
+
+// what the output of speech and convert jobs is encoded into: nothing (PCM), Opus packets one
+// after another, or Ogg/Opus
+typedef enum { CODEC_PCM, CODEC_OPUS, CODEC_OGG_OPUS, NUM_CODECS } codec_type;
+
+struct work_data;
+
+// a piece of a convert job split at sentence boundaries, or an item of a batch, see run_segment()
+typedef struct {
+  struct work_data* work;
+  // range of work_data.input
+  size_t begin;
+  size_t end;
+  int16_t* pcm;
+  size_t pcm_size;
+  bool done;
+  // when the segment went to the queue
+  Clock::time_point queued_at;
+} segment_data;
+
+// what is applied to the PCM of a job, which engines render at unity gain
+typedef struct {
+  float volume;
+  // unless kNormalizeNone, the volume is worked out from the PCM so that it meets `target_level`
+  // dBFS instead
+  Normalization normalize;
+  float target_level;
+} gain_options;
+
+typedef struct work_data {
+  // what JS refers to the job by, see export_func_cancel()
+  uint32_t id;
+  work_type worktype;
+  unsigned char* input;
+  size_t input_size;
+  size_t input_capacity;
+  void* output;
+  size_t output_size;
+  // set instead of `output` when the output has gone into the cache
+  PcmCache::PcmRef* cached;
+  napi_ref javascript_callback_ref;
+  // set only for streaming calls
+  napi_ref chunk_callback_ref;
+  char* error_message;
+  size_t error_size;
+  // code of the error object, if the error is one that callers are expected to handle
+  const char* error_code;
+  JobQueue::Priority priority;
+  // when the job went to the queue
+  Clock::time_point queued_at;
+  // what PCM is handed over in, which the engine's 16bit mono is turned into on the worker
+  SampleFormat format;
+  uint32_t channels;
+  gain_options gain;
+  // how the voice speaks, which params.prosody points to if any of it is given
+  ebyroid::Prosody prosody;
+  // unless CODEC_PCM, the output is encoded at `bitrate` once it is complete. Opus packets, and
+  // the items of a batch, come with where each of them ends in the output
+  codec_type codec;
+  uint32_t bitrate;
+  uint32_t* packet_ends;
+  size_t num_packets;
+  // storage that stays with the envelope across jobs, see acquire_work()
+  ConvertParams params;
+  CancelToken* cancel;
+  char* base_dir;
+  size_t base_dir_capacity;
+  char* voice;
+  size_t voice_capacity;
+  // set for a job split into segments, which share the envelope, guarded by `segments_mutex`
+  segment_data* segments;
+  size_t segments_capacity;
+  size_t num_segments;
+  // how many segments have gone to the queue, are running there and have been handed on in order
+  size_t segments_pushed;
+  size_t segments_running;
+  size_t segments_emitted;
+  std::mutex* segments_mutex;
+  // resamples the output of a segmented job, as its segments come out at the engine's rate
+  ebyroid::Resampler* resampler;
+  // set while the consumer of a streamed job cannot keep up, which holds the job up before its next
+  // chunk, see export_func_pause()
+  bool paused;
+  std::mutex* flow_mutex;
+  std::condition_variable* resumed;
+  // the segments are whole texts of their own, NUL-separated in `input`, see convertBatch()
+  bool batch;
+  struct work_data* next_free;
+  // links of module_context.works_in_flight
+  struct work_data* prev_in_flight;
+  struct work_data* next_in_flight;
+} work_data;
+
+// how many finished envelopes are kept around for reuse
+static const size_t MAX_FREE_WORKS = 64;
+
+// defaults of the job queue, see default_init_options()
+static const uint32_t DEFAULT_WORKERS = 4;
+static const uint32_t DEFAULT_QUEUE_CAPACITY = 64;
+static const uint32_t DEFAULT_CACHE_BYTES = 0;
+static const uint32_t DEFAULT_MAX_SEGMENT_BYTES = 0;
+static const uint32_t DEFAULT_BITRATE = 64000;
+
+// how many items may wait in module_context.events, beyond which workers block
+static const size_t EVENTS_QUEUE_SIZE = 8;
+
+// the size of the ring of each engine host, which holds 47 sec of 22kHz PCM
+static const uint32_t HOST_RING_BYTES = 4 << 20;
+
+typedef struct {
+  Ebyroid* ebyroid;
+  // runs the engines in host processes instead of `ebyroid`, unless null. `ebyroid` is still
+  // there for the metrics
+  HostPool* hosts;
+  // how many jobs of an engine lane may run at once
+  uint32_t lane_limit;
+  // runs the jobs, and reports back through `events`
+  JobQueue* queue;
+  napi_threadsafe_function events;
+  // results of convert jobs, to serve repeated text without running the engine
+  PcmCache* cache;
+  // longer text is converted in segments of at most this many bytes, unless 0
+  size_t max_segment_bytes;
+  // jobs not finished yet, while which `events` keeps the event loop alive
+  size_t jobs_in_flight;
+  work_data* works_in_flight;
+  uint32_t last_job_id;
+  // envelopes of finished jobs, only ever touched on the main thread
+  work_data* free_works;
+  size_t free_works_count;
+  // ends of jobs that the main thread could not get into the full `events`, to be sent once it has
+  // room, see push_end_on_main()
+  struct stream_item* deferred_ends;
+} module_context;
+
+// an item travelling through module_context.events, either a PCM chunk or the end of a job
+typedef struct stream_item {
+  work_data* work;
+  void* data;
+  size_t size;
+  bool is_end;
+  // links of module_context.deferred_ends
+  struct stream_item* next_deferred;
+} stream_item;
+
+static module_context* module;
+
+// grows a malloc'd block to hold at least `size` bytes, keeping it if it already does
+static bool reserve_bytes(void** block, size_t* capacity, size_t size) {
+  if (size <= *capacity) {
+    return true;
+  }
+  void* grown = realloc(*block, size);
+  if (grown == NULL) {
+    return false;
+  }
+  *block = grown;
+  *capacity = size;
+  return true;
+}
+
+// reads `object[name]` into `result` if it is a number, and leaves `result` alone otherwise
+static napi_status get_optional_uint32(napi_env env,
+                                       napi_value object,
+                                       const char* name,
+                                       uint32_t* result) {
+  napi_status status;
+  napi_value value;
+  napi_valuetype valuetype;
+  status = napi_get_named_property(env, object, name, &value);
+  if (status != napi_ok) {
+    return status;
+  }
+  status = napi_typeof(env, value, &valuetype);
+  if (status != napi_ok || valuetype != napi_number) {
+    return status;
+  }
+  return napi_get_value_uint32(env, value, result);
+}
+
+// reads `object[name]` into `result` if it is a number, and leaves `result` alone otherwise
+static napi_status get_optional_double(napi_env env,
+                                       napi_value object,
+                                       const char* name,
+                                       double* result) {
+  napi_status status;
+  napi_value value;
+  napi_valuetype valuetype;
+  status = napi_get_named_property(env, object, name, &value);
+  if (status != napi_ok) {
+    return status;
+  }
+  status = napi_typeof(env, value, &valuetype);
+  if (status != napi_ok || valuetype != napi_number) {
+    return status;
+  }
+  return napi_get_value_double(env, value, result);
+}
+
+// reads .volume, .normalize and .target_level of `options`, and false if they make no sense
+static bool get_gain_options(napi_env env, napi_value options, gain_options* gain) {
+  double volume = 1.0;
+  uint32_t mode = ebyroid::kNormalizeNone;
+  double level = 0.0;
+  if (get_optional_double(env, options, "volume", &volume) != napi_ok ||
+      get_optional_uint32(env, options, "normalize", &mode) != napi_ok ||
+      get_optional_double(env, options, "target_level", &level) != napi_ok) {
+    return false;
+  }
+  // NaN would slip through the comparisons, and make the gain undefined
+  if (!std::isfinite(volume) || volume < 0.0 || mode > ebyroid::kNormalizeRms ||
+      !std::isfinite(level) || level > 0.0) {
+    return false;
+  }
+  gain->volume = (float) volume;
+  gain->normalize = (Normalization) mode;
+  gain->target_level = (float) level;
+  return true;
+}
+
+// reads .speed, .pitch, .range, .pause_middle, .pause_long and .pause_sentence of `options` into
+// `prosody`, leaving out those not given. false if any makes no sense
+static bool get_prosody(napi_env env, napi_value options, ebyroid::Prosody* prosody, bool* given) {
+  double speed = -1.0, pitch = -1.0, range = -1.0;
+  double pause_middle = -1.0, pause_long = -1.0, pause_sentence = -1.0;
+  if (get_optional_double(env, options, "speed", &speed) != napi_ok ||
+      get_optional_double(env, options, "pitch", &pitch) != napi_ok ||
+      get_optional_double(env, options, "range", &range) != napi_ok ||
+      get_optional_double(env, options, "pause_middle", &pause_middle) != napi_ok ||
+      get_optional_double(env, options, "pause_long", &pause_long) != napi_ok ||
+      get_optional_double(env, options, "pause_sentence", &pause_sentence) != napi_ok) {
+    return false;
+  }
+  // NaN would slip through the comparisons below, as would infinities for the pauses
+  for (double value : {speed, pitch, range, pause_middle, pause_long, pause_sentence}) {
+    if (!std::isfinite(value)) {
+      return false;
+    }
+  }
+  // what VOICEROID2 takes
+  if ((speed >= 0.0 && (speed < 0.5 || speed > 4.0)) ||
+      (pitch >= 0.0 && (pitch < 0.5 || pitch > 2.0)) || range > 2.0 || pause_middle > 10000.0 ||
+      pause_long > 10000.0 || pause_sentence > 10000.0) {
+    return false;
+  }
+  prosody->speed = speed < 0.0 ? -1.0f : (float) speed;
+  prosody->pitch = pitch < 0.0 ? -1.0f : (float) pitch;
+  prosody->range = range < 0.0 ? -1.0f : (float) range;
+  prosody->pause_middle = pause_middle < 0.0 ? -1 : (int32_t) pause_middle;
+  prosody->pause_long = pause_long < 0.0 ? -1 : (int32_t) pause_long;
+  prosody->pause_sentence = pause_sentence < 0.0 ? -1 : (int32_t) pause_sentence;
+  *given = speed >= 0.0 || pitch >= 0.0 || range >= 0.0 || pause_middle >= 0.0 ||
+           pause_long >= 0.0 || pause_sentence >= 0.0;
+  return true;
+}
+
+// takes an envelope from the free list, so that steady traffic does not touch the heap for it
+static work_data* acquire_work() {
+  work_data* work = module->free_works;
+  if (work == NULL) {
+    work = (work_data*) calloc(1, sizeof(*work));
+    if (work != NULL) {
+      work->cancel = new CancelToken();
+      work->segments_mutex = new std::mutex();
+      work->flow_mutex = new std::mutex();
+      work->resumed = new std::condition_variable();
+    }
+    return work;
+  }
+  module->free_works = work->next_free;
+  module->free_works_count--;
+  return work;
+}
+
+static void destroy_work(work_data* work) {
+  free(work->input);
+  free(work->base_dir);
+  free(work->voice);
+  free(work->segments);
+  delete work->cancel;
+  delete work->segments_mutex;
+  delete work->flow_mutex;
+  delete work->resumed;
+  delete work->resampler;
+  free(work);
+}
+
+// frees whatever belongs to the finished job alone and puts the envelope back on the free list
+static void recycle_work(work_data* work) {
+  free(work->output);
+  free(work->error_message);
+  free(work->packet_ends);
+  delete work->cached;
+  work->packet_ends = NULL;
+  work->num_packets = 0;
+  work->output = NULL;
+  work->cached = NULL;
+  work->error_message = NULL;
+  work->error_code = NULL;
+  work->chunk_callback_ref = NULL;
+  work->cancel->Reset();
+  for (size_t i = 0; i < work->num_segments; i++) {
+    free(work->segments[i].pcm);
+  }
+  work->num_segments = 0;
+  delete work->resampler;
+  work->resampler = NULL;
+  work->batch = false;
+  work->paused = false;
+
+  if (module->free_works_count >= MAX_FREE_WORKS) {
+    destroy_work(work);
+    return;
+  }
+  work->next_free = module->free_works;
+  module->free_works = work;
+  module->free_works_count++;
+}
+
+// the metrics of the engine pool, which jobs count into as well
+static Metrics& metrics() {
+  return module->ebyroid->metrics();
+}
+
+static uint64_t usec_since(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count();
+}
+
+// counts the error by its ResultCode, if the engine failed with one
+static void count_error(std::exception& e) {
+  if (ebyroid::ApiError* api_error = dynamic_cast<ebyroid::ApiError*>(&e); api_error) {
+    metrics().CountError(api_error->result());
+  }
+}
+
+// the engine calls of jobs, which go to the engine hosts if there are any and to `ebyroid` if not
+static void engine_hiragana(const ConvertParams& params,
+                            const unsigned char* input,
+                            unsigned char** output,
+                            size_t* output_size) {
+  if (module->hosts) {
+    module->hosts->Hiragana(params, input, output, output_size);
+  } else {
+    module->ebyroid->Hiragana(params, input, output, output_size);
+  }
+}
+
+static void engine_speech(const ConvertParams& params,
+                          const unsigned char* input,
+                          int16_t** output,
+                          size_t* output_size,
+                          const PcmSink& sink) {
+  if (module->hosts) {
+    module->hosts->Speech(params, input, output, output_size, 0u, sink);
+  } else {
+    module->ebyroid->Speech(params, input, output, output_size, 0u, sink);
+  }
+}
+
+static void engine_convert(const ConvertParams& params,
+                           const unsigned char* input,
+                           int16_t** output,
+                           size_t* output_size,
+                           const PcmSink& sink,
+                           uint32_t trim) {
+  if (module->hosts) {
+    module->hosts->Convert(params, input, output, output_size, sink, trim);
+  } else {
+    module->ebyroid->Convert(params, input, output, output_size, sink, trim);
+  }
+}
+
+static uint32_t engine_sample_rate(const ConvertParams& params) {
+  return module->hosts ? module->hosts->SampleRate(params) : module->ebyroid->SampleRate(params);
+}
+
+static void engine_preload(const std::string& base_dir,
+                           const std::string& voice,
+                           ebyroid::LoadTimings* timings) {
+  if (module->hosts) {
+    module->hosts->Preload(base_dir, voice, timings);
+  } else {
+    module->ebyroid->Preload(base_dir, voice, timings);
+  }
+}
+
+// fails the job with a copy of `what`, and `code` if callers are expected to handle the error
+static void set_error(work_data* work, const char* what, const char* code) {
+  work->error_size = strlen(what);
+  work->error_message = (char*) malloc(work->error_size + 1);
+  strcpy(work->error_message, what);
+  work->error_code = code;
+}
+
+// applies `gain` to `size` samples of 16bit mono and writes them to `out` in the format asked for
+static void render_pcm(const int16_t* pcm,
+                       size_t size,
+                       float gain,
+                       SampleFormat format,
+                       uint32_t channels,
+                       void* out) {
+  if (gain == 1.0f) {
+    ebyroid::ConvertPcm(pcm, size, format, channels, out);
+    return;
+  }
+  if (format == ebyroid::kS16 && channels == 1) {
+    ebyroid::ApplyGain(pcm, size, gain, (int16_t*) out);
+    return;
+  }
+  thread_local std::vector<int16_t> scaled;
+  scaled.resize(size);
+  ebyroid::ApplyGain(pcm, size, gain, scaled.data());
+  ebyroid::ConvertPcm(scaled.data(), size, format, channels, out);
+}
+
+// the gain to apply to the whole of `pcm`
+static float gain_of(const gain_options& gain, const int16_t* pcm, size_t size) {
+  if (gain.normalize == ebyroid::kNormalizeNone) {
+    return gain.volume;
+  }
+  return ebyroid::NormalizingGain(pcm, size, gain.normalize, gain.target_level);
+}
+
+static void push_chunk(work_data* work, const int16_t* shorts, size_t size) {
+  Clock::time_point started = Clock::now();
+  stream_item* item = (stream_item*) malloc(sizeof(*item));
+  item->work = work;
+  item->size = size * work->channels * ebyroid::BytesPerSample(work->format);
+  item->data = malloc(item->size);
+  {
+    TraceSpan span("copy", work->id);
+    span.Arg("bytes", (int64_t) item->size);
+    render_pcm(shorts, size, work->gain.volume, work->format, work->channels, item->data);
+  }
+  item->is_end = false;
+  metrics().copy_usec.Observe(usec_since(started));
+  metrics().output_bytes.Add(item->size);
+  // blocks while the main thread is behind, and fails only once the environment is going away
+  if (napi_call_threadsafe_function(module->events, item, napi_tsfn_blocking) != napi_ok) {
+    free(item->data);
+    free(item);
+  }
+}
+
+// the job is over: let the main thread call back, behind any chunks of the job still on the way.
+// runs on a worker, see push_end_on_main() for the main thread
+static void push_end(work_data* work) {
+  stream_item* item = (stream_item*) calloc(1, sizeof(*item));
+  item->work = work;
+  item->is_end = true;
+  if (napi_call_threadsafe_function(module->events, item, napi_tsfn_blocking) != napi_ok) {
+    free(item);
+  }
+}
+
+// push_end() on the main thread, which must not block on `events` as it is the one to drain it. the
+// end waits in module_context.deferred_ends if there is no room
+static void push_end_on_main(work_data* work) {
+  stream_item* item = (stream_item*) calloc(1, sizeof(*item));
+  item->work = work;
+  item->is_end = true;
+  napi_status status = napi_call_threadsafe_function(module->events, item, napi_tsfn_nonblocking);
+  if (status == napi_queue_full) {
+    item->next_deferred = module->deferred_ends;
+    module->deferred_ends = item;
+  } else if (status != napi_ok) {
+    free(item);
+  }
+}
+
+// sends the ends that push_end_on_main() has held back, as far as `events` has room for them
+static void send_deferred_ends() {
+  while (stream_item* item = module->deferred_ends) {
+    napi_status status = napi_call_threadsafe_function(module->events, item, napi_tsfn_nonblocking);
+    if (status == napi_queue_full) {
+      return;
+    }
+    module->deferred_ends = item->next_deferred;
+    if (status != napi_ok) {
+      free(item);
+    }
+  }
+}
+
+// holds a streamed job up for as long as its consumer has paused it, short of its cancellation or
+// deadline. never called with `segments_mutex` held, which the main thread may be waiting for
+static void wait_while_paused(work_data* work) {
+  std::unique_lock<std::mutex> lock(*work->flow_mutex);
+  while (work->paused && !work->cancel->cancelled() && Clock::now() < work->params.deadline) {
+    work->resumed->wait_for(lock, std::chrono::milliseconds(100));
+  }
+}
+
+// jobs of an engine share a lane, named after the voice
+static void lane_of(const ConvertParams& params, std::string* lane) {
+  lane->clear();
+  if (params.voice) {
+    lane->append(params.base_dir).append(1, '\n').append(params.voice);
+  }
+}
+
+// moves the output of a finished convert job into the cache, from which it is shared
+static void cache_output(work_data* work) {
+  thread_local std::string key;
+  const uint32_t mode = ebyroid::IOMODE_PLAIN_TO_WAVE;
+  if (!PcmCache::MakeKey(&key, work->params, mode, work->input, work->input_size)) {
+    return;
+  }
+  int16_t* pcm = (int16_t*) work->output;
+  work->cached = new PcmCache::PcmRef(module->cache->Insert(key, pcm, work->output_size));
+  work->output = NULL;
+}
+
+// turns the 16bit mono output of a finished job into what the caller asked for, at its gain
+static void shape_pcm(work_data* work) {
+  const int16_t* pcm = (const int16_t*) work->output;
+  size_t samples = work->output_size / 2;
+  if (work->cached) {
+    pcm = (*work->cached)->data;
+    samples = (*work->cached)->size / 2;
+  }
+  float gain = gain_of(work->gain, pcm, samples);
+  if (work->format == ebyroid::kS16 && work->channels == 1) {
+    if (gain == 1.0f) {
+      return;
+    }
+    if (!work->cached) {
+      ebyroid::ApplyGain(pcm, samples, gain, (int16_t*) work->output);
+      return;
+    }
+  }
+  size_t size = samples * work->channels * ebyroid::BytesPerSample(work->format);
+  void* formatted = malloc(size > 0 ? size : 1);
+  if (formatted == NULL) {
+    set_error(work, "Could not allocate memory for the output", NULL);
+    return;
+  }
+  render_pcm(pcm, samples, gain, work->format, work->channels, formatted);
+  free(work->output);
+  delete work->cached;
+  work->cached = NULL;
+  work->output = formatted;
+  work->output_size = size;
+}
+
+static void shape_output(work_data* work) {
+  Clock::time_point started = Clock::now();
+  TraceSpan span("copy", work->id);
+  shape_pcm(work);
+  span.Arg("bytes", (int64_t) work->output_size);
+  metrics().copy_usec.Observe(usec_since(started));
+}
+
+static void fail_job(work_data* work, std::exception& e) {
+  static const char* const names[] = {"Ebyroid::Hiragana", "Ebyroid::Speech", "Ebyroid::Convert"};
+  if (JobAborted* aborted = dynamic_cast<JobAborted*>(&e); aborted) {
+    // what the caller asked for, so nothing to complain about
+    const char* code = aborted->reason() == JobAborted::kCancelled ? "EBYROID_CANCELLED"
+                                                                   : "EBYROID_DEADLINE_EXCEEDED";
+    set_error(work, e.what(), code);
+    return;
+  }
+  count_error(e);
+  Eprintf("(%s) %s", names[work->worktype], e.what());
+  set_error(work, e.what(), NULL);
+}
+
+#ifdef EBYROID_WITH_OPUS
+// encodes the shaped output of a finished job, which is 16bit PCM at 48kHz
+static void encode_output(work_data* work) {
+  const int16_t* pcm = (const int16_t*) work->output;
+  size_t size = work->output_size;
+  if (work->cached) {
+    pcm = (*work->cached)->data;
+    size = (*work->cached)->size;
+  }
+  try {
+    ebyroid::OpusWriter writer(work->channels,
+                               work->bitrate,
+                               work->codec == CODEC_OGG_OPUS ? ebyroid::OpusWriter::kOgg
+                                                             : ebyroid::OpusWriter::kPackets);
+    writer.Write(pcm, size / 2 / work->channels);
+    writer.Finish();
+    const std::vector<uint32_t>& ends = writer.packet_ends();
+    if (!ends.empty()) {
+      work->packet_ends = (uint32_t*) malloc(ends.size() * sizeof(uint32_t));
+      if (work->packet_ends == NULL) {
+        set_error(work, "Could not allocate memory for the output", NULL);
+        return;
+      }
+      memcpy(work->packet_ends, ends.data(), ends.size() * sizeof(uint32_t));
+    }
+    work->num_packets = ends.size();
+    free(work->output);
+    delete work->cached;
+    work->cached = NULL;
+    work->output = writer.Release(&work->output_size);
+  } catch (std::exception& e) {
+    fail_job(work, e);
+  }
+}
+#endif
+
+// the last step of a job that does not stream: its output as the caller wants it
+static void finish_output(work_data* work) {
+  shape_output(work);
+#ifdef EBYROID_WITH_OPUS
+  if (work->error_message == NULL && work->codec != CODEC_PCM) {
+    encode_output(work);
+  }
+#endif
+  if (work->error_message == NULL) {
+    metrics().output_bytes.Add(work->cached ? (*work->cached)->size : work->output_size);
+  }
+}
+
+static void run_segment(void* data);
+static napi_typedarray_type array_type_of(SampleFormat format, size_t* element_size);
+
+// where the segment that starts at `pos` ends: at a sentence boundary, or at the NUL after the
+// item of a batch
+static size_t segment_end(const work_data* work, size_t pos) {
+  if (work->batch) {
+    return pos + strlen((const char*) work->input + pos);
+  }
+  const size_t max_bytes = module->max_segment_bytes;
+  return pos + ebyroid::NextSegment(work->input + pos, work->input_size - pos, max_bytes);
+}
+
+// splits a convert job into segments, or a batch into its items, and fills the engine slots of its
+// lane with the first ones. returns false if the queue has no room for any.
+static bool start_segments(work_data* work, const std::string& lane) {
+  const size_t separator = work->batch ? 1 : 0;
+  size_t count = 0;
+  for (size_t pos = 0; pos < work->input_size; count++) {
+    pos = segment_end(work, pos) + separator;
+  }
+  if (count > work->segments_capacity) {
+    void* grown = realloc(work->segments, count * sizeof(segment_data));
+    if (grown == NULL) {
+      return false;
+    }
+    work->segments = (segment_data*) grown;
+    work->segments_capacity = count;
+  }
+
+  size_t pos = 0;
+  for (size_t i = 0; i < count; i++) {
+    segment_data* segment = &work->segments[i];
+    segment->work = work;
+    segment->begin = pos;
+    segment->end = segment_end(work, pos);
+    pos = segment->end + separator;
+    segment->pcm = NULL;
+    segment->pcm_size = 0;
+    segment->done = false;
+  }
+  work->num_segments = count;
+  work->segments_pushed = 0;
+  work->segments_running = 0;
+  work->segments_emitted = 0;
+  work->output_size = 0;
+
+  // no more at once than the engine takes, so that other jobs get to go in between segments
+  std::lock_guard<std::mutex> lock(*work->segments_mutex);
+  while (work->segments_pushed < count && work->segments_pushed < module->lane_limit) {
+    segment_data* next = &work->segments[work->segments_pushed];
+    next->queued_at = Clock::now();
+    if (module->queue->Push(lane, work->priority, run_segment, next) == JobQueue::kFull) {
+      break;
+    }
+    work->segments_pushed++;
+    work->segments_running++;
+  }
+  return work->segments_pushed > 0;
+}
+
+// joins the segments in order into the output of the job
+static void join_segments(work_data* work) {
+  Clock::time_point started = Clock::now();
+  TraceSpan span("join", work->id);
+  size_t total = 0;
+  for (size_t i = 0; i < work->num_segments; i++) {
+    total += work->segments[i].pcm_size;
+  }
+  int16_t* joined = (int16_t*) malloc(total > 0 ? total : 1);
+  if (joined == NULL) {
+    set_error(work, "Could not allocate memory for the output", NULL);
+    return;
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < work->num_segments; i++) {
+    segment_data* segment = &work->segments[i];
+    memcpy((char*) joined + offset, segment->pcm, segment->pcm_size);
+    offset += segment->pcm_size;
+    free(segment->pcm);
+    segment->pcm = NULL;
+  }
+  work->output = joined;
+  work->output_size = total;
+  span.Arg("bytes", (int64_t) total);
+  metrics().copy_usec.Observe(usec_since(started));
+
+  if (work->resampler) {
+    ebyroid::OutputBuffer<int16_t> resampled;
+    size_t samples = total / 2;
+    try {
+      resampled.Reserve((size_t)((uint64_t) samples * work->resampler->to() /
+                                 work->resampler->from()) + 1);
+      work->resampler->Process(joined, samples, &resampled);
+      work->resampler->Flush(&resampled);
+    } catch (std::exception& e) {
+      fail_job(work, e);
+      return;
+    }
+    free(joined);
+    work->output = resampled.Release(&samples);
+    work->output_size = samples * 2;
+  }
+}
+
+// lays the items of a finished batch out one after another in the format of the job, each at a gain
+// of its own, and notes where each of them ends in elements of the array it is handed over in
+static void join_batch(work_data* work) {
+  Clock::time_point started = Clock::now();
+  TraceSpan span("join", work->id);
+  const size_t frame_size = work->channels * ebyroid::BytesPerSample(work->format);
+  size_t element_size;
+  array_type_of(work->format, &element_size);
+  size_t total = 0;
+  for (size_t i = 0; i < work->num_segments; i++) {
+    total += work->segments[i].pcm_size / 2 * frame_size;
+  }
+  void* joined = malloc(total > 0 ? total : 1);
+  uint32_t* ends = (uint32_t*) malloc(work->num_segments * sizeof(uint32_t));
+  if (joined == NULL || ends == NULL) {
+    free(joined);
+    free(ends);
+    set_error(work, "Could not allocate memory for the output", NULL);
+    return;
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < work->num_segments; i++) {
+    segment_data* segment = &work->segments[i];
+    const size_t samples = segment->pcm_size / 2;
+    float gain = gain_of(work->gain, segment->pcm, samples);
+    render_pcm(segment->pcm, samples, gain, work->format, work->channels, (char*) joined + offset);
+    offset += samples * frame_size;
+    ends[i] = (uint32_t)(offset / element_size);
+    free(segment->pcm);
+    segment->pcm = NULL;
+  }
+  work->output = joined;
+  work->output_size = total;
+  work->packet_ends = ends;
+  work->num_packets = work->num_segments;
+  span.Arg("bytes", (int64_t) total);
+  metrics().copy_usec.Observe(usec_since(started));
+  metrics().output_bytes.Add(total);
+}
+
+// runs a segment on a worker of the job queue, and queues the next one in its place
+static void run_segment(void* data) {
+  segment_data* segment = (segment_data*) data;
+  work_data* work = segment->work;
+  const size_t index = segment - work->segments;
+  const uint64_t waited = usec_since(segment->queued_at);
+  metrics().queue_wait_usec.Observe(waited);
+  Tracer::SetJob(work->id);
+  Tracer::Instant("dequeue", work->id, "waitUsec", (int64_t) waited, "segment", (int64_t) index);
+
+  // the engine takes NUL-terminated text, so the segment goes to a copy
+  thread_local std::string text;
+  text.assign((const char*) work->input + segment->begin, segment->end - segment->begin);
+
+  // joins have to come out just like the whole text would, unlike the items of a batch
+  uint32_t trim = ebyroid::kTrimNone;
+  if (!work->batch && index > 0) {
+    trim |= ebyroid::kTrimBegin;
+  }
+  if (!work->batch && index + 1 < work->num_segments) {
+    trim |= ebyroid::kTrimTerm;
+  }
+
+  // segments come out at the engine's rate, and only the whole of them is resampled. items of a
+  // batch are whole, so the engine resamples each of them
+  ConvertParams params = work->params;
+  if (!work->batch) {
+    params.sample_rate = 0;
+  }
+  int16_t* pcm = NULL;
+  size_t pcm_size = 0;
+  uint32_t rate = 0;
+  bool failed = false;
+  try {
+    engine_convert(params, (const unsigned char*) text.c_str(), &pcm, &pcm_size, nullptr, trim);
+    if (!work->batch && work->params.sample_rate != 0) {
+      rate = engine_sample_rate(params);
+    }
+  } catch (std::exception& e) {
+    failed = true;
+    std::lock_guard<std::mutex> lock(*work->segments_mutex);
+    if (work->error_message == NULL) {
+      fail_job(work, e);
+    }
+  }
+
+  if (work->chunk_callback_ref) {
+    wait_while_paused(work);
+  }
+  std::unique_lock<std::mutex> lock(*work->segments_mutex);
+  segment->pcm = pcm;
+  segment->pcm_size = pcm_size;
+  segment->done = true;
+  work->segments_running--;
+
+  if (!failed && work->error_message == NULL && work->resampler == NULL && rate != 0 &&
+      rate != work->params.sample_rate) {
+    try {
+      work->resampler = new ebyroid::Resampler(rate, work->params.sample_rate);
+    } catch (std::exception& e) {
+      fail_job(work, e);
+    }
+  }
+
+  thread_local ebyroid::OutputBuffer<int16_t> resampled;
+  if (!failed && work->error_message == NULL) {
+    // hand on whatever is complete in order, if the job is streamed
+    while (work->chunk_callback_ref && work->segments_emitted < work->num_segments &&
+           work->segments[work->segments_emitted].done) {
+      segment_data* ready = &work->segments[work->segments_emitted];
+      if (work->resampler) {
+        work->resampler->Process(ready->pcm, ready->pcm_size / 2, &resampled);
+        if (work->segments_emitted + 1 == work->num_segments) {
+          work->resampler->Flush(&resampled);
+        }
+        if (resampled.size() > 0) {
+          push_chunk(work, resampled.data(), resampled.size());
+        }
+        work->output_size += resampled.size() * 2;
+        resampled.Clear();
+      } else {
+        if (ready->pcm_size > 0) {
+          push_chunk(work, ready->pcm, ready->pcm_size / 2);
+        }
+        work->output_size += ready->pcm_size;
+      }
+      free(ready->pcm);
+      ready->pcm = NULL;
+      work->segments_emitted++;
+    }
+
+    // and keep the slot busy
+    if (work->segments_pushed < work->num_segments) {
+      static thread_local std::string lane;
+      lane_of(work->params, &lane);
+      segment_data* next = &work->segments[work->segments_pushed];
+      next->queued_at = Clock::now();
+      if (module->queue->Push(lane, work->priority, run_segment, next) == JobQueue::kQueued) {
+        work->segments_pushed++;
+        work->segments_running++;
+      } else {
+        set_error(work, "The job queue is full", "EBYROID_QUEUE_FULL");
+      }
+    }
+  }
+
+  // the job is over once nothing runs any more, and either all is done or something failed
+  if (work->segments_running > 0) {
+    return;
+  }
+  if (work->error_message == NULL && work->segments_pushed < work->num_segments) {
+    return;
+  }
+  if (work->error_message == NULL && work->batch) {
+    join_batch(work);
+  } else if (work->error_message == NULL && !work->chunk_callback_ref) {
+    join_segments(work);
+    if (work->error_message == NULL && module->cache->enabled()) {
+      cache_output(work);
+    }
+    if (work->error_message == NULL) {
+      finish_output(work);
+    }
+  }
+  // the envelope may be gone as soon as the main thread gets the end
+  lock.unlock();
+  push_end(work);
+}
+
+// runs on a worker of the job queue
+static void run_job(void* data) {
+  work_data* work = (work_data*) data;
+  const uint64_t waited = usec_since(work->queued_at);
+  metrics().queue_wait_usec.Observe(waited);
+  Tracer::SetJob(work->id);
+  Tracer::Instant("dequeue", work->id, "waitUsec", (int64_t) waited);
+
+  PcmSink sink = nullptr;
+  if (work->chunk_callback_ref) {
+    sink = [work](const int16_t* shorts, size_t size) {
+      wait_while_paused(work);
+      push_chunk(work, shorts, size);
+    };
+  }
+
+  try {
+    switch (work->worktype) {
+      case WORK_HIRAGANA: {
+        unsigned char* out;
+        engine_hiragana(work->params, work->input, &out, &work->output_size);
+        work->output = out;
+        break;
+      }
+      case WORK_SPEECH: {
+        int16_t* out;
+        engine_speech(work->params, work->input, &out, &work->output_size, sink);
+        work->output = out;
+        if (!sink) {
+          finish_output(work);
+        }
+        break;
+      }
+      case WORK_CONVERT: {
+        if (work->cached) {
+          // found in the cache, see do_async_work()
+          finish_output(work);
+          break;
+        }
+        int16_t* out;
+        engine_convert(
+            work->params, work->input, &out, &work->output_size, sink, ebyroid::kTrimNone);
+        work->output = out;
+        if (!sink && module->cache->enabled()) {
+          cache_output(work);
+        }
+        if (!sink) {
+          finish_output(work);
+        }
+        break;
+      }
+    }
+  } catch (std::exception& e) {
+    fail_job(work, e);
+  }
+
+  push_end(work);
+}
+
+static void finalize_malloced(napi_env env, void* data, void* hint) {
+  free(data);
+}
+
+// the typed array that holds samples of the format: Int16Array, Float32Array, Int32Array, or
+// Uint8Array for packed s24
+static napi_typedarray_type array_type_of(SampleFormat format, size_t* element_size) {
+  switch (format) {
+    case ebyroid::kF32:
+      *element_size = 4;
+      return napi_float32_array;
+    case ebyroid::kS24:
+      *element_size = 1;
+      return napi_uint8_array;
+    case ebyroid::kS32:
+      *element_size = 4;
+      return napi_int32_array;
+    default:
+      *element_size = 2;
+      return napi_int16_array;
+  }
+}
+
+// gives malloc'd memory to V8 without copying, or copies it where external memory is not allowed.
+// either way `data` is no longer the caller's to free.
+static napi_status create_malloced_arraybuffer(napi_env env,
+                                               void* data,
+                                               size_t size,
+                                               napi_value* result) {
+  napi_status status;
+  status = napi_create_external_arraybuffer(env, data, size, finalize_malloced, NULL, result);
+  if (status != napi_ok) {
+    void* node_memory;
+    status = napi_create_arraybuffer(env, size, &node_memory, result);
+    if (status == napi_ok) {
+      memcpy(node_memory, data, size);
+    }
+    free(data);
+  }
+  return status;
+}
+
+// same as create_malloced_arraybuffer, as a typed array of the format
+static napi_status create_pcm_array(napi_env env,
+                                    void* data,
+                                    size_t size,
+                                    SampleFormat format,
+                                    napi_value* result) {
+  napi_value array_buffer;
+  napi_status status = create_malloced_arraybuffer(env, data, size, &array_buffer);
+  if (status != napi_ok) {
+    return status;
+  }
+  size_t element_size;
+  napi_typedarray_type type = array_type_of(format, &element_size);
+  return napi_create_typedarray(env, type, size / element_size, array_buffer, 0, result);
+}
+
+static void finalize_pcm_ref(napi_env env, void* data, void* hint) {
+  delete (PcmCache::PcmRef*) hint;
+}
+
+// gives cached PCM to V8 without copying, the array holding on to it until GC'd.
+// either way `ref` is no longer the caller's to delete.
+static napi_status create_shared_pcm_array(napi_env env,
+                                           PcmCache::PcmRef* ref,
+                                           napi_value* result) {
+  napi_status status;
+  napi_value array_buffer;
+  void* data = (*ref)->data;
+  size_t size = (*ref)->size;
+  status = napi_create_external_arraybuffer(env, data, size, finalize_pcm_ref, ref, &array_buffer);
+  if (status != napi_ok) {
+    void* node_memory;
+    status = napi_create_arraybuffer(env, size, &node_memory, &array_buffer);
+    if (status == napi_ok) {
+      memcpy(node_memory, data, size);
+    }
+    delete ref;
+    if (status != napi_ok) {
+      return status;
+    }
+  }
+  return napi_create_typedarray(env, napi_int16_array, size / 2, array_buffer, 0, result);
+}
+
+// same as create_pcm_array but for a node buffer
+static napi_status create_byte_buffer(napi_env env, void* data, size_t size, napi_value* result) {
+  napi_status status;
+  status = napi_create_external_buffer(env, size, data, finalize_malloced, NULL, result);
+  if (status != napi_ok) {
+    status = napi_create_buffer_copy(env, size, data, NULL, result);
+    free(data);
+  }
+  return status;
+}
 
-using ebyroid::Ebyroid, ebyroid::ConvertParams;
+// how the job ended, by the code of its error
+static Metrics::Outcome outcome_of(const work_data* work) {
+  if (work->error_message == NULL) {
+    return Metrics::kSucceeded;
+  }
+  if (work->error_code == NULL) {
+    return Metrics::kFailed;
+  }
+  if (strcmp(work->error_code, "EBYROID_CANCELLED") == 0) {
+    return Metrics::kCancelled;
+  }
+  if (strcmp(work->error_code, "EBYROID_DEADLINE_EXCEEDED") == 0) {
+    return Metrics::kDeadlineExceeded;
+  }
+  if (strcmp(work->error_code, "EBYROID_QUEUE_FULL") == 0) {
+    return Metrics::kRejected;
+  }
+  return Metrics::kFailed;
+}
+
+static void finish_work(napi_env env, work_data* work) {
+  static const size_t RETVAL_SIZE = 3;
+  napi_status status;
+  napi_value retval[RETVAL_SIZE];
+  napi_value callback, undefined, null_value;
+
+  // prepare JS 'undefined' value
+  status = napi_get_undefined(env, &undefined);
+  e_assert(status == napi_ok);
+
+  // prepare JS 'null' value
+  status = napi_get_null(env, &null_value);
+  e_assert(status == napi_ok);
+
+  metrics().CountOutcome(outcome_of(work));
+
+  if (work->error_message) {
+    napi_value message, code = NULL, error_object;
+    status = napi_create_string_utf8(env, work->error_message, work->error_size, &message);
+    e_assert(status == napi_ok);
+    if (work->error_code) {
+      status = napi_create_string_utf8(env, work->error_code, NAPI_AUTO_LENGTH, &code);
+      e_assert(status == napi_ok);
+    }
+    status = napi_create_error(env, code, message, &error_object);
+    e_assert(status == napi_ok);
+
+    retval[0] = error_object;
+    retval[1] = null_value;
+    retval[2] = undefined;
+    goto DO_FINALLY;
+  }
+
+  napi_value return_value, packet_ends;
+  packet_ends = undefined;
+  if (work->codec == CODEC_OPUS || work->batch) {
+    // where each Opus packet, or each item of a batch, ends in the output
+    napi_value array_buffer;
+    size_t size = work->num_packets * sizeof(uint32_t);
+    status = create_malloced_arraybuffer(env, work->packet_ends, size, &array_buffer);
+    work->packet_ends = NULL;
+    e_assert(status == napi_ok);
+    status = napi_create_typedarray(
+        env, napi_uint32_array, work->num_packets, array_buffer, 0, &packet_ends);
+    e_assert(status == napi_ok);
+  }
+  if (work->codec != CODEC_PCM) {
+    // encoded bytes, along with where each Opus packet ends in them unless they are in Ogg
+    status = create_byte_buffer(env, work->output, work->output_size, &return_value);
+    e_assert(status == napi_ok);
+    work->output = NULL;
+  } else if (work->chunk_callback_ref) {
+    // PCM has already gone out chunk by chunk, so just tell the number of samples
+    status = napi_create_double(env, (double) (work->output_size / 2), &return_value);
+    e_assert(status == napi_ok);
+  } else {
+    switch (work->worktype) {
+      case WORK_HIRAGANA:
+        // hand output bytes over to a node buffer
+        status = create_byte_buffer(env, work->output, work->output_size, &return_value);
+        e_assert(status == napi_ok);
+        work->output = NULL;
+        break;
+      case WORK_SPEECH:
+      case WORK_CONVERT:
+        if (work->cached) {
+          status = create_shared_pcm_array(env, work->cached, &return_value);
+          e_assert(status == napi_ok);
+          work->cached = NULL;
+          break;
+        }
+        // hand output bytes over to a typed array of the format
+        status =
+            create_pcm_array(env, work->output, work->output_size, work->format, &return_value);
+        e_assert(status == napi_ok);
+        work->output = NULL;
+        break;
+    }
+  }
+  retval[0] = null_value;
+  retval[1] = return_value;
+  retval[2] = packet_ends;
+
+DO_FINALLY:
+  // acquire the javascript callback function
+  status = napi_get_reference_value(env, work->javascript_callback_ref, &callback);
+  e_assert(status == napi_ok);
+
+  // actually call the javascript callback function
+  {
+    TraceSpan span("complete", work->id);
+    status = napi_call_function(env, undefined, callback, RETVAL_SIZE, retval, NULL);
+  }
+  e_assert(status == napi_ok || status == napi_pending_exception);
+  Tracer::AsyncEnd("job", work->id);
+
+  // drop the references to the functions
+  // ... means they will be GC'd
+  status = napi_delete_reference(env, work->javascript_callback_ref);
+  e_assert(status == napi_ok);
+  if (work->chunk_callback_ref) {
+    status = napi_delete_reference(env, work->chunk_callback_ref);
+    e_assert(status == napi_ok);
+  }
+
+  // let the event loop go once nothing is left to wait for
+  if (work->prev_in_flight) {
+    work->prev_in_flight->next_in_flight = work->next_in_flight;
+  } else {
+    module->works_in_flight = work->next_in_flight;
+  }
+  if (work->next_in_flight) {
+    work->next_in_flight->prev_in_flight = work->prev_in_flight;
+  }
+  module->jobs_in_flight--;
+  if (module->jobs_in_flight == 0) {
+    status = napi_unref_threadsafe_function(env, module->events);
+    e_assert(status == napi_ok);
+  }
+
+  // and manually allocated recources
+  recycle_work(work);
+}
+
+static void events_on_call_js(napi_env env, napi_value js_callback, void* context, void* data) {
+  napi_status status;
+  stream_item* item = (stream_item*) data;
+
+  if (env == NULL) {
+    // the function is being torn down along with the environment
+    free(item->data);
+    free(item);
+    return;
+  }
+
+  // a slot has just come free
+  send_deferred_ends();
+
+  work_data* work = item->work;
+  if (item->is_end) {
+    free(item);
+    finish_work(env, work);
+    return;
+  }
+
+  // hand the chunk over to a typed array of the format
+  napi_value chunk, undefined, chunk_callback;
+  status = create_pcm_array(env, item->data, item->size, work->format, &chunk);
+  free(item);
+  e_assert(status == napi_ok);
+
+  status = napi_get_undefined(env, &undefined);
+  e_assert(status == napi_ok);
+  status = napi_get_reference_value(env, work->chunk_callback_ref, &chunk_callback);
+  e_assert(status == napi_ok);
+  status = napi_call_function(env, undefined, chunk_callback, 1, &chunk, NULL);
+  e_assert(status == napi_ok || status == napi_pending_exception);
+}
+
+// copies the buffers of a batch into `work->input`, each followed by a NUL, and sets input_size to
+// the bytes of all of them. false unless `array` is a non-empty array of buffers without NULs
+static bool copy_batch_input(napi_env env, napi_value array, work_data* work) {
+  napi_status status;
+  bool is_array;
+  uint32_t length;
+  status = napi_is_array(env, array, &is_array);
+  if (status != napi_ok || !is_array) {
+    return false;
+  }
+  status = napi_get_array_length(env, array, &length);
+  if (status != napi_ok || length == 0) {
+    return false;
+  }
+
+  // the size first, so as to copy into one block
+  size_t size = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1 && !reserve_bytes((void**) &work->input, &work->input_capacity, size + 1)) {
+      return false;
+    }
+    size_t offset = 0;
+    for (uint32_t i = 0; i < length; i++) {
+      napi_value element;
+      bool is_buffer;
+      void* data;
+      size_t data_size;
+      if (napi_get_element(env, array, i, &element) != napi_ok ||
+          napi_is_buffer(env, element, &is_buffer) != napi_ok || !is_buffer ||
+          napi_get_buffer_info(env, element, &data, &data_size) != napi_ok) {
+        return false;
+      }
+      if (pass == 0) {
+        if (memchr(data, '\0', data_size) != NULL) {
+          return false;
+        }
+        size += data_size + 1;
+        continue;
+      }
+      memcpy(work->input + offset, data, data_size);
+      work->input[offset + data_size] = '\0';
+      offset += data_size + 1;
+    }
+  }
+  work->input[size] = '\0';
+  work->input_size = size;
+  return true;
+}
+
+// en_assert for do_async_work() once it has taken an envelope, which goes back to the free list
+// rather than leak along with the buffers it holds
+#ifdef _DEBUG
+#define work_assert(expr) assert(expr)
+#else
+#define work_assert(expr)                                                                          \
+  do {                                                                                             \
+    if (!(expr)) {                                                                                 \
+      recycle_work(work);                                                                          \
+      napi_throw_error(env, "EBY001", "assertion en_assert(" #expr ") failed.");                   \
+      return NULL;                                                                                 \
+    };                                                                                             \
+  } while (0)
+#endif
+
+static napi_value do_async_work(napi_env env,
+                                napi_callback_info info,
+                                work_type worktype,
+                                bool streaming = false,
+                                bool batch = false) {
+  napi_status status;
+  napi_valuetype valuetype;
+
+  // streaming calls take the chunk callback right before the final callback
+  size_t argc = streaming ? 4 : 3;
+  napi_value argv[4];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok);
+  napi_value done_callback = argv[argc - 1];
+
+  // first arg must be buffer, or an array of them for a batch (see copy_batch_input())
+  bool is_buffer;
+  status = napi_is_buffer(env, argv[0], &is_buffer);
+  en_assert(status == napi_ok && is_buffer == !batch);
+
+  // second arg must be object
+  status = napi_typeof(env, argv[1], &valuetype);
+  en_assert(status == napi_ok && valuetype == napi_object);
+
+  // the rest must be functions
+  for (size_t i = 2; i < argc; i++) {
+    status = napi_typeof(env, argv[i], &valuetype);
+    en_assert(status == napi_ok && valuetype == napi_function);
+  }
+
+  // take an envelope and copy the input into the room it already has
+  work_data* work = acquire_work();
+  en_assert(work != NULL);
+  bool ok;
+  work->batch = batch;
+  if (batch) {
+    ok = copy_batch_input(env, argv[0], work);
+    work_assert(ok);
+  } else {
+    unsigned char* node_buffer_data;
+    size_t node_buffer_size;
+    status = napi_get_buffer_info(env, argv[0], (void**) &node_buffer_data, &node_buffer_size);
+    work_assert(status == napi_ok);
+    ok = reserve_bytes((void**) &work->input, &work->input_capacity, node_buffer_size + 1);
+    work_assert(ok);
+    memcpy(work->input, node_buffer_data, node_buffer_size);
+    *(work->input + node_buffer_size) = '\0';
+    work->input_size = node_buffer_size;
+  }
+
+  // build ConvertParams, all of whose properties are optional
+  ConvertParams* params = &work->params;
+  napi_value value;
+  bool has_property;
+
+  // fetch .needs_reload boolean
+  params->needs_reload = false;
+  status = napi_has_named_property(env, argv[1], "needs_reload", &has_property);
+  work_assert(status == napi_ok);
+  if (has_property) {
+    status = napi_get_named_property(env, argv[1], "needs_reload", &value);
+    work_assert(status == napi_ok);
+    status = napi_get_value_bool(env, value, &params->needs_reload);
+    work_assert(status == napi_ok);
+  }
+
+  // the voice to route to
+  params->base_dir = NULL;
+  params->voice = NULL;
+  status = napi_has_named_property(env, argv[1], "voice", &has_property);
+  work_assert(status == napi_ok);
+  if (has_property) {
+    size_t bufsize;
+
+    // fetch .base_dir string
+    status = napi_get_named_property(env, argv[1], "base_dir", &value);
+    work_assert(status == napi_ok);
+    status = napi_get_value_string_utf8(env, value, NULL, 0, &bufsize);
+    work_assert(status == napi_ok);
+    ok = reserve_bytes((void**) &work->base_dir, &work->base_dir_capacity, bufsize + 1);
+    work_assert(ok);
+    status = napi_get_value_string_utf8(env, value, work->base_dir, bufsize + 1, NULL);
+    work_assert(status == napi_ok);
+    params->base_dir = work->base_dir;
+
+    // fetch .voice string
+    status = napi_get_named_property(env, argv[1], "voice", &value);
+    work_assert(status == napi_ok);
+    status = napi_get_value_string_utf8(env, value, NULL, 0, &bufsize);
+    work_assert(status == napi_ok);
+    ok = reserve_bytes((void**) &work->voice, &work->voice_capacity, bufsize + 1);
+    work_assert(ok);
+    status = napi_get_value_string_utf8(env, value, work->voice, bufsize + 1, NULL);
+    work_assert(status == napi_ok);
+    params->voice = work->voice;
+  }
+
+  // fetch .sample_rate number, 0 for the engine's own
+  params->sample_rate = 0;
+  status = get_optional_uint32(env, argv[1], "sample_rate", &params->sample_rate);
+  work_assert(status == napi_ok);
+
+  // fetch .format and .channels numbers, what the PCM is to be handed over in
+  uint32_t format = ebyroid::kS16;
+  status = get_optional_uint32(env, argv[1], "format", &format);
+  work_assert(status == napi_ok && format < ebyroid::kNumSampleFormats);
+  work->format = (SampleFormat) format;
+  work->channels = 1;
+  status = get_optional_uint32(env, argv[1], "channels", &work->channels);
+  work_assert(status == napi_ok && (work->channels == 1 || work->channels == 2));
+
+  // fetch .volume, .normalize and .target_level, the gain of the PCM. normalizing takes the whole
+  // of it, which a stream does not have before it ends
+  ok = get_gain_options(env, argv[1], &work->gain);
+  work_assert(ok && !(streaming && work->gain.normalize != ebyroid::kNormalizeNone));
+
+  // fetch .speed, .pitch, .range and the pauses, how the voice speaks
+  bool has_prosody;
+  ok = get_prosody(env, argv[1], &work->prosody, &has_prosody);
+  work_assert(ok);
+  params->prosody = has_prosody ? &work->prosody : NULL;
+
+  // fetch .codec and .bitrate numbers. Opus takes the whole output of convert in 16bit at 48kHz
+  uint32_t codec = CODEC_PCM;
+  status = get_optional_uint32(env, argv[1], "codec", &codec);
+  work_assert(status == napi_ok && codec < NUM_CODECS);
+#ifndef EBYROID_WITH_OPUS
+  work_assert(codec == CODEC_PCM);
+#endif
+  work_assert(codec == CODEC_PCM || (!streaming && !batch && worktype == WORK_CONVERT &&
+                                     work->format == ebyroid::kS16 &&
+                                     params->sample_rate == ebyroid::kOpusSampleRate));
+  work->codec = (codec_type) codec;
+  work->bitrate = DEFAULT_BITRATE;
+  status = get_optional_uint32(env, argv[1], "bitrate", &work->bitrate);
+  work_assert(status == napi_ok);
+
+  // fetch .priority number
+  uint32_t priority = JobQueue::kNormal;
+  status = napi_has_named_property(env, argv[1], "priority", &has_property);
+  work_assert(status == napi_ok);
+  if (has_property) {
+    status = napi_get_named_property(env, argv[1], "priority", &value);
+    work_assert(status == napi_ok);
+    status = napi_get_value_uint32(env, value, &priority);
+    work_assert(status == napi_ok && priority < JobQueue::kNumPriorities);
+  }
+
+  // fetch .timeout number, the msec from now within which the job has to be done
+  params->cancel = work->cancel;
+  params->deadline = std::chrono::steady_clock::time_point::max();
+  status = napi_has_named_property(env, argv[1], "timeout", &has_property);
+  work_assert(status == napi_ok);
+  if (has_property) {
+    uint32_t timeout;
+    status = napi_get_named_property(env, argv[1], "timeout", &value);
+    work_assert(status == napi_ok);
+    status = napi_get_value_uint32(env, value, &timeout);
+    work_assert(status == napi_ok);
+    params->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  }
+
+  // create reference for the callback fucntion
+  // because it otherwise will soon get GC'd
+  napi_ref callback_ref;
+  status = napi_create_reference(env, done_callback, 1, &callback_ref);
+  work_assert(status == napi_ok);
+
+  // and for the chunk callback too
+  napi_ref chunk_callback_ref = NULL;
+  if (streaming) {
+    status = napi_create_reference(env, argv[2], 1, &chunk_callback_ref);
+    work_assert(status == napi_ok);
+  }
+
+  // fill in working data
+  work->id = ++module->last_job_id;
+  Tracer::AsyncBegin("job", work->id, "type", worktype);
+  work->javascript_callback_ref = callback_ref;
+  work->chunk_callback_ref = chunk_callback_ref;
+  work->worktype = worktype;
+  work->priority = (JobQueue::Priority) priority;
+  work->output = NULL;
+  work->error_message = NULL;
+  work->error_code = NULL;
+
+  // keep the event loop alive until the job reports back
+  if (module->jobs_in_flight == 0) {
+    status = napi_ref_threadsafe_function(env, module->events);
+    en_assert(status == napi_ok);
+  }
+  module->jobs_in_flight++;
+  work->prev_in_flight = NULL;
+  work->next_in_flight = module->works_in_flight;
+  if (work->next_in_flight) {
+    work->next_in_flight->prev_in_flight = work;
+  }
+  module->works_in_flight = work;
+
+  // (reused so as not to allocate)
+  static std::string lane;
+  lane_of(*params, &lane);
+
+  // encoded output is not cached, but the PCM to encode may be, in which case the job is left with
+  // encoding it and need not wait for the engine (engine lanes have '\n' in their names)
+  if (worktype == WORK_CONVERT && work->codec != CODEC_PCM && module->cache->enabled()) {
+    static std::string key;
+    const uint32_t mode = ebyroid::IOMODE_PLAIN_TO_WAVE;
+    if (PcmCache::MakeKey(&key, *params, mode, work->input, work->input_size)) {
+      if (PcmCache::PcmRef pcm = module->cache->Find(key); pcm) {
+        work->cached = new PcmCache::PcmRef(pcm);
+        lane.assign("encode");
+      }
+    }
+  }
+
+  // queue the job, or report back right away that there is no room for it.
+  // long text goes in segments, which run side by side and let other jobs go in between, and so do
+  // the items of a batch
+  bool queued;
+  if (batch || (worktype == WORK_CONVERT && !work->cached && module->max_segment_bytes > 0 &&
+                work->input_size > module->max_segment_bytes)) {
+    queued = start_segments(work, lane);
+  } else {
+    work->queued_at = Clock::now();
+    queued = module->queue->Push(lane, work->priority, run_job, work) == JobQueue::kQueued;
+  }
+  if (!queued) {
+    set_error(work, "The job queue is full", "EBYROID_QUEUE_FULL");
+    push_end_on_main(work);
+  }
+
+  napi_value job_id;
+  status = napi_create_uint32(env, work->id, &job_id);
+  en_assert(status == napi_ok);
+  return job_id;
+}
+
+#undef work_assert
+
+//
+// JS Signature:
+//   convert(inbytes: Buffer, options: object, done: function(err, pcm: PcmArray) -> none) -> none
+//
+// PcmArray is the typed array of options.format: Int16Array (s16, default), Float32Array (f32),
+// Uint8Array (packed s24) or Int32Array (s32).
+//
+static napi_value export_func_convert(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_CONVERT);
+}
+
+//
+// JS Signature:
+//   convertBatch(inbytes: Buffer[],
+//                options: object,
+//                done: function(err, pcm: PcmArray, ends: Uint32Array) -> none) -> none
+//
+// Converts every text of `inbytes` as one job, whose texts go to the engine slots of the voice one
+// after another like the segments of long text do. Their PCM comes back one after another in one
+// array, the i-th ending at ends[i], each at the gain of its own if normalized. Takes the same
+// options as convert() but for .codec, and fails as a whole if any of the texts does.
+//
+static napi_value export_func_convert_batch(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_CONVERT, false, true);
+}
+
+//
+// JS Signature:
+//   speech(inbytes: Buffer, options={}, done: function(err, pcm: PcmArray) -> none) -> none
+//
+static napi_value export_func_speech(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_SPEECH);
+}
+
+//
+// JS Signature:
+//   convertStream(inbytes: Buffer,
+//                 options: object,
+//                 onchunk: function(pcm: PcmArray) -> none,
+//                 done: function(err, samples: number) -> none) -> none
+//
+static napi_value export_func_convert_stream(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_CONVERT, true);
+}
+
+//
+// JS Signature:
+//   speechStream(inbytes: Buffer,
+//                options={},
+//                onchunk: function(pcm: PcmArray) -> none,
+//                done: function(err, samples: number) -> none) -> none
+//
+static napi_value export_func_speech_stream(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_SPEECH, true);
+}
+
+//
+// JS Signature:
+//   reinterpret(inbytes: Buffer, options={}, done: function(err, outbytes: Buffer) -> none) -> none
+//
+static napi_value export_func_reinterpret(napi_env env, napi_callback_info info) {
+  return do_async_work(env, info, WORK_HIRAGANA);
+}
+
+// takes the segments of a job that are still waiting out of the queue, and reports back right away
+// if none of the others runs any more
+static void cancel_segments(work_data* work) {
+  std::unique_lock<std::mutex> lock(*work->segments_mutex);
+  size_t removed = module->queue->RemoveIf([work](JobQueue::JobProc proc, void* job) {
+    return proc == run_segment && ((segment_data*) job)->work == work;
+  });
+  if (removed == 0) {
+    return;
+  }
+  // no more segments get pushed once the job has an error
+  if (work->error_message == NULL) {
+    set_error(work, "The job has been cancelled", "EBYROID_CANCELLED");
+  }
+  work->segments_running -= removed;
+  if (work->segments_running > 0) {
+    return;
+  }
+  lock.unlock();
+  push_end_on_main(work);
+}
+
+//
+// JS Signature:
+//   cancel(jobId: number) -> boolean
+//
+// Gives up on a job that has not finished yet, which then fails with an error of code
+// EBYROID_CANCELLED: a waiting job is taken out of the queue, a running one is aborted.
+// Returns false if the job is not in flight (any more).
+//
+static napi_value export_func_cancel(napi_env env, napi_callback_info info) {
+  napi_status status;
+
+  size_t argc = 1;
+  napi_value argv[1];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok && argc == 1);
+
+  uint32_t id;
+  status = napi_get_value_uint32(env, argv[0], &id);
+  en_assert(status == napi_ok);
+
+  work_data* work = module->works_in_flight;
+  while (work != NULL && work->id != id) {
+    work = work->next_in_flight;
+  }
+  bool found = work != NULL && !work->cancel->cancelled();
+  if (found) {
+    if (work->num_segments > 0) {
+      cancel_segments(work);
+    } else if (module->queue->Remove(work)) {
+      // never to be run, so report back right away
+      set_error(work, "The job has been cancelled", "EBYROID_CANCELLED");
+      push_end_on_main(work);
+    }
+    // the worker is on it (or has just finished), and notices if need be
+    work->cancel->Cancel();
+    std::lock_guard<std::mutex> lock(*work->flow_mutex);
+    work->resumed->notify_all();
+  }
+
+  napi_value result;
+  status = napi_get_boolean(env, found, &result);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+//
+// JS Signature:
+//   pause(jobId: number, paused: boolean) -> boolean
+//
+// Holds a streaming job up before its next chunk while paused, for a consumer that cannot keep up,
+// and lets it go on once not. A paused job still keeps its engine busy, and is still given up on
+// at its deadline or when cancelled. Returns false if the job is not in flight (any more).
+//
+static napi_value export_func_pause(napi_env env, napi_callback_info info) {
+  napi_status status;
+
+  size_t argc = 2;
+  napi_value argv[2];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok && argc == 2);
+
+  uint32_t id;
+  status = napi_get_value_uint32(env, argv[0], &id);
+  en_assert(status == napi_ok);
+  bool paused;
+  status = napi_get_value_bool(env, argv[1], &paused);
+  en_assert(status == napi_ok);
+
+  work_data* work = module->works_in_flight;
+  while (work != NULL && work->id != id) {
+    work = work->next_in_flight;
+  }
+  if (work != NULL) {
+    std::lock_guard<std::mutex> lock(*work->flow_mutex);
+    work->paused = paused;
+    work->resumed->notify_all();
+  }
+
+  napi_value result;
+  status = napi_get_boolean(env, work != NULL, &result);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+// reads the string `object[name]` into `result`, reusing its memory
+static napi_status get_string(napi_env env,
+                              napi_value object,
+                              const char* name,
+                              std::string* result) {
+  napi_status status;
+  napi_value value;
+  size_t size;
+  status = napi_get_named_property(env, object, name, &value);
+  if (status != napi_ok) {
+    return status;
+  }
+  status = napi_get_value_string_utf8(env, value, NULL, 0, &size);
+  if (status != napi_ok) {
+    return status;
+  }
+  result->resize(size);
+  return napi_get_value_string_utf8(env, value, &(*result)[0], size + 1, NULL);
+}
+
+//
+// JS Signature:
+//   lookupCache(inbytes: Buffer, options: object) -> PcmArray | null
+//
+// The PCM that convert() would produce, if it is cached. Takes base_dir, voice, sample_rate,
+// format, channels, the prosody and the gain options from `options` just like convert() does.
+// A 16bit mono array at unity gain shares its memory with the cache, so it must not be written to.
+//
+static napi_value export_func_lookup_cache(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  status = napi_get_null(env, &result);
+  en_assert(status == napi_ok);
+  if (module->cache == NULL || !module->cache->enabled()) {
+    return result;
+  }
+
+  size_t argc = 2;
+  napi_value argv[2];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok && argc == 2);
+
+  unsigned char* input;
+  size_t input_size;
+  status = napi_get_buffer_info(env, argv[0], (void**) &input, &input_size);
+  en_assert(status == napi_ok);
+
+  bool has_voice;
+  status = napi_has_named_property(env, argv[1], "voice", &has_voice);
+  en_assert(status == napi_ok);
+  if (!has_voice) {
+    return result;
+  }
+
+  // reused so that lookups do not allocate
+  static std::string base_dir, voice, key;
+  status = get_string(env, argv[1], "base_dir", &base_dir);
+  en_assert(status == napi_ok);
+  status = get_string(env, argv[1], "voice", &voice);
+  en_assert(status == napi_ok);
+
+  ConvertParams params = {};
+  params.base_dir = &base_dir[0];
+  params.voice = &voice[0];
+  status = get_optional_uint32(env, argv[1], "sample_rate", &params.sample_rate);
+  en_assert(status == napi_ok);
+  uint32_t format = ebyroid::kS16;
+  status = get_optional_uint32(env, argv[1], "format", &format);
+  en_assert(status == napi_ok && format < ebyroid::kNumSampleFormats);
+  uint32_t channels = 1;
+  status = get_optional_uint32(env, argv[1], "channels", &channels);
+  en_assert(status == napi_ok && (channels == 1 || channels == 2));
+  gain_options gain;
+  bool ok = get_gain_options(env, argv[1], &gain);
+  en_assert(ok);
+  ebyroid::Prosody prosody;
+  bool has_prosody;
+  ok = get_prosody(env, argv[1], &prosody, &has_prosody);
+  en_assert(ok);
+  params.prosody = has_prosody ? &prosody : NULL;
+
+  PcmCache::MakeKey(&key, params, ebyroid::IOMODE_PLAIN_TO_WAVE, input, input_size);
+  PcmCache::PcmRef pcm = module->cache->Find(key);
+  if (!pcm) {
+    return result;
+  }
+  size_t samples = pcm->size / 2;
+  float scale = gain_of(gain, pcm->data, samples);
+  if (format == ebyroid::kS16 && channels == 1 && scale == 1.0f) {
+    status = create_shared_pcm_array(env, new PcmCache::PcmRef(pcm), &result);
+    en_assert(status == napi_ok);
+    return result;
+  }
+
+  // anything else is a copy of the cached PCM, which then need not be treated as read-only
+  size_t size = samples * channels * ebyroid::BytesPerSample((SampleFormat) format);
+  void* formatted = malloc(size > 0 ? size : 1);
+  en_assert(formatted != NULL);
+  render_pcm(pcm->data, samples, scale, (SampleFormat) format, channels, formatted);
+  status = create_pcm_array(env, formatted, size, (SampleFormat) format, &result);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+// sets `object[name]` to a number
+static napi_status set_number(napi_env env, napi_value object, const char* name, double number) {
+  napi_value value;
+  napi_status status = napi_create_double(env, number, &value);
+  if (status != napi_ok) {
+    return status;
+  }
+  return napi_set_named_property(env, object, name, value);
+}
+
+//
+// JS Signature:
+//   cacheStats() -> { hits: number,
+//                     misses: number,
+//                     entries: number,
+//                     bytes: number,
+//                     budget: number }
+//
+static napi_value export_func_cache_stats(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  PcmCache::Stats stats = {};
+  if (module->cache != NULL) {
+    stats = module->cache->stats();
+  }
+  status = napi_create_object(env, &result);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "hits", (double) stats.hits);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "misses", (double) stats.misses);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "entries", (double) stats.entries);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "bytes", (double) stats.bytes);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "budget", (double) stats.budget);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+//
+// JS Signature:
+//   stageStats() -> { kanaJobs: number,
+//                     kanaMsec: number,
+//                     waveJobs: number,
+//                     waveMsec: number,
+//                     plainJobs: number,
+//                     plainMsec: number,
+//                     kanaHits: number,
+//                     kanaMisses: number }
+//
+static napi_value export_func_stage_stats(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  ebyroid::StageStats stats = {};
+  if (module->ebyroid != NULL) {
+    stats = module->ebyroid->stage_stats();
+  }
+  status = napi_create_object(env, &result);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "kanaJobs", (double) stats.kana_jobs);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "kanaMsec", stats.kana_usec / 1000.0);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "waveJobs", (double) stats.wave_jobs);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "waveMsec", stats.wave_usec / 1000.0);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "plainJobs", (double) stats.plain_jobs);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "plainMsec", stats.plain_usec / 1000.0);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "kanaHits", (double) stats.kana_hits);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "kanaMisses", (double) stats.kana_misses);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+// a histogram as { bounds: number[], counts: number[], sum: number, count: number }, with the
+// bounds and the sum divided by `unit`. `counts` is per bucket, the last one being above all bounds
+static napi_status create_histogram(napi_env env,
+                                    const Histogram& histogram,
+                                    double unit,
+                                    napi_value* result) {
+  Histogram::Snapshot snapshot = histogram.snapshot();
+  napi_status status;
+  napi_value bounds, counts;
+  status = napi_create_object(env, result);
+  if (status != napi_ok) {
+    return status;
+  }
+  status = napi_create_array_with_length(env, snapshot.bounds.size(), &bounds);
+  if (status != napi_ok) {
+    return status;
+  }
+  status = napi_create_array_with_length(env, snapshot.counts.size(), &counts);
+  if (status != napi_ok) {
+    return status;
+  }
+  for (size_t i = 0; i < snapshot.counts.size(); i++) {
+    napi_value value;
+    if (i < snapshot.bounds.size()) {
+      status = napi_create_double(env, snapshot.bounds[i] / unit, &value);
+      if (status == napi_ok) {
+        status = napi_set_element(env, bounds, (uint32_t) i, value);
+      }
+      if (status != napi_ok) {
+        return status;
+      }
+    }
+    status = napi_create_double(env, (double) snapshot.counts[i], &value);
+    if (status == napi_ok) {
+      status = napi_set_element(env, counts, (uint32_t) i, value);
+    }
+    if (status != napi_ok) {
+      return status;
+    }
+  }
+  status = napi_set_named_property(env, *result, "bounds", bounds);
+  if (status == napi_ok) {
+    status = napi_set_named_property(env, *result, "counts", counts);
+  }
+  if (status == napi_ok) {
+    status = set_number(env, *result, "sum", snapshot.sum / unit);
+  }
+  if (status == napi_ok) {
+    status = set_number(env, *result, "count", (double) snapshot.count);
+  }
+  return status;
+}
+
+// sets `object[name]` to a histogram, see create_histogram()
+static napi_status set_histogram(napi_env env,
+                                 napi_value object,
+                                 const char* name,
+                                 const Histogram& histogram,
+                                 double unit) {
+  napi_value value;
+  napi_status status = create_histogram(env, histogram, unit, &value);
+  if (status != napi_ok) {
+    return status;
+  }
+  return napi_set_named_property(env, object, name, value);
+}
+
+//
+// JS Signature:
+//   stats() -> { jobs: { inFlight: number,
+//                        queued: number,
+//                        succeeded: number,
+//                        failed: number,
+//                        cancelled: number,
+//                        deadlineExceeded: number,
+//                        rejected: number },
+//                errors: { [resultCode: string]: number },
+//                queueWaitMsec: Histogram,
+//                engineMsec: { kana: Histogram, wave: Histogram, plain: Histogram },
+//                chunksPerJob: Histogram,
+//                chunkBytes: Histogram,
+//                outputBytes: number,
+//                copyMsec: Histogram,
+//                loadMsec: Histogram,
+//                loads: { baseDir: string,
+//                         voice: string,
+//                         loads: number,
+//                         reloads: number,
+//                         msec: number }[] } | null
+//
+// Histogram is { bounds: number[], counts: number[], sum: number, count: number }, see
+// create_histogram(). `errors` counts the jobs (and the loads of init()) that failed as the engine
+// returned a ResultCode, by its name (e.g. ERR_TOO_MANY_JOBS). null before init().
+//
+static napi_value export_func_stats(napi_env env, napi_callback_info info) {
+  napi_status status;
+  napi_value result;
+
+  if (module->ebyroid == NULL) {
+    status = napi_get_null(env, &result);
+    en_assert(status == napi_ok);
+    return result;
+  }
+  Metrics& m = metrics();
+  status = napi_create_object(env, &result);
+  en_assert(status == napi_ok);
+
+  napi_value jobs;
+  status = napi_create_object(env, &jobs);
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "inFlight", (double) module->jobs_in_flight);
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "queued", (double) module->queue->pending());
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "succeeded", (double) m.outcomes(Metrics::kSucceeded));
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "failed", (double) m.outcomes(Metrics::kFailed));
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "cancelled", (double) m.outcomes(Metrics::kCancelled));
+  en_assert(status == napi_ok);
+  status =
+      set_number(env, jobs, "deadlineExceeded", (double) m.outcomes(Metrics::kDeadlineExceeded));
+  en_assert(status == napi_ok);
+  status = set_number(env, jobs, "rejected", (double) m.outcomes(Metrics::kRejected));
+  en_assert(status == napi_ok);
+  status = napi_set_named_property(env, result, "jobs", jobs);
+  en_assert(status == napi_ok);
+
+  napi_value errors;
+  status = napi_create_object(env, &errors);
+  en_assert(status == napi_ok);
+  for (auto& [name, count] : m.errors()) {
+    status = set_number(env, errors, name, (double) count);
+    en_assert(status == napi_ok);
+  }
+  status = napi_set_named_property(env, result, "errors", errors);
+  en_assert(status == napi_ok);
+
+  status = set_histogram(env, result, "queueWaitMsec", m.queue_wait_usec, 1000.0);
+  en_assert(status == napi_ok);
+  napi_value engine;
+  status = napi_create_object(env, &engine);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, engine, "kana", m.engine_usec[ebyroid::kKanaStage], 1000.0);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, engine, "wave", m.engine_usec[ebyroid::kWaveStage], 1000.0);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, engine, "plain", m.engine_usec[ebyroid::kPlainStage], 1000.0);
+  en_assert(status == napi_ok);
+  status = napi_set_named_property(env, result, "engineMsec", engine);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, result, "chunksPerJob", m.chunks_per_job, 1.0);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, result, "chunkBytes", m.chunk_bytes, 1.0);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "outputBytes", (double) m.output_bytes.value());
+  en_assert(status == napi_ok);
+  status = set_histogram(env, result, "copyMsec", m.copy_usec, 1000.0);
+  en_assert(status == napi_ok);
+  status = set_histogram(env, result, "loadMsec", m.load_usec, 1000.0);
+  en_assert(status == napi_ok);
+  status = set_number(env, result, "hostRestarts", (double) m.host_restarts.value());
+  en_assert(status == napi_ok);
+
+  std::vector<Metrics::VoiceLoads> voice_loads = m.voice_loads();
+  napi_value loads;
+  status = napi_create_array_with_length(env, voice_loads.size(), &loads);
+  en_assert(status == napi_ok);
+  for (size_t i = 0; i < voice_loads.size(); i++) {
+    const Metrics::VoiceLoads& voice = voice_loads[i];
+    napi_value object, value;
+    status = napi_create_object(env, &object);
+    en_assert(status == napi_ok);
+    status = napi_create_string_utf8(env, voice.base_dir.c_str(), voice.base_dir.size(), &value);
+    en_assert(status == napi_ok);
+    status = napi_set_named_property(env, object, "baseDir", value);
+    en_assert(status == napi_ok);
+    status = napi_create_string_utf8(env, voice.voice.c_str(), voice.voice.size(), &value);
+    en_assert(status == napi_ok);
+    status = napi_set_named_property(env, object, "voice", value);
+    en_assert(status == napi_ok);
+    status = set_number(env, object, "loads", (double) voice.loads);
+    en_assert(status == napi_ok);
+    status = set_number(env, object, "reloads", (double) voice.reloads);
+    en_assert(status == napi_ok);
+    status = set_number(env, object, "msec", voice.usec / 1000.0);
+    en_assert(status == napi_ok);
+    status = napi_set_element(env, loads, (uint32_t) i, object);
+    en_assert(status == napi_ok);
+  }
+  status = napi_set_named_property(env, result, "loads", loads);
+  en_assert(status == napi_ok);
+  return result;
+}
+
+// how many events of each thread the tracer keeps by default
+static const uint32_t DEFAULT_TRACE_EVENTS = 65536;
+
+//
+// JS Signature:
+//   traceStart(eventsPerThread=65536) -> none
+//
+// Starts recording trace events of every job, keeping the latest `eventsPerThread` of every thread.
+// Only the first call sets the size, and anything recorded before the last call is left out of
+// traceFlush().
+//
+static napi_value export_func_trace_start(napi_env env, napi_callback_info info) {
+  napi_status status;
+
+  size_t argc = 1;
+  napi_value argv[1];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok);
+
+  uint32_t events = DEFAULT_TRACE_EVENTS;
+  if (argc > 0) {
+    status = napi_get_value_uint32(env, argv[0], &events);
+    en_assert(status == napi_ok && events > 0);
+  }
+  Tracer::Start(events);
+  return NULL;
+}
+
+//
+// JS Signature:
+//   traceStop() -> none
+//
+// Stops recording, keeping what has been recorded for traceFlush().
+//
+static napi_value export_func_trace_stop(napi_env env, napi_callback_info info) {
+  Tracer::Stop();
+  return NULL;
+}
+
+//
+// JS Signature:
+//   traceFlush(path: string) -> number
+//
+// Writes what has been recorded to `path` in the Chrome trace-event format, for chrome://tracing or
+// Perfetto, and returns how many events went in. Recording goes on meanwhile. Throws an error of
+// code `EBYROID_TRACE_FAILED` if the file cannot be written.
+//
+static napi_value export_func_trace_flush(napi_env env, napi_callback_info info) {
+  napi_status status;
 
-typedef struct {
-  Ebyroid* ebyroid;
-} module_context;
+  size_t argc = 1;
+  napi_value argv[1];
+  status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
+  en_assert(status == napi_ok && argc == 1);
 
-typedef enum { WORK_HIRAGANA, WORK_SPEECH, WORK_CONVERT } work_type;
+  napi_valuetype valuetype;
+  status = napi_typeof(env, argv[0], &valuetype);
+  en_assert(status == napi_ok && valuetype == napi_string);
 
-typedef struct {
-  work_type worktype;
-  unsigned char* input;
-  size_t input_size;
-  void* output;
-  size_t output_size;
-  napi_async_work self;
-  napi_ref javascript_callback_ref;
-  char* error_message;
-  size_t error_size;
-  ConvertParams* convert_params;
-} work_data;
+  std::string path;
+  size_t size;
+  status = napi_get_value_string_utf8(env, argv[0], NULL, 0, &size);
+  en_assert(status == napi_ok);
+  path.resize(size);
+  status = napi_get_value_string_utf8(env, argv[0], &path[0], size + 1, NULL);
+  en_assert(status == napi_ok);
 
-static module_context* module;
+  size_t events = 0;
+  try {
+    events = Tracer::Flush(path);
+  } catch (std::exception& e) {
+    napi_throw_error(env, "EBYROID_TRACE_FAILED", e.what());
+    return NULL;
+  }
+  napi_value result;
+  status = napi_create_double(env, (double) events, &result);
+  en_assert(status == napi_ok);
+  return result;
+}
 
-static void async_work_on_execute(napi_env env, void* data) {
-  int result;
+// settings of init(), which only the first call that sets the module up takes
+typedef struct {
+  uint32_t max_engines;
+  uint32_t workers;
+  uint32_t queue_capacity;
+  uint32_t cache_bytes;
+  uint32_t kana_cache_size;
+  uint32_t max_segment_bytes;
+  // engines run in this many host processes per voice at `host_path`, or in this process if 0
+  uint32_t engine_hosts;
+  std::string host_path;
+} init_options;
+
+// reads init_options from a JS object, leaving out what is not in it. false if any is invalid
+static bool get_init_options(napi_env env, napi_value object, init_options* options) {
   napi_status status;
-  work_data* work = (work_data*) data;
-
-  switch (work->worktype) {
-    case WORK_HIRAGANA:
-      try {
-        unsigned char* out;
-        result = module->ebyroid->Hiragana(work->input, &out, &work->output_size);
-        work->output = out;
-      } catch (std::exception& e) {
-        Eprintf("(Ebyroid::Hiragana) %s", e.what());
-        size_t size = strlen(e.what());
-        char* what = (char*) malloc(size + 1);
-        strcpy(what, e.what());
-        work->error_message = what;
-        work->error_size = size;
-      }
-      break;
-    case WORK_SPEECH:
-      try {
-        int16_t* out;
-        result = module->ebyroid->Speech(work->input, &out, &work->output_size);
-        work->output = out;
-      } catch (std::exception& e) {
-        Eprintf("(Ebyroid::Speech) %s", e.what());
-        size_t size = strlen(e.what());
-        char* what = (char*) malloc(size + 1);
-        strcpy(what, e.what());
-        work->error_message = what;
-        work->error_size = size;
-      }
-      break;
-    case WORK_CONVERT:
-      try {
-        int16_t* out;
-        result =
-            module->ebyroid->Convert(*work->convert_params, work->input, &out, &work->output_size);
-        work->output = out;
-      } catch (std::exception& e) {
-        Eprintf("(Ebyroid::Convert) %s", e.what());
-        size_t size = strlen(e.what());
-        char* what = (char*) malloc(size + 1);
-        strcpy(what, e.what());
-        work->error_message = what;
-        work->error_size = size;
-      }
-      break;
+  napi_valuetype valuetype;
+  status = napi_typeof(env, object, &valuetype);
+  if (status != napi_ok || valuetype != napi_object) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "maxEngines", &options->max_engines);
+  if (status != napi_ok) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "workers", &options->workers);
+  if (status != napi_ok || options->workers == 0) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "queueCapacity", &options->queue_capacity);
+  if (status != napi_ok || options->queue_capacity == 0) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "cacheBytes", &options->cache_bytes);
+  if (status != napi_ok) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "kanaCacheSize", &options->kana_cache_size);
+  if (status != napi_ok) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "maxSegmentBytes", &options->max_segment_bytes);
+  if (status != napi_ok) {
+    return false;
+  }
+  status = get_optional_uint32(env, object, "engineHosts", &options->engine_hosts);
+  if (status != napi_ok) {
+    return false;
+  }
+  bool has_path;
+  status = napi_has_named_property(env, object, "hostPath", &has_path);
+  if (status != napi_ok) {
+    return false;
+  }
+  if (has_path) {
+    napi_value value;
+    size_t size;
+    status = napi_get_named_property(env, object, "hostPath", &value);
+    if (status != napi_ok) {
+      return false;
+    }
+    status = napi_typeof(env, value, &valuetype);
+    if (status != napi_ok || valuetype != napi_string) {
+      return false;
+    }
+    status = napi_get_value_string_utf8(env, value, NULL, 0, &size);
+    if (status != napi_ok) {
+      return false;
+    }
+    options->host_path.resize(size);
+    status = napi_get_value_string_utf8(env, value, &options->host_path[0], size + 1, NULL);
+    if (status != napi_ok) {
+      return false;
+    }
   }
+  return options->engine_hosts == 0 || !options->host_path.empty();
 }
 
-static void async_work_on_complete(napi_env env, napi_status work_status, void* data) {
-  static const size_t RETVAL_SIZE = 2;
+// creates the engine pool (with no engine loaded yet), the cache and the job queue, unless done
+static void setup_module(napi_env env, const init_options& options) {
+  if (module->ebyroid != NULL) {
+    return;
+  }
   napi_status status;
-  napi_value retval[RETVAL_SIZE];
-  napi_value callback, undefined, null_value;
-  work_data* work = (work_data*) data;
 
-  // prepare JS 'undefined' value
-  status = napi_get_undefined(env, &undefined);
-  e_assert(status == napi_ok);
+  module->ebyroid = Ebyroid::Create(options.max_engines, options.kana_cache_size);
 
-  // prepare JS 'null' value
-  status = napi_get_null(env, &null_value);
+  // finalize ebyroid in the cleanup hook
+  status = napi_add_env_cleanup_hook(env, [](void* arg) { delete module->ebyroid; }, NULL);
   e_assert(status == napi_ok);
 
-  if (work_status == napi_cancelled) {
-    static const char* what = "N-API async work has been cancelled";
-    napi_value message, error_object;
-    status = napi_create_string_utf8(env, what, strlen(what), &message);
-    e_assert(status == napi_ok);
-    status = napi_create_error(env, NULL, message, &error_object);
-    e_assert(status == napi_ok);
-
-    retval[0] = error_object;
-    retval[1] = null_value;
-    goto DO_FINALLY;
-  }
-
-  if (work->error_message) {
-    napi_value message, error_object;
-    status = napi_create_string_utf8(env, work->error_message, work->error_size, &message);
+  // the hosts count into the metrics of ebyroid, which outlives them
+  module->lane_limit = ebyroid::kMaxConcurrentJobs;
+  if (options.engine_hosts > 0) {
+    module->hosts = new HostPool(options.host_path,
+                                 options.engine_hosts,
+                                 HOST_RING_BYTES,
+                                 options.kana_cache_size,
+                                 &module->ebyroid->metrics());
+    module->lane_limit = ebyroid::kMaxConcurrentJobs * options.engine_hosts;
+    status = napi_add_env_cleanup_hook(env, [](void* arg) { delete module->hosts; }, NULL);
     e_assert(status == napi_ok);
-    status = napi_create_error(env, NULL, message, &error_object);
-    e_assert(status == napi_ok);
-
-    retval[0] = error_object;
-    retval[1] = null_value;
-    goto DO_FINALLY;
   }
 
-  napi_value return_value;
-  switch (work->worktype) {
-    case WORK_HIRAGANA:
-      // convert output bytes to node buffer
-      status = napi_create_buffer_copy(env, work->output_size, work->output, NULL, &return_value);
-      e_assert(status == napi_ok);
-      break;
-    case WORK_SPEECH:
-    case WORK_CONVERT:
-      // convert output bytes to int16array
-      // create underlying arraybuffer
-      void* node_memory;
-      napi_value array_buffer;
-      status = napi_create_arraybuffer(env, work->output_size, &node_memory, &array_buffer);
-      e_assert(status == napi_ok);
-      // copy data to arraybuffer and create int16array
-      memcpy(node_memory, work->output, work->output_size);
-      e_assert(work->output_size % 2 == 0);
-      status = napi_create_typedarray(
-          env, napi_int16_array, work->output_size / 2, array_buffer, 0, &return_value);
-      e_assert(status == napi_ok);
-      break;
-  }
-  retval[0] = null_value;
-  retval[1] = return_value;
+  // create the function through which workers report back to the main thread
+  napi_value events_name;
+  status = napi_create_string_utf8(env, "Ebyroid Job Events", NAPI_AUTO_LENGTH, &events_name);
+  e_assert(status == napi_ok);
+  status = napi_create_threadsafe_function(env,
+                                           NULL,
+                                           NULL,
+                                           events_name,
+                                           EVENTS_QUEUE_SIZE,
+                                           1,
+                                           NULL,
+                                           NULL,
+                                           NULL,
+                                           events_on_call_js,
+                                           &module->events);
+  e_assert(status == napi_ok);
 
-DO_FINALLY:
-  // acquire the javascript callback function
-  status = napi_get_reference_value(env, work->javascript_callback_ref, &callback);
+  // which only holds the event loop while jobs are in flight
+  status = napi_unref_threadsafe_function(env, module->events);
   e_assert(status == napi_ok);
 
-  // actually call the javascript callback function
-  status = napi_call_function(env, undefined, callback, RETVAL_SIZE, retval, NULL);
-  e_assert(status == napi_ok || status == napi_pending_exception);
+  module->max_segment_bytes = options.max_segment_bytes;
 
-  // decrement the reference count of the function
-  // ... means it will be GC'd
-  uint32_t refs;
-  status = napi_reference_unref(env, work->javascript_callback_ref, &refs);
-  e_assert(status == napi_ok && refs == 0);
+  // the cache outlives the workers, which fill it
+  module->cache = new PcmCache(options.cache_bytes);
+  status = napi_add_env_cleanup_hook(env, [](void* arg) { delete module->cache; }, NULL);
+  e_assert(status == napi_ok);
 
-  // now neko work is done so we delete the work object
-  status = napi_delete_async_work(env, work->self);
+  // start the workers, each engine taking as many jobs at once as it can
+  module->queue = new JobQueue(options.workers, options.queue_capacity, module->lane_limit);
+
+  // the workers have to stop before the engines go away, which the reverse order of hooks ensures.
+  // they may be blocked on the full `events`, or on a paused job, so the jobs are given up on and
+  // `events` is closed first
+  status = napi_add_env_cleanup_hook(
+      env,
+      [](void* arg) {
+        for (work_data* work = module->works_in_flight; work; work = work->next_in_flight) {
+          work->cancel->Cancel();
+          std::lock_guard<std::mutex> lock(*work->flow_mutex);
+          work->resumed->notify_all();
+        }
+        napi_release_threadsafe_function(module->events, napi_tsfn_abort);
+        delete module->queue;
+        while (stream_item* item = module->deferred_ends) {
+          module->deferred_ends = item->next_deferred;
+          free(item);
+        }
+      },
+      NULL);
   e_assert(status == napi_ok);
+}
 
-  // and manually allocated recources
-  free(work->input);
-  free(work->output);
-  free(work->error_message);
-  if (work->convert_params) {
-    free(work->convert_params->base_dir);
-    free(work->convert_params->voice);
-    free(work->convert_params);
-  }
-  free(work);
+// the defaults of init_options
+static init_options default_init_options() {
+  init_options options;
+  options.max_engines = 0;
+  options.workers = DEFAULT_WORKERS;
+  options.queue_capacity = DEFAULT_QUEUE_CAPACITY;
+  options.cache_bytes = DEFAULT_CACHE_BYTES;
+  options.kana_cache_size = 0;
+  options.max_segment_bytes = DEFAULT_MAX_SEGMENT_BYTES;
+  options.engine_hosts = 0;
+  return options;
 }
 
-static napi_value do_async_work(napi_env env, napi_callback_info info, work_type worktype) {
+//
+// JS Signature:
+//   init(baseDir: string,
+//        voice: string,
+//        options={ maxEngines=0,
+//                  workers=4,
+//                  queueCapacity=64,
+//                  cacheBytes=0,
+//                  kanaCacheSize=0,
+//                  maxSegmentBytes=0,
+//                  engineHosts=0,
+//                  hostPath?: string }) -> none
+//
+// Loads the engine of the voice on the main thread, throwing an error of code
+// `EBYROID_INIT_FAILED` if it cannot be. May be called again, but only the first call that gets
+// that far takes the options. See initAsync() to keep the event loop going meanwhile.
+// With `engineHosts` > 0, engines run in that many processes of the executable at `hostPath` per
+// voice rather than in this one, and a crash of one fails its jobs but nothing else.
+//
+static napi_value export_func_init(napi_env env, napi_callback_info info) {
   napi_status status;
-  napi_valuetype valuetype;
 
   size_t argc = 3;
   napi_value argv[3];
   status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
-  en_assert(status == napi_ok);
+  en_assert(status == napi_ok && argc >= 2);
 
-  // first arg must be buffer
-  bool is_buffer;
-  status = napi_is_buffer(env, argv[0], &is_buffer);
-  en_assert(status == napi_ok && is_buffer == true);
+  napi_valuetype valuetype;
+  status = napi_typeof(env, argv[0], &valuetype);
+  en_assert(status == napi_ok && valuetype == napi_string);
 
-  // second arg must be object
   status = napi_typeof(env, argv[1], &valuetype);
-  en_assert(status == napi_ok && valuetype == napi_object);
-
-  // third arg must be function
-  status = napi_typeof(env, argv[2], &valuetype);
-  en_assert(status == napi_ok && valuetype == napi_function);
-
-  // fetch buffer data
-  unsigned char* node_buffer_data;
-  size_t node_buffer_size;
-  status = napi_get_buffer_info(env, argv[0], (void**) &node_buffer_data, &node_buffer_size);
-
-  // allocate
-  unsigned char* buffer = (unsigned char*) malloc(node_buffer_size + 1);
-  memcpy(buffer, node_buffer_data, node_buffer_size);
-  *(buffer + node_buffer_size) = '\0';
+  en_assert(status == napi_ok && valuetype == napi_string);
 
-  // check if the object arg is for params
-  bool is_param;
-  status = napi_has_named_property(env, argv[1], "needs_reload", &is_param);
+  // fetch the strings
+  std::string install_dir, voice_dir;
+  size_t size;
+  status = napi_get_value_string_utf8(env, argv[0], NULL, 0, &size);
+  en_assert(status == napi_ok);
+  install_dir.resize(size);
+  status = napi_get_value_string_utf8(env, argv[0], &install_dir[0], size + 1, NULL);
+  en_assert(status == napi_ok);
+  status = napi_get_value_string_utf8(env, argv[1], NULL, 0, &size);
+  en_assert(status == napi_ok);
+  voice_dir.resize(size);
+  status = napi_get_value_string_utf8(env, argv[1], &voice_dir[0], size + 1, NULL);
   en_assert(status == napi_ok);
 
-  // build ConvertParam if it's for param
-  ConvertParams* params = NULL;
-  if (is_param) {
-    napi_value value;
-    params = (ConvertParams*) malloc(sizeof(*params));
+  // fetch options, if any
+  init_options options = default_init_options();
+  if (argc > 2) {
+    bool ok = get_init_options(env, argv[2], &options);
+    en_assert(ok);
+  }
 
-    // fetch .needs_reload boolean
-    status = napi_get_named_property(env, argv[1], "needs_reload", &value);
-    en_assert(status == napi_ok);
-    status = napi_get_value_bool(env, value, &params->needs_reload);
-    en_assert(status == napi_ok);
+  setup_module(env, options);
 
-    if (params->needs_reload) {
-      size_t bufsize;
-
-      // fetch .base_dir string
-      char* base_dir;
-      status = napi_get_named_property(env, argv[1], "base_dir", &value);
-      en_assert(status == napi_ok);
-      status = napi_get_value_string_utf8(env, value, NULL, NULL, &bufsize);
-      en_assert(status == napi_ok);
-      base_dir = (char*) malloc(bufsize + 1);
-      status = napi_get_value_string_utf8(env, value, base_dir, bufsize + 1, NULL);
-      en_assert(status == napi_ok);
-      params->base_dir = base_dir;
-
-      // fetch .voice string
-      char* voice;
-      status = napi_get_named_property(env, argv[1], "voice", &value);
-      en_assert(status == napi_ok);
-      status = napi_get_value_string_utf8(env, value, NULL, NULL, &bufsize);
-      en_assert(status == napi_ok);
-      voice = (char*) malloc(bufsize + 1);
-      status = napi_get_value_string_utf8(env, value, voice, bufsize + 1, NULL);
-      en_assert(status == napi_ok);
-      params->voice = voice;
-
-      // fetch .volume float
-      double volume;
-      status = napi_get_named_property(env, argv[1], "volume", &value);
-      en_assert(status == napi_ok);
-      status = napi_get_value_double(env, value, &volume);
-      en_assert(status == napi_ok);
-      params->volume = (float) volume;
-
-    } else {
-      params->base_dir = NULL;
-      params->voice = NULL;
-    }
-  }
-
-  char* workname;
-  switch (worktype) {
-    case WORK_HIRAGANA:
-      workname = "Input Text Reinterpretor";
-      break;
-    case WORK_SPEECH:
-      workname = "Reinterpreted Text To PCM Converter";
-      break;
-    case WORK_CONVERT:
-      workname = "Raw Text To PCM Converter";
-      break;
+  // load the first engine, failing which is for the caller to deal with
+  try {
+    engine_preload(install_dir, voice_dir, NULL);
+  } catch (std::exception& e) {
+    count_error(e);
+    napi_throw_error(env, "EBYROID_INIT_FAILED", e.what());
   }
+  return NULL;
+}
 
-  // create name identifier
-  napi_value async_work_name;
-  status = napi_create_string_utf8(env, workname, NAPI_AUTO_LENGTH, &async_work_name);
-  en_assert(status == napi_ok);
-
-  // create reference for the callback fucntion
-  // because it otherwise will soon get GC'd
+// engines that initAsync() loads, and how that went for each of them
+typedef struct {
+  std::vector<std::string> base_dirs;
+  std::vector<std::string> voices;
+  std::vector<ebyroid::LoadTimings> timings;
+  // empty for the voices that loaded
+  std::vector<std::string> errors;
   napi_ref callback_ref;
-  status = napi_create_reference(env, argv[2], 1, &callback_ref);
-  en_assert(status == napi_ok);
+  napi_async_work async_work;
+} init_work;
+
+// loads every engine on a thread of its own, which Ebyroid lets run side by side where it can
+static void init_execute(napi_env env, void* data) {
+  init_work* work = (init_work*) data;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < work->voices.size(); i++) {
+    threads.emplace_back([work, i]() {
+      try {
+        engine_preload(work->base_dirs[i], work->voices[i], &work->timings[i]);
+      } catch (std::exception& e) {
+        count_error(e);
+        work->errors[i] = e.what();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
 
-  // create working data
-  work_data* work = (work_data*) malloc(sizeof(*work));
-  work->input = buffer;
-  work->input_size = node_buffer_size;
-  work->javascript_callback_ref = callback_ref;
-  work->worktype = worktype;
-  work->output = NULL;
-  work->error_message = NULL;
-  work->convert_params = params;
+static void init_complete(napi_env env, napi_status async_status, void* data) {
+  napi_status status;
+  init_work* work = (init_work*) data;
+  napi_value retval[2], callback, undefined;
+  bool failed = false;
 
-  // create async work object
-  status = napi_create_async_work(
-      env, NULL, async_work_name, async_work_on_execute, async_work_on_complete, work, &work->self);
-  en_assert(status == napi_ok);
+  status = napi_get_undefined(env, &undefined);
+  e_assert(status == napi_ok);
+  retval[1] = undefined;
 
-  // queue the async work
-  status = napi_queue_async_work(env, work->self);
-  en_assert(status == napi_ok);
+  // the first voice that failed, if any, fails the whole
+  for (size_t i = 0; i < work->voices.size() && !failed; i++) {
+    if (work->errors[i].empty()) {
+      continue;
+    }
+    failed = true;
+    std::string what = "Could not load " + work->voices[i] + " in " + work->base_dirs[i] + ": ";
+    what += work->errors[i];
+    napi_value code, message;
+    status = napi_create_string_utf8(env, "EBYROID_INIT_FAILED", NAPI_AUTO_LENGTH, &code);
+    e_assert(status == napi_ok);
+    status = napi_create_string_utf8(env, what.c_str(), what.size(), &message);
+    e_assert(status == napi_ok);
+    status = napi_create_error(env, code, message, &retval[0]);
+    e_assert(status == napi_ok);
+  }
 
-  return NULL;
-}
+  if (!failed) {
+    status = napi_get_null(env, &retval[0]);
+    e_assert(status == napi_ok);
+    status = napi_create_array_with_length(env, work->voices.size(), &retval[1]);
+    e_assert(status == napi_ok);
+    for (size_t i = 0; i < work->voices.size(); i++) {
+      const ebyroid::LoadTimings& timings = work->timings[i];
+      napi_value object, loaded;
+      status = napi_create_object(env, &object);
+      e_assert(status == napi_ok);
+      status = napi_get_boolean(env, timings.loaded, &loaded);
+      e_assert(status == napi_ok);
+      status = napi_set_named_property(env, object, "loaded", loaded);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "libraryMsec", timings.library_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "initMsec", timings.init_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "langLoadMsec", timings.lang_load_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "voiceLoadMsec", timings.voice_load_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "paramMsec", timings.param_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = set_number(env, object, "totalMsec", timings.total_usec / 1000.0);
+      e_assert(status == napi_ok);
+      status = napi_set_element(env, retval[1], (uint32_t) i, object);
+      e_assert(status == napi_ok);
+    }
+  }
 
-//
-// JS Signature:
-//   convert(inbytes: Buffer, options: object, done: function(err, pcm: Int16Array) -> none) -> none
-//
-static napi_value export_func_convert(napi_env env, napi_callback_info info) {
-  return do_async_work(env, info, WORK_CONVERT);
-}
+  status = napi_get_reference_value(env, work->callback_ref, &callback);
+  e_assert(status == napi_ok);
+  status = napi_call_function(env, undefined, callback, 2, retval, NULL);
+  e_assert(status == napi_ok || status == napi_pending_exception);
 
-//
-// JS Signature:
-//   speech(inbytes: Buffer, options={}, done: function(err, pcm: Int16Array) -> none) -> none
-//
-static napi_value export_func_speech(napi_env env, napi_callback_info info) {
-  return do_async_work(env, info, WORK_SPEECH);
+  status = napi_delete_reference(env, work->callback_ref);
+  e_assert(status == napi_ok);
+  status = napi_delete_async_work(env, work->async_work);
+  e_assert(status == napi_ok);
+  delete work;
 }
 
 //
 // JS Signature:
-//   reinterpret(inbytes: Buffer, options={}, done: function(err, outbytes: Buffer) -> none) -> none
-//
-static napi_value export_func_reinterpret(napi_env env, napi_callback_info info) {
-  return do_async_work(env, info, WORK_HIRAGANA);
-}
-
+//   initAsync(voices: { baseDir: string, voice: string }[],
+//             options: object,
+//             done: function(err, timings: LoadTimings[]) -> none) -> none
 //
-// JS Signature: init(baseDir: string, voice: string, volume: number) -> none
+// Same as init() with more than one voice, except that the engines are loaded off the main thread
+// and side by side. `options` is that of init(), and `timings` tells how long each stage of loading
+// each engine took, in the order of `voices`. If any of them fails to load, `done` gets an error of
+// code `EBYROID_INIT_FAILED` instead, while the rest stay loaded.
 //
-static napi_value export_func_init(napi_env env, napi_callback_info info) {
-  if (module->ebyroid == NULL) {
-    return NULL;
-  }
-
+static napi_value export_func_init_async(napi_env env, napi_callback_info info) {
   napi_status status;
 
   size_t argc = 3;
   napi_value argv[3];
   status = napi_get_cb_info(env, info, &argc, argv, NULL, NULL);
-  en_assert(status == napi_ok);
+  en_assert(status == napi_ok && argc == 3);
 
-  napi_valuetype valuetype;
-  status = napi_typeof(env, argv[0], &valuetype);
-  en_assert(status == napi_ok && valuetype == napi_string);
+  bool is_array;
+  status = napi_is_array(env, argv[0], &is_array);
+  en_assert(status == napi_ok && is_array);
 
-  status = napi_typeof(env, argv[1], &valuetype);
-  en_assert(status == napi_ok && valuetype == napi_string);
+  init_options options = default_init_options();
+  bool ok = get_init_options(env, argv[1], &options);
+  en_assert(ok);
 
+  napi_valuetype valuetype;
   status = napi_typeof(env, argv[2], &valuetype);
-  en_assert(status == napi_ok && valuetype == napi_number);
+  en_assert(status == napi_ok && valuetype == napi_function);
 
-  // fetch necessary buffer size
-  size_t size;
-  status = napi_get_value_string_utf8(env, argv[0], NULL, 0, &size);
-  // NOTE: 'size' doesn't count the NULL character of the end, it seems
+  // fetch the voices
+  uint32_t length;
+  status = napi_get_array_length(env, argv[0], &length);
   en_assert(status == napi_ok);
+  init_work* work = new init_work();
+  work->base_dirs.resize(length);
+  work->voices.resize(length);
+  work->timings.resize(length);
+  work->errors.resize(length);
+  for (uint32_t i = 0; i < length; i++) {
+    napi_value voice;
+    status = napi_get_element(env, argv[0], i, &voice);
+    if (status == napi_ok) {
+      status = get_string(env, voice, "baseDir", &work->base_dirs[i]);
+    }
+    if (status == napi_ok) {
+      status = get_string(env, voice, "voice", &work->voices[i]);
+    }
+    if (status != napi_ok) {
+      delete work;
+    }
+    en_assert(status == napi_ok);
+  }
 
-  // allocate
-  char* install_dir_buffer = (char*) malloc(size + 1);
-  status = napi_get_value_string_utf8(env, argv[0], install_dir_buffer, size + 1, NULL);
-  en_assert(status == napi_ok);
+  setup_module(env, options);
 
-  // fetch necessary buffer size
-  status = napi_get_value_string_utf8(env, argv[1], NULL, 0, &size);
+  status = napi_create_reference(env, argv[2], 1, &work->callback_ref);
   en_assert(status == napi_ok);
-
-  // allocate
-  char* voice_dir_buffer = (char*) malloc(size + 1);
-  status = napi_get_value_string_utf8(env, argv[1], voice_dir_buffer, size + 1, NULL);
+  napi_value work_name;
+  status = napi_create_string_utf8(env, "Ebyroid Init", NAPI_AUTO_LENGTH, &work_name);
   en_assert(status == napi_ok);
-
-  // fetch volume
-  double volume;
-  status = napi_get_value_double(env, argv[2], &volume);
+  status = napi_create_async_work(
+      env, NULL, work_name, init_execute, init_complete, work, &work->async_work);
   en_assert(status == napi_ok);
-
-  // initialize ebyroid
-  try {
-    module->ebyroid = Ebyroid::Create(install_dir_buffer, voice_dir_buffer, (float) volume);
-  } catch (std::exception& e) {
-    const char* location = "(ebyroid::Ebyroid::Create)";
-    napi_fatal_error(location, strlen(location), e.what(), strlen(e.what()));
-  }
-
-  // finalize ebyroid in the cleanup hook
-  status = napi_add_env_cleanup_hook(env, [](void* arg) { delete module->ebyroid; }, NULL);
+  status = napi_queue_async_work(env, work->async_work);
   en_assert(status == napi_ok);
-
-  free(install_dir_buffer);
-  free(voice_dir_buffer);
-
   return NULL;
 }
 
@@ -408,18 +2605,54 @@ static napi_value module_main(napi_env env, napi_value exports) {
       {"speech", NULL, export_func_speech, NULL, NULL, NULL, napi_enumerable, NULL},
       {"reinterpret", NULL, export_func_reinterpret, NULL, NULL, NULL, napi_enumerable, NULL},
       {"convert", NULL, export_func_convert, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"speechStream", NULL, export_func_speech_stream, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"convertStream", NULL, export_func_convert_stream, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"convertBatch", NULL, export_func_convert_batch, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"cancel", NULL, export_func_cancel, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"pause", NULL, export_func_pause, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"lookupCache", NULL, export_func_lookup_cache, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"cacheStats", NULL, export_func_cache_stats, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"stageStats", NULL, export_func_stage_stats, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"stats", NULL, export_func_stats, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"traceStart", NULL, export_func_trace_start, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"traceStop", NULL, export_func_trace_stop, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"traceFlush", NULL, export_func_trace_flush, NULL, NULL, NULL, napi_enumerable, NULL},
       {"init", NULL, export_func_init, NULL, NULL, NULL, napi_enumerable, NULL},
+      {"initAsync", NULL, export_func_init_async, NULL, NULL, NULL, napi_enumerable, NULL},
   };
 
   napi_status status = napi_define_properties(env, exports, sizeof(props) / sizeof(*props), props);
   en_assert(status == napi_ok);
 
-  module = (module_context*) malloc(sizeof(*module));
+  // whether convert takes a codec, which needs libopus at build time
+  napi_value has_opus;
+#ifdef EBYROID_WITH_OPUS
+  status = napi_get_boolean(env, true, &has_opus);
+#else
+  status = napi_get_boolean(env, false, &has_opus);
+#endif
+  en_assert(status == napi_ok);
+  status = napi_set_named_property(env, exports, "opus", has_opus);
+  en_assert(status == napi_ok);
+
+  module = (module_context*) calloc(1, sizeof(*module));
 
   // clean heap in the cleanup hook
   status = napi_add_env_cleanup_hook(env, [](void* arg) { free(module); }, NULL);
   en_assert(status == napi_ok);
 
+  // hooks run in reverse order, so the free list goes before the module does
+  status = napi_add_env_cleanup_hook(
+      env,
+      [](void* arg) {
+        while (work_data* work = module->free_works) {
+          module->free_works = work->next_free;
+          destroy_work(work);
+        }
+      },
+      NULL);
+  en_assert(status == napi_ok);
+
   return exports;
 }
 
@@ -0,0 +1,132 @@
+#include "ogg_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace ebyroid {
+
+namespace {
+
+// a page gets no more packets once this big, which keeps it within a few hundred msec of Opus
+constexpr size_t kPageBytes = 4096;
+constexpr size_t kMaxLacing = 255;
+constexpr size_t kHeaderBytes = 27;
+
+// CRC-32 of Ogg: polynomial 0x04c11db7, neither reflected nor inverted
+uint32_t Crc32(const unsigned char* data, size_t size) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int k = 0; k < 8; k++) {
+        r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : r << 1;
+      }
+      t[i] = r;
+    }
+    return t;
+  }();
+  uint32_t crc = 0;
+  for (size_t i = 0; i < size; i++) {
+    crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xff];
+  }
+  return crc;
+}
+
+void PutLE(unsigned char* dest, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    dest[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+}  // namespace
+
+void OggWriter::Packet(const unsigned char* data, size_t size, int64_t granule, bool flush) {
+  size_t lacing = size / 255 + 1;
+  if (lacing > kMaxLacing) {
+    throw std::length_error("an Ogg packet that spans pages is not supported");
+  }
+  if (lacing_.size() + lacing > kMaxLacing || body_.size() >= kPageBytes) {
+    FlushPage(false);
+  }
+  lacing_.insert(lacing_.end(), size / 255, 255);
+  lacing_.push_back((unsigned char) (size % 255));
+  body_.insert(body_.end(), data, data + size);
+  granule_ = granule;
+  if (flush) {
+    FlushPage(false);
+  }
+}
+
+void OggWriter::Finish(int64_t granule) {
+  granule_ = granule;
+  FlushPage(true);
+}
+
+void OggWriter::FlushPage(bool last) {
+  if (lacing_.empty() && !last) {
+    return;
+  }
+  size_t size = kHeaderBytes + lacing_.size() + body_.size();
+  size_t spare;
+  unsigned char* page = out_->Tail(size, &spare);
+  std::memcpy(page, "OggS", 4);
+  page[4] = 0;
+  // continued packets never happen here, only the first and the last page are flagged
+  page[5] = (unsigned char) ((sequence_ == 0 ? 0x02 : 0) | (last ? 0x04 : 0));
+  PutLE(page + 6, (uint64_t) granule_, 8);
+  PutLE(page + 14, serial_, 4);
+  PutLE(page + 18, sequence_, 4);
+  PutLE(page + 22, 0, 4);
+  page[26] = (unsigned char) lacing_.size();
+  std::memcpy(page + kHeaderBytes, lacing_.data(), lacing_.size());
+  std::memcpy(page + kHeaderBytes + lacing_.size(), body_.data(), body_.size());
+  PutLE(page + 22, Crc32(page, size), 4);
+  out_->Commit(size);
+
+  sequence_++;
+  lacing_.clear();
+  body_.clear();
+  granule_ = -1;
+}
+
+OggOpusWriter::OggOpusWriter(uint32_t channels,
+                             uint32_t pre_skip,
+                             uint32_t input_rate,
+                             OutputBuffer<unsigned char>* out)
+    : ogg_(std::random_device{}(), out), pre_skip_(pre_skip) {
+  // ID header: version 1, channel mapping family 0 (mono or stereo), no output gain
+  unsigned char head[19];
+  std::memcpy(head, "OpusHead", 8);
+  head[8] = 1;
+  head[9] = (unsigned char) channels;
+  PutLE(head + 10, pre_skip, 2);
+  PutLE(head + 12, input_rate, 4);
+  PutLE(head + 16, 0, 2);
+  head[18] = 0;
+  ogg_.Packet(head, sizeof(head), 0, true);
+
+  // comment header: just the vendor, no comments
+  static constexpr char kVendor[] = "ebyroid";
+  unsigned char tags[8 + 4 + sizeof(kVendor) - 1 + 4];
+  std::memcpy(tags, "OpusTags", 8);
+  PutLE(tags + 8, sizeof(kVendor) - 1, 4);
+  std::memcpy(tags + 12, kVendor, sizeof(kVendor) - 1);
+  PutLE(tags + 12 + sizeof(kVendor) - 1, 0, 4);
+  ogg_.Packet(tags, sizeof(tags), 0, true);
+}
+
+void OggOpusWriter::Packet(const unsigned char* data, size_t size, uint32_t samples) {
+  position_ += samples;
+  ogg_.Packet(data, size, (int64_t) position_);
+}
+
+void OggOpusWriter::Finish(uint64_t samples) {
+  ogg_.Finish((int64_t) (pre_skip_ + samples));
+}
+
+}  // namespace ebyroid
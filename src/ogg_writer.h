@@ -0,0 +1,66 @@
+#ifndef OGG_WRITER_H
+#define OGG_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace ebyroid {
+
+/**
+ * Puts packets of a single logical stream into Ogg pages (RFC 3533), several packets to a page.
+ * The first page is marked as the beginning of the stream and the one Finish() writes as its end.
+ */
+class OggWriter {
+ public:
+  OggWriter(uint32_t serial, OutputBuffer<unsigned char>* out) : serial_(serial), out_(out) {}
+
+  // `granule` is the position at the end of the packet, e.g. samples for audio.
+  // `flush` puts the packet at the end of a page of its own, as the headers of Ogg/Opus want
+  void Packet(const unsigned char* data, size_t size, int64_t granule, bool flush = false);
+  // writes out what is pending, ending the stream at `granule`
+  void Finish(int64_t granule);
+
+ private:
+  void FlushPage(bool last);
+
+  const uint32_t serial_;
+  OutputBuffer<unsigned char>* const out_;
+  uint32_t sequence_ = 0;
+  // the page being filled: its lacing values and the packet bytes behind them
+  std::vector<unsigned char> lacing_;
+  std::vector<unsigned char> body_;
+  // position at the end of the last packet on the page, -1 for none
+  int64_t granule_ = -1;
+};
+
+/**
+ * The Ogg/Opus stream (RFC 7845) around Opus packets of 48kHz audio: ID and comment headers first,
+ * then the packets with their positions. `pre_skip` is the lookahead of the encoder in samples, and
+ * `input_rate` the rate the audio came in, which players may show but need not resample to.
+ */
+class OggOpusWriter {
+ public:
+  OggOpusWriter(uint32_t channels,
+                uint32_t pre_skip,
+                uint32_t input_rate,
+                OutputBuffer<unsigned char>* out);
+
+  // a packet of `samples` samples per channel
+  void Packet(const unsigned char* data, size_t size, uint32_t samples);
+  // ends the stream, where `samples` per channel are all that was put in. the packets must have
+  // that many beyond `pre_skip`, and players cut off the padding after them
+  void Finish(uint64_t samples);
+
+ private:
+  OggWriter ogg_;
+  const uint32_t pre_skip_;
+  // samples per channel that the packets so far decode to, which the granule positions count
+  uint64_t position_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // OGG_WRITER_H
@@ -0,0 +1,122 @@
+#ifdef EBYROID_WITH_OPUS
+
+#include "opus_writer.h"
+
+#include <opus/opus.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ogg_writer.h"
+
+namespace ebyroid {
+
+namespace {
+
+// as much as a single Opus packet may take (RFC 6716)
+constexpr uint32_t kMaxPacketBytes = 1275 * 3 + 7;
+
+std::runtime_error OpusError(const char* what, int error) {
+  return std::runtime_error(std::string(what) + ": " + opus_strerror(error));
+}
+
+}  // namespace
+
+OpusWriter::OpusWriter(uint32_t channels, uint32_t bitrate, Container container)
+    : channels_(channels) {
+  int error;
+  encoder_ = opus_encoder_create(kOpusSampleRate, (int) channels, OPUS_APPLICATION_AUDIO, &error);
+  if (error != OPUS_OK) {
+    throw OpusError("Could not create an Opus encoder", error);
+  }
+  error = opus_encoder_ctl(encoder_, OPUS_SET_BITRATE((opus_int32) bitrate));
+  if (error != OPUS_OK) {
+    opus_encoder_destroy(encoder_);
+    throw OpusError("Opus does not take the bitrate", error);
+  }
+  opus_encoder_ctl(encoder_, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+
+  opus_int32 lookahead = 0;
+  opus_encoder_ctl(encoder_, OPUS_GET_LOOKAHEAD(&lookahead));
+  lookahead_ = (uint32_t) lookahead;
+  if (container == kOgg) {
+    ogg_.reset(new OggOpusWriter(channels, lookahead_, kOpusSampleRate, &out_));
+  }
+  pending_.reserve(kOpusFrameSamples * channels);
+}
+
+OpusWriter::~OpusWriter() {
+  opus_encoder_destroy(encoder_);
+}
+
+void OpusWriter::Write(const int16_t* pcm, size_t frames) {
+  samples_ += frames;
+  const size_t frame_size = kOpusFrameSamples * channels_;
+  size_t n = frames * channels_;
+
+  // top up what is left over from the last time first
+  if (!pending_.empty()) {
+    size_t take = std::min(n, frame_size - pending_.size());
+    pending_.insert(pending_.end(), pcm, pcm + take);
+    pcm += take;
+    n -= take;
+    if (pending_.size() < frame_size) {
+      return;
+    }
+    Encode(pending_.data());
+    pending_.clear();
+  }
+  for (; n >= frame_size; pcm += frame_size, n -= frame_size) {
+    Encode(pcm);
+  }
+  pending_.assign(pcm, pcm + n);
+}
+
+void OpusWriter::Finish() {
+  if (!pending_.empty()) {
+    pending_.resize(kOpusFrameSamples * channels_, 0);
+    Encode(pending_.data());
+  }
+  // the encoder lags `lookahead_` samples behind its input, which silence pushes out of it
+  if (samples_ > 0 && encoded_ < samples_ + lookahead_) {
+    pending_.assign(kOpusFrameSamples * channels_, 0);
+    while (encoded_ < samples_ + lookahead_) {
+      Encode(pending_.data());
+    }
+  }
+  pending_.clear();
+  if (ogg_) {
+    ogg_->Finish(samples_);
+  }
+}
+
+void OpusWriter::Encode(const int16_t* frame) {
+  encoded_ += kOpusFrameSamples;
+  if (ogg_) {
+    unsigned char packet[kMaxPacketBytes];
+    opus_int32 size = opus_encode(encoder_, frame, kOpusFrameSamples, packet, kMaxPacketBytes);
+    if (size < 0) {
+      throw OpusError("Opus encoding failed", size);
+    }
+    ogg_->Packet(packet, size, kOpusFrameSamples);
+    return;
+  }
+
+  // raw packets go straight into the output
+  size_t spare;
+  unsigned char* tail = out_.Tail(kMaxPacketBytes, &spare);
+  opus_int32 size = opus_encode(encoder_, frame, kOpusFrameSamples, tail, kMaxPacketBytes);
+  if (size < 0) {
+    throw OpusError("Opus encoding failed", size);
+  }
+  out_.Commit(size);
+  packet_ends_.push_back((uint32_t) out_.size());
+}
+
+}  // namespace ebyroid
+
+#endif  // EBYROID_WITH_OPUS
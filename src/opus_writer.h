@@ -0,0 +1,75 @@
+#ifndef OPUS_WRITER_H
+#define OPUS_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ogg_writer.h"
+#include "output_buffer.h"
+
+namespace ebyroid {
+
+// the only rate Ogg/Opus plays at, and what Discord takes
+static constexpr uint32_t kOpusSampleRate = 48000;
+// 20 msec, the frame size of Discord voice
+static constexpr uint32_t kOpusFrameSamples = 960;
+
+}  // namespace ebyroid
+
+// only built with libopus, see CMakeLists.txt
+#ifdef EBYROID_WITH_OPUS
+
+// forward-declaration to avoid including opus.h
+struct OpusEncoder;
+
+namespace ebyroid {
+
+/**
+ * Encodes 48kHz 16bit PCM into Opus, 20 msec a packet. The packets either come one after another
+ * with a table of where each ends, or in an Ogg/Opus stream ready to be played as a file.
+ */
+class OpusWriter {
+ public:
+  enum Container { kPackets, kOgg };
+
+  // `bitrate` in bits per second. throws std::runtime_error if libopus does not take it
+  OpusWriter(uint32_t channels, uint32_t bitrate, Container container);
+  OpusWriter(const OpusWriter&) = delete;
+  OpusWriter(OpusWriter&&) = delete;
+  ~OpusWriter();
+
+  // `frames` samples per channel, interleaved
+  void Write(const int16_t* pcm, size_t frames);
+  // encodes what is left, padded with silence into whole packets until the encoder has let out the
+  // last of the input, and ends the stream
+  void Finish();
+
+  // the encoded bytes as malloc'd memory, which the caller frees with free()
+  unsigned char* Release(size_t* size) { return out_.Release(size); }
+  // for kPackets, where each packet ends in the bytes
+  const std::vector<uint32_t>& packet_ends() const { return packet_ends_; }
+
+ private:
+  void Encode(const int16_t* frame);
+
+  const uint32_t channels_;
+  OpusEncoder* encoder_;
+  OutputBuffer<unsigned char> out_;
+  std::unique_ptr<OggOpusWriter> ogg_;
+  std::vector<uint32_t> packet_ends_;
+  // what is short of a whole packet yet
+  std::vector<int16_t> pending_;
+  // samples per channel put in, and those the packets so far decode to, the first `lookahead_` of
+  // which are the delay of the encoder
+  uint64_t samples_ = 0;
+  uint64_t encoded_ = 0;
+  uint32_t lookahead_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // EBYROID_WITH_OPUS
+
+#endif  // OPUS_WRITER_H
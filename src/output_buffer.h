@@ -0,0 +1,83 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace ebyroid {
+
+/**
+ * Growable buffer on malloc'd memory so that its contents can be handed over without copying:
+ * Release() gives away the block, which the new owner frees with free().
+ */
+template <class T>
+class OutputBuffer {
+ public:
+  OutputBuffer() = default;
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer(OutputBuffer&&) = delete;
+  ~OutputBuffer() { std::free(data_); }
+
+  void Append(const T* items, size_t n) {
+    Reserve(size_ + n);
+    std::memcpy(data_ + size_, items, n * sizeof(T));
+    size_ += n;
+  }
+
+  /**
+   * Gives away the memory, followed by one zeroed element past the end as a terminator.
+   * The buffer is empty afterwards.
+   */
+  T* Release(size_t* size) {
+    Reserve(size_ + 1);
+    std::memset(data_ + size_, 0, sizeof(T));
+    T* data = data_;
+    *size = size_;
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    return data;
+  }
+
+  /**
+   * Spare room of at least `n` elements at the end, for the engine to write into directly.
+   * `*spare` gets the actual room, and whatever gets written is to be Commit()ed.
+   */
+  T* Tail(size_t n, size_t* spare) {
+    Reserve(size_ + n);
+    *spare = capacity_ - size_;
+    return data_ + size_;
+  }
+
+  void Commit(size_t n) { size_ += n; }
+
+  // empties the buffer but keeps the memory
+  void Clear() { size_ = 0; }
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  void Reserve(size_t capacity) {
+    if (capacity <= capacity_) {
+      return;
+    }
+    capacity = std::max(capacity, capacity_ * 2);
+    T* data = (T*) std::realloc(data_, capacity * sizeof(T));
+    if (data == nullptr) {
+      throw std::bad_alloc();
+    }
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+ private:
+  T* data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // OUTPUT_BUFFER_H
@@ -0,0 +1,74 @@
+#include "pcm_cache.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ebyroid {
+
+bool PcmCache::MakeKey(std::string* key,
+                       const ConvertParams& params,
+                       uint32_t mode,
+                       const unsigned char* inbytes,
+                       size_t insize) {
+  if (params.base_dir == nullptr || params.voice == nullptr) {
+    return false;
+  }
+  key->clear();
+  key->append(params.base_dir).append(1, '\n').append(params.voice).append(1, '\n');
+  key->append((const char*) &params.sample_rate, sizeof(params.sample_rate));
+  key->append(1, params.prosody ? 'p' : '\0');
+  if (params.prosody) {
+    key->append((const char*) params.prosody, sizeof(*params.prosody));
+  }
+  key->append((const char*) &mode, sizeof(mode));
+  key->append((const char*) inbytes, insize);
+  return true;
+}
+
+PcmCache::PcmRef PcmCache::Find(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  lru_.splice(lru_.begin(), lru_, found->second);
+  return found->second->pcm;
+}
+
+PcmCache::PcmRef PcmCache::Insert(const std::string& key, int16_t* data, size_t size) {
+  PcmRef pcm = std::make_shared<const Pcm>(data, size);
+  if (key.size() + size > budget_) {
+    // would push everything else out, and then some
+    return pcm;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (auto found = index_.find(key); found != index_.end()) {
+    lru_.splice(lru_.begin(), lru_, found->second);
+    return found->second->pcm;
+  }
+
+  lru_.push_front(Entry{key, pcm});
+  index_.emplace(key, lru_.begin());
+  bytes_ += CostOf(lru_.front());
+  while (bytes_ > budget_) {
+    Entry& victim = lru_.back();
+    bytes_ -= CostOf(victim);
+    index_.erase(victim.key);
+    lru_.pop_back();
+  }
+  return pcm;
+}
+
+PcmCache::Stats PcmCache::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Stats{hits_, misses_, lru_.size(), bytes_, budget_};
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,97 @@
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ebyroid.h"
+
+namespace ebyroid {
+
+/**
+ * Memory-bounded LRU cache of synthesized PCM, keyed by everything that decides what the engine
+ * renders: the voice library, the output rate, the prosody, the job mode and the input bytes.
+ * Engines render at unity gain, so PCM is cached before any volume is applied and serves every
+ * volume.
+ *
+ * Cached PCM is shared, never copied: Find() hands out a reference to the same block to everyone,
+ * which stays valid after the entry is evicted. Holders must treat it as read-only.
+ * Thread-safe.
+ */
+class PcmCache {
+ public:
+  // a block of PCM owned by the cache and whoever holds a reference to it
+  struct Pcm {
+    Pcm(int16_t* data, size_t size) : data(data), size(size) {}
+    Pcm(const Pcm&) = delete;
+    Pcm(Pcm&&) = delete;
+    ~Pcm() { std::free(data); }
+
+    int16_t* const data;
+    // in bytes
+    const size_t size;
+  };
+  typedef std::shared_ptr<const Pcm> PcmRef;
+
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+  };
+
+  // `budget` is how many bytes of PCM and keys the cache may hold, 0 to cache nothing
+  explicit PcmCache(size_t budget) : budget_(budget) {}
+  PcmCache(const PcmCache&) = delete;
+  PcmCache(PcmCache&&) = delete;
+
+  /**
+   * Builds the key of a job into `*key`, reusing its memory. Returns false if the job has no
+   * definite engine (no voice given), whose result is not cacheable.
+   */
+  static bool MakeKey(std::string* key,
+                      const ConvertParams& params,
+                      uint32_t mode,
+                      const unsigned char* inbytes,
+                      size_t insize);
+
+  // the cached PCM of the key, or nullptr
+  PcmRef Find(const std::string& key);
+
+  /**
+   * Takes over malloc'd `data` of `size` bytes as the PCM of the key, evicting the least recently
+   * used entries to make room. Returns the reference to hand out, which is the one already
+   * cached if another job has got there first (and `data` is freed then).
+   */
+  PcmRef Insert(const std::string& key, int16_t* data, size_t size);
+
+  bool enabled() const { return budget_ > 0; }
+  Stats stats();
+
+ private:
+  struct Entry {
+    std::string key;
+    PcmRef pcm;
+  };
+
+  static size_t CostOf(const Entry& entry) { return entry.key.size() + entry.pcm->size; }
+
+  const size_t budget_;
+  std::mutex mutex_;
+  // the most recently used first
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  size_t bytes_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // PCM_CACHE_H
@@ -0,0 +1,239 @@
+#include "pcm_format.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "simd.h"
+
+namespace ebyroid {
+
+namespace {
+
+typedef void (*ConvertProc)(const int16_t* in, size_t n, void* out);
+
+constexpr float kF32Scale = 1.0f / 32768.0f;
+
+// scalar kernels, which also take care of what is left over by the SIMD ones
+
+void MonoToStereo16(const int16_t* in, size_t n, void* out) {
+  int16_t* dest = (int16_t*) out;
+  for (size_t i = 0; i < n; i++) {
+    dest[2 * i] = dest[2 * i + 1] = in[i];
+  }
+}
+
+template <uint32_t kChannels>
+void ToF32(const int16_t* in, size_t n, void* out) {
+  float* dest = (float*) out;
+  for (size_t i = 0; i < n; i++) {
+    for (uint32_t c = 0; c < kChannels; c++) {
+      dest[kChannels * i + c] = in[i] * kF32Scale;
+    }
+  }
+}
+
+template <uint32_t kChannels>
+void ToS32(const int16_t* in, size_t n, void* out) {
+  int32_t* dest = (int32_t*) out;
+  for (size_t i = 0; i < n; i++) {
+    for (uint32_t c = 0; c < kChannels; c++) {
+      dest[kChannels * i + c] = (int32_t) ((uint32_t) (uint16_t) in[i] << 16);
+    }
+  }
+}
+
+// packed three bytes per sample leave little for SIMD to do but moving bytes
+template <uint32_t kChannels>
+void ToS24(const int16_t* in, size_t n, void* out) {
+  uint8_t* dest = (uint8_t*) out;
+  for (size_t i = 0; i < n; i++) {
+    uint16_t sample = (uint16_t) in[i];
+    for (uint32_t c = 0; c < kChannels; c++) {
+      dest[0] = 0;
+      dest[1] = (uint8_t) sample;
+      dest[2] = (uint8_t) (sample >> 8);
+      dest += 3;
+    }
+  }
+}
+
+#ifdef EBYROID_X86
+
+EBYROID_TARGET("sse2") void MonoToStereo16Sse2(const int16_t* in, size_t n, void* out) {
+  int16_t* dest = (int16_t*) out;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i), _mm_unpacklo_epi16(x, x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i + 8), _mm_unpackhi_epi16(x, x));
+  }
+  MonoToStereo16(in + i, n - i, dest + 2 * i);
+}
+
+// the samples of `x` (8 of them) as 32bit integers in the upper halves, i.e. shifted left by 16
+EBYROID_TARGET("sse2") inline void Widen16Sse2(__m128i x, __m128i* lo, __m128i* hi) {
+  __m128i zero = _mm_setzero_si128();
+  *lo = _mm_unpacklo_epi16(zero, x);
+  *hi = _mm_unpackhi_epi16(zero, x);
+}
+
+template <uint32_t kChannels>
+EBYROID_TARGET("sse2") void ToS32Sse2(const int16_t* in, size_t n, void* out) {
+  int32_t* dest = (int32_t*) out;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m128i* d = reinterpret_cast<__m128i*>(dest + kChannels * i);
+    __m128i lo, hi;
+    if (kChannels == 1) {
+      Widen16Sse2(x, &lo, &hi);
+      _mm_storeu_si128(d, lo);
+      _mm_storeu_si128(d + 1, hi);
+    } else {
+      Widen16Sse2(_mm_unpacklo_epi16(x, x), &lo, &hi);
+      _mm_storeu_si128(d, lo);
+      _mm_storeu_si128(d + 1, hi);
+      Widen16Sse2(_mm_unpackhi_epi16(x, x), &lo, &hi);
+      _mm_storeu_si128(d + 2, lo);
+      _mm_storeu_si128(d + 3, hi);
+    }
+  }
+  ToS32<kChannels>(in + i, n - i, dest + kChannels * i);
+}
+
+template <uint32_t kChannels>
+EBYROID_TARGET("sse2") void ToF32Sse2(const int16_t* in, size_t n, void* out) {
+  float* dest = (float*) out;
+  // scales the samples shifted left by 16 in one go
+  const __m128 scale = _mm_set1_ps(kF32Scale / 65536.0f);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    float* d = dest + kChannels * i;
+    __m128i lo, hi;
+    if (kChannels == 1) {
+      Widen16Sse2(x, &lo, &hi);
+      _mm_storeu_ps(d, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(d + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    } else {
+      Widen16Sse2(_mm_unpacklo_epi16(x, x), &lo, &hi);
+      _mm_storeu_ps(d, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(d + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+      Widen16Sse2(_mm_unpackhi_epi16(x, x), &lo, &hi);
+      _mm_storeu_ps(d + 8, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(d + 12, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+  }
+  ToF32<kChannels>(in + i, n - i, dest + kChannels * i);
+}
+
+EBYROID_TARGET("avx2") void MonoToStereo16Avx2(const int16_t* in, size_t n, void* out) {
+  int16_t* dest = (int16_t*) out;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    // the unpacks work within 128bit lanes, hence quarters 0 2 | 1 3 so that they come out in order
+    x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256i* d = reinterpret_cast<__m256i*>(dest + 2 * i);
+    _mm256_storeu_si256(d, _mm256_unpacklo_epi16(x, x));
+    _mm256_storeu_si256(d + 1, _mm256_unpackhi_epi16(x, x));
+  }
+  MonoToStereo16(in + i, n - i, dest + 2 * i);
+}
+
+template <uint32_t kChannels>
+EBYROID_TARGET("avx2") void ToS32Avx2(const int16_t* in, size_t n, void* out) {
+  int32_t* dest = (int32_t*) out;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    __m256i* d = reinterpret_cast<__m256i*>(dest + kChannels * i);
+    if (kChannels == 1) {
+      _mm256_storeu_si256(d, _mm256_slli_epi32(_mm256_cvtepi16_epi32(x), 16));
+    } else {
+      __m256i lo = _mm256_cvtepi16_epi32(_mm_unpacklo_epi16(x, x));
+      __m256i hi = _mm256_cvtepi16_epi32(_mm_unpackhi_epi16(x, x));
+      _mm256_storeu_si256(d, _mm256_slli_epi32(lo, 16));
+      _mm256_storeu_si256(d + 1, _mm256_slli_epi32(hi, 16));
+    }
+  }
+  ToS32<kChannels>(in + i, n - i, dest + kChannels * i);
+}
+
+template <uint32_t kChannels>
+EBYROID_TARGET("avx2") void ToF32Avx2(const int16_t* in, size_t n, void* out) {
+  float* dest = (float*) out;
+  const __m256 scale = _mm256_set1_ps(kF32Scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    float* d = dest + kChannels * i;
+    if (kChannels == 1) {
+      __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x));
+      _mm256_storeu_ps(d, _mm256_mul_ps(f, scale));
+    } else {
+      __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_unpacklo_epi16(x, x)));
+      __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_unpackhi_epi16(x, x)));
+      _mm256_storeu_ps(d, _mm256_mul_ps(lo, scale));
+      _mm256_storeu_ps(d + 8, _mm256_mul_ps(hi, scale));
+    }
+  }
+  ToF32<kChannels>(in + i, n - i, dest + kChannels * i);
+}
+
+#endif  // EBYROID_X86
+
+// kernels by format and number of channels (less one), for each SimdLevel
+struct Kernels {
+  ConvertProc procs[kNumSampleFormats][2];
+};
+
+const Kernels kScalarKernels = {{
+    {nullptr, MonoToStereo16},
+    {ToF32<1>, ToF32<2>},
+    {ToS24<1>, ToS24<2>},
+    {ToS32<1>, ToS32<2>},
+}};
+
+#ifdef EBYROID_X86
+const Kernels kSse2Kernels = {{
+    {nullptr, MonoToStereo16Sse2},
+    {ToF32Sse2<1>, ToF32Sse2<2>},
+    {ToS24<1>, ToS24<2>},
+    {ToS32Sse2<1>, ToS32Sse2<2>},
+}};
+
+const Kernels kAvx2Kernels = {{
+    {nullptr, MonoToStereo16Avx2},
+    {ToF32Avx2<1>, ToF32Avx2<2>},
+    {ToS24<1>, ToS24<2>},
+    {ToS32Avx2<1>, ToS32Avx2<2>},
+}};
+#endif
+
+const Kernels& KernelsOfCpu() {
+#ifdef EBYROID_X86
+  switch (CpuSimdLevel()) {
+    case kSimdAvx2:
+      return kAvx2Kernels;
+    case kSimdSse2:
+      return kSse2Kernels;
+    default:
+      break;
+  }
+#endif
+  return kScalarKernels;
+}
+
+}  // namespace
+
+void ConvertPcm(const int16_t* in, size_t n, SampleFormat format, uint32_t channels, void* out) {
+  if (format == kS16 && channels == 1) {
+    std::memcpy(out, in, n * sizeof(int16_t));
+    return;
+  }
+  static const Kernels& kernels = KernelsOfCpu();
+  kernels.procs[format][channels - 1](in, n, out);
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,29 @@
+#ifndef PCM_FORMAT_H
+#define PCM_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ebyroid {
+
+/**
+ * Sample formats that the 16bit output of the engine can be handed over in. All little endian:
+ * s24 is packed into three bytes per sample, f32 ranges from -1.0 to 1.0.
+ */
+enum SampleFormat : uint32_t { kS16 = 0, kF32 = 1, kS24 = 2, kS32 = 3, kNumSampleFormats };
+
+inline size_t BytesPerSample(SampleFormat format) {
+  static const size_t bytes[] = {2, 4, 3, 4};
+  return bytes[format];
+}
+
+/**
+ * Writes `n` samples of 16bit mono PCM to `out` in `format`, each repeated on `channels` (1 or 2)
+ * interleaved channels, i.e. `n * channels * BytesPerSample(format)` bytes. The conversion is
+ * lossless; f32 is the sample divided by 32768, s24 and s32 are the sample shifted left.
+ */
+void ConvertPcm(const int16_t* in, size_t n, SampleFormat format, uint32_t channels, void* out);
+
+}  // namespace ebyroid
+
+#endif  // PCM_FORMAT_H
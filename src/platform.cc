@@ -0,0 +1,502 @@
+#include "platform.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "ebyutil.h"
+
+namespace ebyroid {
+
+namespace platform {
+
+using std::string;
+
+#ifdef _WIN32
+
+LibraryHandle OpenLibrary(const char* search_dir, const char* path) {
+  if (BOOL ok = SetDllDirectoryA(search_dir); !ok) {
+    return nullptr;
+  }
+
+  HINSTANCE handle = LoadLibraryA(path);
+  if (handle == nullptr) {
+    return nullptr;
+  }
+
+  if (BOOL ok = SetDllDirectoryA(nullptr); !ok) {
+    // this should not be so critical
+    Eprintf("SetDllDirectoryA(NULL) failed with code %d", GetLastError());
+    Eprintf("albeit the program will go on ignoring this error.");
+  }
+  return handle;
+}
+
+void* FindSymbol(LibraryHandle handle, const char* decorated_name) {
+  return reinterpret_cast<void*>(GetProcAddress((HINSTANCE) handle, decorated_name));
+}
+
+bool CloseLibrary(LibraryHandle handle) {
+  return FreeLibrary((HINSTANCE) handle) != FALSE;
+}
+
+unsigned long CurrentProcessId() {
+  return GetCurrentProcessId();
+}
+
+bool GetWorkingDirectory(char* buffer, size_t size) {
+  return GetCurrentDirectoryA((DWORD) size, buffer) != 0;
+}
+
+bool SetWorkingDirectory(const char* dir) {
+  return SetCurrentDirectoryA(dir) != FALSE;
+}
+
+bool SpawnProcess(const string& path,
+                  const std::vector<string>& args,
+                  ProcessHandle* process,
+                  PipeHandle* to_child,
+                  PipeHandle* from_child) {
+  HANDLE child_in, to_child_end, from_child_end, child_out;
+  if (!CreatePipe(&child_in, &to_child_end, nullptr, 0)) {
+    return false;
+  }
+  if (!CreatePipe(&from_child_end, &child_out, nullptr, 0)) {
+    DWORD error = GetLastError();
+    CloseHandle(child_in);
+    CloseHandle(to_child_end);
+    SetLastError(error);
+    return false;
+  }
+  // only the ends of the child are to be inherited, and by that child alone: another process
+  // spawned meanwhile would hold on to them, and the child would never see them closed
+  SetHandleInformation(child_in, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+  SetHandleInformation(child_out, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+  HANDLE inherited[] = {child_in, child_out};
+  SIZE_T attributes_size = 0;
+  InitializeProcThreadAttributeList(nullptr, 1, 0, &attributes_size);
+  std::vector<char> attributes_buffer(attributes_size);
+  LPPROC_THREAD_ATTRIBUTE_LIST attributes = (LPPROC_THREAD_ATTRIBUTE_LIST) attributes_buffer.data();
+  if (!InitializeProcThreadAttributeList(attributes, 1, 0, &attributes_size)) {
+    DWORD error = GetLastError();
+    for (HANDLE handle : {child_in, to_child_end, from_child_end, child_out}) {
+      CloseHandle(handle);
+    }
+    SetLastError(error);
+    return false;
+  }
+  if (!UpdateProcThreadAttribute(attributes,
+                                 0,
+                                 PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                 inherited,
+                                 sizeof(inherited),
+                                 nullptr,
+                                 nullptr)) {
+    DWORD error = GetLastError();
+    DeleteProcThreadAttributeList(attributes);
+    for (HANDLE handle : {child_in, to_child_end, from_child_end, child_out}) {
+      CloseHandle(handle);
+    }
+    SetLastError(error);
+    return false;
+  }
+
+  string command_line = "\"" + path + "\"";
+  for (const string& arg : args) {
+    command_line += " \"" + arg + "\"";
+  }
+  command_line += " " + std::to_string((intptr_t) child_in);
+  command_line += " " + std::to_string((intptr_t) child_out);
+
+  STARTUPINFOEXA startup = {};
+  startup.StartupInfo.cb = sizeof(startup);
+  startup.lpAttributeList = attributes;
+  PROCESS_INFORMATION info = {};
+  BOOL ok = CreateProcessA(path.c_str(),
+                           &command_line[0],
+                           nullptr,
+                           nullptr,
+                           TRUE,
+                           EXTENDED_STARTUPINFO_PRESENT,
+                           nullptr,
+                           nullptr,
+                           &startup.StartupInfo,
+                           &info);
+  DWORD error = GetLastError();
+  DeleteProcThreadAttributeList(attributes);
+  CloseHandle(child_in);
+  CloseHandle(child_out);
+  if (!ok) {
+    CloseHandle(to_child_end);
+    CloseHandle(from_child_end);
+    SetLastError(error);
+    return false;
+  }
+  CloseHandle(info.hThread);
+  *process = info.hProcess;
+  *to_child = (PipeHandle) to_child_end;
+  *from_child = (PipeHandle) from_child_end;
+  return true;
+}
+
+void ReapProcess(ProcessHandle process, uint32_t timeout_msec) {
+  if (WaitForSingleObject((HANDLE) process, timeout_msec) != WAIT_OBJECT_0) {
+    TerminateProcess((HANDLE) process, 1);
+    WaitForSingleObject((HANDLE) process, INFINITE);
+  }
+  CloseHandle((HANDLE) process);
+}
+
+void KillProcess(ProcessHandle process) {
+  TerminateProcess((HANDLE) process, 1);
+}
+
+PipeHandle PipeOf(const char* argument) {
+  return (PipeHandle) std::strtoll(argument, nullptr, 10);
+}
+
+bool ReadPipe(PipeHandle pipe, void* buffer, size_t size) {
+  char* p = (char*) buffer;
+  while (size > 0) {
+    DWORD read;
+    DWORD chunk = (DWORD) std::min<size_t>(size, MAXDWORD);
+    if (!ReadFile((HANDLE) pipe, p, chunk, &read, nullptr) || read == 0) {
+      return false;
+    }
+    p += read;
+    size -= read;
+  }
+  return true;
+}
+
+bool WritePipe(PipeHandle pipe, const void* buffer, size_t size) {
+  const char* p = (const char*) buffer;
+  while (size > 0) {
+    DWORD written;
+    DWORD chunk = (DWORD) std::min<size_t>(size, MAXDWORD);
+    if (!WriteFile((HANDLE) pipe, p, chunk, &written, nullptr)) {
+      return false;
+    }
+    p += written;
+    size -= written;
+  }
+  return true;
+}
+
+void ClosePipe(PipeHandle pipe) {
+  CloseHandle((HANDLE) pipe);
+}
+
+void* CreateSharedMemory(const string& name, size_t size, SharedMemoryHandle* handle) {
+  string local = "Local\\" + name;
+  HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE,
+                                      nullptr,
+                                      PAGE_READWRITE,
+                                      (DWORD)((uint64_t) size >> 32),
+                                      (DWORD) size,
+                                      local.c_str());
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  if (GetLastError() == ERROR_ALREADY_EXISTS) {
+    CloseHandle(mapping);
+    SetLastError(ERROR_ALREADY_EXISTS);
+    return nullptr;
+  }
+  void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (memory == nullptr) {
+    DWORD error = GetLastError();
+    CloseHandle(mapping);
+    SetLastError(error);
+    return nullptr;
+  }
+  *handle = mapping;
+  return memory;
+}
+
+void* OpenSharedMemory(const string& name, size_t size, SharedMemoryHandle* handle) {
+  string local = "Local\\" + name;
+  HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, local.c_str());
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (memory == nullptr) {
+    DWORD error = GetLastError();
+    CloseHandle(mapping);
+    SetLastError(error);
+    return nullptr;
+  }
+  *handle = mapping;
+  return memory;
+}
+
+void CloseSharedMemory(void* memory, size_t size, SharedMemoryHandle handle) {
+  UnmapViewOfFile(memory);
+  CloseHandle((HANDLE) handle);
+}
+
+void UnlinkSharedMemory(const string& name) {
+  // a mapping has no name of its own once its last handle is closed
+}
+
+string DescribeLastError() {
+  char m[32];
+  std::snprintf(m, 32, "code %lu", GetLastError());
+  return string(m);
+}
+
+#else
+
+namespace {
+
+// errno is not set by the dl* family, so the last dlerror() is kept here instead
+thread_local string last_error;
+
+}  // namespace
+
+LibraryHandle OpenLibrary(const char* search_dir, const char* path) {
+  // the loader has no per-call search path, the library is expected to be given as a full path
+  (void) search_dir;
+  void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    last_error = dlerror();
+  }
+  return handle;
+}
+
+void* FindSymbol(LibraryHandle handle, const char* decorated_name) {
+  // "_AITalkAPI_Init@4" -> "AITalkAPI_Init"
+  string name(decorated_name[0] == '_' ? decorated_name + 1 : decorated_name);
+  if (size_t at = name.rfind('@'); at != string::npos) {
+    name.resize(at);
+  }
+  void* proc = dlsym(handle, name.c_str());
+  if (proc == nullptr) {
+    last_error = dlerror();
+  }
+  return proc;
+}
+
+bool CloseLibrary(LibraryHandle handle) {
+  if (dlclose(handle) != 0) {
+    last_error = dlerror();
+    return false;
+  }
+  return true;
+}
+
+unsigned long CurrentProcessId() {
+  return (unsigned long) getpid();
+}
+
+bool GetWorkingDirectory(char* buffer, size_t size) {
+  if (getcwd(buffer, size) == nullptr) {
+    last_error = std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool SetWorkingDirectory(const char* dir) {
+  if (chdir(dir) != 0) {
+    last_error = std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool SpawnProcess(const string& path,
+                  const std::vector<string>& args,
+                  ProcessHandle* process,
+                  PipeHandle* to_child,
+                  PipeHandle* from_child) {
+  if (access(path.c_str(), X_OK) != 0) {
+    last_error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  // no other child is to hold on to the pipes, or the child would never see them closed, so they
+  // are closed on exec from the start: a fork on another thread may come at any time
+  int to[2], from[2];
+  if (pipe2(to, O_CLOEXEC) != 0) {
+    last_error = std::strerror(errno);
+    return false;
+  }
+  if (pipe2(from, O_CLOEXEC) != 0) {
+    last_error = std::strerror(errno);
+    close(to[0]);
+    close(to[1]);
+    return false;
+  }
+
+  std::vector<string> strings{path};
+  strings.insert(strings.end(), args.begin(), args.end());
+  strings.push_back(std::to_string(to[0]));
+  strings.push_back(std::to_string(from[1]));
+  std::vector<char*> argv;
+  for (string& arg : strings) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    last_error = std::strerror(errno);
+    for (int fd : {to[0], to[1], from[0], from[1]}) {
+      close(fd);
+    }
+    return false;
+  }
+  if (pid == 0) {
+    // nothing but what is async-signal-safe until exec. the child keeps its own ends alone
+    fcntl(to[0], F_SETFD, 0);
+    fcntl(from[1], F_SETFD, 0);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  close(to[0]);
+  close(from[1]);
+  *process = (ProcessHandle)(intptr_t) pid;
+  *to_child = to[1];
+  *from_child = from[0];
+  return true;
+}
+
+void ReapProcess(ProcessHandle process, uint32_t timeout_msec) {
+  const pid_t pid = (pid_t)(intptr_t) process;
+  const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_msec);
+  int status;
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    if (std::chrono::steady_clock::now() >= until) {
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+      return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+void KillProcess(ProcessHandle process) {
+  kill((pid_t)(intptr_t) process, SIGKILL);
+}
+
+PipeHandle PipeOf(const char* argument) {
+  return (PipeHandle) std::strtol(argument, nullptr, 10);
+}
+
+bool ReadPipe(PipeHandle pipe, void* buffer, size_t size) {
+  char* p = (char*) buffer;
+  while (size > 0) {
+    ssize_t n = read((int) pipe, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      last_error = n < 0 ? std::strerror(errno) : "closed";
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool WritePipe(PipeHandle pipe, const void* buffer, size_t size) {
+  const char* p = (const char*) buffer;
+  while (size > 0) {
+    ssize_t n = write((int) pipe, p, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      last_error = std::strerror(errno);
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+void ClosePipe(PipeHandle pipe) {
+  close((int) pipe);
+}
+
+namespace {
+
+void* MapSharedMemory(const string& name, size_t size, int flags) {
+  string path = "/" + name;
+  int fd = shm_open(path.c_str(), flags, 0600);
+  if (fd < 0) {
+    last_error = std::strerror(errno);
+    return nullptr;
+  }
+  if ((flags & O_CREAT) != 0 && ftruncate(fd, (off_t) size) != 0) {
+    last_error = std::strerror(errno);
+    close(fd);
+    shm_unlink(path.c_str());
+    return nullptr;
+  }
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping holds on to the memory by itself
+  close(fd);
+  if (memory == MAP_FAILED) {
+    last_error = std::strerror(errno);
+    if ((flags & O_CREAT) != 0) {
+      shm_unlink(path.c_str());
+    }
+    return nullptr;
+  }
+  return memory;
+}
+
+}  // namespace
+
+void* CreateSharedMemory(const string& name, size_t size, SharedMemoryHandle* handle) {
+  *handle = nullptr;
+  return MapSharedMemory(name, size, O_CREAT | O_EXCL | O_RDWR);
+}
+
+void* OpenSharedMemory(const string& name, size_t size, SharedMemoryHandle* handle) {
+  *handle = nullptr;
+  return MapSharedMemory(name, size, O_RDWR);
+}
+
+void CloseSharedMemory(void* memory, size_t size, SharedMemoryHandle handle) {
+  (void) handle;
+  munmap(memory, size);
+}
+
+void UnlinkSharedMemory(const string& name) {
+  string path = "/" + name;
+  shm_unlink(path.c_str());
+}
+
+string DescribeLastError() {
+  return last_error;
+}
+
+#endif
+
+}  // namespace platform
+
+}  // namespace ebyroid
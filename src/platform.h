@@ -0,0 +1,108 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// the engine exports everything as __stdcall, which only means something on 32-bit Windows
+#if !defined(_WIN32) && !defined(__stdcall)
+#define __stdcall
+#endif
+
+namespace ebyroid {
+
+namespace platform {
+
+#ifdef _WIN32
+static constexpr size_t kMaxPath = 260;  // MAX_PATH
+static constexpr const char* kPathDelimiter = "\\";
+#else
+static constexpr size_t kMaxPath = 4096;  // PATH_MAX
+static constexpr const char* kPathDelimiter = "/";
+#endif
+
+// opaque handles to avoid including Windows.h in headers
+typedef void* LibraryHandle;
+typedef void* ProcessHandle;
+typedef void* SharedMemoryHandle;
+// a HANDLE on Windows, a file descriptor elsewhere
+typedef intptr_t PipeHandle;
+static constexpr PipeHandle kInvalidPipe = -1;
+
+/**
+ * Loads a shared library. Dependent libraries are searched in `search_dir` first.
+ * Returns nullptr on failure, in which case DescribeLastError() tells why.
+ */
+LibraryHandle OpenLibrary(const char* search_dir, const char* path);
+
+/**
+ * Looks up an engine export by its decorated (`_Name@N`) name.
+ * Non-Windows platforms have no stdcall decoration so it is stripped before the lookup.
+ */
+void* FindSymbol(LibraryHandle handle, const char* decorated_name);
+
+bool CloseLibrary(LibraryHandle handle);
+
+unsigned long CurrentProcessId();
+
+bool GetWorkingDirectory(char* buffer, size_t size);
+bool SetWorkingDirectory(const char* dir);
+
+/**
+ * Starts the executable at `path` with a pipe to it and a pipe from it, whose ends it finds as the
+ * two arguments after `args`, see PipeOf(). Its stdio is that of this process.
+ */
+bool SpawnProcess(const std::string& path,
+                  const std::vector<std::string>& args,
+                  ProcessHandle* process,
+                  PipeHandle* to_child,
+                  PipeHandle* from_child);
+
+/**
+ * Waits up to `timeout_msec` for the process to exit, kills it if it has not, and frees the handle.
+ */
+void ReapProcess(ProcessHandle process, uint32_t timeout_msec);
+
+/**
+ * Kills the process without waiting for it, which ReapProcess() still has to be called for.
+ */
+void KillProcess(ProcessHandle process);
+
+/**
+ * The end of a pipe given by SpawnProcess() as an argument.
+ */
+PipeHandle PipeOf(const char* argument);
+
+/**
+ * Reads or writes exactly `size` bytes, returning false if the pipe has been closed on the other
+ * end or fails.
+ */
+bool ReadPipe(PipeHandle pipe, void* buffer, size_t size);
+bool WritePipe(PipeHandle pipe, const void* buffer, size_t size);
+void ClosePipe(PipeHandle pipe);
+
+/**
+ * Creates a named block of shared memory, or opens one created by another process, and maps it.
+ * Returns nullptr on failure. `name` is a plain file name, without any "/" or "Local\\" prefix.
+ */
+void* CreateSharedMemory(const std::string& name, size_t size, SharedMemoryHandle* handle);
+void* OpenSharedMemory(const std::string& name, size_t size, SharedMemoryHandle* handle);
+void CloseSharedMemory(void* memory, size_t size, SharedMemoryHandle handle);
+
+/**
+ * Takes the name of shared memory away, which then lasts only as long as it stays mapped.
+ */
+void UnlinkSharedMemory(const std::string& name);
+
+/**
+ * Human-readable description of the last failure of the functions above.
+ */
+std::string DescribeLastError();
+
+}  // namespace platform
+
+}  // namespace ebyroid
+
+#endif  // PLATFORM_H
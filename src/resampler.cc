@@ -0,0 +1,258 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "output_buffer.h"
+#include "simd.h"
+
+namespace ebyroid {
+
+using std::vector;
+
+namespace {
+
+// taps are Q14, which leaves the int32 sums room for any filter of ours
+constexpr int kTapShift = 14;
+// taps per phase when there is nothing to filter out but images; more when downsampling
+constexpr double kBaseTaps = 48.0;
+// cutoff, relative to the lower of the nyquist frequencies
+constexpr double kCutoff = 0.9;
+constexpr double kKaiserBeta = 7.0;
+// keeps the filter banks within a few hundred KiB
+constexpr uint32_t kMaxPhases = 4096;
+
+// zeroth order modified bessel function of the first kind, for the kaiser window
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 64; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) {
+      break;
+    }
+  }
+  return sum;
+}
+
+int32_t DotScalar(const int16_t* x, const int16_t* h, size_t n) {
+  // wraps around just like the SIMD kernels would, not that it ever gets that far
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += (uint32_t) ((int32_t) x[i] * h[i]);
+  }
+  return (int32_t) sum;
+}
+
+#ifdef EBYROID_X86
+
+EBYROID_TARGET("sse2") int32_t DotSse2(const int16_t* x, const int16_t* h, size_t n) {
+  __m128i sum = _mm_setzero_si128();
+  for (size_t i = 0; i < n; i += 8) {
+    __m128i xs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    __m128i hs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(xs, hs));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+EBYROID_TARGET("avx2") int32_t DotAvx2(const int16_t* x, const int16_t* h, size_t n) {
+  __m256i sum = _mm256_setzero_si256();
+  for (size_t i = 0; i < n; i += 16) {
+    __m256i xs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+    __m256i hs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(xs, hs));
+  }
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+
+#endif  // EBYROID_X86
+
+}  // namespace
+
+/**
+ * Filters of every phase, one after another. Phase p of `up` produces the output that lies p/up
+ * of the way from input sample i to i+1, out of input samples i-half+1 .. i+half.
+ */
+struct Resampler::Bank {
+  uint32_t up;
+  uint32_t down;
+  uint32_t half;
+  // = 2 * half, a multiple of 16 for the SIMD kernels
+  uint32_t stride;
+  vector<int16_t> taps;
+};
+
+Resampler::Kernel Resampler::BestKernel() {
+  switch (CpuSimdLevel()) {
+    case kSimdAvx2:
+      return kAvx2;
+    case kSimdSse2:
+      return kSse2;
+    default:
+      return kScalar;
+  }
+}
+
+Resampler::Resampler(uint32_t from, uint32_t to, Kernel kernel) : from_(from), to_(to) {
+  if (from == 0 || to == 0) {
+    throw std::invalid_argument("sample rates must be positive");
+  }
+  uint32_t gcd = std::gcd(from, to);
+  bank_ = BankOf(to / gcd, from / gcd);
+
+  switch (kernel) {
+#ifdef EBYROID_X86
+    case kAvx2:
+      dot_ = DotAvx2;
+      break;
+    case kSse2:
+      dot_ = DotSse2;
+      break;
+#endif
+    default:
+      dot_ = DotScalar;
+      break;
+  }
+
+  pending_.assign(bank_->half - 1, 0);
+  base_ = -(int64_t) pending_.size();
+}
+
+Resampler::~Resampler() = default;
+
+std::shared_ptr<const Resampler::Bank> Resampler::BankOf(uint32_t up, uint32_t down) {
+  static std::mutex mutex;
+  static std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<const Bank>> banks;
+
+  if (up > kMaxPhases) {
+    throw std::invalid_argument("the ratio of the sample rates is too complex");
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& cached = banks[{up, down}];
+  if (cached) {
+    return cached;
+  }
+
+  auto bank = std::make_shared<Bank>();
+  // in units of input samples, the filter passes up to `cutoff` times the input nyquist frequency
+  double ratio = std::min(1.0, (double) up / down);
+  double cutoff = kCutoff * ratio;
+  bank->up = up;
+  bank->down = down;
+  bank->stride = ((uint32_t) std::ceil(kBaseTaps / ratio) + 15) / 16 * 16;
+  bank->half = bank->stride / 2;
+  bank->taps.resize((size_t) up * bank->stride);
+
+  const double half = bank->half;
+  const double pi = std::acos(-1.0);
+  const double i0_beta = BesselI0(kKaiserBeta);
+  vector<double> h(bank->stride);
+  for (uint32_t p = 0; p < up; p++) {
+    double sum = 0.0;
+    for (uint32_t j = 0; j < bank->stride; j++) {
+      // distance in time from the tap's input sample to the output sample
+      double t = (double) p / up + half - 1 - j;
+      double x = t / half;
+      double window = x * x < 1.0 ? BesselI0(kKaiserBeta * std::sqrt(1.0 - x * x)) / i0_beta : 0.0;
+      double arg = pi * cutoff * t;
+      h[j] = (t == 0.0 ? 1.0 : std::sin(arg) / arg) * window;
+      sum += h[j];
+    }
+
+    // every phase passes DC at exactly unity, and the rounding error goes to the largest tap
+    int16_t* taps = &bank->taps[(size_t) p * bank->stride];
+    int32_t total = 0;
+    uint32_t peak = 0;
+    for (uint32_t j = 0; j < bank->stride; j++) {
+      taps[j] = (int16_t) std::lround(h[j] / sum * (1 << kTapShift));
+      total += taps[j];
+      if (taps[j] > taps[peak]) {
+        peak = j;
+      }
+    }
+    taps[peak] += (int16_t) ((1 << kTapShift) - total);
+  }
+
+  cached = bank;
+  return cached;
+}
+
+void Resampler::Process(const int16_t* in, size_t n, OutputBuffer<int16_t>* out) {
+  pending_.insert(pending_.end(), in, in + n);
+  consumed_ += n;
+  Run(SIZE_MAX, out);
+}
+
+void Resampler::Flush(OutputBuffer<int16_t>* out) {
+  const Bank& bank = *bank_;
+  uint64_t total = (consumed_ * bank.up + bank.down - 1) / bank.down;
+  pending_.insert(pending_.end(), bank.half + 1, 0);
+  consumed_ += bank.half + 1;
+  Run(total - produced_, out);
+
+  // ready for another stream
+  pending_.assign(bank.half - 1, 0);
+  base_ = -(int64_t) pending_.size();
+  consumed_ = 0;
+  produced_ = 0;
+}
+
+void Resampler::Run(size_t count, OutputBuffer<int16_t>* out) {
+  const Bank& bank = *bank_;
+  // output n is complete once input (n * down / up) + half has come
+  if (consumed_ <= bank.half) {
+    return;
+  }
+  uint64_t ready = ((consumed_ - bank.half) * bank.up + bank.down - 1) / bank.down;
+  if (ready <= produced_) {
+    return;
+  }
+  count = (size_t) std::min<uint64_t>(count, ready - produced_);
+
+  size_t spare;
+  int16_t* dest = out->Tail(count, &spare);
+  const int16_t* input = pending_.data();
+  const int16_t* taps = bank.taps.data();
+  // steps through the input and the phases without dividing for every output
+  uint64_t position = produced_ * bank.down;
+  const int16_t* window = input + ((int64_t) (position / bank.up) - bank.half + 1 - base_);
+  uint32_t phase = (uint32_t) (position % bank.up);
+  const uint32_t skip = bank.down / bank.up;
+  const uint32_t advance = bank.down % bank.up;
+  for (size_t k = 0; k < count; k++) {
+    int32_t sum = dot_(window, taps + (size_t) phase * bank.stride, bank.stride);
+    int32_t sample = (sum + (1 << (kTapShift - 1))) >> kTapShift;
+    dest[k] = (int16_t) std::min(std::max(sample, (int32_t) INT16_MIN), (int32_t) INT16_MAX);
+    window += skip;
+    phase += advance;
+    if (phase >= bank.up) {
+      phase -= bank.up;
+      window++;
+    }
+  }
+  out->Commit(count);
+  produced_ += count;
+
+  // drops the input that no output needs any more
+  int64_t next = (int64_t) (produced_ * bank.down / bank.up) - bank.half + 1;
+  size_t drop = (size_t) std::max<int64_t>(0, next - base_);
+  pending_.erase(pending_.begin(), pending_.begin() + drop);
+  base_ += drop;
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,66 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace ebyroid {
+
+/**
+ * Polyphase FIR resampler for 16bit mono PCM, e.g. the 22050/44100 Hz of the engines to the
+ * 16000/24000/48000 Hz that downstream wants. Any pair of rates works as long as their ratio
+ * reduces to a reasonable number of phases.
+ *
+ * Filters are Kaiser-windowed sincs quantized to Q14, so the math is integer and every kernel
+ * (scalar, SSE2, AVX2) gives bit-identical output. Streaming: feed input with Process() in chunks
+ * of any size, then Flush() once at the end. The output has ceil(input * to / from) samples and no
+ * delay, i.e. output sample n is the input at time n * from / to.
+ *
+ * Not thread-safe, but filter banks are shared among instances for the same rates.
+ */
+class Resampler {
+ public:
+  enum Kernel { kScalar, kSse2, kAvx2 };
+
+  // the fastest kernel this CPU runs
+  static Kernel BestKernel();
+
+  Resampler(uint32_t from, uint32_t to, Kernel kernel = BestKernel());
+  Resampler(const Resampler&) = delete;
+  Resampler(Resampler&&) = delete;
+  ~Resampler();
+
+  // appends whatever output `n` more samples of input make complete
+  void Process(const int16_t* in, size_t n, OutputBuffer<int16_t>* out);
+
+  // appends the rest of the output, as if the input went on with silence
+  void Flush(OutputBuffer<int16_t>* out);
+
+  uint32_t from() const { return from_; }
+  uint32_t to() const { return to_; }
+
+ private:
+  struct Bank;
+  typedef int32_t (*DotProc)(const int16_t* x, const int16_t* h, size_t n);
+
+  static std::shared_ptr<const Bank> BankOf(uint32_t up, uint32_t down);
+  void Run(size_t count, OutputBuffer<int16_t>* out);
+
+  const uint32_t from_;
+  const uint32_t to_;
+  std::shared_ptr<const Bank> bank_;
+  DotProc dot_;
+  // input not consumed yet, whose first sample is input sample `base_` (negative for the zeros
+  // that stand in for what precedes the input)
+  std::vector<int16_t> pending_;
+  int64_t base_;
+  uint64_t consumed_ = 0;
+  uint64_t produced_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // RESAMPLER_H
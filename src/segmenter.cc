@@ -0,0 +1,107 @@
+#include "segmenter.h"
+
+#include <cstddef>
+
+namespace ebyroid {
+
+namespace {
+
+enum Boundary { kNone, kClause, kSentence, kClosing };
+
+inline bool IsLeadByte(unsigned char c) {
+  return (c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC);
+}
+
+// whether `c` is the end of the text or a space, ASCII or full-width
+inline bool IsSpaceOrEnd(const unsigned char* c, const unsigned char* end) {
+  if (c == end) {
+    return true;
+  }
+  if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') {
+    return true;
+  }
+  return c + 1 < end && c[0] == 0x81 && c[1] == 0x40;
+}
+
+// classifies one Shift-JIS character of `len` bytes, out of text that ends at `end`
+Boundary ClassifyChar(const unsigned char* c, size_t len, const unsigned char* end) {
+  if (len == 2 && c[0] == 0x81) {
+    switch (c[1]) {
+      case 0x42:  // 。
+      case 0x48:  // ？
+      case 0x49:  // ！
+        return kSentence;
+      case 0x41:  // 、
+      case 0x43:  // ，
+        return kClause;
+      case 0x6A:  // ）
+      case 0x76:  // 」
+      case 0x78:  // 』
+        return kClosing;
+    }
+    return kNone;
+  }
+  if (len == 1) {
+    switch (c[0]) {
+      case '\n':
+        return kSentence;
+      case '.':
+      case '!':
+      case '?':
+        // which also turn up in numbers, URLs and abbreviations
+        return IsSpaceOrEnd(c + 1, end) ? kSentence : kNone;
+      case ',':
+        return kClause;
+      case '\r':
+      case ')':
+      case '"':
+        return kClosing;
+    }
+  }
+  return kNone;
+}
+
+}  // namespace
+
+size_t NextSegment(const unsigned char* text, size_t size, size_t max_bytes) {
+  if (size <= max_bytes) {
+    return size;
+  }
+
+  size_t last_sentence = 0;
+  size_t last_clause = 0;
+  size_t last_char = 0;
+  bool after_sentence = false;
+  size_t pos = 0;
+  while (pos < size) {
+    size_t len = (IsLeadByte(text[pos]) && pos + 1 < size) ? 2 : 1;
+    if (pos + len > max_bytes) {
+      break;
+    }
+    Boundary boundary = ClassifyChar(text + pos, len, text + size);
+    pos += len;
+    last_char = pos;
+
+    if (boundary == kSentence || (boundary == kClosing && after_sentence)) {
+      // brackets closing a sentence belong to it
+      last_sentence = pos;
+      after_sentence = true;
+    } else {
+      after_sentence = false;
+      if (boundary == kClause) {
+        last_clause = pos;
+      }
+    }
+  }
+
+  if (last_sentence > 0) {
+    return last_sentence;
+  }
+  if (last_clause > 0) {
+    return last_clause;
+  }
+  // a character longer than `max_bytes` still makes a segment of its own
+  return last_char > 0 ? last_char : (IsLeadByte(text[0]) && size > 1 ? 2 : 1);
+}
+
+}  // namespace ebyroid
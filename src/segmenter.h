@@ -0,0 +1,19 @@
+#ifndef SEGMENTER_H
+#define SEGMENTER_H
+
+#include <cstddef>
+
+namespace ebyroid {
+
+/**
+ * Length in bytes of the first segment of Shift-JIS `text`, which is the whole text if it is no
+ * longer than `max_bytes`. Otherwise the segment ends at the last sentence boundary (。！？, a
+ * line break, or . ! ? before a space, along with closing brackets that follow) within
+ * `max_bytes`, or failing that at the last 、, or failing that at the last whole character. Never 0
+ * for non-empty text.
+ */
+size_t NextSegment(const unsigned char* text, size_t size, size_t max_bytes);
+
+}  // namespace ebyroid
+
+#endif  // SEGMENTER_H
@@ -0,0 +1,104 @@
+#include "shared_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "platform.h"
+
+namespace ebyroid {
+
+// a cache line of its own ahead of the data
+struct alignas(64) SharedRing::Header {
+  // how far the reader has released the ring. positions only ever grow, wrapping around at 2^32,
+  // which is a multiple of the capacity
+  std::atomic<uint32_t> tail;
+  uint32_t capacity;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared atomics have to be lock-free");
+
+namespace {
+
+constexpr uint32_t kMaxCapacity = 1u << 30;
+
+void CheckCapacity(uint32_t capacity) {
+  if (capacity == 0 || capacity > kMaxCapacity || (capacity & (capacity - 1)) != 0) {
+    throw std::runtime_error("The size of a shared ring has to be a power of 2 up to 1 GiB");
+  }
+}
+
+}  // namespace
+
+size_t SharedRing::MappedSize(uint32_t capacity) {
+  return sizeof(Header) + capacity;
+}
+
+SharedRing::SharedRing(void* memory, uint32_t capacity, platform::SharedMemoryHandle handle)
+    : header_((Header*) memory),
+      data_((char*) memory + sizeof(Header)),
+      capacity_(capacity),
+      handle_(handle) {}
+
+SharedRing::~SharedRing() {
+  platform::CloseSharedMemory(header_, MappedSize(capacity_), handle_);
+}
+
+SharedRing* SharedRing::Create(const std::string& name, uint32_t capacity) {
+  CheckCapacity(capacity);
+  platform::SharedMemoryHandle handle;
+  void* memory = platform::CreateSharedMemory(name, MappedSize(capacity), &handle);
+  if (memory == nullptr) {
+    throw std::runtime_error("Could not create shared memory " + name + " (" +
+                             platform::DescribeLastError() + ")");
+  }
+  Header* header = new (memory) Header();
+  header->tail.store(0, std::memory_order_relaxed);
+  header->capacity = capacity;
+  return new SharedRing(memory, capacity, handle);
+}
+
+SharedRing* SharedRing::Open(const std::string& name, uint32_t capacity) {
+  CheckCapacity(capacity);
+  platform::SharedMemoryHandle handle;
+  void* memory = platform::OpenSharedMemory(name, MappedSize(capacity), &handle);
+  if (memory == nullptr) {
+    throw std::runtime_error("Could not open shared memory " + name + " (" +
+                             platform::DescribeLastError() + ")");
+  }
+  if (((Header*) memory)->capacity != capacity) {
+    platform::CloseSharedMemory(memory, MappedSize(capacity), handle);
+    throw std::runtime_error("Shared memory " + name + " is not of the size expected");
+  }
+  return new SharedRing(memory, capacity, handle);
+}
+
+bool SharedRing::Reserve(uint32_t size, uint32_t* position, const std::atomic<bool>& abandoned) {
+  if (size > capacity_) {
+    return false;
+  }
+  const uint32_t offset = head_ & (capacity_ - 1);
+  const uint32_t skip = offset + size > capacity_ ? capacity_ - offset : 0;
+  const uint32_t end = head_ + skip + size;
+  // the reader releases as soon as it has copied a block out, so this waits for long only when
+  // the reader is stuck, or gone
+  while (end - header_->tail.load(std::memory_order_acquire) > capacity_) {
+    if (abandoned.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  *position = head_ + skip;
+  head_ = end;
+  return true;
+}
+
+void SharedRing::Release(uint32_t end) {
+  header_->tail.store(end, std::memory_order_release);
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,63 @@
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "platform.h"
+
+namespace ebyroid {
+
+/**
+ * Ring buffer in named shared memory, through which an engine host hands PCM over to the process
+ * that runs it without serializing it into the pipe between them. One process writes blocks and
+ * tells the other where they are over the pipe; the other reads them in the order they were
+ * written and releases each once done with it. A block is never split at the end of the ring, the
+ * writer skips to the start instead. The writer waits while the ring is full.
+ */
+class SharedRing {
+ public:
+  // creates the shared memory for a ring of `capacity` bytes, a power of 2 of at most 1 GiB.
+  // throws std::runtime_error if it cannot be created
+  static SharedRing* Create(const std::string& name, uint32_t capacity);
+  // maps a ring that another process has created
+  static SharedRing* Open(const std::string& name, uint32_t capacity);
+  SharedRing(const SharedRing&) = delete;
+  SharedRing(SharedRing&&) = delete;
+  ~SharedRing();
+
+  uint32_t capacity() const { return capacity_; }
+
+  // makes room for a block of `size` bytes, waiting until the reader has released enough of the
+  // ring, and returns where the block goes. false if the block is larger than the whole ring, or
+  // `abandoned` gets set while waiting. writer only
+  bool Reserve(uint32_t size, uint32_t* position, const std::atomic<bool>& abandoned);
+
+  // the memory of the block at `position`, for the writer to fill or the reader to read
+  void* At(uint32_t position) { return data_ + (position & (capacity_ - 1)); }
+
+  // hands the ring up to `end` (the position of a block plus its size) back to the writer. blocks
+  // are to be released in the order they were written. reader only
+  void Release(uint32_t end);
+
+ private:
+  struct Header;
+
+  // the header and the ring
+  static size_t MappedSize(uint32_t capacity);
+
+  SharedRing(void* memory, uint32_t capacity, platform::SharedMemoryHandle handle);
+
+  Header* const header_;
+  char* const data_;
+  const uint32_t capacity_;
+  const platform::SharedMemoryHandle handle_;
+  // where the next block goes, as seen by the writer
+  uint32_t head_ = 0;
+};
+
+}  // namespace ebyroid
+
+#endif  // SHARED_RING_H
@@ -0,0 +1,536 @@
+// A stand-in for aitalked.dll.
+//
+// It implements the _AITalkAPI_* exports closely enough to drive the whole pipeline on machines
+// without VOICEROID, which is what the native module gets built and profiled against on Linux.
+// No speech is produced: every input character is rendered as a short tone, and punctuation as
+// the pause the real engine would insert, so output length and callback timing scale with input.
+//
+// Timing knobs are read from the environment by _AITalkAPI_Init:
+//   EBYROID_SIM_LOAD_MSEC      cost of each of Init, LangLoad and VoiceLoad   (default 0)
+//   EBYROID_SIM_ANALYSIS_MSEC  cost of language analysis on plain text input  (default 0)
+//   EBYROID_SIM_LATENCY_MSEC   delay before the first buffer of a job          (default 10)
+//   EBYROID_SIM_INTERVAL_MSEC  delay between two consecutive buffers           (default 2)
+//   EBYROID_SIM_CHUNK_SAMPLES  samples per RAWBUF_FULL, capped by len_raw_buf  (default 8192)
+//   EBYROID_SIM_MSEC_PER_CHAR  duration of one input character at speed 1.0   (default 60)
+//   EBYROID_SIM_MAX_JOBS       concurrent jobs before ERR_TOO_MANY_JOBS        (default 2)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../api_adapter.h"
+
+#ifdef _WIN32
+#define SIM_EXPORT extern "C" __declspec(dllexport)
+#else
+#define SIM_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+using namespace ebyroid;
+
+namespace {
+
+using std::string, std::vector;
+using Clock = std::chrono::steady_clock;
+
+struct SimConfig {
+  uint32_t load_msec;
+  uint32_t analysis_msec;
+  uint32_t latency_msec;
+  uint32_t interval_msec;
+  uint32_t chunk_samples;
+  uint32_t msec_per_char;
+  uint32_t max_jobs;
+};
+
+struct Job {
+  int32_t id;
+  JobInOut mode;
+  IntPtr user_data;
+  TTtsParam param;
+  string text;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::atomic<bool> abort{false};
+  vector<int16_t> pcm;
+  string kana;
+  size_t visible = 0;
+  size_t consumed = 0;
+  bool finished = false;
+
+  std::thread thread;
+};
+
+std::mutex engine_mutex;
+bool initialized = false;
+bool lang_loaded = false;
+bool voice_loaded = false;
+uint32_t frequency = 0;
+SimConfig sim;
+TTtsParam current_param;
+int32_t next_job_id = 1;
+std::map<int32_t, std::shared_ptr<Job>> jobs;
+
+uint32_t EnvOr(const char* name, uint32_t fallback) {
+  const char* value = std::getenv(name);
+  if (value == nullptr || *value == '\0') {
+    return fallback;
+  }
+  return (uint32_t) std::strtoul(value, nullptr, 10);
+}
+
+// returns false if the job got aborted while sleeping
+bool Sleep(Job* job, uint32_t msec) {
+  if (msec == 0) {
+    return !job->abort;
+  }
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->cv.wait_for(lock, std::chrono::milliseconds(msec), [job] { return job->abort.load(); });
+  return !job->abort;
+}
+
+void SleepFor(uint32_t msec) {
+  if (msec > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+  }
+}
+
+inline bool IsLeadByte(unsigned char c) {
+  return (c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC);
+}
+
+enum PauseKind { PAUSE_NONE, PAUSE_MIDDLE, PAUSE_SENTENCE };
+
+// classifies one Shift-JIS character
+PauseKind ClassifyChar(const unsigned char* c, size_t len) {
+  if (len == 2 && c[0] == 0x81) {
+    switch (c[1]) {
+      case 0x42:  // 。
+      case 0x48:  // ？
+      case 0x49:  // ！
+        return PAUSE_SENTENCE;
+      case 0x41:  // 、
+      case 0x43:  // ，
+        return PAUSE_MIDDLE;
+    }
+    return PAUSE_NONE;
+  }
+  if (len == 1) {
+    switch (c[0]) {
+      case '\n':
+      case '.':
+      case '!':
+      case '?':
+        return PAUSE_SENTENCE;
+      case ',':
+        return PAUSE_MIDDLE;
+    }
+  }
+  return PAUSE_NONE;
+}
+
+void AppendSilence(vector<int16_t>& pcm, int32_t msec) {
+  if (msec > 0) {
+    pcm.insert(pcm.end(), (size_t) frequency * msec / 1000, 0);
+  }
+}
+
+vector<int16_t> Render(const string& text, const TTtsParam& param) {
+  static constexpr double kPi = 3.14159265358979323846;
+  const TTtsParam::TSpeakerParam& speaker = param.speaker[0];
+  const double speed = speaker.speed > 0.0f ? speaker.speed : 1.0;
+  const double gain = 0.25 * param.volume * speaker.volume;
+  const size_t tone_len = (size_t)(frequency * (sim.msec_per_char / 1000.0) / speed);
+  const size_t ramp = std::max<size_t>(1, tone_len / 8);
+
+  vector<int16_t> pcm;
+  pcm.reserve(tone_len * text.size() / 2 + frequency);
+  AppendSilence(pcm, param.pause_begin);
+
+  const unsigned char* p = (const unsigned char*) text.data();
+  const unsigned char* end = p + text.size();
+  while (p < end) {
+    size_t len = (IsLeadByte(*p) && p + 1 < end) ? 2 : 1;
+    unsigned int code = len == 2 ? (p[0] << 8 | p[1]) : p[0];
+    switch (ClassifyChar(p, len)) {
+      case PAUSE_SENTENCE:
+        AppendSilence(pcm, speaker.pause_sentence);
+        break;
+      case PAUSE_MIDDLE:
+        AppendSilence(pcm, speaker.pause_middle);
+        break;
+      case PAUSE_NONE: {
+        if (code == ' ' || code == '\r' || code == '\t') {
+          break;
+        }
+        double hz = 180.0 * speaker.pitch * std::pow(2.0, (code % 12) / 12.0 * speaker.range);
+        for (size_t i = 0; i < tone_len; i++) {
+          double envelope = std::min({1.0, (double) i / ramp, (double) (tone_len - i) / ramp});
+          double v = gain * envelope * std::sin(2.0 * kPi * hz * i / frequency);
+          v = std::clamp(v * 32767.0, -32768.0, 32767.0);
+          pcm.push_back((int16_t) std::lround(v));
+        }
+        break;
+      }
+    }
+    p += len;
+  }
+
+  AppendSilence(pcm, param.pause_term);
+  return pcm;
+}
+
+void RunSpeechJob(Job* job) {
+  if (job->mode == IOMODE_PLAIN_TO_WAVE && !Sleep(job, sim.analysis_msec)) {
+    return;
+  }
+  vector<int16_t> pcm = Render(job->text, job->param);
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->pcm = std::move(pcm);
+  }
+  if (!Sleep(job, sim.latency_msec)) {
+    return;
+  }
+
+  uint32_t chunk = std::max<uint32_t>(1, job->param.len_raw_buf_bytes / sizeof(int16_t));
+  chunk = std::min(chunk, std::max<uint32_t>(1, sim.chunk_samples));
+  const size_t total = job->pcm.size();
+  while (true) {
+    EventReasonCode reason;
+    {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      size_t remains = total - job->visible;
+      reason = remains > chunk ? RAWBUF_FULL : RAWBUF_FLUSH;
+      job->visible += std::min<size_t>(remains, chunk);
+    }
+    uint64_t tick = (uint64_t) job->visible * 1000 / frequency;
+    job->param.proc_raw_buf(reason, job->id, tick, job->user_data);
+    if (reason == RAWBUF_FLUSH) {
+      break;
+    }
+    if (!Sleep(job, sim.interval_msec)) {
+      return;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->finished = true;
+  }
+  uint64_t tick = (uint64_t) total * 1000 / frequency;
+  job->param.proc_raw_buf(RAWBUF_CLOSE, job->id, tick, job->user_data);
+}
+
+void RunKanaJob(Job* job) {
+  if (!Sleep(job, sim.analysis_msec + sim.latency_msec)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    // the stand-in "AI Kana" is just the text itself, so that kana renders like its source text
+    job->kana = job->text;
+  }
+
+  uint32_t chunk = std::max<uint32_t>(1, job->param.len_text_buf_bytes);
+  const size_t total = job->kana.size();
+  while (true) {
+    EventReasonCode reason;
+    {
+      std::lock_guard<std::mutex> lock(job->mutex);
+      size_t remains = total - job->visible;
+      reason = remains > chunk ? TEXTBUF_FULL : TEXTBUF_FLUSH;
+      job->visible += std::min<size_t>(remains, chunk);
+    }
+    job->param.proc_text_buf(reason, job->id, job->user_data);
+    if (reason == TEXTBUF_FLUSH) {
+      break;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->finished = true;
+  }
+  job->param.proc_text_buf(TEXTBUF_CLOSE, job->id, job->user_data);
+}
+
+ResultCode StartJob(int32_t* job_id, TJobParam* param, const char* text, bool kana) {
+  if (job_id == nullptr || param == nullptr || text == nullptr) {
+    return ERR_INVALID_ARGUMENT;
+  }
+
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  if (!lang_loaded || !voice_loaded) {
+    return ERR_NOT_LOADED;
+  }
+  if (jobs.size() >= sim.max_jobs) {
+    return ERR_TOO_MANY_JOBS;
+  }
+  if (kana ? current_param.proc_text_buf == nullptr : current_param.proc_raw_buf == nullptr) {
+    return ERR_INVALID_ARGUMENT;
+  }
+
+  auto job = std::make_shared<Job>();
+  job->id = next_job_id++;
+  job->mode = param->mode_in_out;
+  job->user_data = param->user_data;
+  job->param = current_param;
+  job->text = text;
+  job->thread = std::thread(kana ? RunKanaJob : RunSpeechJob, job.get());
+  jobs.emplace(job->id, job);
+
+  *job_id = job->id;
+  return ERR_SUCCESS;
+}
+
+ResultCode CloseJob(int32_t job_id) {
+  std::shared_ptr<Job> job;
+  {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    auto it = jobs.find(job_id);
+    if (it == jobs.end()) {
+      return ERR_INVALID_JOBID;
+    }
+    job = it->second;
+    jobs.erase(it);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->abort = true;
+  }
+  job->cv.notify_all();
+  if (job->thread.joinable()) {
+    if (job->thread.get_id() == std::this_thread::get_id()) {
+      job->thread.detach();
+    } else {
+      job->thread.join();
+    }
+  }
+  return ERR_SUCCESS;
+}
+
+template <class T>
+ResultCode ReadJob(int32_t job_id, T* out, uint32_t len, uint32_t* size, bool kana) {
+  if (out == nullptr || size == nullptr) {
+    return ERR_INVALID_ARGUMENT;
+  }
+
+  std::shared_ptr<Job> job;
+  {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    auto it = jobs.find(job_id);
+    if (it == jobs.end()) {
+      return ERR_INVALID_JOBID;
+    }
+    job = it->second;
+  }
+
+  std::lock_guard<std::mutex> lock(job->mutex);
+  size_t n = std::min<size_t>(len, job->visible - job->consumed);
+  if (kana) {
+    std::memcpy(out, job->kana.data() + job->consumed, n);
+  } else {
+    std::memcpy(out, job->pcm.data() + job->consumed, n * sizeof(int16_t));
+  }
+  job->consumed += n;
+  *size = (uint32_t) n;
+  if (n == 0 && job->finished) {
+    return ERR_NOMORE_DATA;
+  }
+  return ERR_SUCCESS;
+}
+
+}  // namespace
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_Init(TConfig* config) {
+  if (config == nullptr || config->hz_voice_db == 0) {
+    return ERR_INVALID_ARGUMENT;
+  }
+
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (initialized) {
+    return ERR_ALREADY_INITIALIZED;
+  }
+  sim.load_msec = EnvOr("EBYROID_SIM_LOAD_MSEC", 0);
+  sim.analysis_msec = EnvOr("EBYROID_SIM_ANALYSIS_MSEC", 0);
+  sim.latency_msec = EnvOr("EBYROID_SIM_LATENCY_MSEC", 10);
+  sim.interval_msec = EnvOr("EBYROID_SIM_INTERVAL_MSEC", 2);
+  sim.chunk_samples = EnvOr("EBYROID_SIM_CHUNK_SAMPLES", 8192);
+  sim.msec_per_char = EnvOr("EBYROID_SIM_MSEC_PER_CHAR", 60);
+  sim.max_jobs = EnvOr("EBYROID_SIM_MAX_JOBS", 2);
+  SleepFor(sim.load_msec);
+
+  frequency = config->hz_voice_db;
+  std::memset(&current_param, 0, sizeof(current_param));
+  current_param.size = sizeof(current_param);
+  current_param.len_text_buf_bytes = 0x1000;
+  current_param.len_raw_buf_bytes = kConfigRawbufSize;
+  current_param.volume = 1.0f;
+  current_param.pause_begin = 50;
+  current_param.pause_term = 80;
+  current_param.num_speakers = 1;
+  TTtsParam::TSpeakerParam& speaker = current_param.speaker[0];
+  speaker.volume = 1.0f;
+  speaker.speed = 1.0f;
+  speaker.pitch = 1.0f;
+  speaker.range = 1.0f;
+  speaker.pause_middle = 150;
+  speaker.pause_long = 370;
+  speaker.pause_sentence = 800;
+  initialized = true;
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_End(void) {
+  vector<int32_t> running;
+  {
+    std::lock_guard<std::mutex> lock(engine_mutex);
+    if (!initialized) {
+      return ERR_NOT_INITIALIZED;
+    }
+    for (auto& [id, job] : jobs) {
+      running.push_back(id);
+    }
+  }
+  for (int32_t id : running) {
+    CloseJob(id);
+  }
+
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  initialized = false;
+  lang_loaded = false;
+  voice_loaded = false;
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_LangLoad(const char* dir_lang) {
+  if (dir_lang == nullptr) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  SleepFor(sim.load_msec);
+  lang_loaded = true;
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_VoiceLoad(const char* voice_name) {
+  if (voice_name == nullptr || std::strlen(voice_name) >= kMaxVoiceName) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  SleepFor(sim.load_msec);
+  std::strcpy(current_param.voice_name, voice_name);
+  std::strcpy(current_param.speaker[0].voice_name, voice_name);
+  voice_loaded = true;
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_VoiceClear(void) {
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  voice_loaded = false;
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_GetParam(IntPtr p_param, uint32_t* size) {
+  if (size == nullptr) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  if (p_param == nullptr || *size < sizeof(TTtsParam)) {
+    *size = sizeof(TTtsParam);
+    return ERR_INSUFFICIENT;
+  }
+  std::memcpy(p_param, &current_param, sizeof(TTtsParam));
+  *size = sizeof(TTtsParam);
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_SetParam(IntPtr p_param) {
+  TTtsParam* param = (TTtsParam*) p_param;
+  if (param == nullptr || param->size < sizeof(TTtsParam)) {
+    return ERR_INVALID_ARGUMENT;
+  }
+  std::lock_guard<std::mutex> lock(engine_mutex);
+  if (!initialized) {
+    return ERR_NOT_INITIALIZED;
+  }
+  // running jobs keep the parameters they were started with
+  std::memcpy(&current_param, param, sizeof(TTtsParam));
+  return ERR_SUCCESS;
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_TextToKana(int32_t* job_id,
+                                                     TJobParam* param,
+                                                     const char* text) {
+  if (param != nullptr && param->mode_in_out != IOMODE_PLAIN_TO_AIKANA) {
+    return ERR_UNSUPPORTED;
+  }
+  return StartJob(job_id, param, text, true);
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_CloseKana(int32_t job_id, int32_t use_event) {
+  (void) use_event;
+  return CloseJob(job_id);
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_GetKana(int32_t job_id,
+                                                  char* text_buf,
+                                                  uint32_t len_buf,
+                                                  uint32_t* size,
+                                                  uint32_t* pos) {
+  if (pos != nullptr) {
+    *pos = 0;
+  }
+  return ReadJob(job_id, text_buf, len_buf, size, true);
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_TextToSpeech(int32_t* job_id,
+                                                       TJobParam* param,
+                                                       const char* text) {
+  if (param != nullptr && param->mode_in_out != IOMODE_PLAIN_TO_WAVE &&
+      param->mode_in_out != IOMODE_AIKANA_TO_WAVE) {
+    return ERR_UNSUPPORTED;
+  }
+  return StartJob(job_id, param, text, false);
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_CloseSpeech(int32_t job_id, int32_t use_event) {
+  (void) use_event;
+  return CloseJob(job_id);
+}
+
+SIM_EXPORT ResultCode __stdcall AITalkAPI_GetData(int32_t job_id,
+                                                  int16_t* raw_buf,
+                                                  uint32_t len_buf,
+                                                  uint32_t* size) {
+  return ReadJob(job_id, raw_buf, len_buf, size, false);
+}
@@ -0,0 +1,44 @@
+#include "simd.h"
+
+#if defined(EBYROID_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ebyroid {
+
+namespace {
+
+SimdLevel Detect() {
+#if defined(EBYROID_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return kSimdAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return kSimdSse2;
+  }
+#elif defined(EBYROID_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1 << 26)) != 0;
+  // AVX also needs the OS to save the YMM registers
+  bool avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  if (avx && (info[1] & (1 << 5)) != 0) {
+    return kSimdAvx2;
+  }
+  if (sse2) {
+    return kSimdSse2;
+  }
+#endif
+  return kSimdNone;
+}
+
+}  // namespace
+
+SimdLevel CpuSimdLevel() {
+  static const SimdLevel level = Detect();
+  return level;
+}
+
+}  // namespace ebyroid
@@ -0,0 +1,27 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// x86 builds carry SSE2 and AVX2 kernels next to the scalar ones, and pick one at runtime
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define EBYROID_X86 1
+#include <immintrin.h>
+#endif
+
+// lets gcc and clang compile a function for an instruction set the build does not assume.
+// msvc takes intrinsics of any instruction set anyway.
+#if defined(EBYROID_X86) && defined(__GNUC__)
+#define EBYROID_TARGET(isa) __attribute__((target(isa)))
+#else
+#define EBYROID_TARGET(isa)
+#endif
+
+namespace ebyroid {
+
+enum SimdLevel { kSimdNone, kSimdSse2, kSimdAvx2 };
+
+// the best instruction set of this CPU that we have kernels for
+SimdLevel CpuSimdLevel();
+
+}  // namespace ebyroid
+
+#endif  // SIMD_H
@@ -0,0 +1,323 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "platform.h"
+
+namespace ebyroid {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  const char* name;
+  // 'X' (complete), 'i' (instant), 'b' and 'e' (async)
+  char phase;
+  uint32_t tid;
+  uint32_t job;
+  uint64_t ts;
+  uint64_t dur;
+  const char* arg_names[2];
+  int64_t args[2];
+  char detail[40];
+};
+
+// a seqlock of its own, as a slot may be overwritten while it is being flushed
+struct Slot {
+  // 2n+1 while the n-th event of the ring is written into the slot, 2n+2 once it is
+  std::atomic<uint64_t> seq{0};
+  Event event;
+};
+
+// written only by the thread that holds it, read by Flush()
+struct Ring {
+  explicit Ring(size_t capacity) : slots(new Slot[capacity]), capacity(capacity) {}
+
+  const std::unique_ptr<Slot[]> slots;
+  const size_t capacity;
+  // how many events have been written
+  std::atomic<uint64_t> head{0};
+};
+
+// the rings of every thread that has recorded anything. a ring goes back to `free` when its thread
+// exits, for the next thread to take over, as engines may run every job on a thread of its own
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ring>> rings;
+  std::vector<Ring*> free;
+  size_t capacity = 0;
+  // events before this are left out of Flush()
+  uint64_t since = 0;
+};
+
+// never destroyed, as threads may still exit after static destruction
+Registry& registry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+const Clock::time_point epoch = Clock::now();
+
+uint32_t ThreadId() {
+  static std::atomic<uint32_t> last{0};
+  thread_local uint32_t tid = ++last;
+  return tid;
+}
+
+// hands the ring of the thread back to the registry as the thread exits
+struct RingHolder {
+  Ring* ring = nullptr;
+  ~RingHolder() {
+    if (ring != nullptr) {
+      std::lock_guard<std::mutex> lock(registry().mutex);
+      registry().free.push_back(ring);
+    }
+  }
+};
+
+thread_local RingHolder ring_holder;
+thread_local uint32_t current_job = 0;
+
+Ring* ThreadRing() {
+  if (ring_holder.ring != nullptr) {
+    return ring_holder.ring;
+  }
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  if (r.capacity == 0) {
+    return nullptr;
+  }
+  if (!r.free.empty()) {
+    ring_holder.ring = r.free.back();
+    r.free.pop_back();
+  } else {
+    r.rings.emplace_back(new Ring(r.capacity));
+    ring_holder.ring = r.rings.back().get();
+  }
+  return ring_holder.ring;
+}
+
+void Record(const Event& event) {
+  Ring* ring = ThreadRing();
+  if (ring == nullptr) {
+    return;
+  }
+  uint64_t n = ring->head.load(std::memory_order_relaxed);
+  Slot& slot = ring->slots[n % ring->capacity];
+  slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.event = event;
+  slot.seq.store(2 * n + 2, std::memory_order_release);
+  ring->head.store(n + 1, std::memory_order_release);
+}
+
+Event MakeEvent(const char* name, char phase, uint32_t job) {
+  Event event;
+  event.name = name;
+  event.phase = phase;
+  event.tid = ThreadId();
+  event.job = job;
+  event.ts = Tracer::Now();
+  event.dur = 0;
+  event.arg_names[0] = nullptr;
+  event.arg_names[1] = nullptr;
+  event.args[0] = 0;
+  event.args[1] = 0;
+  event.detail[0] = '\0';
+  return event;
+}
+
+void WriteEscaped(std::FILE* file, const char* s) {
+  for (; *s != '\0'; s++) {
+    unsigned char c = (unsigned char) *s;
+    if (c == '"' || c == '\\') {
+      std::fprintf(file, "\\%c", c);
+    } else if (c < 0x20) {
+      std::fprintf(file, "\\u%04x", c);
+    } else {
+      std::fputc(c, file);
+    }
+  }
+}
+
+}  // namespace
+
+std::atomic<bool> Tracer::enabled_{false};
+
+void Tracer::Start(size_t events_per_thread) {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  if (r.capacity == 0) {
+    r.capacity = std::max<size_t>(events_per_thread, 1);
+  }
+  r.since = Now();
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::Now() {
+  // never 0, which TraceSpan takes for not recording
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - epoch).count() + 1;
+}
+
+void Tracer::SetJob(uint32_t job) {
+  current_job = job;
+}
+
+uint32_t Tracer::job() {
+  return current_job;
+}
+
+void Tracer::Complete(const char* name,
+                      uint64_t begin,
+                      uint32_t job,
+                      const char* arg_name,
+                      int64_t arg,
+                      const char* arg_name2,
+                      int64_t arg2,
+                      const char* detail) {
+  if (!enabled()) {
+    return;
+  }
+  Event event = MakeEvent(name, 'X', job);
+  event.dur = event.ts - std::min(begin, event.ts);
+  event.ts -= event.dur;
+  event.arg_names[0] = arg_name;
+  event.args[0] = arg;
+  event.arg_names[1] = arg_name2;
+  event.args[1] = arg2;
+  if (detail != nullptr) {
+    std::snprintf(event.detail, sizeof(event.detail), "%s", detail);
+  }
+  Record(event);
+}
+
+void Tracer::Instant(const char* name,
+                     uint32_t job,
+                     const char* arg_name,
+                     int64_t arg,
+                     const char* arg_name2,
+                     int64_t arg2) {
+  if (!enabled()) {
+    return;
+  }
+  Event event = MakeEvent(name, 'i', job);
+  event.arg_names[0] = arg_name;
+  event.args[0] = arg;
+  event.arg_names[1] = arg_name2;
+  event.args[1] = arg2;
+  Record(event);
+}
+
+void Tracer::AsyncBegin(const char* name, uint32_t job, const char* arg_name, int64_t arg) {
+  if (!enabled()) {
+    return;
+  }
+  Event event = MakeEvent(name, 'b', job);
+  event.arg_names[0] = arg_name;
+  event.args[0] = arg;
+  Record(event);
+}
+
+void Tracer::AsyncEnd(const char* name, uint32_t job) {
+  if (!enabled()) {
+    return;
+  }
+  Record(MakeEvent(name, 'e', job));
+}
+
+size_t Tracer::Flush(const std::string& path) {
+  // take a copy of every complete event, skipping any overwritten while being copied
+  std::vector<Event> events;
+  uint64_t since;
+  {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    since = r.since;
+    for (auto& ring : r.rings) {
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      uint64_t first = head > ring->capacity ? head - ring->capacity : 0;
+      for (uint64_t n = first; n < head; n++) {
+        Slot& slot = ring->slots[n % ring->capacity];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2) {
+          continue;
+        }
+        Event event = slot.event;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != 2 * n + 2) {
+          continue;
+        }
+        if (event.ts >= since) {
+          events.push_back(event);
+        }
+      }
+    }
+  }
+  std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+    return a.ts < b.ts;
+  });
+
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    throw std::runtime_error("Could not open " + path + " to write the trace to");
+  }
+  const unsigned long pid = platform::CurrentProcessId();
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  std::fprintf(file,
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,"
+               "\"args\":{\"name\":\"ebyroid\"}}",
+               pid);
+  for (const Event& event : events) {
+    std::fprintf(file,
+                 ",\n{\"name\":\"%s\",\"cat\":\"ebyroid\",\"ph\":\"%c\",\"pid\":%lu,\"tid\":%u,"
+                 "\"ts\":%llu",
+                 event.name,
+                 event.phase,
+                 pid,
+                 event.tid,
+                 (unsigned long long) event.ts);
+    if (event.phase == 'X') {
+      std::fprintf(file, ",\"dur\":%llu", (unsigned long long) event.dur);
+    } else if (event.phase == 'i') {
+      std::fprintf(file, ",\"s\":\"t\"");
+    } else {
+      // async events pair up by id
+      std::fprintf(file, ",\"id\":%u", event.job);
+    }
+    std::fprintf(file, ",\"args\":{\"job\":%u", event.job);
+    for (int i = 0; i < 2; i++) {
+      if (event.arg_names[i] != nullptr) {
+        std::fprintf(file, ",\"%s\":%lld", event.arg_names[i], (long long) event.args[i]);
+      }
+    }
+    if (event.detail[0] != '\0') {
+      std::fprintf(file, ",\"detail\":\"");
+      WriteEscaped(file, event.detail);
+      std::fprintf(file, "\"");
+    }
+    std::fprintf(file, "}}");
+  }
+  std::fprintf(file, "\n]}\n");
+  bool failed = std::ferror(file) != 0;
+  failed = std::fclose(file) != 0 || failed;
+  if (failed) {
+    throw std::runtime_error("Could not write the trace to " + path);
+  }
+  return events.size();
+}
+
+}  // namespace ebyroid
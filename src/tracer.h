@@ -0,0 +1,95 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace ebyroid {
+
+/**
+ * Opt-in recorder of what happens to each job, as Chrome trace events (chrome://tracing, Perfetto).
+ * Every thread records into a ring of its own without locking, which the oldest events fall out of
+ * once it is full. While not started, recording costs a relaxed atomic load and nothing else.
+ * Events carry the id of the job they belong to, see SetJob().
+ */
+class Tracer {
+ public:
+  // starts recording, keeping up to `events_per_thread` of the latest events of every thread.
+  // the rings are allocated once, so only the first start sets their size
+  static void Start(size_t events_per_thread);
+  // stops recording, keeping what has been recorded for Flush()
+  static void Stop();
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  // writes what has been recorded since the last Start() to `path` as trace-event JSON, returning
+  // how many events went in. throws std::runtime_error if the file cannot be written
+  static size_t Flush(const std::string& path);
+
+  // usec on the clock of the events
+  static uint64_t Now();
+
+  // the job that the calling thread works on, which events recorded by the thread belong to
+  static void SetJob(uint32_t job);
+  static uint32_t job();
+
+  // a span from `begin` (see Now()) until now. `arg_name`s are string literals, which are referred
+  // to rather than copied. `detail`, if any, is copied (and cut short)
+  static void Complete(const char* name,
+                       uint64_t begin,
+                       uint32_t job,
+                       const char* arg_name = nullptr,
+                       int64_t arg = 0,
+                       const char* arg_name2 = nullptr,
+                       int64_t arg2 = 0,
+                       const char* detail = nullptr);
+  // a point in time
+  static void Instant(const char* name,
+                      uint32_t job,
+                      const char* arg_name = nullptr,
+                      int64_t arg = 0,
+                      const char* arg_name2 = nullptr,
+                      int64_t arg2 = 0);
+  // the two ends of a span that may begin and end on different threads, such as a whole job
+  static void AsyncBegin(const char* name, uint32_t job, const char* arg_name, int64_t arg);
+  static void AsyncEnd(const char* name, uint32_t job);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+/**
+ * Records a span of its own scope as a Complete() event, if the tracer is running when it is made.
+ */
+class TraceSpan {
+ public:
+  TraceSpan(const char* name, uint32_t job)
+      : name_(name), job_(job), begin_(Tracer::enabled() ? Tracer::Now() : 0) {}
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan(TraceSpan&&) = delete;
+  ~TraceSpan() {
+    if (begin_ != 0) {
+      Tracer::Complete(name_, begin_, job_, arg_name_, arg_, nullptr, 0, detail_);
+    }
+  }
+
+  // what goes along with the event. `name` is a string literal, `detail` is copied when recorded
+  void Arg(const char* name, int64_t value) {
+    arg_name_ = name;
+    arg_ = value;
+  }
+  void Detail(const char* detail) { detail_ = detail; }
+
+ private:
+  const char* const name_;
+  const uint32_t job_;
+  const uint64_t begin_;
+  const char* arg_name_ = nullptr;
+  int64_t arg_ = 0;
+  const char* detail_ = nullptr;
+};
+
+}  // namespace ebyroid
+
+#endif  // TRACER_H
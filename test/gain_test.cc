@@ -0,0 +1,112 @@
+#include "gain.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace ebyroid {
+namespace {
+
+std::vector<int16_t> MakeInput(size_t n) {
+  static const int16_t kExtremes[] = {32767, -32768, 20000, -20000, 1, -1, 0};
+  std::vector<int16_t> input(n);
+  for (size_t i = 0; i < n; i++) {
+    input[i] = i < 7 ? kExtremes[i] : (int16_t) (i * 2654435761u >> 16);
+  }
+  return input;
+}
+
+// what ApplyGain() does in Q12, one sample at a time
+std::vector<int16_t> Reference(const std::vector<int16_t>& in, float gain) {
+  int32_t q = (int32_t) std::lround(gain * 4096);
+  std::vector<int16_t> out(in.size());
+  for (size_t i = 0; i < in.size(); i++) {
+    int32_t sample = (in[i] * q + 2048) >> 12;
+    out[i] = (int16_t) std::min(std::max(sample, -32768), 32767);
+  }
+  return out;
+}
+
+TEST(GainTest, SaturatesRatherThanWrappingAround) {
+  std::vector<int16_t> input(40);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = i % 2 == 0 ? 20000 : -20000;
+  }
+  std::vector<int16_t> output(input.size());
+  ApplyGain(input.data(), input.size(), 2.0f, output.data());
+  for (size_t i = 0; i < output.size(); i++) {
+    EXPECT_EQ(output[i], i % 2 == 0 ? 32767 : -32768) << i;
+  }
+}
+
+TEST(GainTest, AgreesWithTheReferenceOverEveryTail) {
+  for (size_t n : {0, 1, 7, 8, 9, 15, 16, 17, 33, 1000}) {
+    std::vector<int16_t> input = MakeInput(n);
+    for (float gain : {0.0f, 0.25f, 0.7f, 1.5f, 3.0f, kMaxGain}) {
+      std::vector<int16_t> output(n);
+      ApplyGain(input.data(), n, gain, output.data());
+      EXPECT_EQ(output, Reference(input, gain)) << "gain " << gain << ", " << n;
+    }
+  }
+}
+
+TEST(GainTest, WorksInPlace) {
+  std::vector<int16_t> pcm = MakeInput(100);
+  std::vector<int16_t> expected = Reference(pcm, 0.5f);
+  ApplyGain(pcm.data(), pcm.size(), 0.5f, pcm.data());
+  EXPECT_EQ(pcm, expected);
+}
+
+TEST(GainTest, ClampsGainsOutOfRange) {
+  std::vector<int16_t> input = MakeInput(20);
+  std::vector<int16_t> output(input.size());
+  ApplyGain(input.data(), input.size(), 100.0f, output.data());
+  EXPECT_EQ(output, Reference(input, kMaxGain));
+  ApplyGain(input.data(), input.size(), -1.0f, output.data());
+  EXPECT_EQ(output, std::vector<int16_t>(input.size(), 0));
+}
+
+TEST(GainTest, LeavesSilenceAlone) {
+  std::vector<int16_t> silence(100, 0);
+  EXPECT_EQ(NormalizingGain(silence.data(), silence.size(), kNormalizePeak, -1.0f), 1.0f);
+  EXPECT_EQ(NormalizingGain(silence.data(), silence.size(), kNormalizeRms, -20.0f), 1.0f);
+  EXPECT_EQ(NormalizingGain(silence.data(), 0, kNormalizePeak, -1.0f), 1.0f);
+}
+
+TEST(GainTest, DoesNotNormalizeWhenNotAskedTo) {
+  std::vector<int16_t> quiet(100, 100);
+  EXPECT_EQ(NormalizingGain(quiet.data(), quiet.size(), kNormalizeNone, 0.0f), 1.0f);
+}
+
+TEST(GainTest, BringsThePeakToTheTarget) {
+  // the peak sits in the vectorized part once, then in the scalar tail
+  for (size_t at : {3, 99}) {
+    std::vector<int16_t> pcm(100, 1000);
+    pcm[at] = -16384;
+    EXPECT_FLOAT_EQ(NormalizingGain(pcm.data(), pcm.size(), kNormalizePeak, 0.0f), 2.0f);
+    EXPECT_NEAR(NormalizingGain(pcm.data(), pcm.size(), kNormalizePeak, -6.0206f), 1.0f, 1e-4);
+  }
+  std::vector<int16_t> full(16, -32768);
+  EXPECT_FLOAT_EQ(NormalizingGain(full.data(), full.size(), kNormalizePeak, 0.0f), 1.0f);
+}
+
+TEST(GainTest, BringsTheRmsToTheTarget) {
+  // a square wave, whose RMS is its amplitude
+  std::vector<int16_t> pcm(101);
+  for (size_t i = 0; i < pcm.size(); i++) {
+    pcm[i] = i % 2 == 0 ? 8192 : -8192;
+  }
+  EXPECT_FLOAT_EQ(NormalizingGain(pcm.data(), pcm.size(), kNormalizeRms, 0.0f), 4.0f);
+}
+
+TEST(GainTest, CapsTheNormalizingGain) {
+  std::vector<int16_t> pcm(100, 0);
+  pcm[50] = 1;
+  EXPECT_EQ(NormalizingGain(pcm.data(), pcm.size(), kNormalizePeak, 0.0f), kMaxGain);
+}
+
+}  // namespace
+}  // namespace ebyroid
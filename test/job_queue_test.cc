@@ -0,0 +1,195 @@
+#include "job_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ebyroid {
+namespace {
+
+// a job that holds its worker until let go, to keep a slot of its lane busy
+struct Job {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool started = false;
+  bool released = false;
+  bool ran = false;
+};
+
+void RunJob(void* data) {
+  Job* job = (Job*) data;
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->started = true;
+  job->ran = true;
+  job->cv.notify_all();
+  job->cv.wait(lock, [job] { return job->released; });
+}
+
+void Release(Job* job) {
+  std::lock_guard<std::mutex> lock(job->mutex);
+  job->released = true;
+  job->cv.notify_all();
+}
+
+bool WaitStarted(Job* job) {
+  std::unique_lock<std::mutex> lock(job->mutex);
+  return job->cv.wait_for(lock, std::chrono::seconds(5), [job] { return job->started; });
+}
+
+bool HasStarted(Job* job) {
+  std::lock_guard<std::mutex> lock(job->mutex);
+  return job->started;
+}
+
+// gives the workers a moment to take whatever they are going to
+void Settle() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+TEST(JobQueueTest, RunsNoMoreThanTheLaneLimitOfALane) {
+  Job jobs[3];
+  {
+    JobQueue queue(4, 8, 2);
+    for (Job& job : jobs) {
+      ASSERT_EQ(queue.Push("akari", JobQueue::kNormal, RunJob, &job), JobQueue::kQueued);
+    }
+    ASSERT_TRUE(WaitStarted(&jobs[0]));
+    ASSERT_TRUE(WaitStarted(&jobs[1]));
+    Settle();
+    EXPECT_FALSE(HasStarted(&jobs[2]));
+    EXPECT_EQ(queue.pending(), 1u);
+
+    Release(&jobs[0]);
+    EXPECT_TRUE(WaitStarted(&jobs[2]));
+    Release(&jobs[1]);
+    Release(&jobs[2]);
+  }
+}
+
+TEST(JobQueueTest, LanesDoNotHoldEachOtherUp) {
+  Job akari[2], kiritan;
+  {
+    JobQueue queue(4, 8, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &akari[0]);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &akari[1]);
+    queue.Push("kiritan", JobQueue::kNormal, RunJob, &kiritan);
+    EXPECT_TRUE(WaitStarted(&akari[0]));
+    EXPECT_TRUE(WaitStarted(&kiritan));
+    Release(&akari[0]);
+    EXPECT_TRUE(WaitStarted(&akari[1]));
+    Release(&akari[1]);
+    Release(&kiritan);
+  }
+}
+
+TEST(JobQueueTest, TakesHigherPrioritiesFirst) {
+  Job busy, low, high;
+  {
+    JobQueue queue(1, 8, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &busy);
+    ASSERT_TRUE(WaitStarted(&busy));
+    queue.Push("akari", JobQueue::kLow, RunJob, &low);
+    queue.Push("akari", JobQueue::kHigh, RunJob, &high);
+    Release(&busy);
+    EXPECT_TRUE(WaitStarted(&high));
+    EXPECT_FALSE(HasStarted(&low));
+    Release(&high);
+    EXPECT_TRUE(WaitStarted(&low));
+    Release(&low);
+  }
+}
+
+TEST(JobQueueTest, RejectsJobsBeyondTheCapacityOfARing) {
+  Job busy, waiting[2], high;
+  {
+    JobQueue queue(1, 2, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &busy);
+    ASSERT_TRUE(WaitStarted(&busy));
+    EXPECT_EQ(queue.Push("akari", JobQueue::kNormal, RunJob, &waiting[0]), JobQueue::kQueued);
+    EXPECT_EQ(queue.Push("akari", JobQueue::kNormal, RunJob, &waiting[1]), JobQueue::kQueued);
+    EXPECT_EQ(queue.Push("akari", JobQueue::kNormal, RunJob, &high), JobQueue::kFull);
+    // every priority class has a ring of its own
+    EXPECT_EQ(queue.Push("akari", JobQueue::kHigh, RunJob, &high), JobQueue::kQueued);
+    Release(&busy);
+    Release(&high);
+    Release(&waiting[0]);
+    Release(&waiting[1]);
+  }
+}
+
+TEST(JobQueueTest, RemovesWaitingJobsOnly) {
+  Job busy, first, second, third;
+  {
+    JobQueue queue(1, 4, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &busy);
+    ASSERT_TRUE(WaitStarted(&busy));
+    queue.Push("akari", JobQueue::kNormal, RunJob, &first);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &second);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &third);
+
+    EXPECT_FALSE(queue.Remove(&busy));
+    EXPECT_TRUE(queue.Remove(&second));
+    EXPECT_FALSE(queue.Remove(&second));
+    EXPECT_EQ(queue.pending(), 2u);
+
+    // the jobs behind keep their order
+    Release(&busy);
+    EXPECT_TRUE(WaitStarted(&first));
+    Release(&first);
+    EXPECT_TRUE(WaitStarted(&third));
+    Release(&third);
+    EXPECT_FALSE(second.ran);
+  }
+}
+
+TEST(JobQueueTest, RemovesEveryWaitingJobThatMatches) {
+  Job busy, jobs[5];
+  {
+    JobQueue queue(1, 8, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &busy);
+    ASSERT_TRUE(WaitStarted(&busy));
+    for (int i = 0; i < 5; i++) {
+      queue.Push("akari", i == 4 ? JobQueue::kHigh : JobQueue::kNormal, RunJob, &jobs[i]);
+    }
+
+    // the even ones, across priorities, and never the running one
+    size_t removed = queue.RemoveIf([&](JobQueue::JobProc proc, void* job) {
+      return proc == RunJob && (job == &busy || (((Job*) job - jobs) % 2 == 0));
+    });
+    EXPECT_EQ(removed, 3u);
+    EXPECT_EQ(queue.pending(), 2u);
+
+    Release(&busy);
+    EXPECT_TRUE(WaitStarted(&jobs[1]));
+    Release(&jobs[1]);
+    EXPECT_TRUE(WaitStarted(&jobs[3]));
+    Release(&jobs[3]);
+    EXPECT_FALSE(jobs[0].ran || jobs[2].ran || jobs[4].ran);
+  }
+}
+
+TEST(JobQueueTest, NeverRunsWhatIsLeftOnDestruction) {
+  Job busy, waiting;
+  std::thread releaser;
+  {
+    JobQueue queue(1, 4, 1);
+    queue.Push("akari", JobQueue::kNormal, RunJob, &busy);
+    ASSERT_TRUE(WaitStarted(&busy));
+    queue.Push("akari", JobQueue::kNormal, RunJob, &waiting);
+    releaser = std::thread([&busy] {
+      Settle();
+      Release(&busy);
+    });
+    // stops the workers, and waits for the running job
+  }
+  releaser.join();
+  EXPECT_FALSE(waiting.ran);
+}
+
+}  // namespace
+}  // namespace ebyroid
@@ -0,0 +1,53 @@
+#include "kana_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace ebyroid {
+namespace {
+
+TEST(KanaCacheTest, FindsWhatWasInserted) {
+  KanaCache cache(4);
+  EXPECT_EQ(cache.Find("text"), nullptr);
+  cache.Insert("text", "<S>(Kana)");
+  KanaCache::KanaRef found = cache.Find("text");
+  ASSERT_NE(found, nullptr);
+  EXPECT_EQ(*found, "<S>(Kana)");
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.misses(), 1u);
+}
+
+TEST(KanaCacheTest, HoldsUpToItsCapacity) {
+  KanaCache cache(2);
+  cache.Insert("a", "A");
+  cache.Insert("b", "B");
+  cache.Insert("c", "C");
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  EXPECT_NE(cache.Find("b"), nullptr);
+  EXPECT_NE(cache.Find("c"), nullptr);
+}
+
+TEST(KanaCacheTest, EvictsTheLeastRecentlyUsed) {
+  KanaCache cache(2);
+  cache.Insert("a", "A");
+  cache.Insert("b", "B");
+  cache.Find("a");
+  cache.Insert("c", "C");
+  EXPECT_NE(cache.Find("a"), nullptr);
+  EXPECT_EQ(cache.Find("b"), nullptr);
+}
+
+TEST(KanaCacheTest, ReplacesTheKanaOfAKey) {
+  KanaCache cache(2);
+  KanaCache::KanaRef old_kana = cache.Insert("a", "A");
+  cache.Insert("a", "A2");
+  cache.Insert("b", "B");
+  EXPECT_EQ(*cache.Find("a"), "A2");
+  EXPECT_NE(cache.Find("b"), nullptr);
+  // what was handed out before stays valid
+  EXPECT_EQ(*old_kana, "A");
+}
+
+}  // namespace
+}  // namespace ebyroid
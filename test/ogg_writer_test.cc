@@ -0,0 +1,188 @@
+#include "ogg_writer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace ebyroid {
+namespace {
+
+// what the header of a page says, and what follows it
+struct Page {
+  unsigned char flags;
+  int64_t granule;
+  uint32_t serial;
+  uint32_t sequence;
+  uint32_t crc;
+  std::vector<unsigned char> lacing;
+  std::vector<unsigned char> body;
+  // the whole page with its CRC zeroed, which the CRC is over
+  std::vector<unsigned char> bytes;
+};
+
+uint64_t GetLE(const unsigned char* src, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t) src[i] << (8 * i);
+  }
+  return value;
+}
+
+std::vector<Page> ParsePages(const OutputBuffer<unsigned char>& out) {
+  std::vector<Page> pages;
+  const unsigned char* data = out.data();
+  size_t pos = 0;
+  while (pos < out.size()) {
+    EXPECT_EQ(std::memcmp(data + pos, "OggS", 4), 0) << "page at " << pos;
+    Page page;
+    page.flags = data[pos + 5];
+    page.granule = (int64_t) GetLE(data + pos + 6, 8);
+    page.serial = (uint32_t) GetLE(data + pos + 14, 4);
+    page.sequence = (uint32_t) GetLE(data + pos + 18, 4);
+    page.crc = (uint32_t) GetLE(data + pos + 22, 4);
+    const size_t segments = data[pos + 26];
+    page.lacing.assign(data + pos + 27, data + pos + 27 + segments);
+    size_t body_size = 0;
+    for (unsigned char lacing : page.lacing) {
+      body_size += lacing;
+    }
+    const size_t size = 27 + segments + body_size;
+    page.body.assign(data + pos + 27 + segments, data + pos + size);
+    page.bytes.assign(data + pos, data + pos + size);
+    std::memset(page.bytes.data() + 22, 0, 4);
+    pages.push_back(page);
+    pos += size;
+  }
+  EXPECT_EQ(pos, out.size());
+  return pages;
+}
+
+// the CRC of Ogg one bit at a time: polynomial 0x04c11db7, neither reflected nor inverted
+uint32_t ReferenceCrc(const std::vector<unsigned char>& bytes) {
+  uint32_t crc = 0;
+  for (unsigned char byte : bytes) {
+    crc ^= (uint32_t) byte << 24;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc & 0x80000000u) ? (crc << 1) ^ 0x04c11db7u : crc << 1;
+    }
+  }
+  return crc;
+}
+
+std::vector<unsigned char> PacketOf(size_t size, unsigned char fill) {
+  return std::vector<unsigned char>(size, fill);
+}
+
+TEST(OggWriterTest, ChecksEveryPageWithTheCrcOfOgg) {
+  // the CRC of Ogg is CKSUM without the final inversion
+  EXPECT_EQ(ReferenceCrc({'1', '2', '3', '4', '5', '6', '7', '8', '9'}), 0x89A1897Fu);
+
+  OutputBuffer<unsigned char> out;
+  OggWriter writer(0x12345678, &out);
+  for (size_t i = 0; i < 20; i++) {
+    std::vector<unsigned char> packet = PacketOf(100 + i * 37, (unsigned char) i);
+    writer.Packet(packet.data(), packet.size(), (int64_t) i, i == 0);
+  }
+  writer.Finish(20);
+  std::vector<Page> pages = ParsePages(out);
+  ASSERT_GE(pages.size(), 3u);
+  for (size_t i = 0; i < pages.size(); i++) {
+    EXPECT_EQ(pages[i].crc, ReferenceCrc(pages[i].bytes)) << "page " << i;
+    EXPECT_EQ(pages[i].serial, 0x12345678u);
+    EXPECT_EQ(pages[i].sequence, i);
+  }
+}
+
+TEST(OggWriterTest, LacesPacketsOfWhole255sWithATrailingZero) {
+  OutputBuffer<unsigned char> out;
+  OggWriter writer(1, &out);
+  std::vector<unsigned char> packet = PacketOf(510, 0xAB);
+  writer.Packet(packet.data(), packet.size(), 1);
+  writer.Packet(nullptr, 0, 2);
+  std::vector<unsigned char> short_packet = PacketOf(256, 0xCD);
+  writer.Packet(short_packet.data(), short_packet.size(), 3);
+  writer.Finish(3);
+
+  std::vector<Page> pages = ParsePages(out);
+  ASSERT_EQ(pages.size(), 1u);
+  EXPECT_EQ(pages[0].lacing, std::vector<unsigned char>({255, 255, 0, 0, 255, 1}));
+  ASSERT_EQ(pages[0].body.size(), 766u);
+  EXPECT_EQ(pages[0].body[509], 0xAB);
+  EXPECT_EQ(pages[0].body[510], 0xCD);
+}
+
+TEST(OggWriterTest, FlagsTheFirstAndTheLastPage) {
+  OutputBuffer<unsigned char> out;
+  OggWriter writer(1, &out);
+  std::vector<unsigned char> packet = PacketOf(10, 0);
+  writer.Packet(packet.data(), packet.size(), 0, true);
+  writer.Packet(packet.data(), packet.size(), 0, true);
+  writer.Packet(packet.data(), packet.size(), 5);
+  writer.Finish(5);
+
+  std::vector<Page> pages = ParsePages(out);
+  ASSERT_EQ(pages.size(), 3u);
+  EXPECT_EQ(pages[0].flags, 0x02);
+  EXPECT_EQ(pages[1].flags, 0x00);
+  EXPECT_EQ(pages[2].flags, 0x04);
+
+  // a stream of one page is both
+  OutputBuffer<unsigned char> single;
+  OggWriter single_writer(1, &single);
+  single_writer.Packet(packet.data(), packet.size(), 5);
+  single_writer.Finish(5);
+  pages = ParsePages(single);
+  ASSERT_EQ(pages.size(), 1u);
+  EXPECT_EQ(pages[0].flags, 0x06);
+}
+
+TEST(OggWriterTest, PutsThePositionOfTheLastPacketOnEachPage) {
+  OutputBuffer<unsigned char> out;
+  OggWriter writer(1, &out);
+  std::vector<unsigned char> packet = PacketOf(1000, 0);
+  // a page takes no more once it has 4096 bytes, which is after 5 of these
+  for (int64_t i = 1; i <= 7; i++) {
+    writer.Packet(packet.data(), packet.size(), i * 10);
+  }
+  writer.Finish(65);
+
+  std::vector<Page> pages = ParsePages(out);
+  ASSERT_EQ(pages.size(), 2u);
+  EXPECT_EQ(pages[0].granule, 50);
+  // and the end of the stream is where Finish() says, short of the padding in the last packet
+  EXPECT_EQ(pages[1].granule, 65);
+}
+
+TEST(OggOpusWriterTest, CountsThePreSkipIntoTheEndOnly) {
+  OutputBuffer<unsigned char> out;
+  OggOpusWriter writer(2, 312, 22050, &out);
+  std::vector<unsigned char> packet = PacketOf(1000, 0);
+  for (int i = 0; i < 7; i++) {
+    writer.Packet(packet.data(), packet.size(), 960);
+  }
+  writer.Finish(6000);
+
+  std::vector<Page> pages = ParsePages(out);
+  ASSERT_EQ(pages.size(), 4u);
+  // the headers, on pages of their own at position 0
+  ASSERT_EQ(pages[0].body.size(), 19u);
+  EXPECT_EQ(std::string(pages[0].body.begin(), pages[0].body.begin() + 8), "OpusHead");
+  EXPECT_EQ(pages[0].body[9], 2);
+  EXPECT_EQ(GetLE(pages[0].body.data() + 10, 2), 312u);
+  EXPECT_EQ(GetLE(pages[0].body.data() + 12, 4), 22050u);
+  EXPECT_EQ(pages[0].granule, 0);
+  EXPECT_EQ(std::string(pages[1].body.begin(), pages[1].body.begin() + 8), "OpusTags");
+  EXPECT_EQ(pages[1].granule, 0);
+  // what the packets decode to, which begins with the pre-skip
+  EXPECT_EQ(pages[2].granule, 5 * 960);
+  EXPECT_EQ(pages[3].granule, 312 + 6000);
+  EXPECT_LE(pages[3].granule, 7 * 960);
+}
+
+}  // namespace
+}  // namespace ebyroid
@@ -0,0 +1,138 @@
+#include "pcm_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace ebyroid {
+namespace {
+
+// `size` bytes of malloc'd PCM, for the cache to take over
+int16_t* PcmOf(size_t size) {
+  int16_t* data = (int16_t*) std::malloc(size);
+  std::memset(data, 0, size);
+  return data;
+}
+
+ConvertParams ParamsOf(char* base_dir, char* voice) {
+  ConvertParams params = {};
+  params.base_dir = base_dir;
+  params.voice = voice;
+  return params;
+}
+
+TEST(PcmCacheTest, FindsWhatWasInserted) {
+  PcmCache cache(1024);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  int16_t* data = PcmOf(100);
+  PcmCache::PcmRef inserted = cache.Insert("a", data, 100);
+  PcmCache::PcmRef found = cache.Find("a");
+  ASSERT_NE(found, nullptr);
+  // shared, not copied
+  EXPECT_EQ(found->data, data);
+  EXPECT_EQ(found, inserted);
+
+  PcmCache::Stats stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.entries, 1u);
+  EXPECT_EQ(stats.bytes, 101u);
+}
+
+TEST(PcmCacheTest, StaysWithinItsBudgetOfBytes) {
+  // room for two entries of a 1 byte key and 100 bytes of PCM
+  PcmCache cache(250);
+  cache.Insert("a", PcmOf(100), 100);
+  cache.Insert("b", PcmOf(100), 100);
+  EXPECT_EQ(cache.stats().bytes, 202u);
+  cache.Insert("c", PcmOf(100), 100);
+  EXPECT_EQ(cache.stats().entries, 2u);
+  EXPECT_LE(cache.stats().bytes, 250u);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+}
+
+TEST(PcmCacheTest, EvictsTheLeastRecentlyUsed) {
+  PcmCache cache(250);
+  cache.Insert("a", PcmOf(100), 100);
+  cache.Insert("b", PcmOf(100), 100);
+  // "a" is used after "b", which goes first then
+  cache.Find("a");
+  cache.Insert("c", PcmOf(100), 100);
+  EXPECT_NE(cache.Find("a"), nullptr);
+  EXPECT_EQ(cache.Find("b"), nullptr);
+  EXPECT_NE(cache.Find("c"), nullptr);
+}
+
+TEST(PcmCacheTest, EvictedPcmStaysWithItsHolders) {
+  PcmCache cache(150);
+  PcmCache::PcmRef held = cache.Insert("a", PcmOf(100), 100);
+  cache.Insert("b", PcmOf(100), 100);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  EXPECT_EQ(held->size, 100u);
+  EXPECT_EQ(held->data[49], 0);
+}
+
+TEST(PcmCacheTest, DoesNotCacheWhatExceedsTheBudget) {
+  PcmCache cache(100);
+  cache.Insert("a", PcmOf(50), 50);
+  PcmCache::PcmRef pcm = cache.Insert("b", PcmOf(200), 200);
+  ASSERT_NE(pcm, nullptr);
+  EXPECT_EQ(pcm->size, 200u);
+  EXPECT_EQ(cache.Find("b"), nullptr);
+  // and leaves the rest alone
+  EXPECT_NE(cache.Find("a"), nullptr);
+}
+
+TEST(PcmCacheTest, KeepsTheFirstOfARace) {
+  PcmCache cache(1024);
+  PcmCache::PcmRef first = cache.Insert("a", PcmOf(100), 100);
+  PcmCache::PcmRef second = cache.Insert("a", PcmOf(100), 100);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(cache.stats().entries, 1u);
+}
+
+TEST(PcmCacheTest, KeysTellApartWhatTheEngineRendersDifferently) {
+  char base_dir[] = "C:\\VOICEROID2";
+  char akari[] = "akari_44";
+  char yukari[] = "yukari_44";
+  const unsigned char text[] = "hello";
+  std::string a, b;
+
+  ConvertParams params = ParamsOf(base_dir, akari);
+  ASSERT_TRUE(PcmCache::MakeKey(&a, params, 0, text, 5));
+  ASSERT_TRUE(PcmCache::MakeKey(&b, params, 0, text, 5));
+  EXPECT_EQ(a, b);
+
+  ConvertParams other_voice = ParamsOf(base_dir, yukari);
+  ASSERT_TRUE(PcmCache::MakeKey(&b, other_voice, 0, text, 5));
+  EXPECT_NE(a, b);
+
+  ConvertParams other_rate = params;
+  other_rate.sample_rate = 48000;
+  ASSERT_TRUE(PcmCache::MakeKey(&b, other_rate, 0, text, 5));
+  EXPECT_NE(a, b);
+
+  Prosody prosody;
+  prosody.speed = 1.5f;
+  ConvertParams other_prosody = params;
+  other_prosody.prosody = &prosody;
+  ASSERT_TRUE(PcmCache::MakeKey(&b, other_prosody, 0, text, 5));
+  EXPECT_NE(a, b);
+
+  ASSERT_TRUE(PcmCache::MakeKey(&b, params, 1, text, 5));
+  EXPECT_NE(a, b);
+  ASSERT_TRUE(PcmCache::MakeKey(&b, params, 0, text, 4));
+  EXPECT_NE(a, b);
+}
+
+TEST(PcmCacheTest, JobsWithoutAVoiceAreNotCacheable) {
+  std::string key;
+  const unsigned char text[] = "hello";
+  EXPECT_FALSE(PcmCache::MakeKey(&key, ParamsOf(nullptr, nullptr), 0, text, 5));
+}
+
+}  // namespace
+}  // namespace ebyroid
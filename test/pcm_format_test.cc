@@ -0,0 +1,87 @@
+#include "pcm_format.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ebyroid {
+namespace {
+
+// every extreme, then a ramp over the whole range
+std::vector<int16_t> MakeInput(size_t n) {
+  static const int16_t kExtremes[] = {0, 1, -1, 32767, -32768, 16384, -16385};
+  std::vector<int16_t> input(n);
+  for (size_t i = 0; i < n; i++) {
+    input[i] = i < 7 ? kExtremes[i] : (int16_t) (i * 2654435761u >> 16);
+  }
+  return input;
+}
+
+// what the header promises, one sample at a time
+std::vector<uint8_t> Reference(const std::vector<int16_t>& in,
+                               SampleFormat format,
+                               uint32_t channels) {
+  const size_t bytes = BytesPerSample(format);
+  std::vector<uint8_t> out(in.size() * channels * bytes);
+  uint8_t* dest = out.data();
+  for (int16_t sample : in) {
+    for (uint32_t c = 0; c < channels; c++) {
+      switch (format) {
+        case kS16:
+          std::memcpy(dest, &sample, 2);
+          break;
+        case kF32: {
+          float value = sample / 32768.0f;
+          std::memcpy(dest, &value, 4);
+          break;
+        }
+        case kS24: {
+          uint32_t value = (uint32_t) ((int32_t) sample * 256);
+          dest[0] = (uint8_t) value;
+          dest[1] = (uint8_t) (value >> 8);
+          dest[2] = (uint8_t) (value >> 16);
+          break;
+        }
+        case kS32: {
+          int32_t value = (int32_t) sample * 65536;
+          std::memcpy(dest, &value, 4);
+          break;
+        }
+        default:
+          break;
+      }
+      dest += bytes;
+    }
+  }
+  return out;
+}
+
+TEST(PcmFormatTest, ConvertsLikeTheReferenceInEveryFormatAndLayout) {
+  // lengths around the widths of the vector kernels leave tails of every size
+  for (size_t n : {0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000}) {
+    std::vector<int16_t> input = MakeInput(n);
+    for (uint32_t format = kS16; format < kNumSampleFormats; format++) {
+      for (uint32_t channels = 1; channels <= 2; channels++) {
+        std::vector<uint8_t> expected = Reference(input, (SampleFormat) format, channels);
+        // a guard byte past the end catches overruns
+        std::vector<uint8_t> output(expected.size() + 1, 0xA5);
+        ConvertPcm(input.data(), n, (SampleFormat) format, channels, output.data());
+        EXPECT_EQ(output.back(), 0xA5) << "format " << format << ", " << channels << "ch, " << n;
+        output.pop_back();
+        EXPECT_EQ(output, expected) << "format " << format << ", " << channels << "ch, " << n;
+      }
+    }
+  }
+}
+
+TEST(PcmFormatTest, KnowsTheSizeOfASample) {
+  EXPECT_EQ(BytesPerSample(kS16), 2u);
+  EXPECT_EQ(BytesPerSample(kF32), 4u);
+  EXPECT_EQ(BytesPerSample(kS24), 3u);
+  EXPECT_EQ(BytesPerSample(kS32), 4u);
+}
+
+}  // namespace
+}  // namespace ebyroid
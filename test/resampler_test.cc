@@ -0,0 +1,90 @@
+#include "resampler.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "output_buffer.h"
+
+namespace ebyroid {
+namespace {
+
+// a loud chirp with noise on top, which drives the filters into saturation now and then
+std::vector<int16_t> MakeInput(size_t n) {
+  std::vector<int16_t> input(n);
+  uint32_t noise = 12345;
+  for (size_t i = 0; i < n; i++) {
+    double t = (double) i / n;
+    noise = noise * 1664525 + 1013904223;
+    double v = 36000.0 * std::sin(3000.0 * t * t) + (double) (noise >> 20) - 2048.0;
+    input[i] = (int16_t) std::fmax(-32768.0, std::fmin(32767.0, v));
+  }
+  return input;
+}
+
+// resamples all of `input` fed in chunks of `chunk` samples
+std::vector<int16_t> Resample(uint32_t from,
+                              uint32_t to,
+                              Resampler::Kernel kernel,
+                              const std::vector<int16_t>& input,
+                              size_t chunk) {
+  Resampler resampler(from, to, kernel);
+  OutputBuffer<int16_t> output;
+  for (size_t pos = 0; pos < input.size(); pos += chunk) {
+    resampler.Process(input.data() + pos, std::min(chunk, input.size() - pos), &output);
+  }
+  resampler.Flush(&output);
+  return std::vector<int16_t>(output.data(), output.data() + output.size());
+}
+
+const uint32_t kRates[][2] = {
+    {22050, 16000}, {22050, 24000}, {22050, 48000}, {44100, 16000}, {44100, 24000}, {44100, 48000}};
+
+TEST(ResamplerTest, MakesTheCeilingOfTheRatioOfSamples) {
+  for (const auto& rates : kRates) {
+    for (size_t n : {1, 2, 7, 441, 1000, 22051}) {
+      std::vector<int16_t> output =
+          Resample(rates[0], rates[1], Resampler::kScalar, MakeInput(n), 4096);
+      size_t expected = (size_t) ((n * rates[1] + rates[0] - 1) / rates[0]);
+      EXPECT_EQ(output.size(), expected) << rates[0] << " -> " << rates[1] << ", " << n;
+    }
+  }
+}
+
+TEST(ResamplerTest, MakesNothingOfNothing) {
+  EXPECT_TRUE(Resample(22050, 48000, Resampler::kScalar, {}, 4096).empty());
+}
+
+TEST(ResamplerTest, DoesNotDependOnHowTheInputIsChunked) {
+  std::vector<int16_t> input = MakeInput(10000);
+  for (const auto& rates : kRates) {
+    std::vector<int16_t> whole = Resample(rates[0], rates[1], Resampler::kScalar, input, 10000);
+    std::vector<int16_t> chunked = Resample(rates[0], rates[1], Resampler::kScalar, input, 13);
+    EXPECT_EQ(whole, chunked) << rates[0] << " -> " << rates[1];
+  }
+}
+
+TEST(ResamplerTest, KernelsAgreeToTheBit) {
+  std::vector<int16_t> input = MakeInput(44100);
+  const Resampler::Kernel best = Resampler::BestKernel();
+  for (const auto& rates : kRates) {
+    std::vector<int16_t> scalar = Resample(rates[0], rates[1], Resampler::kScalar, input, 8192);
+    for (int kernel = Resampler::kSse2; kernel <= best; kernel++) {
+      std::vector<int16_t> output =
+          Resample(rates[0], rates[1], (Resampler::Kernel) kernel, input, 8192);
+      EXPECT_EQ(output, scalar) << rates[0] << " -> " << rates[1] << ", kernel " << kernel;
+    }
+  }
+}
+
+TEST(ResamplerTest, RejectsRatesOfZero) {
+  EXPECT_THROW(Resampler(0, 48000), std::invalid_argument);
+  EXPECT_THROW(Resampler(22050, 0), std::invalid_argument);
+}
+
+}  // namespace
+}  // namespace ebyroid
@@ -0,0 +1,150 @@
+/* eslint-disable no-console */
+const assert = require('assert').strict;
+const CancelHandle = require('../lib/cancel_handle');
+const Scheduler = require('../lib/scheduler');
+
+// all the scheduler looks at of a Voiceroid
+const akari = { baseDirPath: 'C:\\VOICEROID2', voiceDirName: 'akari_44' };
+const kiritan = { baseDirPath: 'C:\\VOICEROID+', voiceDirName: 'kiritan_22' };
+
+function sleep(msec) {
+  return new Promise(resolve => setTimeout(resolve, msec));
+}
+
+/**
+ * @param {Promise} promise
+ * @returns {{settled: boolean, error: Error?}} what has become of the promise so far
+ */
+function watch(promise) {
+  const state = { settled: false, error: null };
+  promise.then(
+    () => {
+      state.settled = true;
+    },
+    err => {
+      state.settled = true;
+      state.error = err;
+    }
+  );
+  return state;
+}
+
+const tests = {
+  async 'a resident library goes at once'() {
+    const scheduler = new Scheduler(1, 1000);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    await scheduler.acquire(akari);
+    assert.deepEqual(scheduler.stats(), {
+      loads: 1,
+      reloads: 0,
+      fifoReloads: 0,
+      queued: 0,
+    });
+  },
+
+  async 'a library is swapped in once the resident one runs dry'() {
+    const scheduler = new Scheduler(1, 1000);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    const other = watch(scheduler.acquire(kiritan));
+    await sleep(10);
+    assert.equal(other.settled, false);
+    assert.equal(scheduler.isResident(kiritan), false);
+
+    scheduler.release(akari);
+    await sleep(0);
+    assert.equal(other.settled, true);
+    assert.equal(scheduler.isResident(kiritan), true);
+    assert.equal(scheduler.isResident(akari), false);
+    assert.equal(scheduler.stats().loads, 2);
+  },
+
+  async 'requests are batched by library'() {
+    const scheduler = new Scheduler(1, 1000);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    // A, B, A, B: the second A goes along with the first, and both Bs after them
+    const b1 = watch(scheduler.acquire(kiritan));
+    await scheduler.acquire(akari);
+    const b2 = watch(scheduler.acquire(kiritan));
+    scheduler.release(akari);
+    scheduler.release(akari);
+    await sleep(0);
+    assert.equal(b1.settled && b2.settled, true);
+    // where arrival order would have reloaded both libraries once
+    const stats = scheduler.stats();
+    assert.equal(stats.loads, 2);
+    assert.equal(stats.reloads, 0);
+    assert.equal(stats.fifoReloads, 2);
+  },
+
+  async 'a waiting library gets its turn after maxWait'() {
+    const scheduler = new Scheduler(1, 30);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    const other = watch(scheduler.acquire(kiritan));
+
+    // within maxWait, the resident library keeps taking requests
+    await scheduler.acquire(akari);
+    await sleep(50);
+    // past it, the resident library is drained: new requests wait behind the other library
+    const late = watch(scheduler.acquire(akari));
+    await sleep(0);
+    assert.equal(late.settled, false);
+    assert.equal(other.settled, false);
+
+    scheduler.release(akari);
+    scheduler.release(akari);
+    await sleep(0);
+    assert.equal(other.settled, true);
+    assert.equal(late.settled, false);
+    assert.equal(scheduler.isResident(kiritan), true);
+  },
+
+  async 'a cancelled waiter leaves the queue'() {
+    const scheduler = new Scheduler(1, 1000);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    const cancel = new CancelHandle();
+    const other = watch(scheduler.acquire(kiritan, cancel));
+    cancel.cancel();
+    await sleep(0);
+    assert.equal(other.error.code, 'EBYROID_CANCELLED');
+    assert.equal(scheduler.stats().queued, 0);
+
+    // and no longer holds up the resident library
+    scheduler.release(akari);
+    await scheduler.acquire(akari);
+    assert.equal(scheduler.stats().loads, 1);
+  },
+
+  async 'a waiter past its deadline leaves the queue'() {
+    const scheduler = new Scheduler(1, 1000);
+    scheduler.preload(akari);
+    await scheduler.acquire(akari);
+    const other = watch(scheduler.acquire(kiritan, null, Date.now() + 10));
+    await sleep(30);
+    assert.equal(other.error.code, 'EBYROID_DEADLINE_EXCEEDED');
+    assert.equal(scheduler.stats().queued, 0);
+  },
+
+  async 'without a limit every library stays resident'() {
+    const scheduler = new Scheduler(0, 1000);
+    await scheduler.acquire(akari);
+    await scheduler.acquire(kiritan);
+    assert.equal(scheduler.room(), Infinity);
+    assert.equal(scheduler.isResident(akari), true);
+    assert.equal(scheduler.isResident(kiritan), true);
+  },
+};
+
+(async () => {
+  for (const [name, test] of Object.entries(tests)) {
+    await test();
+    console.log(`ok - ${name}`);
+  }
+})().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
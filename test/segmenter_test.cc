@@ -0,0 +1,82 @@
+#include "segmenter.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace ebyroid {
+namespace {
+
+// Shift-JIS of the characters the tests are made of
+const std::string kA = "\x82\xA0";           // あ
+const std::string kI = "\x82\xA2";           // い
+const std::string kPeriod = "\x81\x42";      // 。
+const std::string kComma = "\x81\x41";       // 、
+const std::string kCloseQuote = "\x81\x76";  // 」
+
+size_t Segment(const std::string& text, size_t max_bytes) {
+  return NextSegment((const unsigned char*) text.data(), text.size(), max_bytes);
+}
+
+TEST(SegmenterTest, TakesAWholeTextThatFits) {
+  std::string text = kA + kPeriod + kI;
+  EXPECT_EQ(Segment(text, text.size()), text.size());
+  EXPECT_EQ(Segment(text, 100), text.size());
+}
+
+TEST(SegmenterTest, EndsAtTheLastSentenceWithin) {
+  std::string text = kA + kPeriod + kI + kPeriod + kA + kI + kA;
+  EXPECT_EQ(Segment(text, 10), 8u);
+  EXPECT_EQ(Segment(text, 7), 4u);
+  EXPECT_EQ(Segment("ab\ncd.ef", 5), 3u);
+}
+
+TEST(SegmenterTest, EndsAtAsciiMarksOnlyBeforeASpace) {
+  // a decimal number is not cut apart, nor is a URL
+  EXPECT_EQ(Segment("a, 3.14159", 8), 2u);
+  EXPECT_EQ(Segment("Done. 3.14", 8), 5u);
+  EXPECT_EQ(Segment("see a.b/c?d=1", 12), 12u);
+  EXPECT_EQ(Segment("Why?\tok", 6), 4u);
+  EXPECT_EQ(Segment("Yes!" + std::string("\x81\x40") + "ok", 7), 4u);
+}
+
+TEST(SegmenterTest, KeepsClosingBracketsWithTheirSentence) {
+  std::string text = kA + kPeriod + kCloseQuote + kI + kI;
+  EXPECT_EQ(Segment(text, 8), 6u);
+  // but a bracket on its own is no boundary
+  EXPECT_EQ(Segment(kA + kCloseQuote + kI + kI, 6), 6u);
+}
+
+TEST(SegmenterTest, FallsBackToTheLastClause) {
+  std::string text = kA + kComma + kI + kComma + kA + kI;
+  EXPECT_EQ(Segment(text, 10), 8u);
+}
+
+TEST(SegmenterTest, FallsBackToTheLastWholeCharacter) {
+  std::string text = kA + kI + kA + kI;
+  EXPECT_EQ(Segment(text, 5), 4u);
+}
+
+TEST(SegmenterTest, LeavesALeadByteAtTheLimitToTheNextSegment) {
+  // the lead byte of あ is the 4th byte, which would make the limit
+  std::string text = "abc" + kA + "d";
+  EXPECT_EQ(Segment(text, 4), 3u);
+  EXPECT_EQ(Segment(text, 5), 5u);
+}
+
+TEST(SegmenterTest, DoesNotMistakeATrailByteForALeadByte) {
+  // 0x88 0x81 is one character, whose trail byte followed by 'B' reads as 。 when off by one
+  std::string text = "\x88\x81"
+                     "BCDE";
+  EXPECT_EQ(Segment(text, 5), 5u);
+}
+
+TEST(SegmenterTest, NeverMakesAnEmptySegment) {
+  std::string text = kA + kI;
+  EXPECT_EQ(Segment(text, 1), 2u);
+  EXPECT_EQ(Segment(text, 0), 2u);
+  EXPECT_EQ(Segment("ab", 0), 1u);
+}
+
+}  // namespace
+}  // namespace ebyroid
@@ -0,0 +1,121 @@
+#include "shared_ring.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "platform.h"
+
+namespace ebyroid {
+namespace {
+
+// a writer's ring and a reader's mapping of the same memory, whose name is gone right away
+struct Rings {
+  std::unique_ptr<SharedRing> writer;
+  std::unique_ptr<SharedRing> reader;
+};
+
+Rings MakeRings(uint32_t capacity) {
+  static int last = 0;
+  const std::string name = "ebyroid-test-" + std::to_string(platform::CurrentProcessId()) + "-" +
+                           std::to_string(++last);
+  Rings rings;
+  rings.writer.reset(SharedRing::Create(name, capacity));
+  rings.reader.reset(SharedRing::Open(name, capacity));
+  platform::UnlinkSharedMemory(name);
+  return rings;
+}
+
+const std::atomic<bool> kNotAbandoned{false};
+
+TEST(SharedRingTest, HandsBlocksOverToTheReader) {
+  Rings rings = MakeRings(64);
+  uint32_t position;
+  ASSERT_TRUE(rings.writer->Reserve(6, &position, kNotAbandoned));
+  EXPECT_EQ(position, 0u);
+  std::memcpy(rings.writer->At(position), "hello", 6);
+  EXPECT_STREQ((const char*) rings.reader->At(position), "hello");
+
+  ASSERT_TRUE(rings.writer->Reserve(6, &position, kNotAbandoned));
+  EXPECT_EQ(position, 6u);
+}
+
+TEST(SharedRingTest, SkipsToTheStartRatherThanSplittingABlock) {
+  Rings rings = MakeRings(64);
+  uint32_t position;
+  ASSERT_TRUE(rings.writer->Reserve(40, &position, kNotAbandoned));
+  rings.reader->Release(position + 40);
+
+  // 40 more bytes do not fit in the 24 left before the end
+  ASSERT_TRUE(rings.writer->Reserve(40, &position, kNotAbandoned));
+  EXPECT_EQ(position, 64u);
+  EXPECT_EQ(rings.writer->At(position), rings.writer->At(0));
+  rings.reader->Release(position + 40);
+
+  // and a block that ends right at the end of the ring is not skipped
+  ASSERT_TRUE(rings.writer->Reserve(24, &position, kNotAbandoned));
+  EXPECT_EQ(position, 104u);
+}
+
+TEST(SharedRingTest, KeepsTheDataAcrossManyWraps) {
+  Rings rings = MakeRings(64);
+  for (uint32_t i = 0; i < 1000; i++) {
+    const uint32_t size = 1 + i % 23;
+    uint32_t position;
+    ASSERT_TRUE(rings.writer->Reserve(size, &position, kNotAbandoned));
+    std::memset(rings.writer->At(position), (int) (i & 0xFF), size);
+
+    const unsigned char* block = (const unsigned char*) rings.reader->At(position);
+    for (uint32_t k = 0; k < size; k++) {
+      ASSERT_EQ(block[k], i & 0xFF) << "block " << i;
+    }
+    rings.reader->Release(position + size);
+  }
+}
+
+TEST(SharedRingTest, WaitsForTheReaderWhileFull) {
+  Rings rings = MakeRings(64);
+  uint32_t first;
+  ASSERT_TRUE(rings.writer->Reserve(64, &first, kNotAbandoned));
+
+  std::atomic<bool> released{false};
+  std::thread reader([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    released = true;
+    rings.reader->Release(first + 64);
+  });
+  uint32_t position;
+  EXPECT_TRUE(rings.writer->Reserve(8, &position, kNotAbandoned));
+  EXPECT_TRUE(released.load());
+  EXPECT_EQ(position, 64u);
+  reader.join();
+}
+
+TEST(SharedRingTest, GivesUpWhenAbandoned) {
+  Rings rings = MakeRings(64);
+  uint32_t position;
+  ASSERT_TRUE(rings.writer->Reserve(64, &position, kNotAbandoned));
+  const std::atomic<bool> abandoned{true};
+  EXPECT_FALSE(rings.writer->Reserve(1, &position, abandoned));
+}
+
+TEST(SharedRingTest, RejectsBlocksLargerThanTheRing) {
+  Rings rings = MakeRings(64);
+  uint32_t position;
+  EXPECT_FALSE(rings.writer->Reserve(65, &position, kNotAbandoned));
+}
+
+TEST(SharedRingTest, TakesPowersOf2Only) {
+  EXPECT_THROW(SharedRing::Create("ebyroid-test-bad", 100), std::runtime_error);
+  EXPECT_THROW(SharedRing::Create("ebyroid-test-bad", 0), std::runtime_error);
+}
+
+}  // namespace
+}  // namespace ebyroid